@@ -0,0 +1,136 @@
+#include "AnnotationLayerItem.h"
+#include <QHash>
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+#include <QVector>
+#include <algorithm>
+
+namespace {
+
+    // Подписи выводятся, только если на экране немного аннотаций
+    const size_t LabelLimit = 300;
+
+    // Отметки меньше этого размера на экране (пикс.) рисуются точками
+    const double PointSize = 3.0;
+
+    // Отметки одного цвета накапливаются и выводятся одним вызовом
+    struct Batch {
+        QVector<QRectF> rects;
+        QVector<QLineF> lines;
+        QVector<QPointF> points;
+    };
+
+} // namespace
+
+AnnotationLayerItem::AnnotationLayerItem(const AnnotationStore* annotationStore, const QRectF& imageBounds, QGraphicsItem* parent)
+    : QGraphicsItem(parent), store(annotationStore), area(imageBounds), detectedVisible(true) {
+    // exposedRect нужен для запроса только видимых аннотаций
+    setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+    setZValue(1);
+}
+
+void AnnotationLayerItem::setDetectedVisible(bool visible) {
+    detectedVisible = visible;
+    update();
+}
+
+QColor AnnotationLayerItem::color(const Annotation& annotation) {
+    switch (annotation.kind) {
+    case AnnotationKind::Measurement:
+        return Qt::cyan;
+    case AnnotationKind::Comment:
+        return Qt::white;
+    case AnnotationKind::Defect:
+        break;
+    }
+    // Цвета классов индикаций (порядок DefectType)
+    switch (annotation.category) {
+    case 0:
+        return Qt::green;
+    case 1:
+        return Qt::yellow;
+    case 2:
+        return Qt::red;
+    case 3:
+        return Qt::magenta;
+    default:
+        return QColor(255, 128, 0);
+    }
+}
+
+QRectF AnnotationLayerItem::boundingRect() const {
+    return area;
+}
+
+void AnnotationLayerItem::paint(QPainter* painter, const QStyleOptionGraphicsItem* option, QWidget*) {
+    if (!store || store->isEmpty()) {
+        return;
+    }
+
+    // Экранных пикселей на пиксель изображения
+    const qreal lod = option->levelOfDetailFromTransform(painter->worldTransform());
+    std::vector<const Annotation*> visible = store->query(option->exposedRect & area);
+    if (!detectedVisible) {
+        visible.erase(std::remove_if(visible.begin(), visible.end(), [](const Annotation* annotation) { return annotation->detected; }),
+            visible.end());
+    }
+    if (visible.empty()) {
+        return;
+    }
+
+    QHash<QRgb, Batch> batches;
+    for (const Annotation* annotation : visible) {
+        Batch& batch = batches[color(*annotation).rgb()];
+        const QRectF bounds = annotation->bounds();
+        if (std::max(bounds.width(), bounds.height()) * lod < PointSize) {
+            batch.points.append(bounds.center());
+        }
+        else if (annotation->kind == AnnotationKind::Measurement) {
+            batch.lines.append(annotation->line);
+        }
+        else {
+            batch.rects.append(annotation->rect.normalized());
+        }
+    }
+
+    painter->save();
+    painter->setClipRect(area);
+    painter->setBrush(Qt::NoBrush);
+    for (auto it = batches.cbegin(); it != batches.cend(); ++it) {
+        QPen pen{ QColor::fromRgb(it.key()) };
+        pen.setCosmetic(true);
+        painter->setPen(pen);
+        if (!it->rects.isEmpty()) {
+            painter->drawRects(it->rects);
+        }
+        if (!it->lines.isEmpty()) {
+            painter->drawLines(it->lines);
+        }
+        if (!it->points.isEmpty()) {
+            pen.setWidthF(PointSize);
+            painter->setPen(pen);
+            painter->drawPoints(it->points.constData(), static_cast<int>(it->points.size()));
+        }
+    }
+
+    // Подписи в экранных координатах, чтобы размер шрифта не зависел от масштаба
+    if (visible.size() <= LabelLimit) {
+        const QTransform world = painter->worldTransform();
+        painter->setWorldTransform(QTransform());
+        for (const Annotation* annotation : visible) {
+            if (annotation->text.isEmpty()) {
+                continue;
+            }
+            const QRectF bounds = annotation->bounds();
+            if (annotation->kind != AnnotationKind::Comment && std::max(bounds.width(), bounds.height()) * lod < 4 * PointSize) {
+                continue;
+            }
+            const QPointF anchor = annotation->kind == AnnotationKind::Measurement
+                ? world.map(annotation->line.center())
+                : world.mapRect(bounds).topLeft();
+            painter->setPen(color(*annotation));
+            painter->drawText(anchor + QPointF(2, -3), annotation->text);
+        }
+    }
+    painter->restore();
+}
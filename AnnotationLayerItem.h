@@ -0,0 +1,32 @@
+#ifndef ANNOTATIONLAYERITEM_H
+#define ANNOTATIONLAYERITEM_H
+
+#include <QGraphicsItem>
+#include <QColor>
+#include "AnnotationStore.h"
+
+// Слой аннотаций: один элемент сцены для всех отметок вместо элемента на
+// каждую. Координаты элемента - координаты исходного изображения (переход к
+// сцене задается преобразованием элемента). Отрисовываются только аннотации,
+// попавшие в видимую область, по запросу к пространственному индексу;
+// отрисовка ограничена показанной после обрезки
+// областью; при сильном уменьшении мелкие отметки рисуются точками, подписи скрываются
+class AnnotationLayerItem : public QGraphicsItem {
+public:
+    AnnotationLayerItem(const AnnotationStore* store, const QRectF& imageBounds, QGraphicsItem* parent = nullptr);
+
+    // Отображение индикаций, найденных автоматическим поиском
+    void setDetectedVisible(bool visible);
+
+    static QColor color(const Annotation& annotation);
+
+    QRectF boundingRect() const override;
+    void paint(QPainter* painter, const QStyleOptionGraphicsItem* option, QWidget* widget = nullptr) override;
+
+private:
+    const AnnotationStore* store;
+    QRectF area; // Показанная область исходного изображения (после обрезки)
+    bool detectedVisible;
+};
+
+#endif // ANNOTATIONLAYERITEM_H
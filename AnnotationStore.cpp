@@ -0,0 +1,312 @@
+#include "AnnotationStore.h"
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <numeric>
+
+namespace {
+
+    // Перед перестроением индекса допускается столько аннотаций, проверяемых перебором
+    const size_t UnindexedLimit = 256;
+
+    // В отличие от QRectF::intersects и united, работают и для вырожденных
+    // рамок (точка комментария, горизонтальный или вертикальный отрезок)
+    bool overlaps(const QRectF& a, const QRectF& b) {
+        return a.left() <= b.right() && b.left() <= a.right() && a.top() <= b.bottom() && b.top() <= a.bottom();
+    }
+
+    QRectF unite(const QRectF& a, const QRectF& b) {
+        const qreal left = std::min(a.left(), b.left());
+        const qreal top = std::min(a.top(), b.top());
+        return QRectF(left, top, std::max(a.right(), b.right()) - left, std::max(a.bottom(), b.bottom()) - top);
+    }
+
+    double distanceToRect(const QPointF& point, const QRectF& rect) {
+        const double dx = std::max({ rect.left() - point.x(), 0.0, point.x() - rect.right() });
+        const double dy = std::max({ rect.top() - point.y(), 0.0, point.y() - rect.bottom() });
+        return std::hypot(dx, dy);
+    }
+
+    double distanceToSegment(const QPointF& point, const QLineF& line) {
+        const QPointF d = line.p2() - line.p1();
+        const double lengthSquared = QPointF::dotProduct(d, d);
+        double t = lengthSquared > 0.0 ? QPointF::dotProduct(point - line.p1(), d) / lengthSquared : 0.0;
+        t = std::clamp(t, 0.0, 1.0);
+        const QPointF nearest = line.p1() + t * d;
+        return std::hypot(point.x() - nearest.x(), point.y() - nearest.y());
+    }
+
+    // Упорядочивание STR: полосы по центру x, внутри полосы - по центру y.
+    // Последовательные группы по NodeCapacity образуют компактные узлы
+    void sortTileRecursive(std::vector<int>& items, int capacity, const std::function<QRectF(int)>& rectOf) {
+        const size_t count = items.size();
+        const size_t pages = (count + capacity - 1) / capacity;
+        const size_t slices = static_cast<size_t>(std::ceil(std::sqrt(double(pages))));
+        const size_t sliceSize = std::max<size_t>(1, slices) * capacity;
+
+        auto centerX = [&rectOf](int a, int b) { return rectOf(a).center().x() < rectOf(b).center().x(); };
+        auto centerY = [&rectOf](int a, int b) { return rectOf(a).center().y() < rectOf(b).center().y(); };
+        std::sort(items.begin(), items.end(), centerX);
+        for (size_t start = 0; start < count; start += sliceSize) {
+            std::sort(items.begin() + start, items.begin() + std::min(count, start + sliceSize), centerY);
+        }
+    }
+
+    const char* kindName(AnnotationKind kind) {
+        switch (kind) {
+        case AnnotationKind::Defect:
+            return "defect";
+        case AnnotationKind::Measurement:
+            return "measurement";
+        case AnnotationKind::Comment:
+            return "comment";
+        }
+        return "comment";
+    }
+
+} // namespace
+
+const char* const AnnotationStore::TagKey = "_annotations";
+
+QRectF Annotation::bounds() const {
+    if (kind == AnnotationKind::Measurement) {
+        return QRectF(line.p1(), line.p2()).normalized();
+    }
+    return rect.normalized();
+}
+
+AnnotationStore::AnnotationStore() : nextId(1), root(-1), indexedCount(0), dirty(false) {}
+
+quint64 AnnotationStore::add(Annotation annotation) {
+    annotation.id = nextId++;
+    positions.insert(annotation.id, annotations.size());
+    annotations.push_back(annotation);
+    return annotation.id;
+}
+
+bool AnnotationStore::remove(quint64 id) {
+    auto it = positions.find(id);
+    if (it == positions.end()) {
+        return false;
+    }
+    // Удаление перестановкой с последним элементом; индекс строится заново
+    const size_t position = it.value();
+    positions.erase(it);
+    if (position + 1 != annotations.size()) {
+        annotations[position] = annotations.back();
+        positions[annotations[position].id] = position;
+    }
+    annotations.pop_back();
+    invalidateIndex();
+    return true;
+}
+
+void AnnotationStore::removeDetected() {
+    annotations.erase(std::remove_if(annotations.begin(), annotations.end(), [](const Annotation& annotation) { return annotation.detected; }),
+        annotations.end());
+    positions.clear();
+    for (size_t i = 0; i < annotations.size(); ++i) {
+        positions.insert(annotations[i].id, i);
+    }
+    invalidateIndex();
+}
+
+void AnnotationStore::clear() {
+    annotations.clear();
+    positions.clear();
+    invalidateIndex();
+}
+
+const Annotation* AnnotationStore::find(quint64 id) const {
+    auto it = positions.constFind(id);
+    return it == positions.constEnd() ? nullptr : &annotations[it.value()];
+}
+
+void AnnotationStore::invalidateIndex() {
+    dirty = true;
+}
+
+void AnnotationStore::rebuildIndex() const {
+    nodes.clear();
+    children.clear();
+    order.resize(annotations.size());
+    std::iota(order.begin(), order.end(), 0);
+
+    std::vector<QRectF> bounds(annotations.size());
+    for (size_t i = 0; i < annotations.size(); ++i) {
+        bounds[i] = annotations[i].bounds();
+    }
+
+    // Листья
+    sortTileRecursive(order, NodeCapacity, [&bounds](int index) { return bounds[index]; });
+    std::vector<int> level;
+    for (size_t start = 0; start < order.size(); start += NodeCapacity) {
+        Node node;
+        node.leaf = true;
+        node.first = static_cast<int>(start);
+        node.count = static_cast<int>(std::min<size_t>(NodeCapacity, order.size() - start));
+        node.bounds = bounds[order[start]];
+        for (int k = 1; k < node.count; ++k) {
+            node.bounds = unite(node.bounds, bounds[order[start + k]]);
+        }
+        level.push_back(static_cast<int>(nodes.size()));
+        nodes.push_back(node);
+    }
+
+    // Верхние уровни тем же упорядочиванием по рамкам узлов
+    while (level.size() > 1) {
+        sortTileRecursive(level, NodeCapacity, [this](int index) { return nodes[index].bounds; });
+        std::vector<int> parents;
+        for (size_t start = 0; start < level.size(); start += NodeCapacity) {
+            Node node;
+            node.leaf = false;
+            node.first = static_cast<int>(children.size());
+            node.count = static_cast<int>(std::min<size_t>(NodeCapacity, level.size() - start));
+            node.bounds = nodes[level[start]].bounds;
+            for (int k = 0; k < node.count; ++k) {
+                children.push_back(level[start + k]);
+                node.bounds = unite(node.bounds, nodes[level[start + k]].bounds);
+            }
+            parents.push_back(static_cast<int>(nodes.size()));
+            nodes.push_back(node);
+        }
+        level.swap(parents);
+    }
+
+    root = level.empty() ? -1 : level.front();
+    indexedCount = annotations.size();
+    dirty = false;
+}
+
+std::vector<const Annotation*> AnnotationStore::query(const QRectF& rect) const {
+    if (dirty || annotations.size() - indexedCount > UnindexedLimit) {
+        rebuildIndex();
+    }
+
+    std::vector<const Annotation*> result;
+    const QRectF area = rect.normalized();
+    if (root >= 0) {
+        std::vector<int> stack{ root };
+        while (!stack.empty()) {
+            const Node& node = nodes[stack.back()];
+            stack.pop_back();
+            if (!overlaps(node.bounds, area)) {
+                continue;
+            }
+            for (int k = 0; k < node.count; ++k) {
+                if (node.leaf) {
+                    const Annotation& annotation = annotations[order[node.first + k]];
+                    if (overlaps(annotation.bounds(), area)) {
+                        result.push_back(&annotation);
+                    }
+                }
+                else {
+                    stack.push_back(children[node.first + k]);
+                }
+            }
+        }
+    }
+    for (size_t i = indexedCount; i < annotations.size(); ++i) {
+        if (overlaps(annotations[i].bounds(), area)) {
+            result.push_back(&annotations[i]);
+        }
+    }
+    return result;
+}
+
+quint64 AnnotationStore::hitTest(const QPointF& point, double tolerance) const {
+    quint64 best = 0;
+    double bestDistance = tolerance;
+    const QRectF area(point.x() - tolerance, point.y() - tolerance, 2 * tolerance, 2 * tolerance);
+    for (const Annotation* annotation : query(area)) {
+        const double distance = annotation->kind == AnnotationKind::Measurement
+            ? distanceToSegment(point, annotation->line)
+            : distanceToRect(point, annotation->rect.normalized());
+        if (distance <= bestDistance) {
+            bestDistance = distance;
+            best = annotation->id;
+        }
+    }
+    return best;
+}
+
+QString AnnotationStore::toJson(const QTransform& transform, const QRectF& clip) const {
+    QJsonArray array;
+    for (const Annotation& annotation : annotations) {
+        QJsonObject object;
+        object.insert("kind", kindName(annotation.kind));
+        if (annotation.kind == AnnotationKind::Measurement) {
+            const QLineF line = transform.map(annotation.line);
+            if (!clip.isNull() && !overlaps(QRectF(line.p1(), line.p2()).normalized(), clip)) {
+                continue;
+            }
+            object.insert("line", QJsonArray{ line.x1(), line.y1(), line.x2(), line.y2() });
+        }
+        else {
+            const QRectF rect = transform.mapRect(annotation.rect.normalized());
+            if (!clip.isNull() && !overlaps(rect, clip)) {
+                continue;
+            }
+            object.insert("rect", QJsonArray{ rect.x(), rect.y(), rect.width(), rect.height() });
+        }
+        if (!annotation.text.isEmpty()) {
+            object.insert("text", annotation.text);
+        }
+        if (annotation.category >= 0) {
+            object.insert("category", annotation.category);
+        }
+        if (annotation.score != 0.0) {
+            object.insert("score", annotation.score);
+        }
+        if (annotation.detected) {
+            object.insert("detected", true);
+        }
+        array.append(object);
+    }
+    return QString::fromUtf8(QJsonDocument(array).toJson(QJsonDocument::Compact));
+}
+
+bool AnnotationStore::fromJson(const QString& json) {
+    clear();
+    if (json.isEmpty()) {
+        return true;
+    }
+    const QJsonDocument doc = QJsonDocument::fromJson(json.toUtf8());
+    if (!doc.isArray()) {
+        return false;
+    }
+
+    const QJsonArray array = doc.array();
+    annotations.reserve(array.size());
+    for (const QJsonValue& value : array) {
+        const QJsonObject object = value.toObject();
+        Annotation annotation;
+        const QString kind = object.value("kind").toString();
+        if (kind == "defect") {
+            annotation.kind = AnnotationKind::Defect;
+        }
+        else if (kind == "measurement") {
+            annotation.kind = AnnotationKind::Measurement;
+        }
+        else {
+            annotation.kind = AnnotationKind::Comment;
+        }
+        const QJsonArray rect = object.value("rect").toArray();
+        if (rect.size() == 4) {
+            annotation.rect = QRectF(rect[0].toDouble(), rect[1].toDouble(), rect[2].toDouble(), rect[3].toDouble());
+        }
+        const QJsonArray line = object.value("line").toArray();
+        if (line.size() == 4) {
+            annotation.line = QLineF(line[0].toDouble(), line[1].toDouble(), line[2].toDouble(), line[3].toDouble());
+        }
+        annotation.text = object.value("text").toString();
+        annotation.category = object.value("category").toInt(-1);
+        annotation.score = object.value("score").toDouble();
+        annotation.detected = object.value("detected").toBool();
+        add(annotation);
+    }
+    return true;
+}
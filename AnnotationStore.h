@@ -0,0 +1,94 @@
+#ifndef ANNOTATIONSTORE_H
+#define ANNOTATIONSTORE_H
+
+#include <QHash>
+#include <QLineF>
+#include <QRectF>
+#include <QString>
+#include <QTransform>
+#include <vector>
+
+// Виды аннотаций
+enum class AnnotationKind {
+    Defect,       // Отметка индикации (рамка)
+    Measurement,  // Измерение длины (отрезок)
+    Comment       // Комментарий к области
+};
+
+// Аннотация в координатах исходного изображения
+struct Annotation {
+    quint64 id = 0;
+    AnnotationKind kind = AnnotationKind::Comment;
+    QRectF rect;            // Рамка индикации или область комментария
+    QLineF line;            // Отрезок измерения
+    QString text;           // Класс индикации, подпись измерения или текст комментария
+    int category = -1;      // Класс индикации (DefectType) для выбора цвета
+    double score = 0.0;     // Отклик детектора в единицах СКО шума
+    bool detected = false;  // Найдена автоматическим поиском
+
+    QRectF bounds() const;
+};
+
+// Хранилище аннотаций с пространственным индексом: R-дерево, упакованное
+// методом STR (sort-tile-recursive). Индекс перестраивается лениво при
+// запросе после удалений или накопления неиндексированных добавлений,
+// последние до перестроения проверяются перебором
+class AnnotationStore {
+public:
+    // Ключ тегов, под которым аннотации хранятся в JSON-трейлере .raw
+    static const char* const TagKey;
+
+    AnnotationStore();
+
+    // Добавление; возвращает присвоенный идентификатор
+    quint64 add(Annotation annotation);
+    bool remove(quint64 id);
+    // Удаление найденных автоматическим поиском индикаций
+    void removeDetected();
+    void clear();
+
+    int size() const { return static_cast<int>(annotations.size()); }
+    bool isEmpty() const { return annotations.empty(); }
+    const Annotation* find(quint64 id) const;
+    const std::vector<Annotation>& all() const { return annotations; }
+
+    // Аннотации, рамки которых пересекают rect
+    std::vector<const Annotation*> query(const QRectF& rect) const;
+
+    // Ближайшая к точке аннотация в пределах tolerance; 0, если такой нет
+    quint64 hitTest(const QPointF& point, double tolerance) const;
+
+    // Сериализация в компактный JSON. transform переводит координаты
+    // (например, в координаты сохраняемого изображения после поворота и
+    // обрезки), аннотации вне clip (если он задан) не записываются
+    QString toJson(const QTransform& transform = QTransform(), const QRectF& clip = QRectF()) const;
+    // Замена содержимого аннотациями из JSON; false при ошибке разбора
+    bool fromJson(const QString& json);
+
+private:
+    static const int NodeCapacity = 16;
+
+    // Узел R-дерева: лист ссылается на отрезок order, внутренний узел - на отрезок children
+    struct Node {
+        QRectF bounds;
+        int first = 0;
+        int count = 0;
+        bool leaf = true;
+    };
+
+    void rebuildIndex() const;
+    void invalidateIndex();
+
+    std::vector<Annotation> annotations;
+    QHash<quint64, size_t> positions; // Идентификатор -> позиция в annotations
+    quint64 nextId;
+
+    mutable std::vector<Node> nodes;
+    mutable std::vector<int> order;     // Позиции аннотаций в порядке листьев
+    mutable std::vector<int> children;  // Дочерние узлы внутренних узлов
+    mutable int root;
+    mutable size_t indexedCount;        // Аннотации [0, indexedCount) в индексе
+    mutable bool dirty;
+};
+
+#endif // ANNOTATIONSTORE_H
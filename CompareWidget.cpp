@@ -0,0 +1,204 @@
+#include "CompareWidget.h"
+#include "ImageProcessor.h"
+#include "ImageHistogram.h"
+#include "TiledImageItem.h"
+#include <QComboBox>
+#include <QGraphicsScene>
+#include <QGraphicsView>
+#include <QHBoxLayout>
+#include <QLabel>
+#include <QPushButton>
+#include <QScrollBar>
+#include <QSplitter>
+#include <QTimer>
+#include <QVBoxLayout>
+#include <QWheelEvent>
+
+namespace {
+
+    // Период мерцания, мс
+    const int FlickerInterval = 500;
+
+    cv::Rect toCvRect(const QRect& rect) {
+        return cv::Rect(rect.x(), rect.y(), rect.width(), rect.height());
+    }
+
+} // namespace
+
+CompareWidget::CompareWidget(QWidget* parent)
+    : QWidget(parent), referenceItem(nullptr), overlayItem(nullptr), alignedItem(nullptr), differenceItem(nullptr),
+    windowLow(0.0), windowHigh(65535.0), synchronizing(false) {
+    modeBox = new QComboBox(this);
+    modeBox->addItem(tr("Рядом"));
+    modeBox->addItem(tr("Мерцание"));
+    modeBox->addItem(tr("Разность"));
+    infoLabel = new QLabel(this);
+    QPushButton* closeButton = new QPushButton(tr("Закрыть сравнение"), this);
+
+    QHBoxLayout* controls = new QHBoxLayout;
+    controls->addWidget(new QLabel(tr("Режим:"), this));
+    controls->addWidget(modeBox);
+    controls->addWidget(infoLabel, 1);
+    controls->addWidget(closeButton);
+
+    leftView = new QGraphicsView(new QGraphicsScene(this), this);
+    rightView = new QGraphicsView(new QGraphicsScene(this), this);
+    QSplitter* splitter = new QSplitter(Qt::Horizontal, this);
+    for (QGraphicsView* view : { leftView, rightView }) {
+        view->setTransformationAnchor(QGraphicsView::AnchorUnderMouse);
+        view->setResizeAnchor(QGraphicsView::AnchorViewCenter);
+        view->setDragMode(QGraphicsView::ScrollHandDrag);
+        view->viewport()->installEventFilter(this);
+        splitter->addWidget(view);
+
+        // Прокрутка одного окна повторяется в другом
+        connect(view->horizontalScrollBar(), &QScrollBar::valueChanged, this, [this, view]() { synchronize(view); });
+        connect(view->verticalScrollBar(), &QScrollBar::valueChanged, this, [this, view]() { synchronize(view); });
+    }
+
+    QVBoxLayout* layout = new QVBoxLayout(this);
+    layout->setContentsMargins(0, 0, 0, 0);
+    layout->addLayout(controls);
+    layout->addWidget(splitter, 1);
+
+    flickerTimer = new QTimer(this);
+    flickerTimer->setInterval(FlickerInterval);
+    connect(flickerTimer, &QTimer::timeout, this, &CompareWidget::toggleFlicker);
+    connect(modeBox, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &CompareWidget::setMode);
+    connect(closeButton, &QPushButton::clicked, this, &CompareWidget::closeRequested);
+}
+
+void CompareWidget::setFilms(const FilmComparison::Pyramid& referencePyramid, const FilmComparison::Pyramid& comparisonPyramid, const FilmAlignment& filmAlignment) {
+    clear();
+    reference = referencePyramid;
+    comparison = comparisonPyramid;
+    alignment = filmAlignment;
+
+    // Окно по процентилям эталона; гистограмма уменьшенного уровня достаточно точна
+    const ImageHistogram histogram = ImageHistogram::compute(reference[std::min<size_t>(2, reference.size() - 1)]);
+    windowLow = histogram.percentile(0.005);
+    windowHigh = std::max<double>(histogram.percentile(0.995), windowLow + 1.0);
+
+    const QSize size(reference.front().cols, reference.front().rows);
+    referenceItem = new TiledImageItem(size, [this](const QRect& rect, int level) {
+        return ImageProcessor::cvMatToQImage(ImageProcessor::applyWindow(
+            FilmComparison::referenceTile(reference, toCvRect(rect), level), windowLow, windowHigh));
+    });
+    auto alignedRenderer = [this](const QRect& rect, int level) {
+        return ImageProcessor::cvMatToQImage(ImageProcessor::applyWindow(
+            FilmComparison::alignedTile(comparison, alignment, toCvRect(rect), level), windowLow, windowHigh));
+    };
+    overlayItem = new TiledImageItem(size, alignedRenderer);
+    alignedItem = new TiledImageItem(size, alignedRenderer);
+    differenceItem = new TiledImageItem(size, [this](const QRect& rect, int level) {
+        return ImageProcessor::cvMatToQImage(FilmComparison::differenceTile(reference, comparison, alignment, toCvRect(rect), level));
+    });
+
+    leftView->scene()->addItem(referenceItem);
+    leftView->scene()->addItem(overlayItem);
+    rightView->scene()->addItem(alignedItem);
+    rightView->scene()->addItem(differenceItem);
+    leftView->scene()->setSceneRect(0, 0, size.width(), size.height());
+    rightView->scene()->setSceneRect(0, 0, size.width(), size.height());
+
+    infoLabel->setText(tr("Сдвиг: %1, %2 пикс.; отклик %3; совмещение %4 мс")
+        .arg(alignment.shift.x, 0, 'f', 2).arg(alignment.shift.y, 0, 'f', 2)
+        .arg(alignment.response, 0, 'f', 2).arg(alignment.elapsedMs, 0, 'f', 0));
+    setMode(modeBox->currentIndex());
+    fitInView();
+}
+
+void CompareWidget::setWindow(double low, double high) {
+    windowLow = low;
+    windowHigh = std::max(high, low + 1.0);
+    for (TiledImageItem* item : { referenceItem, overlayItem, alignedItem }) {
+        if (item) {
+            item->invalidate();
+        }
+    }
+}
+
+void CompareWidget::clear() {
+    flickerTimer->stop();
+    leftView->scene()->clear();
+    rightView->scene()->clear();
+    referenceItem = nullptr;
+    overlayItem = nullptr;
+    alignedItem = nullptr;
+    differenceItem = nullptr;
+    reference.clear();
+    comparison.clear();
+    infoLabel->clear();
+}
+
+void CompareWidget::setMode(int mode) {
+    if (modeBox->currentIndex() != mode) {
+        modeBox->setCurrentIndex(mode);
+        return;
+    }
+    flickerTimer->stop();
+    if (!referenceItem) {
+        return;
+    }
+
+    overlayItem->setVisible(false);
+    alignedItem->setVisible(mode == SideBySide);
+    differenceItem->setVisible(mode == Difference);
+    rightView->setVisible(mode != Flicker);
+    if (mode == Flicker) {
+        flickerTimer->start();
+    }
+    synchronize(leftView);
+}
+
+void CompareWidget::toggleFlicker() {
+    if (overlayItem) {
+        overlayItem->setVisible(!overlayItem->isVisible());
+    }
+}
+
+void CompareWidget::zoomIn() {
+    scaleViews(1.1);
+}
+
+void CompareWidget::zoomOut() {
+    scaleViews(0.9);
+}
+
+void CompareWidget::fitInView() {
+    leftView->fitInView(leftView->sceneRect(), Qt::KeepAspectRatio);
+    synchronize(leftView);
+}
+
+void CompareWidget::scaleViews(double factor) {
+    leftView->scale(factor, factor);
+    synchronize(leftView);
+}
+
+void CompareWidget::synchronize(QGraphicsView* source) {
+    if (synchronizing) {
+        return;
+    }
+    // Сцены совпадают по координатам, поэтому достаточно повторить
+    // преобразование и положение полос прокрутки
+    synchronizing = true;
+    QGraphicsView* target = source == leftView ? rightView : leftView;
+    target->setTransform(source->transform());
+    target->horizontalScrollBar()->setValue(source->horizontalScrollBar()->value());
+    target->verticalScrollBar()->setValue(source->verticalScrollBar()->value());
+    synchronizing = false;
+}
+
+bool CompareWidget::eventFilter(QObject* watched, QEvent* event) {
+    // Масштабирование колесом относительно точки под курсором в любом из окон
+    if (event->type() == QEvent::Wheel) {
+        QGraphicsView* view = watched == leftView->viewport() ? leftView : (watched == rightView->viewport() ? rightView : nullptr);
+        if (view) {
+            const double factor = static_cast<QWheelEvent*>(event)->angleDelta().y() > 0 ? 1.1 : 0.9;
+            view->scale(factor, factor);
+            synchronize(view);
+            return true;
+        }
+    }
+    return QWidget::eventFilter(watched, event);
+}
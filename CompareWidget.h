@@ -0,0 +1,72 @@
+#ifndef COMPAREWIDGET_H
+#define COMPAREWIDGET_H
+
+#include <QWidget>
+#include "FilmComparison.h"
+
+class QComboBox;
+class QGraphicsView;
+class QLabel;
+class QTimer;
+class TiledImageItem;
+
+// Сравнение двух снимков одного объекта: эталон и совмещенный с ним снимок
+// рядом, мерцание (поочередный показ в одном окне) или нормированная разность.
+// Масштаб и положение двух окон синхронизированы; все изображения строятся
+// по видимым тайлам
+class CompareWidget : public QWidget {
+    Q_OBJECT
+
+public:
+    enum Mode {
+        SideBySide,
+        Flicker,
+        Difference
+    };
+
+    explicit CompareWidget(QWidget* parent = nullptr);
+
+    // Пирамиды снимков (FilmComparison::buildPyramid) и результат совмещения
+    void setFilms(const FilmComparison::Pyramid& reference, const FilmComparison::Pyramid& comparison, const FilmAlignment& alignment);
+    void setWindow(double low, double high);
+    void clear();
+
+public slots:
+    void setMode(int mode);
+    void zoomIn();
+    void zoomOut();
+    void fitInView();
+
+signals:
+    void closeRequested();
+
+protected:
+    bool eventFilter(QObject* watched, QEvent* event) override;
+
+private slots:
+    void toggleFlicker();
+
+private:
+    void synchronize(QGraphicsView* source);
+    void scaleViews(double factor);
+
+    QGraphicsView* leftView;
+    QGraphicsView* rightView;
+    QComboBox* modeBox;
+    QLabel* infoLabel;
+    QTimer* flickerTimer;
+
+    TiledImageItem* referenceItem;   // Эталон (левое окно)
+    TiledImageItem* overlayItem;     // Совмещенный снимок поверх эталона для мерцания
+    TiledImageItem* alignedItem;     // Совмещенный снимок (правое окно)
+    TiledImageItem* differenceItem;  // Разность (правое окно)
+
+    FilmComparison::Pyramid reference;
+    FilmComparison::Pyramid comparison;
+    FilmAlignment alignment;
+    double windowLow;
+    double windowHigh;
+    bool synchronizing;
+};
+
+#endif // COMPAREWIDGET_H
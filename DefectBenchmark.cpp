@@ -0,0 +1,183 @@
+#include "DefectBenchmark.h"
+#include <QElapsedTimer>
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+namespace {
+
+    const double defectContrast = 2000.0; // Амплитуда дефекта относительно фона
+    const double noiseSigma = 150.0;
+    // Пороги по замерам на снимках 1024..8192 (зерна 1-5): найдены все 30 дефектов,
+    // ложных кандидатов от 7 до 73 на снимок, в основном у кромок шва, где фон
+    // оценивается хуже. Их число не растет с площадью, поэтому ограничено на снимок
+    const double minRecall = 0.95;     // Доля найденных внесенных дефектов: допускается один пропуск из 30
+    const int maxFalsePositives = 80;  // Ложные кандидаты на снимок
+
+    // Форма дефекта рисуется в локальной маске с полем 4 пикселя и размывается
+    void addBlurred(cv::Mat& film, const cv::Mat& shape, const cv::Rect& box, double amplitude) {
+        cv::Mat blurred;
+        cv::GaussianBlur(shape, blurred, cv::Size(), 1.0);
+        film(box) += blurred * amplitude;
+    }
+
+}
+
+namespace DefectBenchmark {
+
+    SyntheticFilm generateFilm(int size, unsigned int seed) {
+        SyntheticFilm film;
+        cv::RNG rng(seed);
+
+        // Фон: уровень около 20000 с горизонтальным градиентом экспозиции
+        cv::Mat values(size, size, CV_32F);
+        for (int y = 0; y < size; ++y) {
+            float* row = values.ptr<float>(y);
+            for (int x = 0; x < size; ++x) {
+                row[x] = 18000.0f + 4000.0f * x / size;
+            }
+        }
+
+        // Сварной шов: более плотная (темная) полоса по середине высоты
+        const int beadTop = size * 2 / 5;
+        const int beadHeight = size / 5;
+        cv::Mat bead = cv::Mat::zeros(size, size, CV_32F);
+        bead(cv::Rect(0, beadTop, size, beadHeight)).setTo(1.0f);
+        cv::GaussianBlur(bead, bead, cv::Size(), size / 128.0);
+        values -= bead * 3000.0f;
+
+        // Дефекты располагаются в шве по сетке ячеек, чтобы не перекрываться
+        const int cell = std::max(size / 16, 64);
+        const DefectType types[] = { DefectType::Pore, DefectType::Inclusion, DefectType::Crack, DefectType::LackOfFusion };
+        int counter = 0;
+        for (int x = cell / 2; x + cell <= size; x += cell) {
+            for (int row = 0; row < 2; ++row) {
+                const DefectType type = types[counter++ % 4];
+                const int y = beadTop + row * beadHeight / 2 + cell / 4;
+                cv::Rect box;
+                cv::Mat shape;
+
+                if (type == DefectType::Pore) {
+                    const int radius = rng.uniform(3, 9);
+                    box = cv::Rect(x - radius - 4, y - radius - 4, 2 * radius + 9, 2 * radius + 9);
+                    shape = cv::Mat::zeros(box.size(), CV_32F);
+                    cv::circle(shape, cv::Point(radius + 4, radius + 4), radius, cv::Scalar(1.0), cv::FILLED);
+                    addBlurred(values, shape, box, defectContrast);
+                }
+                else if (type == DefectType::Inclusion) {
+                    const cv::Size axes(rng.uniform(4, 10), rng.uniform(3, 6));
+                    box = cv::Rect(x - axes.width - 4, y - axes.width - 4, 2 * axes.width + 9, 2 * axes.width + 9);
+                    shape = cv::Mat::zeros(box.size(), CV_32F);
+                    cv::ellipse(shape, cv::Point(axes.width + 4, axes.width + 4), axes, rng.uniform(0.0, 180.0), 0, 360, cv::Scalar(1.0), cv::FILLED);
+                    addBlurred(values, shape, box, -defectContrast);
+                }
+                else if (type == DefectType::Crack) {
+                    // Случайное блуждание с преимущественным направлением
+                    const int length = cell / 2;
+                    box = cv::Rect(x - length / 2 - 4, y - length / 2 - 4, length + 8, length + 8);
+                    shape = cv::Mat::zeros(box.size(), CV_32F);
+                    cv::Point2d point(4, 4 + length / 2);
+                    double angle = rng.uniform(-0.5, 0.5);
+                    for (int step = 0; step < length / 4; ++step) {
+                        const cv::Point2d next = point + 4.0 * cv::Point2d(std::cos(angle), std::sin(angle));
+                        cv::line(shape, point, next, cv::Scalar(1.0), 1, cv::LINE_8);
+                        point = next;
+                        angle = std::clamp(angle + rng.uniform(-0.4, 0.4), -0.8, 0.8);
+                    }
+                    addBlurred(values, shape, box, defectContrast);
+                }
+                else {
+                    // Несплавление: длинная прямая линия по кромке шва
+                    const int length = cell - 8;
+                    const int edge = row == 0 ? beadTop : beadTop + beadHeight;
+                    box = cv::Rect(x, edge - 6, length, 12);
+                    shape = cv::Mat::zeros(box.size(), CV_32F);
+                    cv::line(shape, cv::Point(4, 6), cv::Point(length - 5, 6), cv::Scalar(1.0), 3, cv::LINE_8);
+                    addBlurred(values, shape, box, defectContrast);
+                }
+
+                // Истинный прямоугольник - по фактически нарисованным пикселям
+                cv::Mat mask = shape > 0.5f;
+                film.defects.push_back({ cv::boundingRect(mask) + box.tl(), type });
+            }
+        }
+
+        cv::Mat noise(values.size(), CV_32F);
+        rng.fill(noise, cv::RNG::NORMAL, 0.0, noiseSigma);
+        values += noise;
+        values.convertTo(film.image, CV_16U);
+        return film;
+    }
+
+    int run(int size, int runs, unsigned int seed, std::ostream& out) {
+        const SyntheticFilm film = generateFilm(size, seed);
+        const DefectDetector detector;
+
+        std::vector<double> times;
+        std::vector<DefectCandidate> candidates;
+        for (int i = 0; i < std::max(runs, 1); ++i) {
+            QElapsedTimer timer;
+            timer.start();
+            candidates = detector.detect(film.image);
+            times.push_back(timer.nsecsElapsed() / 1e6);
+        }
+        std::sort(times.begin(), times.end());
+        const double median = times[times.size() / 2];
+
+        // Сопоставление: внесенный дефект найден, если его пересекает кандидат
+        std::map<DefectType, int> implanted, found;
+        int typed = 0;
+        std::vector<bool> matched(candidates.size(), false);
+        for (const ImplantedDefect& defect : film.defects) {
+            ++implanted[defect.type];
+            int best = -1;
+            for (int i = 0; i < static_cast<int>(candidates.size()); ++i) {
+                if ((candidates[i].box & defect.box).area() > 0 && (best < 0 || candidates[i].score > candidates[best].score)) {
+                    best = i;
+                }
+            }
+            for (int i = 0; i < static_cast<int>(candidates.size()); ++i) {
+                if ((candidates[i].box & defect.box).area() > 0) {
+                    matched[i] = true;
+                }
+            }
+            if (best >= 0) {
+                ++found[defect.type];
+                typed += candidates[best].type == defect.type ? 1 : 0;
+            }
+        }
+        const int falsePositives = static_cast<int>(std::count(matched.begin(), matched.end(), false));
+
+        int foundTotal = 0;
+        for (const auto& entry : found) {
+            foundTotal += entry.second;
+        }
+
+        out << "Film: " << size << "x" << size << " 16-bit, defects: " << film.defects.size()
+            << ", threads: " << cv::getNumThreads() << "\n";
+        out << "Time: min " << times.front() << " ms, median " << median << " ms ("
+            << (static_cast<double>(size) * size / 1e6) / (median / 1e3) << " Mpx/s)\n";
+        out << "Recall: " << foundTotal << "/" << film.defects.size() << "\n";
+        for (const auto& entry : implanted) {
+            out << "  " << DefectDetector::typeName(entry.first).toStdString() << ": "
+                << found[entry.first] << "/" << entry.second << "\n";
+        }
+        out << "Type accuracy: " << typed << "/" << foundTotal << "\n";
+        out << "False positives: " << falsePositives << "\n";
+
+        // Целевое время задано для кадра 4k x 4k; для других размеров - пропорционально площади.
+        // Быстрый, но пропускающий дефекты или шумный детектор проверку не проходит
+        const double budget = 1000.0 * (static_cast<double>(size) * size) / (4096.0 * 4096.0);
+        const int requiredFound = static_cast<int>(std::ceil(minRecall * film.defects.size()));
+        const int allowedFalsePositives = maxFalsePositives;
+        const bool fastEnough = median <= budget;
+        const bool completeEnough = foundTotal >= requiredFound;
+        const bool cleanEnough = falsePositives <= allowedFalsePositives;
+        const bool passed = fastEnough && completeEnough && cleanEnough;
+        out << (passed ? "PASS" : "FAIL") << ": budget " << budget << " ms" << (fastEnough ? "" : " exceeded")
+            << ", recall at least " << requiredFound << (completeEnough ? "" : " not reached")
+            << ", false positives at most " << allowedFalsePositives << (cleanEnough ? "" : " exceeded") << "\n";
+        return passed ? 0 : 1;
+    }
+
+}
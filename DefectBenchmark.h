@@ -0,0 +1,32 @@
+#ifndef DEFECTBENCHMARK_H
+#define DEFECTBENCHMARK_H
+
+#include "DefectDetector.h"
+#include <ostream>
+
+// Синтетические снимки с внесенными дефектами для оценки скорости
+// и полноты поиска индикаций
+namespace DefectBenchmark {
+
+    struct ImplantedDefect {
+        cv::Rect box;
+        DefectType type;
+    };
+
+    struct SyntheticFilm {
+        cv::Mat image; // CV_16UC1
+        std::vector<ImplantedDefect> defects;
+    };
+
+    // Снимок size x size: фон с градиентом, сварной шов, шум и набор дефектов всех классов
+    SyntheticFilm generateFilm(int size, unsigned int seed);
+
+    // Прогон детектора runs раз на синтетическом снимке; отчет выводится в out.
+    // Возвращает 0, если снимок 4096x4096 обработан быстрее секунды (другие размеры -
+    // пропорционально площади), найдено не менее 95% внесенных дефектов и ложных
+    // кандидатов на снимке не больше 80
+    int run(int size, int runs, unsigned int seed, std::ostream& out);
+
+}
+
+#endif // DEFECTBENCHMARK_H
@@ -0,0 +1,386 @@
+#include "DefectDetector.h"
+#include <QObject>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <unordered_map>
+
+namespace {
+
+    const double BackgroundScale = 1.0 / 8.0; // Уменьшение при оценке фона
+    const double BlobSigmas[2] = { 1.5, 3.0 }; // Ядра разности гауссиан
+    const double RidgeSigma = 1.5;             // Ядро сглаживания перед гессианом
+    const int PyramidLevels = 2;               // Уровни пирамиды ниже исходного
+    const int MaxNoiseTiles = 8;               // Тайлов в выборке для оценки шума
+    const int MergeCell = 64;                  // Ячейка сетки при объединении кандидатов
+
+    // Выборка модулей значений с шагом 4 по обеим осям для оценки СКО
+    void sampleAbs(const cv::Mat& values, std::vector<float>& samples) {
+        for (int y = 0; y < values.rows; y += 4) {
+            const float* row = values.ptr<float>(y);
+            for (int x = 0; x < values.cols; x += 4) {
+                samples.push_back(std::abs(row[x]));
+            }
+        }
+    }
+
+    // Робастная оценка СКО по медиане модулей
+    float robustSigma(std::vector<float>& samples) {
+        if (samples.empty()) {
+            return 1.0f;
+        }
+        auto middle = samples.begin() + samples.size() / 2;
+        std::nth_element(samples.begin(), middle, samples.end());
+        return std::max(*middle * 1.4826f, 1e-3f);
+    }
+
+    // Разность гауссиан (приближение лапласиана) на уровне пирамиды
+    cv::Mat differenceOfGaussians(const cv::Mat& z) {
+        cv::Mat fine, coarse;
+        cv::GaussianBlur(z, fine, cv::Size(), BlobSigmas[0]);
+        cv::GaussianBlur(z, coarse, cv::Size(), BlobSigmas[1]);
+        return fine - coarse;
+    }
+
+    // Вторые производные сглаженного уровня пирамиды
+    void hessian(const cv::Mat& z, cv::Mat& dxx, cv::Mat& dyy, cv::Mat& dxy) {
+        cv::Mat smoothed;
+        cv::GaussianBlur(z, smoothed, cv::Size(), RidgeSigma);
+        cv::Sobel(smoothed, dxx, CV_32F, 2, 0, 3);
+        cv::Sobel(smoothed, dyy, CV_32F, 0, 2, 3);
+        cv::Sobel(smoothed, dxy, CV_32F, 1, 1, 3);
+    }
+
+    // Отклик в единицах СКО шума, приведенный к размеру тайла
+    cv::Mat normalized(cv::Mat response, float noise, const cv::Size& size) {
+        response *= 1.0f / noise;
+        if (response.size() != size) {
+            cv::resize(response, response, size, 0, 0, cv::INTER_LINEAR);
+        }
+        return response;
+    }
+
+    // Отклик на светлые линии: кривизна поперек линии (наименьшее собственное
+    // значение гессиана) при слабой кривизне вдоль нее
+    cv::Mat ridgeResponse(const cv::Mat& z, float noise, const cv::Size& size) {
+        cv::Mat dxx, dyy, dxy;
+        hessian(z, dxx, dyy, dxy);
+
+        cv::Mat response(dxx.size(), CV_32F);
+        for (int y = 0; y < response.rows; ++y) {
+            const float* xx = dxx.ptr<float>(y);
+            const float* yy = dyy.ptr<float>(y);
+            const float* xy = dxy.ptr<float>(y);
+            float* r = response.ptr<float>(y);
+            for (int x = 0; x < response.cols; ++x) {
+                const float halfTrace = 0.5f * (xx[x] + yy[x]);
+                const float halfDiff = 0.5f * (xx[x] - yy[x]);
+                const float root = std::sqrt(halfDiff * halfDiff + xy[x] * xy[x]);
+                const float across = halfTrace - root;
+                const float along = halfTrace + root;
+                r[x] = (across < 0.0f && std::abs(along) < 0.5f * std::abs(across)) ? -across : 0.0f;
+            }
+        }
+
+        // Нормировка на шум лапласиана: у самого отклика медиана нулевая
+        return normalized(response, noise, size);
+    }
+
+    // Связная компонента отклика
+    struct Component {
+        cv::Rect box;
+        cv::Point2d centroid;
+        double elongation;
+        double peak;
+    };
+
+    std::vector<Component> components(const cv::Mat& response, double threshold, int minArea) {
+        std::vector<Component> result;
+        cv::Mat mask = response > threshold;
+        cv::Mat labels, stats, centroids;
+        const int count = cv::connectedComponentsWithStats(mask, labels, stats, centroids, 8, CV_32S);
+
+        for (int i = 1; i < count; ++i) {
+            if (stats.at<int>(i, cv::CC_STAT_AREA) < minArea) {
+                continue;
+            }
+            Component component;
+            component.box = cv::Rect(stats.at<int>(i, cv::CC_STAT_LEFT), stats.at<int>(i, cv::CC_STAT_TOP),
+                stats.at<int>(i, cv::CC_STAT_WIDTH), stats.at<int>(i, cv::CC_STAT_HEIGHT));
+            component.centroid = cv::Point2d(centroids.at<double>(i, 0), centroids.at<double>(i, 1));
+
+            // Вытянутость по центральным моментам второго порядка
+            cv::Mat componentMask = labels(component.box) == i;
+            cv::Moments m = cv::moments(componentMask, true);
+            const double mu20 = m.mu20 / m.m00;
+            const double mu02 = m.mu02 / m.m00;
+            const double mu11 = m.mu11 / m.m00;
+            const double root = std::sqrt(0.25 * (mu20 - mu02) * (mu20 - mu02) + mu11 * mu11);
+            const double major = 0.5 * (mu20 + mu02) + root;
+            const double minor = std::max(0.5 * (mu20 + mu02) - root, 0.25);
+            component.elongation = std::sqrt(major / minor);
+
+            cv::minMaxLoc(response(component.box), nullptr, &component.peak, nullptr, nullptr, componentMask);
+            result.push_back(component);
+        }
+        return result;
+    }
+
+    cv::Rect expand(const cv::Rect& rect, int margin) {
+        return cv::Rect(rect.x - margin, rect.y - margin, rect.width + 2 * margin, rect.height + 2 * margin);
+    }
+
+    int findRoot(std::vector<int>& parent, int i) {
+        while (parent[i] != i) {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    }
+
+    // Объединение частей одной индикации, попавших в соседние тайлы.
+    // Пары сравниваются только внутри ячеек сетки, которые задевает кандидат,
+    // и сливаются через систему непересекающихся множеств. Объединенный
+    // прямоугольник может коснуться новых кандидатов, поэтому проход
+    // повторяется, пока число кандидатов уменьшается
+    void mergeTouching(std::vector<DefectCandidate>& candidates) {
+        size_t previous = 0;
+        while (candidates.size() > 1 && candidates.size() != previous) {
+            previous = candidates.size();
+
+            std::unordered_map<int64_t, std::vector<int>> cells;
+            for (int i = 0; i < static_cast<int>(candidates.size()); ++i) {
+                const cv::Rect box = expand(candidates[i].box, 1);
+                for (int cy = cvFloor(double(box.y) / MergeCell); cy <= cvFloor(double(box.br().y - 1) / MergeCell); ++cy) {
+                    for (int cx = cvFloor(double(box.x) / MergeCell); cx <= cvFloor(double(box.br().x - 1) / MergeCell); ++cx) {
+                        cells[(int64_t(uint32_t(cy)) << 32) | uint32_t(cx)].push_back(i);
+                    }
+                }
+            }
+
+            std::vector<int> parent(candidates.size());
+            std::iota(parent.begin(), parent.end(), 0);
+            for (const auto& cell : cells) {
+                const std::vector<int>& members = cell.second;
+                for (size_t a = 0; a < members.size(); ++a) {
+                    for (size_t b = a + 1; b < members.size(); ++b) {
+                        const DefectCandidate& first = candidates[members[a]];
+                        const DefectCandidate& second = candidates[members[b]];
+                        if (first.type == second.type && !(expand(first.box, 1) & second.box).empty()) {
+                            parent[findRoot(parent, members[a])] = findRoot(parent, members[b]);
+                        }
+                    }
+                }
+            }
+
+            // Порядок сохраняется: множество представляет его первый кандидат
+            std::vector<int> slot(candidates.size(), -1);
+            std::vector<DefectCandidate> merged;
+            for (int i = 0; i < static_cast<int>(candidates.size()); ++i) {
+                int& target = slot[findRoot(parent, i)];
+                if (target < 0) {
+                    target = static_cast<int>(merged.size());
+                    merged.push_back(candidates[i]);
+                }
+                else {
+                    merged[target].box |= candidates[i].box;
+                    merged[target].score = std::max(merged[target].score, candidates[i].score);
+                }
+            }
+            candidates.swap(merged);
+        }
+    }
+
+    // Из перекрывающихся кандидатов разных классов остается самый сильный
+    void suppressOverlapping(std::vector<DefectCandidate>& candidates) {
+        std::sort(candidates.begin(), candidates.end(), [](const DefectCandidate& a, const DefectCandidate& b) { return a.score > b.score; });
+        std::vector<DefectCandidate> kept;
+        for (const DefectCandidate& candidate : candidates) {
+            bool covered = false;
+            for (const DefectCandidate& stronger : kept) {
+                if ((candidate.box & stronger.box).area() * 2 > candidate.box.area()) {
+                    covered = true;
+                    break;
+                }
+            }
+            if (!covered) {
+                kept.push_back(candidate);
+            }
+        }
+        candidates.swap(kept);
+    }
+
+} // namespace
+
+DefectDetector::DefectDetector(const DetectorParams& detectorParams) : params(detectorParams) {}
+
+QString DefectDetector::typeName(DefectType type) {
+    switch (type) {
+    case DefectType::Pore:
+        return QObject::tr("Пора");
+    case DefectType::Inclusion:
+        return QObject::tr("Включение");
+    case DefectType::Crack:
+        return QObject::tr("Трещина");
+    case DefectType::LackOfFusion:
+        return QObject::tr("Несплавление");
+    }
+    return QString();
+}
+
+int DefectDetector::overlap() const {
+    // Носитель ядра фона (3 сигмы) плюс пиксель уменьшенной копии с каждой
+    // стороны; ядра разности гауссиан и гессиана на верхнем уровне пирамиды
+    const int scale = 1 << PyramidLevels;
+    const int background = cvCeil(3.0 * params.backgroundSigma) + 2 * cvRound(1.0 / BackgroundScale);
+    const int pyramid = cvCeil(3.0 * std::max(BlobSigmas[1], RidgeSigma + 1.0) * scale) + 2 * scale;
+    // Кратность шагу уменьшенной копии совмещает ее сетку во всех тайлах
+    const int step = cvRound(1.0 / BackgroundScale);
+    const int required = std::max({ params.overlap, background, pyramid });
+    return (required + step - 1) / step * step;
+}
+
+std::vector<cv::Mat> DefectDetector::residualPyramid(const cv::Mat& tile) const {
+    cv::Mat values;
+    tile.convertTo(values, CV_32F);
+
+    // Нормализация фона: сглаживание крупного масштаба на уменьшенной копии
+    cv::Mat reduced, background;
+    cv::resize(values, reduced, cv::Size(), BackgroundScale, BackgroundScale, cv::INTER_AREA);
+    cv::GaussianBlur(reduced, reduced, cv::Size(), params.backgroundSigma * BackgroundScale);
+    cv::resize(reduced, background, values.size(), 0, 0, cv::INTER_LINEAR);
+
+    // Отклонение от фона; дефекты приводятся к светлой полярности. Масштаб
+    // не нормируется: отклики делятся на общий для снимка шум
+    std::vector<cv::Mat> levels(PyramidLevels + 1);
+    levels[0] = (values - background) * (params.voidsBright ? 1.0 : -1.0);
+    // Пирамида: крупные масштабы считаются теми же малыми ядрами на уменьшенных уровнях
+    for (int level = 1; level <= PyramidLevels; ++level) {
+        cv::pyrDown(levels[level - 1], levels[level]);
+    }
+    return levels;
+}
+
+void DefectDetector::sampleNoise(const cv::Mat& tile, std::vector<float> (&samples)[NoiseChannels]) const {
+    const std::vector<cv::Mat> levels = residualPyramid(tile);
+    for (int level = 0; level <= PyramidLevels; ++level) {
+        sampleAbs(differenceOfGaussians(levels[level]), samples[level]);
+    }
+    const cv::Mat* ridgeLevels[2] = { &levels[0], &levels[PyramidLevels] };
+    for (int i = 0; i < 2; ++i) {
+        cv::Mat dxx, dyy, dxy;
+        hessian(*ridgeLevels[i], dxx, dyy, dxy);
+        sampleAbs(dxx + dyy, samples[PyramidLevels + 1 + i]);
+    }
+}
+
+void DefectDetector::detectTile(const cv::Mat& tile, const cv::Rect& tileRect, const cv::Rect& core, const NoiseLevels& noise,
+    std::vector<DefectCandidate>& candidates) const {
+    const std::vector<cv::Mat> levels = residualPyramid(tile);
+    const cv::Size size = levels[0].size();
+    cv::Mat blob0 = normalized(differenceOfGaussians(levels[0]), noise.sigma[0], size);
+    cv::Mat blob1 = normalized(differenceOfGaussians(levels[1]), noise.sigma[1], size);
+    cv::Mat blob2 = normalized(differenceOfGaussians(levels[2]), noise.sigma[2], size);
+    cv::Mat bright = cv::max(blob0, cv::max(blob1, blob2));
+    cv::Mat dark = -cv::min(blob0, cv::min(blob1, blob2));
+    cv::Mat thin = ridgeResponse(levels[0], noise.sigma[3], size);
+    cv::Mat wide = ridgeResponse(levels[PyramidLevels], noise.sigma[4], size);
+
+    auto accept = [&](const Component& component, DefectType type) {
+        // Компонента принадлежит тайлу, в ядро которого попадает ее центр
+        const cv::Point2d center = component.centroid + cv::Point2d(tileRect.x, tileRect.y);
+        if (!core.contains(cv::Point(cvFloor(center.x), cvFloor(center.y)))) {
+            return;
+        }
+        candidates.push_back({ component.box + tileRect.tl(), type, component.peak });
+    };
+
+    for (const Component& component : components(bright, params.threshold, params.minArea)) {
+        if (component.elongation < 3.0) {
+            accept(component, DefectType::Pore);
+        }
+        else if (component.elongation < 6.0) {
+            accept(component, DefectType::Inclusion);
+        }
+    }
+    for (const Component& component : components(dark, params.threshold, params.minArea)) {
+        if (component.elongation < 6.0) {
+            accept(component, DefectType::Inclusion);
+        }
+    }
+    for (const Component& component : components(thin, params.threshold, params.minArea)) {
+        if (component.elongation >= 3.0 && std::max(component.box.width, component.box.height) >= 8) {
+            accept(component, DefectType::Crack);
+        }
+    }
+    for (const Component& component : components(wide, params.threshold, params.minArea * 4)) {
+        if (component.elongation >= 4.0 && std::max(component.box.width, component.box.height) >= 32) {
+            accept(component, DefectType::LackOfFusion);
+        }
+    }
+}
+
+std::vector<DefectCandidate> DefectDetector::detect(const cv::Mat& image) const {
+    std::vector<DefectCandidate> result;
+    if (image.empty()) {
+        return result;
+    }
+
+    cv::Mat gray = image;
+    if (gray.channels() > 1) {
+        cv::cvtColor(image, gray, gray.channels() == 4 ? cv::COLOR_BGRA2GRAY : cv::COLOR_BGR2GRAY);
+    }
+
+    const cv::Rect bounds(0, 0, gray.cols, gray.rows);
+    const int tileSize = std::max(params.tileSize, 64);
+    const int tilesX = (gray.cols + tileSize - 1) / tileSize;
+    const int tilesY = (gray.rows + tileSize - 1) / tileSize;
+    const int tileCount = tilesX * tilesY;
+    const int margin = overlap();
+    auto paddedTile = [&](int index, cv::Rect& core) {
+        core = cv::Rect((index % tilesX) * tileSize, (index / tilesX) * tileSize, tileSize, tileSize) & bounds;
+        return expand(core, margin) & bounds;
+    };
+
+    // Шум оценивается по равномерной выборке тайлов и общий для всего снимка:
+    // собственная нормировка каждого тайла давала разные пороги по сторонам шва тайлов
+    const int noiseStep = std::max(1, (tileCount + MaxNoiseTiles - 1) / MaxNoiseTiles);
+    const int noiseTiles = (tileCount + noiseStep - 1) / noiseStep;
+    std::vector<std::vector<float>> tileSamples(size_t(noiseTiles) * NoiseChannels);
+    cv::parallel_for_(cv::Range(0, noiseTiles), [&](const cv::Range& range) {
+        for (int i = range.start; i < range.end; ++i) {
+            cv::Rect core;
+            const cv::Rect padded = paddedTile(i * noiseStep, core);
+            std::vector<float> samples[NoiseChannels];
+            sampleNoise(gray(padded), samples);
+            for (int channel = 0; channel < NoiseChannels; ++channel) {
+                tileSamples[size_t(i) * NoiseChannels + channel].swap(samples[channel]);
+            }
+        }
+    });
+    NoiseLevels noise;
+    for (int channel = 0; channel < NoiseChannels; ++channel) {
+        std::vector<float> samples;
+        for (int i = 0; i < noiseTiles; ++i) {
+            const std::vector<float>& part = tileSamples[size_t(i) * NoiseChannels + channel];
+            samples.insert(samples.end(), part.begin(), part.end());
+        }
+        noise.sigma[channel] = robustSigma(samples);
+    }
+
+    std::vector<std::vector<DefectCandidate>> perTile(tileCount);
+    cv::parallel_for_(cv::Range(0, tileCount), [&](const cv::Range& range) {
+        for (int index = range.start; index < range.end; ++index) {
+            cv::Rect core;
+            const cv::Rect padded = paddedTile(index, core);
+            detectTile(gray(padded), padded, core, noise, perTile[index]);
+        }
+    });
+
+    for (const std::vector<DefectCandidate>& tileCandidates : perTile) {
+        result.insert(result.end(), tileCandidates.begin(), tileCandidates.end());
+    }
+    mergeTouching(result);
+    suppressOverlapping(result);
+    return result;
+}
@@ -0,0 +1,63 @@
+#ifndef DEFECTDETECTOR_H
+#define DEFECTDETECTOR_H
+
+#include <opencv2/opencv.hpp>
+#include <QString>
+#include <vector>
+
+// Классы индикаций
+enum class DefectType {
+    Pore,          // Пора
+    Inclusion,     // Включение
+    Crack,         // Трещина
+    LackOfFusion   // Несплавление
+};
+
+// Кандидат в индикацию
+struct DefectCandidate {
+    cv::Rect box;       // Ограничивающий прямоугольник в координатах изображения
+    DefectType type;
+    double score;       // Пиковый отклик в единицах СКО шума
+};
+
+// Параметры поиска
+struct DetectorParams {
+    int tileSize = 1024;           // Размер ядра тайла
+    int overlap = 0;               // Минимальное перекрытие тайлов; фактическое не меньше носителя ядер
+    double backgroundSigma = 24.0; // Масштаб фона (сварной шов, неравномерность экспозиции)
+    double threshold = 5.0;        // Порог отклика в единицах СКО шума
+    int minArea = 4;               // Минимальная площадь компоненты, пикс.
+    bool voidsBright = true;       // Дефекты с меньшей плотностью материала светлее фона
+};
+
+// Поиск кандидатов в индикации классическими операторами: нормализация фона,
+// многомасштабные DoG (округлые) и гессианные (линейные) фильтры, связные
+// компоненты. Изображение обрабатывается параллельно по тайлам с перекрытием
+class DefectDetector {
+public:
+    explicit DefectDetector(const DetectorParams& params = DetectorParams());
+
+    std::vector<DefectCandidate> detect(const cv::Mat& image) const;
+
+    static QString typeName(DefectType type);
+
+private:
+    // Каналы оценки шума: разность гауссиан на трех уровнях пирамиды,
+    // лапласиан на исходном и верхнем уровнях
+    static const int NoiseChannels = 5;
+    struct NoiseLevels {
+        float sigma[NoiseChannels] = { 1.0f, 1.0f, 1.0f, 1.0f, 1.0f };
+    };
+
+    // Перекрытие тайлов: не меньше носителя ядер фона и пирамиды
+    int overlap() const;
+    // Отклонение от фона и его пирамида
+    std::vector<cv::Mat> residualPyramid(const cv::Mat& tile) const;
+    void sampleNoise(const cv::Mat& tile, std::vector<float> (&samples)[NoiseChannels]) const;
+    void detectTile(const cv::Mat& tile, const cv::Rect& tileRect, const cv::Rect& core, const NoiseLevels& noise,
+        std::vector<DefectCandidate>& candidates) const;
+
+    DetectorParams params;
+};
+
+#endif // DEFECTDETECTOR_H
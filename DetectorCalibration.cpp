@@ -0,0 +1,246 @@
+#include "DetectorCalibration.h"
+#include "ImageProcessor.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QDebug>
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+    // Коррекция строки: насыщающее вычитание темнового кадра, умножение на
+    // коэффициент Q2.14 в 32-битной арифметике, округление и упаковка с насыщением
+    void correctRow(const ushort* src, const ushort* dark, const ushort* gain, ushort* dst, int count) {
+        const unsigned int rounding = 1u << (CalibrationSet::GainBits - 1);
+        int x = 0;
+#if CV_SIMD
+        const int lanes = cv::v_uint16::nlanes;
+        const cv::v_uint32 vRounding = cv::vx_setall_u32(rounding);
+        for (; x <= count - lanes; x += lanes) {
+            const cv::v_uint16 signal = cv::vx_load(src + x) - cv::vx_load(dark + x);
+            cv::v_uint32 low, high;
+            cv::v_mul_expand(signal, cv::vx_load(gain + x), low, high);
+            low = (low + vRounding) >> CalibrationSet::GainBits;
+            high = (high + vRounding) >> CalibrationSet::GainBits;
+            cv::v_store(dst + x, cv::v_pack(low, high));
+        }
+        cv::vx_cleanup();
+#endif
+        for (; x < count; ++x) {
+            const unsigned int signal = src[x] > dark[x] ? src[x] - dark[x] : 0u;
+            dst[x] = cv::saturate_cast<ushort>((signal * gain[x] + rounding) >> CalibrationSet::GainBits);
+        }
+    }
+
+    // Медиана и робастное СКО по выборке с шагом 4
+    void robustLevel(const cv::Mat& image, double& median, double& sigma) {
+        std::vector<ushort> samples;
+        for (int y = 0; y < image.rows; y += 4) {
+            const ushort* row = image.ptr<ushort>(y);
+            for (int x = 0; x < image.cols; x += 4) {
+                samples.push_back(row[x]);
+            }
+        }
+        auto middle = samples.begin() + samples.size() / 2;
+        std::nth_element(samples.begin(), middle, samples.end());
+        median = *middle;
+
+        std::vector<double> deviations(samples.size());
+        std::transform(samples.begin(), samples.end(), deviations.begin(), [median](ushort v) { return std::abs(v - median); });
+        auto deviationMiddle = deviations.begin() + deviations.size() / 2;
+        std::nth_element(deviations.begin(), deviationMiddle, deviations.end());
+        sigma = std::max(*deviationMiddle * 1.4826, 1.0);
+    }
+
+    QMutex registryMutex;
+    QString registryRoot;
+    QHash<QString, std::shared_ptr<const CalibrationSet>> registryCache;
+
+} // namespace
+
+std::shared_ptr<CalibrationSet> CalibrationSet::build(const cv::Mat& dark, const cv::Mat& flat, const cv::Mat& defects) {
+    if (dark.type() != CV_16UC1 || flat.type() != CV_16UC1 || dark.size() != flat.size()) {
+        throw std::runtime_error("Темновой и светлый кадры должны быть 16-битными и одного размера");
+    }
+    if (!defects.empty() && (defects.type() != CV_8UC1 || defects.size() != dark.size())) {
+        throw std::runtime_error("Маска дефектных пикселей не совпадает с кадрами по размеру");
+    }
+
+    auto calibration = std::make_shared<CalibrationSet>();
+    calibration->dark = dark.clone();
+
+    // Отклик пикселя и средний отклик по исправным пикселям
+    cv::Mat response;
+    cv::subtract(flat, dark, response, cv::noArray(), CV_32F);
+    const double meanResponse = cv::mean(response, response > 0)[0];
+
+    // Горячие пиксели: темновой сигнал выше медианы на 10 СКО
+    double darkMedian, darkSigma;
+    robustLevel(dark, darkMedian, darkSigma);
+    const float hotLevel = static_cast<float>(darkMedian + 10.0 * darkSigma);
+
+    // Коэффициенты усиления; пиксели с откликом вне [1/4; 4] от среднего считаются дефектными
+    const float maxGain = static_cast<float>((65535.0) / (1 << GainBits));
+    cv::Mat bad(dark.size(), CV_8UC1);
+    calibration->gain.create(dark.size(), CV_16UC1);
+    for (int y = 0; y < dark.rows; ++y) {
+        const float* r = response.ptr<float>(y);
+        const ushort* d = dark.ptr<ushort>(y);
+        const uchar* known = defects.empty() ? nullptr : defects.ptr<uchar>(y);
+        ushort* g = calibration->gain.ptr<ushort>(y);
+        uchar* b = bad.ptr<uchar>(y);
+        for (int x = 0; x < dark.cols; ++x) {
+            const float value = r[x] > 0.0f ? static_cast<float>(meanResponse) / r[x] : 0.0f;
+            b[x] = (value < 0.25f || value >= std::min(4.0f, maxGain) || d[x] > hotLevel || (known && known[x])) ? 1 : 0;
+            g[x] = b[x] ? 0 : cv::saturate_cast<ushort>(value * (1 << GainBits));
+        }
+    }
+
+    // Для каждого дефектного пикселя запоминаются исправные соседи: 3x3, при их отсутствии 5x5
+    for (int y = 0; y < bad.rows; ++y) {
+        for (int x = 0; x < bad.cols; ++x) {
+            if (!bad.at<uchar>(y, x)) {
+                continue;
+            }
+            BadPixel pixel{ y * bad.cols + x, 0, {} };
+            for (int radius = 1; radius <= 2 && pixel.count == 0; ++radius) {
+                for (int dy = -radius; dy <= radius && pixel.count < 8; ++dy) {
+                    for (int dx = -radius; dx <= radius && pixel.count < 8; ++dx) {
+                        const int nx = x + dx;
+                        const int ny = y + dy;
+                        if (nx >= 0 && ny >= 0 && nx < bad.cols && ny < bad.rows && !bad.at<uchar>(ny, nx)) {
+                            pixel.neighbors[pixel.count++] = ny * bad.cols + nx;
+                        }
+                    }
+                }
+            }
+            calibration->badPixels.push_back(pixel);
+        }
+    }
+
+    return calibration;
+}
+
+std::shared_ptr<CalibrationSet> CalibrationSet::loadDirectory(const QString& directory) {
+    QDir dir(directory);
+    QMap<QString, QString> ignored;
+    cv::Mat dark = ImageProcessor::readImageFromRawFile(dir.filePath("dark.raw").toStdString(), ignored);
+    cv::Mat flat = ImageProcessor::readImageFromRawFile(dir.filePath("flat.raw").toStdString(), ignored);
+
+    cv::Mat defects;
+    if (dir.exists("defects.png")) {
+        QImage mask(dir.filePath("defects.png"));
+        if (mask.isNull()) {
+            throw std::runtime_error("Не удалось открыть маску дефектных пикселей");
+        }
+        defects = ImageProcessor::QImageToCvMat(mask.convertToFormat(QImage::Format_Grayscale8));
+    }
+
+    return build(dark, flat, defects);
+}
+
+void CalibrationSet::apply(const cv::Mat& src, cv::Mat& dst) const {
+    if (src.type() != CV_16UC1 || src.size() != dark.size()) {
+        throw std::runtime_error("Калибровка не соответствует изображению");
+    }
+    dst.create(src.size(), CV_16UC1);
+
+    // Полосы строк обрабатываются параллельно
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range) {
+        for (int y = range.start; y < range.end; ++y) {
+            correctRow(src.ptr<ushort>(y), dark.ptr<ushort>(y), gain.ptr<ushort>(y), dst.ptr<ushort>(y), src.cols);
+        }
+    });
+
+    // Соседи дефектных пикселей исправны, поэтому замены независимы друг от друга
+    const int cols = dst.cols;
+    const int count = static_cast<int>(badPixels.size());
+    cv::parallel_for_(cv::Range(0, count), [&](const cv::Range& range) {
+        for (int i = range.start; i < range.end; ++i) {
+            const BadPixel& pixel = badPixels[i];
+            unsigned int sum = 0;
+            for (int n = 0; n < pixel.count; ++n) {
+                sum += dst.ptr<ushort>(pixel.neighbors[n] / cols)[pixel.neighbors[n] % cols];
+            }
+            dst.ptr<ushort>(pixel.index / cols)[pixel.index % cols] = pixel.count ? static_cast<ushort>(sum / pixel.count) : 0;
+        }
+    }, std::max(1.0, count / 65536.0));
+}
+
+namespace DetectorCalibration {
+
+    const QString DetectorIdTag = "Идентификатор детектора";
+    const QString CalibrationTag = "Калибровка детектора";
+
+    void setRoot(const QString& directory) {
+        QMutexLocker locker(&registryMutex);
+        registryRoot = directory;
+        registryCache.clear();
+    }
+
+    QString root() {
+        QMutexLocker locker(&registryMutex);
+        if (registryRoot.isEmpty()) {
+            registryRoot = QCoreApplication::applicationDirPath() + "/calibration";
+        }
+        return registryRoot;
+    }
+
+    std::shared_ptr<const CalibrationSet> find(const QString& detectorId) {
+        // Идентификатор используется как имя каталога
+        if (detectorId.contains('/') || detectorId.contains('\\') || detectorId.contains("..")) {
+            return nullptr;
+        }
+        const QString directory = QDir(root()).filePath(detectorId);
+        {
+            QMutexLocker locker(&registryMutex);
+            auto it = registryCache.constFind(detectorId);
+            if (it != registryCache.constEnd()) {
+                return it.value();
+            }
+        }
+
+        // Отсутствие калибровки тоже запоминается, чтобы не обращаться к диску на каждом кадре
+        std::shared_ptr<const CalibrationSet> calibration;
+        if (QFileInfo(directory).isDir()) {
+            try {
+                calibration = CalibrationSet::loadDirectory(directory);
+            }
+            catch (const std::exception& ex) {
+                qWarning() << "Не удалось загрузить калибровку детектора" << detectorId << ex.what();
+            }
+        }
+
+        QMutexLocker locker(&registryMutex);
+        registryCache.insert(detectorId, calibration);
+        return calibration;
+    }
+
+    void clearCache() {
+        QMutexLocker locker(&registryMutex);
+        registryCache.clear();
+    }
+
+    bool apply(cv::Mat& image, QMap<QString, QString>& tags) {
+        const QString detectorId = tags.value(DetectorIdTag).trimmed();
+        if (detectorId.isEmpty() || tags.contains(CalibrationTag) || image.type() != CV_16UC1) {
+            return false;
+        }
+
+        std::shared_ptr<const CalibrationSet> calibration = find(detectorId);
+        if (!calibration || calibration->size() != image.size()) {
+            return false;
+        }
+
+        calibration->apply(image, image);
+        tags.insert(CalibrationTag, QString("%1, дефектных пикселей: %2").arg(detectorId).arg(calibration->badPixelCount()));
+        return true;
+    }
+
+} // namespace DetectorCalibration
@@ -0,0 +1,68 @@
+#ifndef DETECTORCALIBRATION_H
+#define DETECTORCALIBRATION_H
+
+#include <QString>
+#include <QMap>
+#include <opencv2/opencv.hpp>
+#include <memory>
+#include <vector>
+
+// Калибровка плоскопанельного детектора: темновой кадр, коэффициенты
+// усиления в фиксированной точке и список дефектных пикселей с их соседями
+class CalibrationSet {
+public:
+    // Дробных разрядов коэффициента усиления (Q2.14, диапазон [0; 4))
+    static const int GainBits = 14;
+
+    // Построение по усредненным темновому (dark) и светлому (flat) кадрам CV_16UC1.
+    // defects - необязательная маска CV_8UC1 известных дефектных пикселей
+    static std::shared_ptr<CalibrationSet> build(const cv::Mat& dark, const cv::Mat& flat, const cv::Mat& defects = cv::Mat());
+
+    // Загрузка из каталога: dark.raw, flat.raw и необязательный defects.png.
+    // При ошибке выбрасывает std::runtime_error
+    static std::shared_ptr<CalibrationSet> loadDirectory(const QString& directory);
+
+    cv::Size size() const { return dark.size(); }
+    int badPixelCount() const { return static_cast<int>(badPixels.size()); }
+
+    // Коррекция кадра CV_16UC1: (src - dark) * gain с интерполяцией дефектных
+    // пикселей. dst может совпадать с src; если dst уже нужного размера и типа,
+    // память не выделяется (потоковая обработка кадров)
+    void apply(const cv::Mat& src, cv::Mat& dst) const;
+
+private:
+    // Дефектный пиксель заменяется средним исправных соседей
+    struct BadPixel {
+        int index;
+        int count;
+        int neighbors[8];
+    };
+
+    cv::Mat dark; // CV_16UC1
+    cv::Mat gain; // CV_16UC1, Q2.14
+    std::vector<BadPixel> badPixels;
+};
+
+// Реестр калибровок по идентификатору детектора из тегов снимка.
+// Калибровка детектора ID хранится в каталоге <root>/<ID>
+namespace DetectorCalibration {
+
+    // Тег идентификатора детектора и отметка о выполненной калибровке
+    extern const QString DetectorIdTag;
+    extern const QString CalibrationTag;
+
+    void setRoot(const QString& directory);
+    QString root();
+
+    // Калибровка детектора (загружается один раз); nullptr, если ее нет
+    std::shared_ptr<const CalibrationSet> find(const QString& detectorId);
+    void clearCache();
+
+    // Калибровка изображения по тегам на месте. Снимки с отметкой о калибровке
+    // и снимки без идентификатора детектора не изменяются.
+    // Возвращает true, если калибровка применена
+    bool apply(cv::Mat& image, QMap<QString, QString>& tags);
+
+} // namespace DetectorCalibration
+
+#endif // DETECTORCALIBRATION_H
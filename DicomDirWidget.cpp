@@ -0,0 +1,73 @@
+#include "DicomDirWidget.h"
+#include <QFileInfo>
+#include <QHeaderView>
+#include <QTreeWidget>
+#include <QVBoxLayout>
+
+DicomDirWidget::DicomDirWidget(QWidget* parent) : QWidget(parent) {
+    tree = new QTreeWidget(this);
+    tree->setColumnCount(2);
+    tree->setHeaderLabels(QStringList() << tr("Запись") << tr("Файл"));
+    tree->header()->setStretchLastSection(true);
+    tree->setUniformRowHeights(true); // Быстрая прокрутка дерева из тысяч снимков
+
+    connect(tree, &QTreeWidget::itemActivated, this, [this](QTreeWidgetItem* item) {
+        const QString fileName = item->data(0, Qt::UserRole).toString();
+        if (!fileName.isEmpty()) {
+            emit fileActivated(fileName);
+        }
+    });
+
+    QVBoxLayout* layout = new QVBoxLayout(this);
+    layout->setContentsMargins(0, 0, 0, 0);
+    layout->addWidget(tree);
+}
+
+void DicomDirWidget::setIndex(const DicomDirRecord& root) {
+    clear();
+    tree->setUpdatesEnabled(false);
+    addRecords(root, tree->invisibleRootItem());
+    tree->expandToDepth(1);
+    tree->setUpdatesEnabled(true);
+}
+
+void DicomDirWidget::clear() {
+    tree->clear();
+    files.clear();
+}
+
+void DicomDirWidget::addRecords(const DicomDirRecord& record, QTreeWidgetItem* parent) {
+    for (const DicomDirRecord& child : record.children) {
+        const QMap<QString, QString>& tags = child.tags;
+        QString text;
+        switch (child.level) {
+        case DicomDirLevel::Patient:
+            text = tr("%1 (%2)").arg(tags.value("Название объекта"), tags.value("ID объекта"));
+            break;
+        case DicomDirLevel::Study:
+            text = tr("Исследование %1 %2").arg(tags.value("Дата производства"), tags.value("Описание исследования"));
+            break;
+        case DicomDirLevel::Series:
+            text = tr("Серия %1 %2 %3").arg(tags.value("Номер серии"), tags.value("Модальность"), tags.value("Описание серии"));
+            break;
+        case DicomDirLevel::Image:
+            text = tr("Снимок %1").arg(tags.value("Номер снимка"));
+            break;
+        default:
+            text = tr("Прочая запись");
+            break;
+        }
+
+        QTreeWidgetItem* item = new QTreeWidgetItem(parent);
+        item->setText(0, text.simplified());
+        if (!child.fileName.isEmpty()) {
+            item->setText(1, QFileInfo(child.fileName).fileName());
+            item->setToolTip(1, child.fileName);
+            if (child.level == DicomDirLevel::Image) {
+                item->setData(0, Qt::UserRole, child.fileName);
+                files.append(child.fileName);
+            }
+        }
+        addRecords(child, item);
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef DICOMDIRWIDGET_H
+#define DICOMDIRWIDGET_H
+
+#include <QWidget>
+#include <QStringList>
+#include "DicomDirectory.h"
+
+class QTreeWidget;
+class QTreeWidgetItem;
+
+// Дерево носителя DICOMDIR: объект - исследование - серия - снимок.
+// Строится по индексу без открытия файлов снимков; двойной щелчок
+// по снимку открывает его
+class DicomDirWidget : public QWidget {
+    Q_OBJECT
+
+public:
+    explicit DicomDirWidget(QWidget* parent = nullptr);
+
+    void setIndex(const DicomDirRecord& root);
+    void clear();
+
+    // Файлы снимков в порядке дерева (для перехода к соседним снимкам)
+    QStringList imageFiles() const { return files; }
+
+signals:
+    void fileActivated(const QString& fileName);
+
+private:
+    void addRecords(const DicomDirRecord& record, QTreeWidgetItem* parent);
+
+    QTreeWidget* tree;
+    QStringList files;
+};
+
+#endif // DICOMDIRWIDGET_H
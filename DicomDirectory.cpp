@@ -0,0 +1,254 @@
+#include "DicomDirectory.h"
+#include "FileIntegrity.h"
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <algorithm>
+#include <stdexcept>
+#include "dcmtk/config/osconfig.h"
+#include <dcmtk/dcmdata/dcdicdir.h>
+#include <dcmtk/dcmdata/dcdirrec.h>
+#include <dcmtk/dcmdata/dcdeftag.h>
+#include <dcmtk/dcmdata/dcuid.h>
+
+namespace {
+
+    // Соответствие элементов записи тегам изображения
+    struct TagMapping {
+        DcmTagKey key;
+        const char* name;
+    };
+
+    const TagMapping PatientTags[] = {
+        { DCM_PatientName, "Название объекта" },
+        { DCM_PatientID, "ID объекта" },
+        { DCM_PatientBirthDate, "Дата рождения объекта" },
+        { DCM_PatientSex, "Пол объекта" },
+    };
+
+    const TagMapping StudyTags[] = {
+        { DCM_StudyInstanceUID, "UID исследования" },
+        { DCM_StudyDate, "Дата производства" },
+        { DCM_StudyDescription, "Описание исследования" },
+    };
+
+    const TagMapping SeriesTags[] = {
+        { DCM_SeriesInstanceUID, "UID серии" },
+        { DCM_SeriesNumber, "Номер серии" },
+        { DCM_Modality, "Модальность" },
+        { DCM_SeriesDescription, "Описание серии" },
+    };
+
+    const TagMapping ImageTags[] = {
+        { DCM_ReferencedSOPInstanceUIDInFile, "UID снимка" },
+        { DCM_InstanceNumber, "Номер снимка" },
+        { DCM_Rows, "Количество строк" },
+        { DCM_Columns, "Количество столбцов" },
+        { DCM_ReferencedTransferSyntaxUIDInFile, "Синтаксис передачи" },
+    };
+
+    // Компонент ReferencedFileID (PS3.10, 8.5): до 8 символов A-Z, 0-9 и _
+    const int MaxFileIdLength = 8;
+
+    bool isFileIdComponent(const QString& component) {
+        if (component.isEmpty() || component.size() > MaxFileIdLength) {
+            return false;
+        }
+        for (const QChar c : component) {
+            if (!((c >= u'A' && c <= u'Z') || (c >= u'0' && c <= u'9') || c == u'_')) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template <size_t N>
+    void readTags(DcmItem* record, const TagMapping(&mappings)[N], QMap<QString, QString>& tags) {
+        for (const TagMapping& mapping : mappings) {
+            OFString value;
+            if (record->findAndGetOFStringArray(mapping.key, value).good() && !value.empty()) {
+                tags.insert(mapping.name, value.c_str());
+            }
+        }
+    }
+
+    void readRecords(DcmDirectoryRecord& parent, const QDir& base, DicomDirRecord& target) {
+        DcmDirectoryRecord* record = nullptr;
+        while ((record = parent.nextSub(record)) != nullptr) {
+            DicomDirRecord child;
+            switch (record->getRecordType()) {
+            case ERT_Patient:
+                child.level = DicomDirLevel::Patient;
+                readTags(record, PatientTags, child.tags);
+                break;
+            case ERT_Study:
+                child.level = DicomDirLevel::Study;
+                readTags(record, StudyTags, child.tags);
+                break;
+            case ERT_Series:
+                child.level = DicomDirLevel::Series;
+                readTags(record, SeriesTags, child.tags);
+                break;
+            case ERT_Image:
+                child.level = DicomDirLevel::Image;
+                readTags(record, ImageTags, child.tags);
+                break;
+            default:
+                child.level = DicomDirLevel::Other;
+                break;
+            }
+
+            // Путь хранится компонентами через обратную косую черту относительно папки индекса
+            OFString fileId;
+            if (record->findAndGetOFStringArray(DCM_ReferencedFileID, fileId).good() && !fileId.empty()) {
+                child.fileName = QDir::cleanPath(base.filePath(QString(fileId.c_str()).replace('\\', '/')));
+            }
+            readRecords(*record, base, child);
+            target.children.push_back(std::move(child));
+        }
+    }
+
+    void collectImages(const DicomDirRecord& record, const QMap<QString, QString>& inherited, QList<DicomDirItem>& items) {
+        QMap<QString, QString> tags = inherited;
+        for (auto it = record.tags.cbegin(); it != record.tags.cend(); ++it) {
+            tags.insert(it.key(), it.value());
+        }
+        if (record.level == DicomDirLevel::Image && !record.fileName.isEmpty()) {
+            items.append(DicomDirItem{ record.fileName, tags });
+        }
+        for (const DicomDirRecord& child : record.children) {
+            collectImages(child, tags, items);
+        }
+    }
+
+    // Запись без ссылки на файл: DCMTK не открывает снимок, элементы заполняются из тегов
+    DcmDirectoryRecord* newRecord(E_DirRecType type) {
+        return new DcmDirectoryRecord(type, nullptr, OFFilename());
+    }
+
+    void putString(DcmItem* record, const DcmTagKey& key, const QString& value) {
+        record->putAndInsertString(key, value.toStdString().c_str());
+    }
+
+} // namespace
+
+namespace DicomDirectory {
+
+    bool isDicomDir(const QString& fileName) {
+        return QFileInfo(fileName).fileName().compare("DICOMDIR", Qt::CaseInsensitive) == 0;
+    }
+
+    DicomDirRecord read(const QString& fileName) {
+        if (!QFileInfo(fileName).isFile()) {
+            throw std::runtime_error("Файл DICOMDIR не найден");
+        }
+        DcmDicomDir dicomDir(OFFilename(QFile::encodeName(fileName).constData()));
+        if (dicomDir.error().bad()) {
+            throw std::runtime_error(std::string("Не удалось прочитать DICOMDIR: ") + dicomDir.error().text());
+        }
+
+        DicomDirRecord root;
+        readRecords(dicomDir.getRootRecord(), QFileInfo(fileName).absoluteDir(), root);
+        return root;
+    }
+
+    QList<DicomDirItem> images(const DicomDirRecord& root) {
+        QList<DicomDirItem> items;
+        collectImages(root, QMap<QString, QString>(), items);
+        return items;
+    }
+
+    QString fileId(const QString& name) {
+        // 48 бит SHA-1 имени: 4 шестнадцатеричные цифры - папка, 8 - файл
+        const QString hash = QString::fromLatin1(QCryptographicHash::hash(name.toUtf8(), QCryptographicHash::Sha1).toHex().toUpper());
+        return hash.left(4) + '/' + hash.mid(4, MaxFileIdLength);
+    }
+
+    bool write(const QString& fileName, const QList<DicomDirItem>& items) {
+        const QDir base = QFileInfo(fileName).absoluteDir();
+        const QString temporaryName = FileIntegrity::temporaryFileName(fileName);
+        OFCondition status;
+        {
+            DcmDicomDir dicomDir(OFFilename(QFile::encodeName(temporaryName).constData()), "NDTANALYZER");
+            DcmDirectoryRecord& root = dicomDir.getRootRecord();
+
+            // Записи верхних уровней создаются при первом снимке своей группы
+            QHash<QString, DcmDirectoryRecord*> patients;
+            QHash<QString, DcmDirectoryRecord*> studies;
+            QHash<QString, DcmDirectoryRecord*> series;
+            for (const DicomDirItem& item : items) {
+                const QString relative = base.relativeFilePath(QFileInfo(item.fileName).absoluteFilePath());
+                if (relative.startsWith("..")) {
+                    qWarning() << "Снимок вне папки DICOMDIR пропущен:" << item.fileName;
+                    continue;
+                }
+                const QStringList components = relative.split('/');
+                if (!std::all_of(components.cbegin(), components.cend(), isFileIdComponent)) {
+                    qWarning() << "Имя снимка недопустимо в DICOMDIR, снимок пропущен:" << item.fileName;
+                    continue;
+                }
+                const QMap<QString, QString>& tags = item.tags;
+
+                // Идентификатор объекта обязателен в записи PATIENT
+                const QString patientId = tags.value("ID объекта").isEmpty() ? QString("UNKNOWN") : tags.value("ID объекта");
+                DcmDirectoryRecord*& patient = patients[patientId];
+                if (!patient) {
+                    patient = newRecord(ERT_Patient);
+                    putString(patient, DCM_PatientName, tags.value("Название объекта"));
+                    putString(patient, DCM_PatientID, patientId);
+                    root.insertSub(patient);
+                }
+
+                const QString studyKey = patientId + '\n' + tags.value("UID исследования");
+                DcmDirectoryRecord*& study = studies[studyKey];
+                if (!study) {
+                    study = newRecord(ERT_Study);
+                    putString(study, DCM_StudyInstanceUID, tags.value("UID исследования"));
+                    putString(study, DCM_StudyDate, tags.value("Дата производства"));
+                    putString(study, DCM_StudyTime, QString());
+                    putString(study, DCM_StudyDescription, tags.value("Описание исследования"));
+                    putString(study, DCM_StudyID, QString());
+                    putString(study, DCM_AccessionNumber, QString());
+                    patient->insertSub(study);
+                }
+
+                const QString seriesKey = studyKey + '\n' + tags.value("UID серии");
+                DcmDirectoryRecord*& seriesRecord = series[seriesKey];
+                if (!seriesRecord) {
+                    seriesRecord = newRecord(ERT_Series);
+                    putString(seriesRecord, DCM_Modality, tags.value("Модальность").isEmpty() ? QString("OT") : tags.value("Модальность"));
+                    putString(seriesRecord, DCM_SeriesInstanceUID, tags.value("UID серии"));
+                    putString(seriesRecord, DCM_SeriesNumber, tags.value("Номер серии", "1"));
+                    if (tags.contains("Описание серии")) {
+                        putString(seriesRecord, DCM_SeriesDescription, tags.value("Описание серии"));
+                    }
+                    study->insertSub(seriesRecord);
+                }
+
+                DcmDirectoryRecord* image = newRecord(ERT_Image);
+                putString(image, DCM_ReferencedFileID, QString(relative).replace('/', '\\'));
+                image->putAndInsertString(DCM_ReferencedSOPClassUIDInFile, UID_SecondaryCaptureImageStorage);
+                putString(image, DCM_ReferencedSOPInstanceUIDInFile, tags.value("UID снимка"));
+                putString(image, DCM_ReferencedTransferSyntaxUIDInFile, tags.value("Синтаксис передачи", UID_LittleEndianExplicitTransferSyntax));
+                putString(image, DCM_InstanceNumber, tags.value("Номер снимка", "1"));
+                if (tags.contains("Количество строк") && tags.contains("Количество столбцов")) {
+                    image->putAndInsertUint16(DCM_Rows, tags.value("Количество строк").toUShort());
+                    image->putAndInsertUint16(DCM_Columns, tags.value("Количество столбцов").toUShort());
+                }
+                seriesRecord->insertSub(image);
+            }
+
+            status = dicomDir.write(EXS_LittleEndianExplicit, EET_UndefinedLength, EGL_withoutGL);
+        }
+        if (status.bad()) {
+            qWarning() << "Не удалось записать DICOMDIR:" << status.text();
+            QFile::remove(temporaryName);
+            return false;
+        }
+        return FileIntegrity::commitFile(temporaryName, fileName);
+    }
+
+} // namespace DicomDirectory
@@ -0,0 +1,62 @@
+#ifndef DICOMDIRECTORY_H
+#define DICOMDIRECTORY_H
+
+#include <QList>
+#include <QMap>
+#include <QString>
+#include <vector>
+
+// Уровень записи DICOMDIR
+enum class DicomDirLevel {
+    Root,
+    Patient,
+    Study,
+    Series,
+    Image,
+    Other
+};
+
+// Запись иерархии DICOMDIR с тегами своего уровня
+// (ключи - как у DicomProcessor::extractAllTags)
+struct DicomDirRecord {
+    DicomDirLevel level = DicomDirLevel::Root;
+    QMap<QString, QString> tags;
+    QString fileName; // Абсолютный путь файла, на который ссылается запись
+    std::vector<DicomDirRecord> children;
+};
+
+// Снимок индекса: файл и теги всех уровней иерархии
+struct DicomDirItem {
+    QString fileName;
+    QMap<QString, QString> tags;
+};
+
+// Индекс носителя DICOM (DICOMDIR): иерархия объект - исследование -
+// серия - снимок читается из одного файла без открытия самих снимков,
+// а записывается по тегам, уже извлеченным при конвертации
+namespace DicomDirectory {
+
+    // Имя файла индекса (DICOMDIR без расширения, регистр не важен)
+    bool isDicomDir(const QString& fileName);
+
+    // Чтение индекса; при ошибке выбрасывает std::runtime_error
+    DicomDirRecord read(const QString& fileName);
+
+    // Снимки иерархии в порядке обхода; теги снимка дополнены тегами
+    // объекта, исследования и серии
+    QList<DicomDirItem> images(const DicomDirRecord& root);
+
+    // Относительный путь снимка, допустимый в ReferencedFileID (компоненты до
+    // 8 символов A-Z, 0-9, _): папка и файл из хеша имени name, например "3F2A/9C01B7E4"
+    QString fileId(const QString& name);
+
+    // Запись индекса fileName по снимкам items, лежащим в его папке или вложенных.
+    // Файлы снимков не читаются: UID берутся из тегов (DicomProcessor::assignInstanceUids),
+    // синтаксис передачи - из тега "Синтаксис передачи" (по умолчанию Explicit VR
+    // Little Endian). Снимки записаны saveDicom как Secondary Capture; снимки,
+    // путь к которым не состоит из имен fileId, пропускаются
+    bool write(const QString& fileName, const QList<DicomDirItem>& items);
+
+} // namespace DicomDirectory
+
+#endif // DICOMDIRECTORY_H
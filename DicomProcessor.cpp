@@ -1,5 +1,8 @@
 #include "DicomProcessor.h"
-#include <QMessageBox>
+#include "AnnotationStore.h"
+#include "Packed12.h"
+#include <QDebug>
+#include <QFile>
 #include "dcmtk/config/osconfig.h"
 #include "dcmtk/dcmimgle/dcmimage.h"   // for DcmImage
 #include "dcmtk/dcmdata/dctk.h"        // for DcmFileFormat
@@ -13,14 +16,19 @@
 #include <dcmtk/dcmdata/dcmetinf.h>
 #include <dcmtk/dcmimgle/dcmimage.h>
 #include <dcmtk/dcmdata/dcistrma.h>
+#include <dcmtk/dcmdata/dcrledrg.h>
+#include <dcmtk/dcmdata/dcrleerg.h>
+#include <mutex>
 #include <opencv2/opencv.hpp>
 
 DicomProcessor::DicomProcessor() {}
 
 DicomProcessor::~DicomProcessor() {}
 
-unsigned short width, height, bitsAllocated, bitsStored, highBit;
-OFString photometricInterpretation;
+// Параметры текущего файла; свои в каждом потоке, так как файлы
+// могут декодироваться фоновой предзагрузкой параллельно с основным потоком
+thread_local unsigned short width, height, bitsAllocated, bitsStored, highBit;
+thread_local OFString photometricInterpretation;
 
 // Определения тегов
 const DcmTagKey DCM_XRaySource = DcmTagKey(0x0018, 0x7040);
@@ -32,12 +40,128 @@ const DcmTagKey DCM_InspectionDate = DcmTagKey(0x0018, 0x9121);
 const DcmTagKey DCM_InspectionTime = DcmTagKey(0x0018, 0x9122);
 const DcmTagKey DCM_InspectionLocation = DcmTagKey(0x0018, 0x9123);
 
+// Частные теги NDTAnalyzer: блок 0x10 группы 0009 и CRC32C пиксельных данных в нем
+const char* const NDTPrivateCreator = "NDTANALYZER";
+const DcmTagKey DCM_NDTPrivateCreator = DcmTagKey(0x0009, 0x0010);
+const DcmTagKey DCM_NDTPixelChecksum = DcmTagKey(0x0009, 0x1010);
+// Последовательность аннотаций и элементы ее записей
+const DcmTagKey DCM_NDTAnnotationSequence = DcmTagKey(0x0009, 0x1020);
+const DcmTagKey DCM_NDTAnnotationKind = DcmTagKey(0x0009, 0x1021);
+const DcmTagKey DCM_NDTAnnotationGeometry = DcmTagKey(0x0009, 0x1022);
+const DcmTagKey DCM_NDTAnnotationText = DcmTagKey(0x0009, 0x1023);
+const DcmTagKey DCM_NDTAnnotationScore = DcmTagKey(0x0009, 0x1024);
+const DcmTagKey DCM_NDTAnnotationCategory = DcmTagKey(0x0009, 0x1025);
+const DcmTagKey DCM_NDTAnnotationOrigin = DcmTagKey(0x0009, 0x1026);
+// Отметка о калибровке детектора, выполненной при загрузке исходного снимка
+const DcmTagKey DCM_NDTCalibration = DcmTagKey(0x0009, 0x1030);
+// Имя исходного файла пакетной конвертации
+const DcmTagKey DCM_NDTSourceFile = DcmTagKey(0x0009, 0x1031);
+
+namespace {
+
+    // Кодек RLE Lossless входит в dcmdata; регистрация нужна один раз на процесс
+    void registerCodecs() {
+        static std::once_flag registered;
+        std::call_once(registered, []() {
+            DcmRLEDecoderRegistration::registerCodecs();
+            DcmRLEEncoderRegistration::registerCodecs();
+        });
+    }
+
+    // Запись аннотаций в частную последовательность: рамка хранится как
+    // x, y, ширина, высота, отрезок измерения - как x1, y1, x2, y2
+    void writeAnnotations(DcmDataset* dataset, const QString& json) {
+        AnnotationStore store;
+        if (!store.fromJson(json) || store.isEmpty()) {
+            return;
+        }
+        DcmSequenceOfItems* sequence = new DcmSequenceOfItems(DcmTag(DCM_NDTAnnotationSequence, EVR_SQ));
+        for (const Annotation& annotation : store.all()) {
+            DcmItem* item = new DcmItem();
+            double geometry[4];
+            const char* kind;
+            if (annotation.kind == AnnotationKind::Measurement) {
+                kind = "MEASUREMENT";
+                geometry[0] = annotation.line.x1();
+                geometry[1] = annotation.line.y1();
+                geometry[2] = annotation.line.x2();
+                geometry[3] = annotation.line.y2();
+            }
+            else {
+                kind = annotation.kind == AnnotationKind::Defect ? "DEFECT" : "COMMENT";
+                geometry[0] = annotation.rect.x();
+                geometry[1] = annotation.rect.y();
+                geometry[2] = annotation.rect.width();
+                geometry[3] = annotation.rect.height();
+            }
+            item->putAndInsertString(DcmTag(DCM_NDTAnnotationKind, EVR_CS), kind);
+            // Четыре значения одного элемента FD: putAndInsertFloat64 с позицией
+            // заменил бы элемент целиком, оставив только последнее значение
+            DcmFloatingPointDouble* geometryElement = new DcmFloatingPointDouble(DcmTag(DCM_NDTAnnotationGeometry, EVR_FD));
+            geometryElement->putFloat64Array(geometry, 4);
+            item->insert(geometryElement, true);
+            if (!annotation.text.isEmpty()) {
+                item->putAndInsertString(DcmTag(DCM_NDTAnnotationText, EVR_LT), annotation.text.toStdString().c_str());
+            }
+            if (annotation.score != 0.0) {
+                item->putAndInsertFloat64(DcmTag(DCM_NDTAnnotationScore, EVR_FD), annotation.score);
+            }
+            if (annotation.category >= 0) {
+                item->putAndInsertSint16(DcmTag(DCM_NDTAnnotationCategory, EVR_SS), static_cast<Sint16>(annotation.category));
+            }
+            item->putAndInsertString(DcmTag(DCM_NDTAnnotationOrigin, EVR_CS), annotation.detected ? "AUTO" : "MANUAL");
+            sequence->append(item);
+        }
+        dataset->insert(sequence, true);
+    }
+
+    // Чтение частной последовательности обратно в JSON тега аннотаций
+    QString readAnnotations(DcmDataset* dataset) {
+        DcmSequenceOfItems* sequence = nullptr;
+        if (dataset->findAndGetSequence(DCM_NDTAnnotationSequence, sequence).bad() || !sequence) {
+            return QString();
+        }
+        AnnotationStore store;
+        for (unsigned long i = 0; i < sequence->card(); ++i) {
+            DcmItem* item = sequence->getItem(i);
+            OFString kind, origin, text;
+            item->findAndGetOFString(DCM_NDTAnnotationKind, kind);
+            double geometry[4] = {};
+            for (unsigned long k = 0; k < 4; ++k) {
+                item->findAndGetFloat64(DCM_NDTAnnotationGeometry, geometry[k], k);
+            }
+
+            Annotation annotation;
+            if (kind == "MEASUREMENT") {
+                annotation.kind = AnnotationKind::Measurement;
+                annotation.line = QLineF(geometry[0], geometry[1], geometry[2], geometry[3]);
+            }
+            else {
+                annotation.kind = kind == "DEFECT" ? AnnotationKind::Defect : AnnotationKind::Comment;
+                annotation.rect = QRectF(geometry[0], geometry[1], geometry[2], geometry[3]);
+            }
+            if (item->findAndGetOFStringArray(DCM_NDTAnnotationText, text).good()) {
+                annotation.text = QString::fromStdString(text.c_str());
+            }
+            item->findAndGetFloat64(DCM_NDTAnnotationScore, annotation.score);
+            Sint16 category = -1;
+            item->findAndGetSint16(DCM_NDTAnnotationCategory, category);
+            annotation.category = category;
+            annotation.detected = item->findAndGetOFString(DCM_NDTAnnotationOrigin, origin).good() && origin == "AUTO";
+            store.add(annotation);
+        }
+        return store.toJson();
+    }
+
+} // namespace
+
 QImage DicomProcessor::processMonochromeDicom(const QString& fileName) {
     QImage qImage;
     std::unique_ptr<DicomImage> dicomImage(new DicomImage(fileName.toStdString().c_str(), CIF_MayDetachPixelData));
 
     if (dicomImage && dicomImage->getStatus() == EIS_Normal) {
-        if (bitsAllocated == 16 && bitsStored <= 12) {
+        // 16-битные данные читаются без потери разрядности и растягиваются на 16 бит
+        if (bitsAllocated == 16 && bitsStored <= 16) {
             unsigned short* pixelData16 = (unsigned short*)(dicomImage->getOutputData(16));
             if (pixelData16) {
                 QImage qImage16(width, height, QImage::Format_Grayscale16);
@@ -58,7 +182,8 @@ QImage DicomProcessor::processMonochromeDicom(const QString& fileName) {
         }
     }
     else {
-        QMessageBox::warning(nullptr, QObject::tr("Ошибка"), QObject::tr("Не удалось обработать DICOM изображение"));
+        // Пустое изображение обрабатывает вызывающий код: функция может выполняться вне GUI потока
+        qWarning() << "Не удалось обработать DICOM изображение" << fileName;
     }
 
     return qImage;
@@ -146,7 +271,7 @@ QImage DicomProcessor::processColorDicom(const QString& fileName) {
 
     }
     else {
-        QMessageBox::warning(nullptr, QObject::tr("Ошибка"), QObject::tr("Не удалось обработать цветное DICOM изображение"));
+        qWarning() << "Не удалось обработать цветное DICOM изображение" << fileName;
     }
     qImage = qImage.convertToFormat(QImage::Format_Grayscale8);
     return qImage;
@@ -193,6 +318,20 @@ QMap<QString, QString> DicomProcessor::extractAllTags(DcmDataset* dataset) {
     tags.insert("Рентгеновский источник", xRaySource.c_str());
     dataset->findAndGetOFString(DCM_DetectorType, detectorType);
     tags.insert("Тип детектора", detectorType.c_str());
+    if (dataset->findAndGetOFString(DCM_DetectorID, value).good()) {
+        tags.insert("Идентификатор детектора", value.c_str());
+    }
+    // Отметка о калибровке, выполненной при загрузке исходного снимка. Читается
+    // только из блока NDTANALYZER: элементы 0009,10xx других производителей
+    // имеют свой смысл
+    OFString creator;
+    const bool ownBlock = dataset->findAndGetOFString(DCM_NDTPrivateCreator, creator).good() && creator == NDTPrivateCreator;
+    if (ownBlock && dataset->findAndGetOFStringArray(DCM_NDTCalibration, value).good()) {
+        tags.insert("Калибровка детектора", value.c_str());
+    }
+    if (ownBlock && dataset->findAndGetOFStringArray(DCM_NDTSourceFile, value).good()) {
+        tags.insert("Исходный файл", QString::fromUtf8(value.c_str()));
+    }
 
     Uint16 kV, mA, exposureTime;
     dataset->findAndGetUint16(DCM_KVP, kV);
@@ -237,10 +376,67 @@ QMap<QString, QString> DicomProcessor::extractAllTags(DcmDataset* dataset) {
     dataset->findAndGetOFString(DCM_PhotometricInterpretation, photometricInterpretation);
     tags.insert("Фотометрическая интерпретация", photometricInterpretation.c_str());
 
+    // Идентификаторы исследования, серии и снимка
+    if (dataset->findAndGetOFString(DCM_StudyInstanceUID, value).good()) {
+        tags.insert("UID исследования", value.c_str());
+    }
+    if (dataset->findAndGetOFString(DCM_SeriesInstanceUID, value).good()) {
+        tags.insert("UID серии", value.c_str());
+    }
+    if (dataset->findAndGetOFString(DCM_SOPInstanceUID, value).good()) {
+        tags.insert("UID снимка", value.c_str());
+    }
+    if (dataset->findAndGetOFString(DCM_SeriesNumber, value).good()) {
+        tags.insert("Номер серии", value.c_str());
+    }
+    if (dataset->findAndGetOFString(DCM_InstanceNumber, value).good()) {
+        tags.insert("Номер снимка", value.c_str());
+    }
+
+    // Размер пикселя "между строками\между столбцами", мм
+    if (dataset->findAndGetOFStringArray(DCM_PixelSpacing, value).good()) {
+        tags.insert("Размер пикселя (мм)", value.c_str());
+    }
+
+    // Окно отображения, рекомендованное при съемке (первое из значений)
+    Float64 windowCenter, windowWidth;
+    if (dataset->findAndGetFloat64(DCM_WindowCenter, windowCenter).good() &&
+        dataset->findAndGetFloat64(DCM_WindowWidth, windowWidth).good()) {
+        tags.insert("Центр окна", QString::number(windowCenter));
+        tags.insert("Ширина окна", QString::number(windowWidth));
+    }
+
+    // Аннотации NDTAnalyzer из частной последовательности
+    const QString annotations = readAnnotations(dataset);
+    if (!annotations.isEmpty()) {
+        tags.insert(AnnotationStore::TagKey, annotations);
+    }
+
     return tags;
 }
 
+const char* const DicomProcessor::AssignedInstanceUidKey = "_assignedInstanceUid";
+
+void DicomProcessor::assignInstanceUids(QMap<QString, QString>& tags) {
+    char uid[100];
+    if (tags.value("UID исследования").isEmpty()) {
+        tags.insert("UID исследования", dcmGenerateUniqueIdentifier(uid, SITE_STUDY_UID_ROOT));
+    }
+    if (tags.value("UID серии").isEmpty()) {
+        tags.insert("UID серии", dcmGenerateUniqueIdentifier(uid, SITE_SERIES_UID_ROOT));
+    }
+    tags.insert("UID снимка", dcmGenerateUniqueIdentifier(uid, SITE_INSTANCE_UID_ROOT));
+    tags.insert(AssignedInstanceUidKey, tags.value("UID снимка"));
+    if (tags.value("Номер серии").isEmpty()) {
+        tags.insert("Номер серии", "1");
+    }
+    if (tags.value("Номер снимка").isEmpty()) {
+        tags.insert("Номер снимка", "1");
+    }
+}
+
 QImage DicomProcessor::processDicom(const QString& fileName, QString& infoMsg) {
+    registerCodecs();
     DcmFileFormat fileFormat;
 
     OFCondition status = fileFormat.loadFile(fileName.toStdString().c_str());
@@ -278,7 +474,7 @@ QImage DicomProcessor::processDicom(const QString& fileName, QString& infoMsg) {
     return qImage;
 }
 
-bool DicomProcessor::saveDicom(const cv::Mat& image, const QString& fileName, const QMap<QString, QString>& tags) {
+bool DicomProcessor::saveDicom(const cv::Mat& image, const QString& fileName, const QMap<QString, QString>& tags, bool compressed) {
     DcmFileFormat fileFormat;
     DcmDataset* dataset = fileFormat.getDataset();
 
@@ -299,6 +495,32 @@ bool DicomProcessor::saveDicom(const cv::Mat& image, const QString& fileName, co
     dataset->putAndInsertString(DCM_PatientSex, tags["Пол объекта"].toStdString().c_str());
     dataset->putAndInsertString(DCM_XRaySource, tags["Рентгеновский источник"].toStdString().c_str());
     dataset->putAndInsertString(DCM_DetectorType, tags["Тип детектора"].toStdString().c_str());
+    if (tags.contains("Идентификатор детектора")) {
+        dataset->putAndInsertString(DCM_DetectorID, tags["Идентификатор детектора"].toStdString().c_str());
+    }
+    if (tags.contains("Размер пикселя (мм)")) {
+        dataset->putAndInsertString(DCM_PixelSpacing, tags["Размер пикселя (мм)"].toStdString().c_str());
+    }
+    if (tags.contains("Калибровка детектора")) {
+        dataset->putAndInsertString(DcmTag(DCM_NDTCalibration, EVR_LO), tags["Калибровка детектора"].toStdString().c_str());
+    }
+    if (tags.contains("Исходный файл")) {
+        dataset->putAndInsertString(DcmTag(DCM_NDTSourceFile, EVR_LO), tags["Исходный файл"].toStdString().c_str());
+    }
+    // Исследование и серия - из тегов исходного файла, иначе новые. Сохраненный
+    // или производный снимок - новый экземпляр с новым UID; без изменений
+    // записывается только UID, назначенный заранее (пакетная конвертация с DICOMDIR)
+    QMap<QString, QString> identifiers = tags;
+    const QString assignedUid = tags.value(AssignedInstanceUidKey);
+    assignInstanceUids(identifiers);
+    if (!assignedUid.isEmpty()) {
+        identifiers.insert("UID снимка", assignedUid);
+    }
+    dataset->putAndInsertString(DCM_StudyInstanceUID, identifiers["UID исследования"].toStdString().c_str());
+    dataset->putAndInsertString(DCM_SeriesInstanceUID, identifiers["UID серии"].toStdString().c_str());
+    dataset->putAndInsertString(DCM_SOPInstanceUID, identifiers["UID снимка"].toStdString().c_str());
+    dataset->putAndInsertString(DCM_SeriesNumber, identifiers["Номер серии"].toStdString().c_str());
+    dataset->putAndInsertString(DCM_InstanceNumber, identifiers["Номер снимка"].toStdString().c_str());
     dataset->putAndInsertUint16(DCM_KVP, tags["Напряжение (кВ)"].toInt());
     dataset->putAndInsertUint16(DCM_ExposureTime, tags["Время экспозиции (мс)"].toInt());
     dataset->putAndInsertString(DCM_ObjectDiameter, tags["Диаметр объекта (мм)"].toStdString().c_str());
@@ -317,23 +539,126 @@ bool DicomProcessor::saveDicom(const cv::Mat& image, const QString& fileName, co
     dataset->putAndInsertUint16(DCM_HighBit, tags["Старший бит"].toInt());
     dataset->putAndInsertString(DCM_PhotometricInterpretation, tags["Фотометрическая интерпретация"].toStdString().c_str());
 
+    // 12-битные данные, растянутые при загрузке на 16 бит (младшие 4 бита
+    // нулевые), возвращаются к исходному диапазону и записываются с BitsStored = 12;
+    // processMonochromeDicom снова растягивает их при чтении. Значения меньше 4096
+    // без сдвига (.raw, TIFF) записываются как есть с BitsStored = 16, иначе
+    // при чтении они были бы умножены на 16
+    cv::Mat pixels = image;
+    unsigned short storedBits = static_cast<unsigned short>(image.elemSize1() * 8);
+    if (Packed12::losslessShift(image) == 4) {
+        storedBits = 12;
+        image.convertTo(pixels, CV_16U, 1.0 / 16);
+    }
+    if (!pixels.isContinuous()) {
+        pixels = pixels.clone();
+    }
+
     // Установка размера изображения
     dataset->putAndInsertUint16(DCM_Rows, image.rows);
     dataset->putAndInsertUint16(DCM_Columns, image.cols);
     dataset->putAndInsertUint16(DCM_BitsAllocated, image.elemSize1() * 8); // Установка BitsAllocated в зависимости от размера элемента
-    dataset->putAndInsertUint16(DCM_BitsStored, image.elemSize1() * 8); // Установка BitsStored в зависимости от размера элемента
-    dataset->putAndInsertUint16(DCM_HighBit, (image.elemSize1() * 8) - 1); // Установка HighBit
+    dataset->putAndInsertUint16(DCM_BitsStored, storedBits);
+    dataset->putAndInsertUint16(DCM_HighBit, storedBits - 1); // Установка HighBit
     dataset->putAndInsertUint16(DCM_PixelRepresentation, 0); // 0 для unsigned данных
 
-    // Установка данных пикселей
-    dataset->putAndInsertUint16Array(DCM_PixelData, (Uint16*)image.data, image.total() * image.channels());
-
-    // Сохранение файла
-    OFCondition status = fileFormat.saveFile(fileName.toStdString().c_str(), EXS_LittleEndianExplicit);
-    if (status.good()) {
-        return true;
+    // Установка данных пикселей: 8-битные записываются побайтно (OB), остальные - словами
+    const unsigned long pixelCount = static_cast<unsigned long>(pixels.total() * pixels.channels());
+    if (pixels.depth() == CV_8U) {
+        dataset->putAndInsertUint8Array(DCM_PixelData, pixels.data, pixelCount);
     }
     else {
+        dataset->putAndInsertUint16Array(DCM_PixelData, (Uint16*)pixels.data, pixelCount);
+    }
+
+    // Контрольная сумма несжатых пиксельных данных в частном теге
+    dataset->putAndInsertString(DcmTag(DCM_NDTPrivateCreator, EVR_LO), NDTPrivateCreator);
+    dataset->putAndInsertUint32(DcmTag(DCM_NDTPixelChecksum, EVR_UL),
+        FileIntegrity::crc32c(0, pixels.data, pixelCount * pixels.elemSize1()));
+    writeAnnotations(dataset, tags.value(AnnotationStore::TagKey));
+
+    // Сжатие без потерь RLE: пиксельные данные кодируются перед записью
+    E_TransferSyntax transferSyntax = EXS_LittleEndianExplicit;
+    if (compressed) {
+        registerCodecs();
+        transferSyntax = EXS_RLELossless;
+        if (dataset->chooseRepresentation(transferSyntax, nullptr).bad() || !dataset->canWriteXfer(transferSyntax)) {
+            qWarning() << "Не удалось сжать пиксельные данные DICOM" << fileName;
+            return false;
+        }
+    }
+
+    // Запись во временный файл и атомарная замена: при ошибке записи
+    // прежний файл остается нетронутым
+    const QString temporaryName = FileIntegrity::temporaryFileName(fileName);
+    OFCondition status = fileFormat.saveFile(temporaryName.toStdString().c_str(), transferSyntax);
+    if (status.bad()) {
+        qWarning() << "Не удалось сохранить DICOM файл:" << status.text();
+        QFile::remove(temporaryName);
         return false;
     }
+    return FileIntegrity::commitFile(temporaryName, fileName);
+}
+
+FileIntegrity::VerifyResult DicomProcessor::verifyChecksum(const QString& fileName) {
+    FileIntegrity::VerifyResult result;
+    result.fileName = fileName;
+
+    DcmFileFormat fileFormat;
+    OFCondition status = fileFormat.loadFile(fileName.toStdString().c_str());
+    if (status.bad()) {
+        result.status = FileIntegrity::VerifyResult::Unreadable;
+        result.message = QString::fromLatin1(status.text());
+        return result;
+    }
+    DcmDataset* dataset = fileFormat.getDataset();
+
+    Uint32 stored = 0;
+    if (dataset->findAndGetUint32(DCM_NDTPixelChecksum, stored).bad()) {
+        result.status = FileIntegrity::VerifyResult::Unprotected;
+        return result;
+    }
+
+    // Сумма записана по несжатым данным: сжатый файл сначала распаковывается
+    if (DcmXfer(dataset->getOriginalXfer()).isEncapsulated()) {
+        registerCodecs();
+        status = dataset->chooseRepresentation(EXS_LittleEndianExplicit, nullptr);
+        if (status.bad()) {
+            result.status = FileIntegrity::VerifyResult::Unreadable;
+            result.message = QString::fromLatin1(status.text());
+            return result;
+        }
+    }
+
+    Uint16 allocated = 16;
+    dataset->findAndGetUint16(DCM_BitsAllocated, allocated);
+    const void* pixels = nullptr;
+    unsigned long count = 0;
+    size_t bytesPerValue = sizeof(Uint16);
+    if (allocated == 8) {
+        const Uint8* bytes = nullptr;
+        status = dataset->findAndGetUint8Array(DCM_PixelData, bytes, &count);
+        pixels = bytes;
+        bytesPerValue = sizeof(Uint8);
+    }
+    else {
+        const Uint16* words = nullptr;
+        status = dataset->findAndGetUint16Array(DCM_PixelData, words, &count);
+        pixels = words;
+    }
+    if (status.bad() || !pixels) {
+        result.status = FileIntegrity::VerifyResult::Corrupted;
+        result.message = QObject::tr("Нет пиксельных данных");
+        return result;
+    }
+
+    const uint32_t actual = FileIntegrity::crc32c(0, pixels, count * bytesPerValue);
+    if (actual != stored) {
+        result.status = FileIntegrity::VerifyResult::Corrupted;
+        result.message = QObject::tr("Контрольная сумма не совпадает: записана %1, вычислена %2")
+            .arg(FileIntegrity::checksumText(stored), FileIntegrity::checksumText(actual));
+        return result;
+    }
+    result.status = FileIntegrity::VerifyResult::Valid;
+    return result;
 }
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include <QMap>
 #include <opencv2/opencv.hpp>
 #include <dcmtk/dcmdata/dctk.h>
+#include "FileIntegrity.h"
 
 class DicomProcessor {
 public:
@@ -15,8 +16,21 @@ public:
     static QImage processMonochromeDicom(const QString& fileName);
     static QImage processColorDicom(const QString& fileName);
     static QImage invertImageColors(const QImage& image);
-    static bool saveDicom(const cv::Mat& image, const QString& fileName, const QMap<QString, QString>& tags);
+    // compressed - запись со сжатием без потерь RLE Lossless вместо несжатого Explicit VR Little Endian
+    static bool saveDicom(const cv::Mat& image, const QString& fileName, const QMap<QString, QString>& tags, bool compressed = false);
     static QMap<QString, QString> extractAllTags(DcmDataset* dataset);
+
+    // Ключ UID снимка, назначенного assignInstanceUids; saveDicom записывает его
+    // без изменений. В теги изображения и файла не попадает
+    static const char* const AssignedInstanceUidKey;
+
+    // Недостающие UID исследования и серии, номера серии и снимка и новый UID снимка
+    // (также под ключом AssignedInstanceUidKey). Назначаются до записи, чтобы файл
+    // и индекс DICOMDIR строились по одним тегам
+    static void assignInstanceUids(QMap<QString, QString>& tags);
+
+    // Проверка CRC32C пиксельных данных по частному тегу, записанному saveDicom
+    static FileIntegrity::VerifyResult verifyChecksum(const QString& fileName);
 };
 
 #endif // DICOMPROCESSOR_H
\ No newline at end of file
@@ -0,0 +1,275 @@
+#include "EditHistory.h"
+#include <QObject>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+    qint64 byteSize(const cv::Size& size, int type) {
+        return static_cast<qint64>(size.area()) * CV_ELEM_SIZE(type);
+    }
+
+    bool sameContent(const cv::Mat& a, const cv::Mat& b) {
+        if (a.size() != b.size() || a.type() != b.type()) {
+            return false;
+        }
+        const size_t rowBytes = a.cols * a.elemSize();
+        for (int y = 0; y < a.rows; ++y) {
+            if (std::memcmp(a.ptr(y), b.ptr(y), rowBytes) != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+} // namespace
+
+EditHistory::EditHistory(qint64 memoryLimitBytes)
+    : current(-1), limit(memoryLimitBytes), inMemory(0), spilled(0), clock(0), nextImageId(0) {}
+
+void EditHistory::clear() {
+    versions.clear();
+    tiles.clear();
+    current = -1;
+    inMemory = 0;
+    spilled = 0;
+    spillFile.reset();
+}
+
+EditHistory::TilePtr EditHistory::makeTile(const cv::Mat& data) {
+    TilePtr tile = std::make_shared<Tile>();
+    tile->data = data.clone();
+    tile->size = data.size();
+    tile->type = data.type();
+    tile->lastUse = ++clock;
+    tiles.push_back(tile);
+    inMemory += byteSize(tile->size, tile->type);
+    return tile;
+}
+
+const cv::Mat& EditHistory::tileData(const TilePtr& tile) {
+    tile->lastUse = ++clock;
+    if (tile->data.empty()) {
+        // Чтение выгруженного тайла; копия на диске остается для повторной выгрузки
+        const qint64 bytes = byteSize(tile->size, tile->type);
+        tile->data.create(tile->size, tile->type);
+        if (!spillFile->seek(tile->fileOffset) || spillFile->read(reinterpret_cast<char*>(tile->data.data), bytes) != bytes) {
+            tile->data.release();
+            throw std::runtime_error("Ошибка чтения файла истории правок");
+        }
+        inMemory += bytes;
+        spilled -= bytes;
+    }
+    return tile->data;
+}
+
+void EditHistory::reset(const cv::Mat& image, const QMap<QString, QString>& tags, const QByteArray& state) {
+    clear();
+    Version version;
+    version.size = image.size();
+    version.type = image.type();
+    version.source = image;
+    version.tags = tags;
+    version.state = state;
+    version.imageId = ++nextImageId;
+    versions.push_back(std::move(version));
+    current = 0;
+}
+
+void EditHistory::materialize(Version& version) {
+    if (version.source.empty()) {
+        return;
+    }
+    // Тайлы создаются один раз и разделяются всеми версиями с тем же изображением
+    const cv::Mat image = version.source;
+    for (int y = 0; y < image.rows; y += TileSize) {
+        for (int x = 0; x < image.cols; x += TileSize) {
+            version.tiles.push_back(makeTile(image(cv::Rect(x, y, std::min(TileSize, image.cols - x), std::min(TileSize, image.rows - y)))));
+        }
+    }
+    for (Version& other : versions) {
+        if (&other != &version && other.imageId == version.imageId) {
+            other.tiles = version.tiles;
+            other.source.release();
+        }
+    }
+    version.source.release();
+}
+
+void EditHistory::commit(const QString& description, const cv::Mat& image, const QMap<QString, QString>& tags,
+    const QByteArray& state) {
+    if (current < 0) {
+        reset(image, tags, state);
+        return;
+    }
+    truncateRedo();
+    // Первая правка изображения: исходная версия копируется в тайлы,
+    // чтобы подчиняться лимиту памяти и не зависеть от изменений снаружи
+    materialize(versions[current]);
+
+    Version version;
+    version.description = description;
+    version.size = image.size();
+    version.type = image.type();
+    version.tags = tags;
+    version.state = state;
+    version.imageId = ++nextImageId;
+
+    // При неизменной геометрии тайлы с прежним содержимым разделяются с предыдущей версией
+    const bool sameLayout = versions[current].size == version.size && versions[current].type == version.type;
+    int index = 0;
+    for (int y = 0; y < image.rows; y += TileSize) {
+        for (int x = 0; x < image.cols; x += TileSize, ++index) {
+            const cv::Mat part = image(cv::Rect(x, y, std::min(TileSize, image.cols - x), std::min(TileSize, image.rows - y)));
+            if (sameLayout) {
+                const TilePtr& previous = versions[current].tiles[index];
+                if (sameContent(tileData(previous), part)) {
+                    version.tiles.push_back(previous);
+                    continue;
+                }
+            }
+            version.tiles.push_back(makeTile(part));
+        }
+    }
+
+    versions.push_back(std::move(version));
+    ++current;
+    collect();
+    enforceLimit();
+}
+
+void EditHistory::commitTags(const QString& description, const QMap<QString, QString>& tags) {
+    if (current < 0) {
+        return;
+    }
+    truncateRedo();
+
+    Version version = versions[current];
+    version.description = description;
+    version.tags = tags;
+    versions.push_back(std::move(version));
+    ++current;
+    collect();
+}
+
+QString EditHistory::undoText() const {
+    return canUndo() ? versions[current].description : QString();
+}
+
+QString EditHistory::redoText() const {
+    return canRedo() ? versions[current + 1].description : QString();
+}
+
+void EditHistory::undo() {
+    if (canUndo()) {
+        --current;
+    }
+}
+
+void EditHistory::redo() {
+    if (canRedo()) {
+        ++current;
+    }
+}
+
+cv::Mat EditHistory::image() {
+    if (current < 0) {
+        return cv::Mat();
+    }
+    const Version& version = versions[current];
+    if (!version.source.empty()) {
+        return version.source;
+    }
+    cv::Mat result(version.size, version.type);
+    int index = 0;
+    for (int y = 0; y < result.rows; y += TileSize) {
+        for (int x = 0; x < result.cols; x += TileSize, ++index) {
+            const cv::Mat& data = tileData(version.tiles[index]);
+            data.copyTo(result(cv::Rect(x, y, data.cols, data.rows)));
+        }
+    }
+    enforceLimit();
+    return result;
+}
+
+quint64 EditHistory::imageVersion() const {
+    return current < 0 ? 0 : versions[current].imageId;
+}
+
+QMap<QString, QString> EditHistory::tags() const {
+    return current < 0 ? QMap<QString, QString>() : versions[current].tags;
+}
+
+void EditHistory::setState(const QByteArray& state) {
+    if (current >= 0) {
+        versions[current].state = state;
+    }
+}
+
+QByteArray EditHistory::state() const {
+    return current < 0 ? QByteArray() : versions[current].state;
+}
+
+void EditHistory::setMemoryLimit(qint64 bytes) {
+    limit = bytes;
+    enforceLimit();
+}
+
+void EditHistory::truncateRedo() {
+    versions.resize(current + 1);
+}
+
+void EditHistory::collect() {
+    // Тайл, на который ссылается только общий список, не нужен ни одной версии
+    for (auto it = tiles.begin(); it != tiles.end();) {
+        if (it->use_count() == 1) {
+            const qint64 bytes = byteSize((*it)->size, (*it)->type);
+            ((*it)->data.empty() ? spilled : inMemory) -= bytes;
+            it = tiles.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+void EditHistory::enforceLimit() {
+    if (inMemory <= limit) {
+        return;
+    }
+
+    // Выгружаются сначала давно не использованные тайлы
+    std::vector<TilePtr> candidates;
+    for (const TilePtr& tile : tiles) {
+        if (!tile->data.empty()) {
+            candidates.push_back(tile);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const TilePtr& a, const TilePtr& b) { return a->lastUse < b->lastUse; });
+
+    if (!spillFile) {
+        spillFile = std::make_unique<QTemporaryFile>();
+        if (!spillFile->open()) {
+            spillFile.reset();
+            throw std::runtime_error("Не удалось создать файл истории правок");
+        }
+    }
+
+    for (const TilePtr& tile : candidates) {
+        if (inMemory <= limit) {
+            break;
+        }
+        const qint64 bytes = byteSize(tile->size, tile->type);
+        if (tile->fileOffset < 0) {
+            const cv::Mat data = tile->data.isContinuous() ? tile->data : tile->data.clone();
+            tile->fileOffset = spillFile->size();
+            if (!spillFile->seek(tile->fileOffset) || spillFile->write(reinterpret_cast<const char*>(data.data), bytes) != bytes) {
+                tile->fileOffset = -1;
+                throw std::runtime_error("Ошибка записи файла истории правок");
+            }
+        }
+        tile->data.release();
+        inMemory -= bytes;
+        spilled += bytes;
+    }
+}
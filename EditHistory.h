@@ -0,0 +1,100 @@
+#ifndef EDITHISTORY_H
+#define EDITHISTORY_H
+
+#include <QMap>
+#include <QString>
+#include <QTemporaryFile>
+#include <opencv2/opencv.hpp>
+#include <list>
+#include <memory>
+#include <vector>
+
+// История правок изображения и тегов с отменой и повтором. Версия хранится
+// как сетка тайлов: неизмененные тайлы разделяются с предыдущей версией,
+// новая версия добавляет только тайлы, содержимое которых изменилось.
+// При превышении лимита памяти давно не использованные тайлы выгружаются
+// во временный файл и читаются обратно при обращении; ошибки файла выгрузки
+// выбрасываются как std::runtime_error.
+// Исходная версия не копируется при открытии: она ссылается на изображение,
+// пока первая правка изображения не потребует разбить его на тайлы.
+// К версии можно привязать состояние интерфейса (state), например включенные
+// фильтры, чтобы отмена восстанавливала и его
+class EditHistory {
+public:
+    static const int TileSize = 256;
+
+    explicit EditHistory(qint64 memoryLimitBytes = qint64(512) * 1024 * 1024);
+
+    // Начало истории с исходного изображения. Пиксели не копируются: изображение
+    // не должно меняться на месте, пока история на него ссылается
+    void reset(const cv::Mat& image, const QMap<QString, QString>& tags, const QByteArray& state = QByteArray());
+    void clear();
+    bool isEmpty() const { return current < 0; }
+
+    // Новая версия после правки изображения и/или тегов; версии для повтора отбрасываются
+    void commit(const QString& description, const cv::Mat& image, const QMap<QString, QString>& tags,
+        const QByteArray& state = QByteArray());
+    void commitTags(const QString& description, const QMap<QString, QString>& tags);
+    // Состояние интерфейса текущей версии меняется без создания новой
+    void setState(const QByteArray& state);
+
+    bool canUndo() const { return current > 0; }
+    bool canRedo() const { return current + 1 < static_cast<int>(versions.size()); }
+    QString undoText() const;
+    QString redoText() const;
+    void undo();
+    void redo();
+
+    // Изображение и теги текущей версии. imageVersion() меняется только
+    // при переходе к версии с другим изображением (не только тегами)
+    cv::Mat image();
+    quint64 imageVersion() const;
+    QMap<QString, QString> tags() const;
+    QByteArray state() const;
+
+    void setMemoryLimit(qint64 bytes);
+    qint64 memoryLimit() const { return limit; }
+    qint64 memoryUsage() const { return inMemory; }
+    qint64 spilledBytes() const { return spilled; }
+
+private:
+    // Тайл, общий для всех версий, в которых он не менялся
+    struct Tile {
+        cv::Mat data;           // Пусто, если тайл выгружен
+        cv::Size size;
+        int type = 0;
+        qint64 fileOffset = -1; // Положение во временном файле
+        quint64 lastUse = 0;
+    };
+    using TilePtr = std::shared_ptr<Tile>;
+
+    struct Version {
+        QString description;
+        cv::Size size;
+        int type = 0;
+        std::vector<TilePtr> tiles; // Построчно, tilesX x tilesY
+        cv::Mat source;             // Изображение исходной версии, еще не разбитое на тайлы
+        quint64 imageId = 0;
+        QMap<QString, QString> tags;
+        QByteArray state;
+    };
+
+    TilePtr makeTile(const cv::Mat& data);
+    void materialize(Version& version);
+    const cv::Mat& tileData(const TilePtr& tile);
+    void truncateRedo();
+    void collect();
+    void enforceLimit();
+
+    std::vector<Version> versions;
+    int current;
+    std::list<TilePtr> tiles; // Все тайлы истории, для учета памяти
+    qint64 limit;
+    qint64 inMemory;
+    qint64 spilled;
+    quint64 clock;
+    quint64 nextImageId;
+    std::unique_ptr<QTemporaryFile> spillFile;
+};
+
+#endif // EDITHISTORY_H
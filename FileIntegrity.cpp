@@ -0,0 +1,228 @@
+#include "FileIntegrity.h"
+#include "DicomProcessor.h"
+#include "Packed12.h"
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QObject>
+#include <QRandomGenerator>
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#include <nmmintrin.h>
+#define NDT_CRC32_INSTRUCTION
+#endif
+
+#ifdef Q_OS_WIN
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#else
+#include <cstdio>
+#include <unistd.h>
+#endif
+
+namespace {
+
+    // Таблицы программного расчета по 8 байт за шаг (slicing-by-8)
+    struct Crc32cTables {
+        uint32_t table[8][256];
+
+        Crc32cTables() {
+            const uint32_t polynomial = 0x82F63B78u; // Отраженный полином Кастаньоли
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; ++bit) {
+                    crc = (crc & 1) ? (crc >> 1) ^ polynomial : crc >> 1;
+                }
+                table[0][i] = crc;
+            }
+            for (int k = 1; k < 8; ++k) {
+                for (int i = 0; i < 256; ++i) {
+                    table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+                }
+            }
+        }
+    };
+
+    uint32_t crc32cSoftware(uint32_t crc, const uint8_t* data, size_t size) {
+        static const Crc32cTables tables;
+        const auto& t = tables.table;
+        while (size >= 8) {
+            uint64_t word;
+            std::memcpy(&word, data, sizeof(word));
+            word ^= crc;
+            crc = t[7][word & 0xFF] ^ t[6][(word >> 8) & 0xFF] ^ t[5][(word >> 16) & 0xFF] ^ t[4][(word >> 24) & 0xFF]
+                ^ t[3][(word >> 32) & 0xFF] ^ t[2][(word >> 40) & 0xFF] ^ t[1][(word >> 48) & 0xFF] ^ t[0][word >> 56];
+            data += 8;
+            size -= 8;
+        }
+        while (size--) {
+            crc = t[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+#ifdef NDT_CRC32_INSTRUCTION
+#if defined(__GNUC__) || defined(__clang__)
+    __attribute__((target("sse4.2")))
+#endif
+    uint32_t crc32cHardware(uint32_t crc, const uint8_t* data, size_t size) {
+        uint64_t value = crc;
+        while (size >= 8) {
+            uint64_t word;
+            std::memcpy(&word, data, sizeof(word));
+            value = _mm_crc32_u64(value, word);
+            data += 8;
+            size -= 8;
+        }
+        crc = static_cast<uint32_t>(value);
+        while (size--) {
+            crc = _mm_crc32_u8(crc, *data++);
+        }
+        return crc;
+    }
+#endif
+
+    FileIntegrity::VerifyResult makeResult(const QString& fileName, FileIntegrity::VerifyResult::Status status, const QString& message = QString()) {
+        FileIntegrity::VerifyResult result;
+        result.fileName = fileName;
+        result.status = status;
+        result.message = message;
+        return result;
+    }
+
+    // Потоковая проверка .raw: пиксели не загружаются в память целиком
+    FileIntegrity::VerifyResult verifyRaw(const QString& fileName) {
+        using FileIntegrity::VerifyResult;
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly)) {
+            return makeResult(fileName, VerifyResult::Unreadable, file.errorString());
+        }
+
+        uint16_t header[2];
+        if (file.read(reinterpret_cast<char*>(header), sizeof(header)) != qint64(sizeof(header))
+            || file.size() < qint64(sizeof(header) + sizeof(uint32_t))) {
+            return makeResult(fileName, VerifyResult::Corrupted, QObject::tr("Файл обрезан"));
+        }
+
+        // Трейлер: JSON и его длина в последних 4 байтах. Объем пикселей
+        // зависит от признака 12-битной упаковки в нем
+        uint32_t jsonLength = 0;
+        file.seek(file.size() - qint64(sizeof(jsonLength)));
+        file.read(reinterpret_cast<char*>(&jsonLength), sizeof(jsonLength));
+        if (jsonLength == 0 || qint64(jsonLength) > file.size() - qint64(sizeof(header) + sizeof(jsonLength))) {
+            return makeResult(fileName, VerifyResult::Corrupted, QObject::tr("Поврежден блок тегов"));
+        }
+        file.seek(file.size() - qint64(sizeof(jsonLength)) - jsonLength);
+        const QJsonDocument doc = QJsonDocument::fromJson(file.read(jsonLength));
+        if (!doc.isObject()) {
+            return makeResult(fileName, VerifyResult::Corrupted, QObject::tr("Поврежден блок тегов"));
+        }
+        const QString stored = doc.object().value(FileIntegrity::RawChecksumKey).toString();
+        if (stored.isEmpty()) {
+            return makeResult(fileName, VerifyResult::Unprotected);
+        }
+
+        const qint64 pixelBytes = doc.object().contains(Packed12::RawPackingKey)
+            ? qint64(Packed12::packedSize(header[1])) * header[0]
+            : qint64(header[0]) * header[1] * qint64(sizeof(uint16_t));
+        if (qint64(sizeof(header)) + pixelBytes + jsonLength + qint64(sizeof(jsonLength)) != file.size()) {
+            return makeResult(fileName, VerifyResult::Corrupted, QObject::tr("Файл обрезан"));
+        }
+
+        uint32_t crc = FileIntegrity::crc32c(0, header, sizeof(header));
+        file.seek(sizeof(header));
+        std::vector<char> buffer(4 * 1024 * 1024);
+        for (qint64 remaining = pixelBytes; remaining > 0;) {
+            const qint64 chunk = file.read(buffer.data(), std::min<qint64>(remaining, qint64(buffer.size())));
+            if (chunk <= 0) {
+                return makeResult(fileName, VerifyResult::Unreadable, file.errorString());
+            }
+            crc = FileIntegrity::crc32c(crc, buffer.data(), size_t(chunk));
+            remaining -= chunk;
+        }
+
+        if (FileIntegrity::checksumText(crc) != stored) {
+            return makeResult(fileName, VerifyResult::Corrupted,
+                QObject::tr("Контрольная сумма не совпадает: записана %1, вычислена %2").arg(stored, FileIntegrity::checksumText(crc)));
+        }
+        return makeResult(fileName, VerifyResult::Valid);
+    }
+
+} // namespace
+
+namespace FileIntegrity {
+
+    uint32_t crc32c(uint32_t crc, const void* data, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+#ifdef NDT_CRC32_INSTRUCTION
+        static const bool hardware = cv::checkHardwareSupport(CV_CPU_SSE4_2);
+        if (hardware) {
+            return ~crc32cHardware(~crc, bytes, size);
+        }
+#endif
+        return ~crc32cSoftware(~crc, bytes, size);
+    }
+
+    QString checksumText(uint32_t crc) {
+        return QString("%1").arg(crc, 8, 16, QLatin1Char('0'));
+    }
+
+    QString temporaryFileName(const QString& fileName) {
+        return QString("%1.%2.tmp").arg(fileName).arg(QRandomGenerator::global()->generate(), 8, 16, QLatin1Char('0'));
+    }
+
+    bool commitFile(const QString& temporaryName, const QString& fileName) {
+        bool committed = false;
+        {
+            QFile file(temporaryName);
+            if (file.open(QIODevice::ReadWrite)) {
+#ifdef Q_OS_WIN
+                committed = FlushFileBuffers(reinterpret_cast<HANDLE>(_get_osfhandle(file.handle()))) != 0;
+#else
+                committed = ::fsync(file.handle()) == 0;
+#endif
+            }
+        }
+        if (committed) {
+#ifdef Q_OS_WIN
+            committed = MoveFileExW(reinterpret_cast<LPCWSTR>(QDir::toNativeSeparators(QFileInfo(temporaryName).absoluteFilePath()).utf16()),
+                reinterpret_cast<LPCWSTR>(QDir::toNativeSeparators(QFileInfo(fileName).absoluteFilePath()).utf16()),
+                MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+            committed = std::rename(QFile::encodeName(temporaryName).constData(), QFile::encodeName(fileName).constData()) == 0;
+#endif
+        }
+        if (!committed) {
+            QFile::remove(temporaryName);
+        }
+        return committed;
+    }
+
+    VerifyResult verifyFile(const QString& fileName) {
+        if (fileName.endsWith(".raw", Qt::CaseInsensitive)) {
+            return verifyRaw(fileName);
+        }
+        if (fileName.endsWith(".dcm", Qt::CaseInsensitive)) {
+            return DicomProcessor::verifyChecksum(fileName);
+        }
+        return makeResult(fileName, VerifyResult::Unreadable, QObject::tr("Неподдерживаемый формат"));
+    }
+
+    QStringList collectFiles(const QString& directory) {
+        QStringList fileNames;
+        QDirIterator it(directory, QStringList() << "*.raw" << "*.dcm", QDir::Files, QDirIterator::Subdirectories);
+        while (it.hasNext()) {
+            fileNames << it.next();
+        }
+        fileNames.sort();
+        return fileNames;
+    }
+
+} // namespace FileIntegrity
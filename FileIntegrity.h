@@ -0,0 +1,52 @@
+#ifndef FILEINTEGRITY_H
+#define FILEINTEGRITY_H
+
+#include <QString>
+#include <QStringList>
+#include <cstddef>
+#include <cstdint>
+
+namespace FileIntegrity {
+
+    // Ключ контрольной суммы в JSON-трейлере файла .raw. В теги изображения
+    // не попадает: читатель проверяет и удаляет его
+    const char* const RawChecksumKey = "_crc32c";
+
+    // CRC32C (полином Кастаньоли) с продолжением:
+    // crc32c(crc32c(0, a), b) == crc32c(0, a + b).
+    // На x86-64 с SSE 4.2 считается инструкцией crc32
+    uint32_t crc32c(uint32_t crc, const void* data, size_t size);
+
+    QString checksumText(uint32_t crc);
+
+    // Уникальное имя временного файла рядом с целевым
+    QString temporaryFileName(const QString& fileName);
+
+    // Сброс временного файла на диск и атомарная замена им целевого.
+    // При ошибке временный файл удаляется, целевой остается прежним
+    bool commitFile(const QString& temporaryName, const QString& fileName);
+
+    // Результат проверки одного файла
+    struct VerifyResult {
+        enum Status {
+            Valid,        // Контрольная сумма совпала
+            Unprotected,  // Файл записан без контрольной суммы
+            Corrupted,    // Контрольная сумма не совпала или файл обрезан
+            Unreadable    // Файл не удалось открыть или разобрать
+        };
+
+        QString fileName;
+        Status status = Unreadable;
+        QString message;
+    };
+
+    // Проверка файла .raw или DICOM. Потокобезопасна: для массовой проверки
+    // вызывается параллельно (QtConcurrent::mapped)
+    VerifyResult verifyFile(const QString& fileName);
+
+    // Файлы .raw и .dcm каталога и его подкаталогов
+    QStringList collectFiles(const QString& directory);
+
+} // namespace FileIntegrity
+
+#endif // FILEINTEGRITY_H
@@ -0,0 +1,196 @@
+#include "FilmComparison.h"
+#include <QElapsedTimer>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+    const int CoarseSize = 512;      // Уровень грубого совмещения по большей стороне
+    const int RefineSize = 1024;     // Наибольший фрагмент уточнения
+    const int MinRefineSize = 32;
+    const double MaxResidual = 4.0;  // Допустимая поправка прогноза на уровне уточнения, пикс.
+    const int SigmaSampleSize = 512; // Фрагмент оценки СКО разности
+
+    cv::Mat toFloat(const cv::Mat& image) {
+        cv::Mat result;
+        image.convertTo(result, CV_32F);
+        return result;
+    }
+
+    // Фрагмент rect сравниваемого уровня в координатах эталона (без приведения яркости)
+    cv::Mat warpLevel(const cv::Mat& level, const cv::Point2d& shift, const cv::Rect& rect, cv::Rect& valid) {
+        const cv::Matx23d map(1.0, 0.0, rect.x + shift.x, 0.0, 1.0, rect.y + shift.y);
+        cv::Mat tile;
+        cv::warpAffine(level, tile, map, rect.size(), cv::INTER_LINEAR | cv::WARP_INVERSE_MAP, cv::BORDER_CONSTANT, cv::Scalar(0));
+
+        // Пиксели тайла, для которых интерполяция берет значения внутри снимка
+        const int left = static_cast<int>(std::ceil(-rect.x - shift.x));
+        const int top = static_cast<int>(std::ceil(-rect.y - shift.y));
+        const int right = static_cast<int>(std::floor(level.cols - 1 - rect.x - shift.x));
+        const int bottom = static_cast<int>(std::floor(level.rows - 1 - rect.y - shift.y));
+        valid = cv::Rect(cv::Point(left, top), cv::Point(right + 1, bottom + 1)) & cv::Rect(cv::Point(0, 0), rect.size());
+        return tile;
+    }
+
+    cv::Point2d levelShift(const FilmAlignment& alignment, int level) {
+        return alignment.shift * (1.0 / (1 << level));
+    }
+
+    // Разность эталона и приведенного сравниваемого снимка в области rect
+    cv::Mat difference(const FilmComparison::Pyramid& reference, const FilmComparison::Pyramid& comparison,
+        const FilmAlignment& alignment, const cv::Rect& rect, int level, cv::Rect& valid) {
+        const cv::Mat aligned = warpLevel(comparison[level], levelShift(alignment, level), rect, valid);
+        cv::Mat result;
+        aligned.convertTo(result, CV_32F, -alignment.gain, -alignment.offset);
+        cv::add(result, toFloat(reference[level](rect)), result);
+        return result;
+    }
+
+    // Центральный фрагмент области не больше limit по каждой стороне
+    cv::Rect centralPart(const cv::Rect& area, int limit) {
+        const int width = std::min(area.width, limit);
+        const int height = std::min(area.height, limit);
+        return cv::Rect(area.x + (area.width - width) / 2, area.y + (area.height - height) / 2, width, height);
+    }
+
+    // Перекрытие уровней в координатах эталона при целом сдвиге
+    cv::Rect overlapArea(const cv::Mat& reference, const cv::Mat& comparison, const cv::Point& shift) {
+        return cv::Rect(0, 0, reference.cols, reference.rows) & cv::Rect(-shift.x, -shift.y, comparison.cols, comparison.rows);
+    }
+
+    // Уточнение прогноза фазовой корреляцией по центральному фрагменту перекрытия
+    void refine(const cv::Mat& reference, const cv::Mat& comparison, cv::Point2d& shift, double& response) {
+        const cv::Point whole(cvRound(shift.x), cvRound(shift.y));
+        const cv::Rect crop = centralPart(overlapArea(reference, comparison, whole), RefineSize);
+        if (crop.width < MinRefineSize || crop.height < MinRefineSize) {
+            return;
+        }
+        cv::Mat window;
+        cv::createHanningWindow(window, crop.size(), CV_32F);
+        double levelResponse = 0.0;
+        const cv::Point2d residual = cv::phaseCorrelate(toFloat(reference(crop)), toFloat(comparison(crop + whole)), window, &levelResponse);
+        // Большая поправка означает ложный пик: прогноз предыдущего уровня надежнее
+        if (std::abs(residual.x) <= MaxResidual && std::abs(residual.y) <= MaxResidual) {
+            shift = cv::Point2d(whole) + residual;
+            response = levelResponse;
+        }
+    }
+
+} // namespace
+
+namespace FilmComparison {
+
+    Pyramid buildPyramid(const cv::Mat& image, int tileSize) {
+        CV_Assert(image.type() == CV_16UC1);
+        Pyramid pyramid{ image };
+        while (std::max(pyramid.back().cols, pyramid.back().rows) > tileSize) {
+            cv::Mat next;
+            cv::pyrDown(pyramid.back(), next);
+            pyramid.push_back(next);
+        }
+        return pyramid;
+    }
+
+    FilmAlignment align(const Pyramid& reference, const Pyramid& comparison) {
+        QElapsedTimer timer;
+        timer.start();
+        FilmAlignment alignment;
+
+        // Грубый уровень: первый, помещающийся в CoarseSize, общий для обеих пирамид
+        int coarse = 0;
+        while (coarse + 1 < static_cast<int>(std::min(reference.size(), comparison.size()))
+            && std::max(reference[coarse].cols, reference[coarse].rows) > CoarseSize) {
+            ++coarse;
+        }
+
+        // Фазовая корреляция общих по размеру частей; окно Ханна подавляет края
+        const cv::Size common(std::min(reference[coarse].cols, comparison[coarse].cols), std::min(reference[coarse].rows, comparison[coarse].rows));
+        cv::Mat window;
+        cv::createHanningWindow(window, common, CV_32F);
+        cv::Point2d shift = cv::phaseCorrelate(toFloat(reference[coarse](cv::Rect(cv::Point(), common))),
+            toFloat(comparison[coarse](cv::Rect(cv::Point(), common))), window, &alignment.response);
+
+        // Точное положение: грубый сдвиг уточняется еще раз на том же уровне
+        // (большой сдвиг мог исказить общие части), затем на каждом следующем
+        refine(reference[coarse], comparison[coarse], shift, alignment.response);
+        for (int level = coarse - 1; level >= 0; --level) {
+            shift *= 2.0;
+            refine(reference[level], comparison[level], shift, alignment.response);
+        }
+        alignment.shift = shift;
+
+        // Приведение яркости по средним и СКО перекрытия на грубом уровне
+        cv::Rect valid;
+        const cv::Rect coarseRect(0, 0, reference[coarse].cols, reference[coarse].rows);
+        const cv::Mat aligned = warpLevel(comparison[coarse], levelShift(alignment, coarse), coarseRect, valid);
+        if (valid.area() > 0) {
+            cv::Scalar meanReference, sigmaReference, meanComparison, sigmaComparison;
+            cv::meanStdDev(reference[coarse](valid), meanReference, sigmaReference);
+            cv::meanStdDev(aligned(valid), meanComparison, sigmaComparison);
+            if (sigmaComparison[0] > 0.0) {
+                alignment.gain = sigmaReference[0] / sigmaComparison[0];
+            }
+            alignment.offset = meanReference[0] - alignment.gain * meanComparison[0];
+        }
+
+        // СКО разности на каждом уровне: шум усредняется пирамидой, поэтому
+        // нормировка для разных масштабов своя
+        const int levels = static_cast<int>(std::min(reference.size(), comparison.size()));
+        alignment.differenceSigma.assign(reference.size(), 1.0);
+        for (int level = 0; level < levels; ++level) {
+            const cv::Point2d shiftAtLevel = levelShift(alignment, level);
+            const cv::Rect area = overlapArea(reference[level], comparison[level], cv::Point(cvCeil(shiftAtLevel.x), cvCeil(shiftAtLevel.y)));
+            if (area.width < 2 || area.height < 2) {
+                continue;
+            }
+            cv::Rect sampleValid;
+            const cv::Rect sample = centralPart(area, SigmaSampleSize);
+            const cv::Mat diff = difference(reference, comparison, alignment, sample, level, sampleValid);
+            if (sampleValid.area() > 0) {
+                cv::Scalar mean, sigma;
+                cv::meanStdDev(diff(sampleValid), mean, sigma);
+                alignment.differenceSigma[level] = std::max(sigma[0], 1.0);
+            }
+        }
+
+        alignment.elapsedMs = timer.nsecsElapsed() / 1e6;
+        return alignment;
+    }
+
+    cv::Mat referenceTile(const Pyramid& reference, const cv::Rect& rect, int level) {
+        return reference[level](rect & cv::Rect(0, 0, reference[level].cols, reference[level].rows));
+    }
+
+    cv::Mat alignedTile(const Pyramid& comparison, const FilmAlignment& alignment, const cv::Rect& rect, int level, cv::Rect* valid) {
+        if (level >= static_cast<int>(comparison.size())) {
+            return cv::Mat::zeros(rect.size(), CV_16UC1);
+        }
+        cv::Rect covered;
+        cv::Mat tile = warpLevel(comparison[level], levelShift(alignment, level), rect, covered);
+        tile.convertTo(tile, CV_16U, alignment.gain, alignment.offset);
+        // Вне снимка остаются нули, а не приведенное смещение яркости
+        cv::Mat outside(tile.size(), CV_8UC1, cv::Scalar(255));
+        outside(covered).setTo(0);
+        tile.setTo(0, outside);
+        if (valid) {
+            *valid = covered;
+        }
+        return tile;
+    }
+
+    cv::Mat differenceTile(const Pyramid& reference, const Pyramid& comparison, const FilmAlignment& alignment,
+        const cv::Rect& rect, int level, double range) {
+        cv::Mat tile(rect.size(), CV_8UC1, cv::Scalar(128));
+        if (level >= static_cast<int>(comparison.size())) {
+            return tile;
+        }
+        cv::Rect valid;
+        const cv::Mat diff = difference(reference, comparison, alignment, rect, level, valid);
+        if (valid.area() > 0) {
+            const double sigma = level < static_cast<int>(alignment.differenceSigma.size()) ? alignment.differenceSigma[level] : 1.0;
+            diff(valid).convertTo(tile(valid), CV_8U, 127.0 / (range * sigma), 128.0);
+        }
+        return tile;
+    }
+
+} // namespace FilmComparison
@@ -0,0 +1,46 @@
+#ifndef FILMCOMPARISON_H
+#define FILMCOMPARISON_H
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+// Результат совмещения сравниваемого снимка с эталонным
+struct FilmAlignment {
+    cv::Point2d shift;       // Точке (x, y) эталона соответствует (x + shift.x, y + shift.y) сравниваемого
+    double response = 0.0;  // Отклик фазовой корреляции на последнем уровне уточнения (0..1)
+    double gain = 1.0;      // Яркость сравниваемого приводится к эталону: value * gain + offset
+    double offset = 0.0;
+    std::vector<double> differenceSigma; // СКО разности по перекрытию на каждом уровне пирамиды
+    double elapsedMs = 0.0;
+};
+
+// Сравнение снимков одного объекта, сделанных в разное время.
+// Все функции построения тайлов работают только с запрошенной областью
+// уровня пирамиды, без проходов по изображению целиком
+namespace FilmComparison {
+
+    // Пирамида CV_16UC1: уровень level уменьшен в 2^level раз (как у TiledImageItem),
+    // верхний уровень помещается в один тайл tileSize
+    using Pyramid = std::vector<cv::Mat>;
+    Pyramid buildPyramid(const cv::Mat& image, int tileSize);
+
+    // Совмещение от грубого к точному: фазовая корреляция на уровне около
+    // 512 пикселей, затем уточнение на каждом следующем уровне по
+    // центральному фрагменту с субпиксельной точностью
+    FilmAlignment align(const Pyramid& reference, const Pyramid& comparison);
+
+    // Тайл эталона: область rect уровня level
+    cv::Mat referenceTile(const Pyramid& reference, const cv::Rect& rect, int level);
+
+    // Тайл сравниваемого снимка, сдвинутого в координаты эталона и приведенного
+    // к его яркости. Вне снимка - нули; valid - часть тайла, покрытая снимком
+    cv::Mat alignedTile(const Pyramid& comparison, const FilmAlignment& alignment, const cv::Rect& rect, int level, cv::Rect* valid = nullptr);
+
+    // Нормированная разность CV_8UC1: 128 - совпадение, +-127 - разность
+    // в range СКО шума разности; вне перекрытия - 128
+    cv::Mat differenceTile(const Pyramid& reference, const Pyramid& comparison, const FilmAlignment& alignment,
+        const cv::Rect& rect, int level, double range = 4.0);
+
+} // namespace FilmComparison
+
+#endif // FILMCOMPARISON_H
@@ -0,0 +1,329 @@
+#include "FilterGraph.h"
+#include <QObject>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+namespace {
+
+    // Ревизии узлов выдаются из общего счетчика, поэтому ключи кэша не повторяются
+    quint64 nextRevision() {
+        static std::atomic<quint64> counter{ 0 };
+        return ++counter;
+    }
+
+    int oddKernel(double size) {
+        int k = std::max(3, static_cast<int>(std::lround(size)));
+        return k | 1;
+    }
+
+    cv::Rect expand(const cv::Rect& rect, int radius) {
+        return cv::Rect(rect.x - radius, rect.y - radius, rect.width + 2 * radius, rect.height + 2 * radius);
+    }
+
+} // namespace
+
+FilterNode::FilterNode(std::vector<FilterParameter> parameters)
+    : params(std::move(parameters)), enabled(false), rev(nextRevision()) {}
+
+void FilterNode::setEnabled(bool value) {
+    if (enabled != value) {
+        enabled = value;
+        rev = nextRevision();
+    }
+}
+
+void FilterNode::setParameter(int index, double value) {
+    const FilterParameter& parameter = params[index];
+    value = std::clamp(value, parameter.minimum, parameter.maximum);
+    if (params[index].value != value) {
+        params[index].value = value;
+        rev = nextRevision();
+    }
+}
+
+// --- Нерезкое маскирование ---
+
+UnsharpMaskNode::UnsharpMaskNode()
+    : FilterNode({ { QObject::tr("Сигма"), 3.0, 0.5, 50.0, 0.5 }, { QObject::tr("Усиление"), 1.0, 0.1, 10.0, 0.1 } }) {}
+
+std::shared_ptr<FilterNode> UnsharpMaskNode::clone() const {
+    return std::make_shared<UnsharpMaskNode>(*this);
+}
+
+QString UnsharpMaskNode::name() const {
+    return QObject::tr("Нерезкое маскирование");
+}
+
+int UnsharpMaskNode::radius(double scale) const {
+    // Размер ядра cv::GaussianBlur для 16-битных данных - 4 сигмы в каждую сторону
+    return static_cast<int>(std::ceil(4.0 * std::max(parameter(0) * scale, 0.3))) + 1;
+}
+
+void UnsharpMaskNode::apply(const cv::Mat& src, cv::Mat& dst, double scale) const {
+    const double sigma = std::max(parameter(0) * scale, 0.3);
+    const double amount = parameter(1);
+    cv::Mat blurred;
+    cv::GaussianBlur(src, blurred, cv::Size(), sigma, sigma, cv::BORDER_REPLICATE);
+    cv::addWeighted(src, 1.0 + amount, blurred, -amount, 0.0, dst);
+}
+
+// --- CLAHE ---
+
+ClaheNode::ClaheNode()
+    : FilterNode({ { QObject::tr("Порог контраста"), 2.0, 1.0, 40.0, 0.5 }, { QObject::tr("Размер блока"), 128.0, 16.0, 1024.0, 16.0 } }) {}
+
+std::shared_ptr<FilterNode> ClaheNode::clone() const {
+    return std::make_shared<ClaheNode>(*this);
+}
+
+QString ClaheNode::name() const {
+    return QObject::tr("CLAHE");
+}
+
+int ClaheNode::radius(double) const {
+    return 0;
+}
+
+void ClaheNode::apply(const cv::Mat& src, cv::Mat& dst, double scale) const {
+    if (src.channels() != 1) {
+        dst = src.clone();
+        return;
+    }
+    // Сетка блоков задается их размером в пикселях полного разрешения,
+    // чтобы результат на уровнях пирамиды соответствовал полному
+    const double blockSize = std::max(parameter(1) * scale, 8.0);
+    const cv::Size grid(std::max(1, cvRound(src.cols / blockSize)), std::max(1, cvRound(src.rows / blockSize)));
+    cv::Ptr<cv::CLAHE> clahe = cv::createCLAHE(parameter(0), grid);
+    clahe->apply(src, dst);
+}
+
+// --- Вычитание фона ---
+
+BackgroundSubtractionNode::BackgroundSubtractionNode()
+    : FilterNode({ { QObject::tr("Размер ядра"), 101.0, 15.0, 1001.0, 10.0 } }), level(0.0) {}
+
+std::shared_ptr<FilterNode> BackgroundSubtractionNode::clone() const {
+    return std::make_shared<BackgroundSubtractionNode>(*this);
+}
+
+QString BackgroundSubtractionNode::name() const {
+    return QObject::tr("Вычитание фона");
+}
+
+void BackgroundSubtractionNode::prepare(const cv::Mat& source) {
+    // Постоянный уровень, к которому приводится фон: одинаков для всех тайлов
+    level = source.empty() ? 0.0 : cv::mean(source)[0];
+}
+
+int BackgroundSubtractionNode::radius(double scale) const {
+    return oddKernel(parameter(0) * scale) / 2;
+}
+
+void BackgroundSubtractionNode::apply(const cv::Mat& src, cv::Mat& dst, double scale) const {
+    const int kernel = oddKernel(parameter(0) * scale);
+    cv::Mat srcF, background;
+    src.convertTo(srcF, CV_32F);
+    // Усреднение с квадратным ядром: стоимость не зависит от размера ядра
+    cv::blur(srcF, background, cv::Size(kernel, kernel), cv::Point(-1, -1), cv::BORDER_REPLICATE);
+    cv::Mat result = srcF - background + cv::Scalar::all(level);
+    result.convertTo(dst, src.depth());
+}
+
+// --- Медианный фильтр ---
+
+MedianDenoiseNode::MedianDenoiseNode()
+    : FilterNode({ { QObject::tr("Размер ядра"), 3.0, 3.0, 5.0, 2.0 } }) {}
+
+std::shared_ptr<FilterNode> MedianDenoiseNode::clone() const {
+    return std::make_shared<MedianDenoiseNode>(*this);
+}
+
+QString MedianDenoiseNode::name() const {
+    return QObject::tr("Медианный фильтр");
+}
+
+int MedianDenoiseNode::radius(double) const {
+    return static_cast<int>(parameter(0)) / 2;
+}
+
+void MedianDenoiseNode::apply(const cv::Mat& src, cv::Mat& dst, double) const {
+    const int kernel = static_cast<int>(parameter(0)) >= 5 ? 5 : 3;
+    cv::medianBlur(src, dst, kernel);
+}
+
+// --- Цепочка ---
+
+FilterChain::FilterChain() : sourceGeneration(nextRevision()) {}
+
+void FilterChain::setSource(const cv::Mat& image) {
+    levels.clear();
+    if (!image.empty()) {
+        levels.push_back(image);
+    }
+    sourceGeneration = nextRevision();
+    for (StageCache& cache : caches) {
+        cache = StageCache();
+    }
+    for (const std::shared_ptr<FilterNode>& node : chain) {
+        node->prepare(image);
+    }
+}
+
+FilterChain FilterChain::snapshot() const {
+    // Ревизии узлов сохраняются, поэтому кэши стадий остаются действительными
+    FilterChain copy = *this;
+    for (std::shared_ptr<FilterNode>& node : copy.chain) {
+        node = node->clone();
+    }
+    return copy;
+}
+
+void FilterChain::addNode(const std::shared_ptr<FilterNode>& node) {
+    node->prepare(source());
+    chain.push_back(node);
+    caches.emplace_back();
+}
+
+bool FilterChain::hasActiveNodes() const {
+    return std::any_of(chain.begin(), chain.end(), [](const std::shared_ptr<FilterNode>& node) { return node->isEnabled(); });
+}
+
+cv::Size FilterChain::levelSize(int level) const {
+    if (levels.empty()) {
+        return cv::Size();
+    }
+    const int factor = 1 << level;
+    return cv::Size((levels.front().cols + factor - 1) / factor, (levels.front().rows + factor - 1) / factor);
+}
+
+const cv::Mat& FilterChain::levelImage(int level) {
+    if (levels.empty()) {
+        return empty;
+    }
+    while (static_cast<int>(levels.size()) <= level) {
+        cv::Mat next;
+        cv::pyrDown(levels.back(), next);
+        levels.push_back(next);
+    }
+    return levels[level];
+}
+
+quint64 FilterChain::stageKey(size_t index) const {
+    quint64 key = sourceGeneration;
+    for (size_t i = 0; i <= index; ++i) {
+        key = key * 1000003ULL ^ chain[i]->revision();
+    }
+    return key;
+}
+
+cv::Mat FilterChain::applyTiled(const FilterNode& node, const cv::Mat& src, double scale) const {
+    const int tileSize = 512;
+    const int radius = node.radius(scale);
+    const cv::Rect bounds(0, 0, src.cols, src.rows);
+    const int tilesX = (src.cols + tileSize - 1) / tileSize;
+    const int tilesY = (src.rows + tileSize - 1) / tileSize;
+
+    cv::Mat dst(src.size(), src.type());
+    cv::parallel_for_(cv::Range(0, tilesX * tilesY), [&](const cv::Range& range) {
+        for (int index = range.start; index < range.end; ++index) {
+            const cv::Rect tile = cv::Rect((index % tilesX) * tileSize, (index / tilesX) * tileSize, tileSize, tileSize) & bounds;
+            const cv::Rect input = expand(tile, radius) & bounds;
+            cv::Mat output;
+            node.apply(src(input), output, scale);
+            output(tile - input.tl()).copyTo(dst(tile));
+        }
+    });
+    return dst;
+}
+
+cv::Mat FilterChain::evaluate(const cv::Rect& region, int level) {
+    const cv::Mat& base = levelImage(level);
+    const cv::Rect bounds(0, 0, base.cols, base.rows);
+    const cv::Rect target = region & bounds;
+    if (target.empty()) {
+        return cv::Mat();
+    }
+    const double scale = 1.0 / (1 << level);
+
+    std::vector<size_t> active;
+    for (size_t i = 0; i < chain.size(); ++i) {
+        if (chain[i]->isEnabled()) {
+            active.push_back(i);
+        }
+    }
+
+    // Обратный проход: какая область нужна на выходе и на входе каждого узла
+    std::vector<cv::Rect> outputNeed(active.size());
+    std::vector<cv::Rect> inputNeed(active.size());
+    cv::Rect required = target;
+    for (size_t k = active.size(); k-- > 0;) {
+        const FilterNode& node = *chain[active[k]];
+        outputNeed[k] = required;
+        required = node.isLocal() ? (expand(required, node.radius(scale)) & bounds) : bounds;
+        inputNeed[k] = required;
+    }
+
+    // Поиск самого позднего узла, запомненный результат которого еще верен
+    cv::Mat current;
+    cv::Rect currentRegion;
+    size_t start = 0;
+    for (size_t k = active.size(); k-- > 0;) {
+        const StageCache& cache = caches[active[k]];
+        if (cache.key == stageKey(active[k]) && cache.level == level && (cache.region & outputNeed[k]) == outputNeed[k]) {
+            current = cache.result;
+            currentRegion = cache.region;
+            start = k + 1;
+            break;
+        }
+    }
+    if (start == 0) {
+        currentRegion = required;
+        current = base(currentRegion);
+    }
+
+    for (size_t k = start; k < active.size(); ++k) {
+        const FilterNode& node = *chain[active[k]];
+        const cv::Mat input = current(inputNeed[k] - currentRegion.tl());
+        cv::Mat output;
+        if (node.isLocal()) {
+            output = applyTiled(node, input, scale);
+        }
+        else {
+            node.apply(input, output, scale);
+        }
+
+        // Края входа без окрестности неверны, запоминается только верная часть;
+        // для нелокального узла это весь кадр
+        StageCache& cache = caches[active[k]];
+        cache.key = stageKey(active[k]);
+        cache.level = level;
+        cache.region = node.isLocal() ? outputNeed[k] : inputNeed[k];
+        cache.result = output(cache.region - inputNeed[k].tl());
+        current = cache.result;
+        currentRegion = cache.region;
+    }
+
+    return current(target - currentRegion.tl());
+}
+
+void FilterChain::bake(int bandRows, const std::function<void(const cv::Mat& band, int y)>& sink) {
+    const cv::Mat& image = source();
+    bandRows = std::max(bandRows, 1);
+    for (int y = 0; y < image.rows; y += bandRows) {
+        const cv::Rect band(0, y, image.cols, std::min(bandRows, image.rows - y));
+        sink(hasActiveNodes() ? evaluate(band, 0) : image(band), y);
+    }
+}
+
+cv::Mat FilterChain::bakeAll() {
+    if (!hasActiveNodes()) {
+        return source();
+    }
+
+    cv::Mat result(source().size(), source().type());
+    bake(512, [&result](const cv::Mat& band, int y) {
+        band.copyTo(result(cv::Rect(0, y, band.cols, band.rows)));
+    });
+    return result;
+}
@@ -0,0 +1,158 @@
+#ifndef FILTERGRAPH_H
+#define FILTERGRAPH_H
+
+#include <opencv2/opencv.hpp>
+#include <QString>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Параметр фильтра, редактируемый в панели
+struct FilterParameter {
+    QString name;
+    double value;
+    double minimum;
+    double maximum;
+    double step;
+};
+
+// Узел цепочки фильтров. Узел не хранит изображений: он описывает
+// преобразование и окрестность, необходимую для расчета одного пикселя
+class FilterNode {
+public:
+    explicit FilterNode(std::vector<FilterParameter> parameters);
+    virtual ~FilterNode() = default;
+
+    virtual QString name() const = 0;
+
+    // Независимая копия узла с теми же параметрами и ревизией
+    virtual std::shared_ptr<FilterNode> clone() const = 0;
+
+    // Радиус окрестности в пикселях полного разрешения при масштабе scale
+    virtual int radius(double scale) const = 0;
+
+    // Локальный узел считается по тайлам с перекрытием radius();
+    // нелокальный (CLAHE) требует кадр целиком
+    virtual bool isLocal() const { return true; }
+
+    // Применение к src; scale = 1 / 2^level для уровней пирамиды
+    virtual void apply(const cv::Mat& src, cv::Mat& dst, double scale) const = 0;
+
+    // Вызывается при смене исходного изображения цепочки
+    virtual void prepare(const cv::Mat&) {}
+
+    bool isEnabled() const { return enabled; }
+    void setEnabled(bool value);
+
+    const std::vector<FilterParameter>& parameters() const { return params; }
+    double parameter(int index) const { return params[index].value; }
+    void setParameter(int index, double value);
+
+    // Номер ревизии меняется при любом изменении узла и служит ключом кэша
+    quint64 revision() const { return rev; }
+
+protected:
+    std::vector<FilterParameter> params;
+
+private:
+    bool enabled;
+    quint64 rev;
+};
+
+// Нерезкое маскирование: src + amount * (src - GaussianBlur(src, sigma))
+class UnsharpMaskNode : public FilterNode {
+public:
+    UnsharpMaskNode();
+    QString name() const override;
+    std::shared_ptr<FilterNode> clone() const override;
+    int radius(double scale) const override;
+    void apply(const cv::Mat& src, cv::Mat& dst, double scale) const override;
+};
+
+// Адаптивное выравнивание гистограммы с ограничением контраста
+class ClaheNode : public FilterNode {
+public:
+    ClaheNode();
+    QString name() const override;
+    std::shared_ptr<FilterNode> clone() const override;
+    int radius(double scale) const override;
+    bool isLocal() const override { return false; }
+    void apply(const cv::Mat& src, cv::Mat& dst, double scale) const override;
+};
+
+// Вычитание фона, оцененного усреднением с большим ядром
+class BackgroundSubtractionNode : public FilterNode {
+public:
+    BackgroundSubtractionNode();
+    QString name() const override;
+    std::shared_ptr<FilterNode> clone() const override;
+    int radius(double scale) const override;
+    void apply(const cv::Mat& src, cv::Mat& dst, double scale) const override;
+    void prepare(const cv::Mat& source) override;
+
+private:
+    double level; // Средний уровень исходного изображения
+};
+
+// Медианное подавление шума (ядро 3 или 5 - ограничение cv::medianBlur для 16 бит)
+class MedianDenoiseNode : public FilterNode {
+public:
+    MedianDenoiseNode();
+    QString name() const override;
+    std::shared_ptr<FilterNode> clone() const override;
+    int radius(double scale) const override;
+    void apply(const cv::Mat& src, cv::Mat& dst, double scale) const override;
+};
+
+// Неразрушающая цепочка фильтров над исходным изображением. Результат
+// вычисляется лениво только для запрошенной области и уровня пирамиды,
+// промежуточные результаты каждого узла запоминаются: изменение параметра
+// последнего узла не приводит к пересчету предыдущих
+class FilterChain {
+public:
+    FilterChain();
+
+    void setSource(const cv::Mat& image);
+    const cv::Mat& source() const { return levels.empty() ? empty : levels.front(); }
+
+    void addNode(const std::shared_ptr<FilterNode>& node);
+    // Копия цепочки с копиями узлов: копирование FilterChain разделяет узлы,
+    // а снимок можно запекать в другом потоке, пока GUI меняет параметры
+    FilterChain snapshot() const;
+    const std::vector<std::shared_ptr<FilterNode>>& nodes() const { return chain; }
+    bool hasActiveNodes() const;
+
+    // Размер изображения на уровне пирамиды level (уменьшение в 2^level раз)
+    cv::Size levelSize(int level) const;
+
+    // Результат цепочки для области region в координатах уровня level
+    cv::Mat evaluate(const cv::Rect& region, int level = 0);
+
+    // Запекание цепочки в полном разрешении одним потоковым проходом:
+    // sink получает последовательные полосы строк результата
+    void bake(int bandRows, const std::function<void(const cv::Mat& band, int y)>& sink);
+
+    // Запекание в одно изображение (для форматов, требующих кадр целиком)
+    cv::Mat bakeAll();
+
+private:
+    // Запомненный результат узла
+    struct StageCache {
+        quint64 key = 0;
+        int level = -1;
+        cv::Rect region;
+        cv::Mat result;
+    };
+
+    const cv::Mat& levelImage(int level);
+    quint64 stageKey(size_t index) const;
+    cv::Mat applyTiled(const FilterNode& node, const cv::Mat& src, double scale) const;
+
+    std::vector<std::shared_ptr<FilterNode>> chain;
+    std::vector<StageCache> caches;
+    std::vector<cv::Mat> levels; // Пирамида исходного изображения, строится по запросу
+    quint64 sourceGeneration;
+    cv::Mat empty;
+};
+
+#endif // FILTERGRAPH_H
@@ -0,0 +1,47 @@
+#include "FilterPanelWidget.h"
+#include <QFormLayout>
+#include <QVBoxLayout>
+#include <QDoubleSpinBox>
+
+FilterPanelWidget::FilterPanelWidget(FilterChain* chain, QWidget* parent) : QWidget(parent) {
+    QVBoxLayout* layout = new QVBoxLayout(this);
+
+    for (const std::shared_ptr<FilterNode>& node : chain->nodes()) {
+        QGroupBox* group = new QGroupBox(node->name(), this);
+        group->setCheckable(true);
+        group->setChecked(node->isEnabled());
+        connect(group, &QGroupBox::toggled, this, [this, node](bool checked) {
+            node->setEnabled(checked);
+            emit filtersChanged();
+        });
+
+        QFormLayout* form = new QFormLayout(group);
+        const std::vector<FilterParameter>& parameters = node->parameters();
+        for (int index = 0; index < static_cast<int>(parameters.size()); ++index) {
+            const FilterParameter& parameter = parameters[index];
+            QDoubleSpinBox* spin = new QDoubleSpinBox(group);
+            spin->setRange(parameter.minimum, parameter.maximum);
+            spin->setSingleStep(parameter.step);
+            spin->setDecimals(parameter.step < 1.0 ? 1 : 0);
+            spin->setValue(parameter.value);
+            // Пересчет только по завершении ввода, а не на каждый символ
+            spin->setKeyboardTracking(false);
+            connect(spin, QOverload<double>::of(&QDoubleSpinBox::valueChanged), this, [this, node, index](double value) {
+                node->setParameter(index, value);
+                emit filtersChanged();
+            });
+            form->addRow(parameter.name, spin);
+        }
+        layout->addWidget(group);
+        groups.emplace_back(group, node);
+    }
+    layout->addStretch();
+}
+
+void FilterPanelWidget::refresh() {
+    for (const auto& entry : groups) {
+        entry.first->blockSignals(true);
+        entry.first->setChecked(entry.second->isEnabled());
+        entry.first->blockSignals(false);
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef FILTERPANELWIDGET_H
+#define FILTERPANELWIDGET_H
+
+#include <QWidget>
+#include <QGroupBox>
+#include <vector>
+#include "FilterGraph.h"
+
+// Панель включения и настройки узлов цепочки фильтров
+class FilterPanelWidget : public QWidget {
+    Q_OBJECT
+
+public:
+    explicit FilterPanelWidget(FilterChain* chain, QWidget* parent = nullptr);
+
+    // Обновление флажков после изменения узлов вне панели
+    void refresh();
+
+signals:
+    void filtersChanged();
+
+private:
+    std::vector<std::pair<QGroupBox*, std::shared_ptr<FilterNode>>> groups;
+};
+
+#endif // FILTERPANELWIDGET_H
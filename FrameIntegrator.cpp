@@ -0,0 +1,352 @@
+#include "FrameIntegrator.h"
+#include "ImageProcessor.h"
+#include "DicomProcessor.h"
+#include <QFileInfo>
+#include <QObject>
+#include <dcmtk/dcmdata/dcfilefo.h>
+#include <dcmtk/dcmdata/dcdeftag.h>
+#include <dcmtk/dcmdata/dcpixel.h>
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <cmath>
+#include <future>
+
+namespace {
+
+    // sum += src
+    void accumulateRow(const ushort* src, unsigned* sum, int count) {
+        int x = 0;
+#if CV_SIMD
+        const int lanes = cv::v_uint16::nlanes;
+        for (; x <= count - lanes; x += lanes) {
+            cv::v_uint32 low, high;
+            cv::v_expand(cv::vx_load(src + x), low, high);
+            cv::v_store(sum + x, cv::vx_load(sum + x) + low);
+            cv::v_store(sum + x + lanes / 2, cv::vx_load(sum + x + lanes / 2) + high);
+        }
+        cv::vx_cleanup();
+#endif
+        for (; x < count; ++x) {
+            sum[x] += src[x];
+        }
+    }
+
+    // sum += src, минимум и максимум пикселя
+    void accumulateExtremaRow(const ushort* src, unsigned* sum, ushort* minimum, ushort* maximum, int count) {
+        int x = 0;
+#if CV_SIMD
+        const int lanes = cv::v_uint16::nlanes;
+        for (; x <= count - lanes; x += lanes) {
+            const cv::v_uint16 value = cv::vx_load(src + x);
+            cv::v_store(minimum + x, cv::v_min(cv::vx_load(minimum + x), value));
+            cv::v_store(maximum + x, cv::v_max(cv::vx_load(maximum + x), value));
+            cv::v_uint32 low, high;
+            cv::v_expand(value, low, high);
+            cv::v_store(sum + x, cv::vx_load(sum + x) + low);
+            cv::v_store(sum + x + lanes / 2, cv::vx_load(sum + x + lanes / 2) + high);
+        }
+        cv::vx_cleanup();
+#endif
+        for (; x < count; ++x) {
+            minimum[x] = std::min(minimum[x], src[x]);
+            maximum[x] = std::max(maximum[x], src[x]);
+            sum[x] += src[x];
+        }
+    }
+
+    // Второй проход отсечения: в сумму и счетчик попадают значения из [lower, upper]
+    void accumulateClippedRow(const ushort* src, const ushort* lower, const ushort* upper, unsigned* sum, ushort* accepted, int count) {
+        int x = 0;
+#if CV_SIMD
+        const int lanes = cv::v_uint16::nlanes;
+        const cv::v_uint16 one = cv::vx_setall_u16(1);
+        for (; x <= count - lanes; x += lanes) {
+            const cv::v_uint16 value = cv::vx_load(src + x);
+            const cv::v_uint16 inside = (value >= cv::vx_load(lower + x)) & (value <= cv::vx_load(upper + x));
+            cv::v_store(accepted + x, cv::vx_load(accepted + x) + (inside & one));
+            cv::v_uint32 low, high;
+            cv::v_expand(value & inside, low, high);
+            cv::v_store(sum + x, cv::vx_load(sum + x) + low);
+            cv::v_store(sum + x + lanes / 2, cv::vx_load(sum + x + lanes / 2) + high);
+        }
+        cv::vx_cleanup();
+#endif
+        for (; x < count; ++x) {
+            if (src[x] >= lower[x] && src[x] <= upper[x]) {
+                sum[x] += src[x];
+                ++accepted[x];
+            }
+        }
+    }
+
+    ushort roundedRatio(unsigned numerator, unsigned denominator) {
+        return cv::saturate_cast<ushort>((uint64_t(numerator) + denominator / 2) / denominator);
+    }
+
+} // namespace
+
+FrameSequence::FrameSequence(const QStringList& fileNames)
+    : pixelData(nullptr), nextFragment(0), count(0) {
+    if (fileNames.isEmpty()) {
+        throw std::runtime_error("Не выбраны кадры серии");
+    }
+
+    if (fileNames.size() == 1 && fileNames.first().endsWith(".dcm", Qt::CaseInsensitive)) {
+        // Большие элементы (пиксельные данные) DCMTK по умолчанию не читает
+        // при загрузке, а подгружает с диска по запросу кадра
+        dicom.reset(new DcmFileFormat());
+        OFCondition status = dicom->loadFile(fileNames.first().toStdString().c_str());
+        if (status.bad()) {
+            throw std::runtime_error(std::string("Не удалось открыть DICOM файл: ") + status.text());
+        }
+        DcmDataset* dataset = dicom->getDataset();
+        firstTags = DicomProcessor::extractAllTags(dataset);
+
+        Uint16 rows = 0, columns = 0, bitsAllocated = 0, samplesPerPixel = 1, pixelRepresentation = 0;
+        dataset->findAndGetUint16(DCM_Rows, rows);
+        dataset->findAndGetUint16(DCM_Columns, columns);
+        dataset->findAndGetUint16(DCM_BitsAllocated, bitsAllocated);
+        dataset->findAndGetUint16(DCM_SamplesPerPixel, samplesPerPixel);
+        dataset->findAndGetUint16(DCM_PixelRepresentation, pixelRepresentation);
+        if (bitsAllocated != 16 || samplesPerPixel != 1) {
+            throw std::runtime_error("Поддерживаются только монохромные кадры с 16 битами на пиксель");
+        }
+        // Кадры накапливаются как беззнаковые: знаковые значения дали бы
+        // неверные среднее и границы отсечения
+        if (pixelRepresentation != 0) {
+            throw std::runtime_error("Поддерживаются только кадры без знака (PixelRepresentation = 0)");
+        }
+        Sint32 frames = 1;
+        dataset->findAndGetSint32(DCM_NumberOfFrames, frames);
+
+        DcmElement* element = nullptr;
+        if (dataset->findAndGetElement(DCM_PixelData, element).bad() || !element) {
+            throw std::runtime_error("В DICOM файле нет пиксельных данных");
+        }
+        pixelData = OFstatic_cast(DcmPixelData*, element);
+        count = std::max<Sint32>(frames, 1);
+        size = cv::Size(columns, rows);
+        return;
+    }
+
+    for (const QString& fileName : fileNames) {
+        if (!fileName.endsWith(".raw", Qt::CaseInsensitive)) {
+            throw std::runtime_error("Серия кадров - один многокадровый DICOM файл или файлы .raw");
+        }
+    }
+    files = fileNames;
+    count = files.size();
+    size = ImageProcessor::readImageFromRawFile(files.first().toStdString(), firstTags).size();
+}
+
+FrameSequence::~FrameSequence() {}
+
+cv::Mat FrameSequence::readFrame(int index) {
+    if (!dicom) {
+        QMap<QString, QString> ignored;
+        cv::Mat frame = ImageProcessor::readImageFromRawFile(files[index].toStdString(), ignored);
+        if (frame.size() != size) {
+            throw std::runtime_error("Размер кадра " + QFileInfo(files[index]).fileName().toStdString() + " отличается от первого");
+        }
+        return frame;
+    }
+
+    // Сжатые кадры без таблицы смещений находятся по фрагменту, на котором закончился предыдущий
+    if (index == 0) {
+        nextFragment = 0;
+    }
+    cv::Mat frame(size, CV_16UC1);
+    Uint32 fragment = nextFragment;
+    OFString colorModel;
+    OFCondition status = pixelData->getUncompressedFrame(dicom->getDataset(), Uint32(index), fragment,
+        frame.data, Uint32(frame.total() * frame.elemSize()), colorModel);
+    if (status.bad()) {
+        throw std::runtime_error("Не удалось прочитать кадр " + std::to_string(index + 1) + ": " + status.text());
+    }
+    nextFragment = fragment;
+    return frame;
+}
+
+FrameIntegrator::FrameIntegrator(const cv::Size& frameSize, IntegrationMethod integrationMethod, double clipSigma)
+    : method(integrationMethod), sigma(clipSigma), size(frameSize), pass(0), frames(0) {
+    sum = cv::Mat::zeros(size, CV_32SC1);
+    if (method == IntegrationMethod::MinMaxRejection) {
+        low = cv::Mat(size, CV_16UC1, cv::Scalar(65535));
+        high = cv::Mat::zeros(size, CV_16UC1);
+    }
+    else if (method == IntegrationMethod::SigmaClipping) {
+        sumSq = cv::Mat::zeros(size, CV_64FC1);
+    }
+}
+
+int FrameIntegrator::passCount() const {
+    return method == IntegrationMethod::SigmaClipping ? 2 : 1;
+}
+
+void FrameIntegrator::beginPass(int newPass) {
+    if (newPass != 1 || pass != 0 || method != IntegrationMethod::SigmaClipping || frames == 0) {
+        return;
+    }
+
+    // Интервал [среднее - k СКО; среднее + k СКО]; СКО не меньше единицы,
+    // чтобы квантование почти постоянных пикселей не отбрасывало значения
+    mean.create(size, CV_16UC1);
+    low.create(size, CV_16UC1);
+    high.create(size, CV_16UC1);
+    const double n = frames;
+    cv::parallel_for_(cv::Range(0, size.height), [&](const cv::Range& range) {
+        for (int y = range.start; y < range.end; ++y) {
+            const unsigned* s = sum.ptr<unsigned>(y);
+            const double* sq = sumSq.ptr<double>(y);
+            ushort* m = mean.ptr<ushort>(y);
+            ushort* lower = low.ptr<ushort>(y);
+            ushort* upper = high.ptr<ushort>(y);
+            for (int x = 0; x < size.width; ++x) {
+                const double average = s[x] / n;
+                const double deviation = std::max(std::sqrt(std::max(sq[x] / n - average * average, 0.0)), 1.0);
+                m[x] = cv::saturate_cast<ushort>(average);
+                lower[x] = cv::saturate_cast<ushort>(std::ceil(average - sigma * deviation));
+                upper[x] = cv::saturate_cast<ushort>(std::floor(average + sigma * deviation));
+            }
+        }
+    });
+
+    sumSq.release();
+    sum.setTo(0);
+    accepted = cv::Mat::zeros(size, CV_16UC1);
+    pass = 1;
+}
+
+void FrameIntegrator::add(const cv::Mat& frame) {
+    CV_Assert(frame.type() == CV_16UC1 && frame.size() == size);
+    if (pass == 0 && frames >= MaxFrames) {
+        throw std::runtime_error("Слишком много кадров для накопления");
+    }
+
+    cv::parallel_for_(cv::Range(0, size.height), [&](const cv::Range& range) {
+        for (int y = range.start; y < range.end; ++y) {
+            const ushort* src = frame.ptr<ushort>(y);
+            unsigned* s = sum.ptr<unsigned>(y);
+            if (pass == 1) {
+                accumulateClippedRow(src, low.ptr<ushort>(y), high.ptr<ushort>(y), s, accepted.ptr<ushort>(y), size.width);
+            }
+            else if (method == IntegrationMethod::MinMaxRejection) {
+                accumulateExtremaRow(src, s, low.ptr<ushort>(y), high.ptr<ushort>(y), size.width);
+            }
+            else {
+                accumulateRow(src, s, size.width);
+                if (method == IntegrationMethod::SigmaClipping) {
+                    double* sq = sumSq.ptr<double>(y);
+                    for (int x = 0; x < size.width; ++x) {
+                        sq[x] += double(src[x]) * src[x];
+                    }
+                }
+            }
+        }
+    });
+    if (pass == 0) {
+        ++frames;
+    }
+}
+
+cv::Mat FrameIntegrator::result() const {
+    cv::Mat output(size, CV_16UC1);
+    if (frames == 0) {
+        output.setTo(0);
+        return output;
+    }
+
+    cv::parallel_for_(cv::Range(0, size.height), [&](const cv::Range& range) {
+        for (int y = range.start; y < range.end; ++y) {
+            const unsigned* s = sum.ptr<unsigned>(y);
+            ushort* dst = output.ptr<ushort>(y);
+            if (pass == 1) {
+                const ushort* n = accepted.ptr<ushort>(y);
+                const ushort* m = mean.ptr<ushort>(y);
+                for (int x = 0; x < size.width; ++x) {
+                    dst[x] = n[x] > 0 ? roundedRatio(s[x], n[x]) : m[x];
+                }
+            }
+            else if (method == IntegrationMethod::MinMaxRejection && frames > 2) {
+                const ushort* minimum = low.ptr<ushort>(y);
+                const ushort* maximum = high.ptr<ushort>(y);
+                for (int x = 0; x < size.width; ++x) {
+                    dst[x] = roundedRatio(s[x] - minimum[x] - maximum[x], unsigned(frames - 2));
+                }
+            }
+            else {
+                for (int x = 0; x < size.width; ++x) {
+                    dst[x] = roundedRatio(s[x], unsigned(frames));
+                }
+            }
+        }
+    });
+    return output;
+}
+
+double FrameIntegrator::rejectedFraction() const {
+    if (frames == 0) {
+        return 0.0;
+    }
+    if (pass == 1) {
+        return 1.0 - cv::sum(accepted)[0] / (double(frames) * size.area());
+    }
+    if (method == IntegrationMethod::MinMaxRejection && frames > 2) {
+        return 2.0 / frames;
+    }
+    return 0.0;
+}
+
+QString FrameIntegrator::methodName(IntegrationMethod method) {
+    switch (method) {
+    case IntegrationMethod::Mean:
+        return QObject::tr("Среднее");
+    case IntegrationMethod::MinMaxRejection:
+        return QObject::tr("Среднее без экстремумов");
+    case IntegrationMethod::SigmaClipping:
+        return QObject::tr("Отсечение по СКО");
+    }
+    return QString();
+}
+
+cv::Mat FrameIntegrator::integrate(FrameSequence& sequence, IntegrationMethod method, double clipSigma,
+    const std::function<bool(double)>& progress, QMap<QString, QString>& tags) {
+    const int count = sequence.frameCount();
+    if (count > MaxFrames) {
+        throw std::runtime_error("Слишком много кадров для накопления");
+    }
+
+    FrameIntegrator integrator(sequence.frameSize(), method, clipSigma);
+    const int passes = integrator.passCount();
+    for (int pass = 0; pass < passes; ++pass) {
+        integrator.beginPass(pass);
+        // Следующий кадр читается с диска, пока накапливается текущий:
+        // в памяти не больше двух кадров
+        std::future<cv::Mat> next = std::async(std::launch::async, [&sequence]() { return sequence.readFrame(0); });
+        for (int i = 0; i < count; ++i) {
+            const cv::Mat frame = next.get();
+            if (i + 1 < count) {
+                next = std::async(std::launch::async, [&sequence, i]() { return sequence.readFrame(i + 1); });
+            }
+            integrator.add(frame);
+            if (progress && !progress(double(pass * count + i + 1) / (double(passes) * count))) {
+                if (next.valid()) {
+                    next.wait();
+                }
+                return cv::Mat();
+            }
+        }
+    }
+
+    tags = sequence.tags();
+    tags.insert("Число кадров", QString::number(count));
+    QString methodText = methodName(method);
+    if (method == IntegrationMethod::SigmaClipping) {
+        methodText += QString(" (%1σ)").arg(clipSigma);
+    }
+    tags.insert("Метод интеграции", methodText);
+    if (method != IntegrationMethod::Mean) {
+        tags.insert("Отброшено значений (%)", QString::number(100.0 * integrator.rejectedFraction(), 'f', 2));
+    }
+    return integrator.result();
+}
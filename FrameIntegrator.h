@@ -0,0 +1,95 @@
+#ifndef FRAMEINTEGRATOR_H
+#define FRAMEINTEGRATOR_H
+
+#include <QString>
+#include <QStringList>
+#include <QMap>
+#include <opencv2/opencv.hpp>
+#include <functional>
+#include <memory>
+
+class DcmFileFormat;
+class DcmPixelData;
+
+// Способ объединения кадров серии
+enum class IntegrationMethod {
+    Mean,            // Среднее
+    MinMaxRejection, // Среднее без наибольшего и наименьшего значения пикселя
+    SigmaClipping    // Среднее значений в пределах k СКО от среднего (два прохода)
+};
+
+// Серия кадров одной экспозиции: многокадровый DICOM или последовательность .raw.
+// Кадры читаются по одному (пиксельные данные DICOM остаются на диске до
+// запроса кадра), поэтому объем памяти не зависит от числа кадров
+class FrameSequence {
+public:
+    // Один файл .dcm - многокадровый DICOM, иначе - файлы .raw по порядку.
+    // При ошибке выбрасывает std::runtime_error
+    explicit FrameSequence(const QStringList& fileNames);
+    ~FrameSequence();
+
+    int frameCount() const { return count; }
+    cv::Size frameSize() const { return size; }
+    // Теги первого кадра
+    const QMap<QString, QString>& tags() const { return firstTags; }
+
+    // Кадр CV_16UC1. Последовательное чтение многокадрового DICOM быстрее произвольного
+    cv::Mat readFrame(int index);
+
+private:
+    QStringList files;
+    std::unique_ptr<DcmFileFormat> dicom;
+    DcmPixelData* pixelData;
+    unsigned int nextFragment; // Первый фрагмент следующего кадра сжатого DICOM
+    int count;
+    cv::Size size;
+    QMap<QString, QString> firstTags;
+};
+
+// Потоковое накопление кадров в 32-битном сумматоре. Для каждого пикселя
+// хранится фиксированный набор счетчиков, кадры после добавления не нужны.
+// Отсечение по СКО требует второго прохода по тем же кадрам: в первом
+// накапливаются сумма и сумма квадратов, во втором - только попавшие в
+// интервал значения
+class FrameIntegrator {
+public:
+    // Больше кадров не вмещают 32-битная сумма 16-битных значений и 16-битный счетчик
+    static const int MaxFrames = 65535;
+
+    FrameIntegrator(const cv::Size& frameSize, IntegrationMethod method, double clipSigma = 3.0);
+
+    int passCount() const;
+    // Начало второго прохода отсечения по СКО (после всех кадров первого)
+    void beginPass(int pass);
+    // Добавление кадра CV_16UC1 текущего прохода; строки обрабатываются параллельно
+    void add(const cv::Mat& frame);
+
+    int frameCount() const { return frames; }
+    // Результат CV_16UC1 с округлением
+    cv::Mat result() const;
+    // Доля значений, отброшенных отсечением, от их общего числа
+    double rejectedFraction() const;
+
+    static QString methodName(IntegrationMethod method);
+
+    // Полный цикл по серии. progress(доля) возвращает false для отмены, тогда
+    // результат пустой. В tags записываются теги первого кадра, число кадров
+    // и способ объединения
+    static cv::Mat integrate(FrameSequence& sequence, IntegrationMethod method, double clipSigma,
+        const std::function<bool(double)>& progress, QMap<QString, QString>& tags);
+
+private:
+    IntegrationMethod method;
+    double sigma;
+    cv::Size size;
+    int pass;
+    int frames;
+    cv::Mat sum;       // CV_32SC1, значения трактуются как беззнаковые
+    cv::Mat sumSq;     // CV_64FC1, первый проход отсечения по СКО
+    cv::Mat low;       // CV_16UC1: минимум или нижняя граница интервала отсечения
+    cv::Mat high;      // CV_16UC1: максимум или верхняя граница
+    cv::Mat accepted;  // CV_16UC1: число значений в интервале (второй проход)
+    cv::Mat mean;      // CV_16UC1: среднее первого прохода для пикселей без значений в интервале
+};
+
+#endif // FRAMEINTEGRATOR_H
@@ -0,0 +1,66 @@
+#include "HistogramWidget.h"
+#include <QPainter>
+#include <algorithm>
+#include <cmath>
+
+HistogramWidget::HistogramWidget(QWidget* parent) : QWidget(parent), windowLow(0.0), windowHigh(0.0) {
+    setMinimumHeight(100);
+}
+
+void HistogramWidget::setHistogram(const ImageHistogram& newHistogram) {
+    histogram = newHistogram;
+    update();
+}
+
+void HistogramWidget::setWindow(double low, double high) {
+    windowLow = low;
+    windowHigh = high;
+    update();
+}
+
+void HistogramWidget::paintEvent(QPaintEvent*) {
+    QPainter painter(this);
+    painter.fillRect(rect(), palette().base());
+
+    if (histogram.isEmpty()) {
+        painter.drawText(rect(), Qt::AlignCenter, tr("Нет гистограммы"));
+        return;
+    }
+
+    // Отображается диапазон [min, max] значений, по столбцу на пиксель ширины;
+    // высота в логарифмическом масштабе, чтобы были видны малые пики
+    const int columns = std::max(width(), 1);
+    const double first = histogram.minValue;
+    const double span = std::max(histogram.maxValue - histogram.minValue + 1, 1);
+    std::vector<double> heights(columns, 0.0);
+    double peak = 0.0;
+    for (int column = 0; column < columns; ++column) {
+        const int from = static_cast<int>(first + span * column / columns);
+        const int to = std::max(from + 1, static_cast<int>(first + span * (column + 1) / columns));
+        uint32_t count = 0;
+        for (int value = from; value < to && value <= histogram.maxValue; ++value) {
+            count = std::max(count, histogram.bins[value]);
+        }
+        heights[column] = std::log1p(static_cast<double>(count));
+        peak = std::max(peak, heights[column]);
+    }
+
+    painter.setPen(palette().text().color());
+    for (int column = 0; column < columns; ++column) {
+        const int barHeight = static_cast<int>(height() * heights[column] / std::max(peak, 1.0));
+        painter.drawLine(column, height(), column, height() - barHeight);
+    }
+
+    // Границы окна отображения
+    if (windowHigh > windowLow) {
+        painter.setPen(QPen(Qt::red, 1, Qt::DashLine));
+        const int xLow = static_cast<int>((windowLow - first) * columns / span);
+        const int xHigh = static_cast<int>((windowHigh - first) * columns / span);
+        painter.drawLine(xLow, 0, xLow, height());
+        painter.drawLine(xHigh, 0, xHigh, height());
+    }
+
+    painter.setPen(palette().text().color());
+    painter.drawText(rect().adjusted(4, 2, -4, -2), Qt::AlignTop | Qt::AlignLeft, QString::number(histogram.minValue));
+    painter.drawText(rect().adjusted(4, 2, -4, -2), Qt::AlignTop | Qt::AlignRight, QString::number(histogram.maxValue));
+}
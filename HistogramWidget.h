@@ -0,0 +1,25 @@
+#ifndef HISTOGRAMWIDGET_H
+#define HISTOGRAMWIDGET_H
+
+#include <QWidget>
+#include "ImageHistogram.h"
+
+// Виджет гистограммы с отметками текущего окна отображения
+class HistogramWidget : public QWidget {
+    Q_OBJECT
+
+public:
+    explicit HistogramWidget(QWidget* parent = nullptr);
+    void setHistogram(const ImageHistogram& histogram);
+    void setWindow(double low, double high);
+
+protected:
+    void paintEvent(QPaintEvent* event) override;
+
+private:
+    ImageHistogram histogram;
+    double windowLow;
+    double windowHigh;
+};
+
+#endif // HISTOGRAMWIDGET_H
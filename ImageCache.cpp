@@ -0,0 +1,148 @@
+#include "ImageCache.h"
+#include "Packed12.h"
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QtConcurrent/QtConcurrent>
+
+ImageCache::ImageCache(qint64 limitBytes) {
+    // Предзагрузке достаточно двух потоков: декодирование упирается в диск
+    pool.setMaxThreadCount(2);
+    setLimit(limitBytes);
+}
+
+ImageCache::~ImageCache() {
+    pool.clear();
+    pool.waitForDone();
+}
+
+QString ImageCache::cacheKey(const QString& fileName) {
+    return QFileInfo(fileName).absoluteFilePath();
+}
+
+QDateTime ImageCache::modificationTime(const QString& key) {
+    return QFileInfo(key).lastModified();
+}
+
+ImageCache::Entry* ImageCache::makeEntry(const LoadedImage& loaded, const QDateTime& modified) {
+    Entry* entry = new Entry{ loaded, cv::Mat(), -1, 0, modified };
+    entry->packShift = Packed12::losslessShift(loaded.image);
+    if (entry->packShift >= 0) {
+        entry->packed = Packed12::pack(loaded.image, entry->packShift);
+        entry->width = loaded.image.cols;
+        entry->loaded.image = cv::Mat();
+    }
+    return entry;
+}
+
+void ImageCache::insert(const QString& key, Entry* entry) {
+    const cv::Mat& pixels = entry->packed.empty() ? entry->loaded.image : entry->packed;
+    const qint64 kilobytes = static_cast<qint64>(pixels.total() * pixels.elemSize()) / 1024 + 1;
+    // Запись дороже всего кэша QCache удаляет сразу, вызывающий код сохраняет свою копию
+    entries.insert(key, entry, kilobytes);
+}
+
+bool ImageCache::lookup(const QString& key, Entry& found) {
+    Entry* entry = entries.object(key);
+    if (!entry) {
+        return false;
+    }
+    // Файл перезаписан после декодирования
+    if (entry->modified != modificationTime(key)) {
+        entries.remove(key);
+        return false;
+    }
+    found = *entry;
+    return true;
+}
+
+LoadedImage ImageCache::load(const QString& fileName) {
+    const QString key = cacheKey(fileName);
+    LoadedImage loaded;
+    QFuture<LoadedImage> future;
+
+    {
+        Entry found;
+        QMutexLocker locker(&mutex);
+        if (lookup(key, found)) {
+            ++counters.hits;
+            locker.unlock();
+            // Распаковка вне мьютекса: матрица записи разделяется, а не копируется
+            loaded = found.loaded;
+            if (!found.packed.empty()) {
+                loaded.image = Packed12::unpack(found.packed, found.width, found.packShift);
+            }
+            return loaded;
+        }
+        future = pending.value(key);
+    }
+
+    // Файл уже декодируется предзагрузкой: дожидаемся ее вместо повторного чтения
+    if (future.isValid()) {
+        loaded = future.result();
+        if (!loaded.image.empty()) {
+            QMutexLocker locker(&mutex);
+            ++counters.waits;
+            return loaded;
+        }
+        // Ошибка предзагрузки: повторяем синхронно, чтобы получить исключение с описанием
+    }
+
+    const QDateTime modified = modificationTime(key);
+    loaded = ImageLoader::load(fileName);
+    Entry* entry = makeEntry(loaded, modified);
+
+    QMutexLocker locker(&mutex);
+    ++counters.misses;
+    insert(key, entry);
+    return loaded;
+}
+
+void ImageCache::prefetch(const QStringList& fileNames) {
+    QMutexLocker locker(&mutex);
+
+    for (const QString& fileName : fileNames) {
+        const QString key = cacheKey(fileName);
+        if (pending.contains(key) || entries.contains(key)) {
+            continue;
+        }
+
+        ++counters.prefetches;
+        pending.insert(key, QtConcurrent::run(&pool, [this, key]() {
+            LoadedImage loaded;
+            const QDateTime modified = modificationTime(key);
+            try {
+                loaded = ImageLoader::load(key);
+            }
+            catch (const std::exception&) {
+                // Ошибка будет показана, если пользователь откроет этот файл
+            }
+
+            Entry* entry = loaded.image.empty() ? nullptr : makeEntry(loaded, modified);
+
+            QMutexLocker locker(&mutex);
+            if (entry) {
+                insert(key, entry);
+            }
+            pending.remove(key);
+            return loaded;
+        }));
+    }
+}
+
+void ImageCache::setLimit(qint64 limitBytes) {
+    QMutexLocker locker(&mutex);
+    entries.setMaxCost(limitBytes / 1024);
+}
+
+void ImageCache::clear() {
+    QMutexLocker locker(&mutex);
+    entries.clear();
+}
+
+ImageCacheStatistics ImageCache::statistics() const {
+    QMutexLocker locker(&mutex);
+    ImageCacheStatistics result = counters;
+    result.usedBytes = static_cast<qint64>(entries.totalCost()) * 1024;
+    result.limitBytes = static_cast<qint64>(entries.maxCost()) * 1024;
+    return result;
+}
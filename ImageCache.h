@@ -0,0 +1,67 @@
+#ifndef IMAGECACHE_H
+#define IMAGECACHE_H
+
+#include <QCache>
+#include <QDateTime>
+#include <QFuture>
+#include <QHash>
+#include <QMutex>
+#include <QStringList>
+#include <QThreadPool>
+#include "ImageLoader.h"
+
+// Счетчики обращений к кэшу
+struct ImageCacheStatistics {
+    int hits = 0;        // Изображение уже было декодировано
+    int waits = 0;       // Изображение декодировалось предзагрузкой, ожидали ее завершения
+    int misses = 0;      // Декодирование в момент запроса
+    int prefetches = 0;  // Запущено фоновых декодирований
+    qint64 usedBytes = 0;
+    qint64 limitBytes = 0;
+};
+
+// Кэш декодированных изображений с вытеснением давно не используемых (LRU)
+// при превышении объема и фоновой предзагрузкой соседних снимков
+class ImageCache {
+public:
+    explicit ImageCache(qint64 limitBytes = qint64(1024) * 1024 * 1024);
+    ~ImageCache();
+
+    // Изображение из кэша или декодированное ImageLoader::load.
+    // При ошибке выбрасывает std::runtime_error
+    LoadedImage load(const QString& fileName);
+
+    // Фоновое декодирование файлов, которых еще нет в кэше
+    void prefetch(const QStringList& fileNames);
+
+    void setLimit(qint64 limitBytes);
+    void clear();
+
+    ImageCacheStatistics statistics() const;
+
+private:
+    // 12-битные изображения хранятся упакованными (Packed12) и распаковываются
+    // при выдаче: в тот же объем памяти помещается на треть больше снимков
+    struct Entry {
+        LoadedImage loaded; // Без пикселей, если они упакованы
+        cv::Mat packed;
+        int packShift = -1;
+        int width = 0;
+        QDateTime modified; // Время изменения файла на момент декодирования
+    };
+
+    static QString cacheKey(const QString& fileName);
+    static QDateTime modificationTime(const QString& key);
+    // Упаковка выполняется до захвата мьютекса
+    static Entry* makeEntry(const LoadedImage& loaded, const QDateTime& modified);
+    void insert(const QString& key, Entry* entry);
+    bool lookup(const QString& key, Entry& found);
+
+    mutable QMutex mutex;
+    QCache<QString, Entry> entries;             // Стоимость записи - объем пикселей в КБ
+    QHash<QString, QFuture<LoadedImage>> pending; // Декодируемые в фоне файлы
+    QThreadPool pool;                           // Отдельный пул, чтобы не занимать глобальный
+    ImageCacheStatistics counters;
+};
+
+#endif // IMAGECACHE_H
@@ -0,0 +1,392 @@
+#include "ImageExport.h"
+#include "ImageProcessor.h"
+#include "LatencySuite.h"
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QImage>
+#include <QPixmap>
+#include <QSaveFile>
+#include <QTemporaryDir>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <vector>
+#include <zlib.h>
+
+namespace {
+
+    const size_t StripeBytes = 1 << 20; // Объем исходных строк одной полосы сжатия
+    const int MinAdaptiveLevel = 3;     // С этого уровня фильтр строки выбирается
+
+    const uint8_t PngSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+    void putUint32(uint8_t* out, uint32_t value) {
+        out[0] = static_cast<uint8_t>(value >> 24);
+        out[1] = static_cast<uint8_t>(value >> 16);
+        out[2] = static_cast<uint8_t>(value >> 8);
+        out[3] = static_cast<uint8_t>(value);
+    }
+
+    bool writeChunk(QIODevice& device, const char* type, const uint8_t* data, size_t size) {
+        uint8_t header[8];
+        putUint32(header, static_cast<uint32_t>(size));
+        std::memcpy(header + 4, type, 4);
+        uLong crc = crc32(0L, header + 4, 4);
+        if (size > 0) {
+            crc = crc32(crc, data, static_cast<uInt>(size));
+        }
+        uint8_t trailer[4];
+        putUint32(trailer, static_cast<uint32_t>(crc));
+        return device.write(reinterpret_cast<const char*>(header), 8) == 8
+            && (size == 0 || device.write(reinterpret_cast<const char*>(data), qint64(size)) == qint64(size))
+            && device.write(reinterpret_cast<const char*>(trailer), 4) == 4;
+    }
+
+    // Строка в порядке байтов PNG: 16-битные значения - старшим байтом вперед.
+    // При заданной таблице окна строка сразу переводится в 8 бит
+    void pngRow(const cv::Mat& image, int y, const uchar* lut, uint8_t* out) {
+        if (image.depth() == CV_8U) {
+            const uint8_t* row = image.ptr<uint8_t>(y);
+            if (lut) {
+                for (int x = 0; x < image.cols; ++x) {
+                    out[x] = lut[row[x]];
+                }
+            }
+            else {
+                std::memcpy(out, row, size_t(image.cols));
+            }
+        }
+        else {
+            const uint16_t* row = image.ptr<uint16_t>(y);
+            if (lut) {
+                for (int x = 0; x < image.cols; ++x) {
+                    out[x] = lut[row[x]];
+                }
+            }
+            else {
+                for (int x = 0; x < image.cols; ++x) {
+                    out[2 * x] = static_cast<uint8_t>(row[x] >> 8);
+                    out[2 * x + 1] = static_cast<uint8_t>(row[x]);
+                }
+            }
+        }
+    }
+
+    inline uint8_t paeth(int a, int b, int c) {
+        const int p = a + b - c;
+        const int pa = std::abs(p - a);
+        const int pb = std::abs(p - b);
+        const int pc = std::abs(p - c);
+        return static_cast<uint8_t>(pa <= pb && pa <= pc ? a : (pb <= pc ? b : c));
+    }
+
+    // Фильтр type (0 None, 1 Sub, 2 Up, 3 Average, 4 Paeth) строки row длиной length
+    // при предыдущей строке prior (нули для первой); out - length + 1 байт с типом фильтра
+    void applyFilter(int type, const uint8_t* row, const uint8_t* prior, size_t length, size_t bpp, uint8_t* out) {
+        out[0] = static_cast<uint8_t>(type);
+        uint8_t* filtered = out + 1;
+        for (size_t i = 0; i < length; ++i) {
+            const int a = i >= bpp ? row[i - bpp] : 0;
+            const int b = prior[i];
+            const int c = i >= bpp ? prior[i - bpp] : 0;
+            int predictor = 0;
+            switch (type) {
+            case 1: predictor = a; break;
+            case 2: predictor = b; break;
+            case 3: predictor = (a + b) >> 1; break;
+            case 4: predictor = paeth(a, b, c); break;
+            default: break;
+            }
+            filtered[i] = static_cast<uint8_t>(row[i] - predictor);
+        }
+    }
+
+    // Эвристика libpng: выбирается фильтр с наименьшей суммой модулей
+    // остатков, считая байты знаковыми
+    uint64_t residualCost(const uint8_t* filtered, size_t length) {
+        uint64_t cost = 0;
+        for (size_t i = 0; i < length; ++i) {
+            cost += static_cast<uint64_t>(std::abs(static_cast<int>(static_cast<int8_t>(filtered[i]))));
+        }
+        return cost;
+    }
+
+    // Сжатая полоса строк и сумма Adler-32 ее несжатых (отфильтрованных) данных
+    struct Stripe {
+        std::vector<uint8_t> compressed;
+        uLong adler = 0;
+        size_t rawSize = 0;
+        bool ok = false;
+    };
+
+    // Полоса сжимается независимым блоком deflate. Промежуточные полосы
+    // завершаются Z_SYNC_FLUSH (граница байта), последняя - Z_FINISH,
+    // поэтому склеенные полосы образуют один поток deflate. Словарь
+    // предыдущей полосы не передается: при полосах около мегабайта
+    // потеря степени сжатия мала
+    void compressStripe(const cv::Mat& image, const uchar* lut, int firstRow, int lastRow, int level, bool last, Stripe& stripe) {
+        const size_t bpp = !lut && image.depth() == CV_16U ? 2 : 1;
+        const size_t length = size_t(image.cols) * bpp;
+        const bool adaptive = level >= MinAdaptiveLevel;
+
+        std::vector<uint8_t> prior(length, 0), row(length);
+        std::vector<uint8_t> raw((length + 1) * size_t(lastRow - firstRow));
+        std::vector<uint8_t> candidate(adaptive ? length + 1 : 0);
+        if (firstRow > 0) {
+            pngRow(image, firstRow - 1, lut, prior.data());
+        }
+        for (int y = firstRow; y < lastRow; ++y) {
+            pngRow(image, y, lut, row.data());
+            uint8_t* out = raw.data() + (length + 1) * size_t(y - firstRow);
+            if (!adaptive) {
+                applyFilter(2, row.data(), prior.data(), length, bpp, out);
+            }
+            else {
+                uint64_t bestCost = UINT64_MAX;
+                for (int type = 0; type < 5; ++type) {
+                    applyFilter(type, row.data(), prior.data(), length, bpp, candidate.data());
+                    const uint64_t cost = residualCost(candidate.data() + 1, length);
+                    if (cost < bestCost) {
+                        bestCost = cost;
+                        std::memcpy(out, candidate.data(), length + 1);
+                    }
+                }
+            }
+            std::swap(prior, row);
+        }
+
+        stripe.rawSize = raw.size();
+        stripe.adler = adler32(adler32(0L, Z_NULL, 0), raw.data(), static_cast<uInt>(raw.size()));
+
+        z_stream stream{};
+        if (deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS, 8, Z_FILTERED) != Z_OK) {
+            return;
+        }
+        stripe.compressed.resize(deflateBound(&stream, static_cast<uLong>(raw.size())) + 16);
+        stream.next_in = raw.data();
+        stream.avail_in = static_cast<uInt>(raw.size());
+        stream.next_out = stripe.compressed.data();
+        stream.avail_out = static_cast<uInt>(stripe.compressed.size());
+        const int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+        for (;;) {
+            if (stream.avail_out == 0) {
+                const size_t used = stripe.compressed.size();
+                stripe.compressed.resize(used * 2);
+                stream.next_out = stripe.compressed.data() + used;
+                stream.avail_out = static_cast<uInt>(used);
+            }
+            const int status = deflate(&stream, flush);
+            if (status == Z_STREAM_END) {
+                stripe.ok = true;
+                break;
+            }
+            if (status != Z_OK && status != Z_BUF_ERROR) {
+                break;
+            }
+            if (!last && stream.avail_in == 0 && stream.avail_out != 0) {
+                stripe.ok = true;
+                break;
+            }
+        }
+        stripe.compressed.resize(stream.total_out);
+        deflateEnd(&stream);
+    }
+
+    // PNG целиком: полосы сжимаются группами по числу потоков и пишутся
+    // по порядку, поэтому в памяти одновременно лишь несколько полос
+    bool writePng(const cv::Mat& image, const uchar* lut, int level, QIODevice& device) {
+        const int bitDepth = !lut && image.depth() == CV_16U ? 16 : 8;
+        const size_t rowBytes = size_t(image.cols) * (bitDepth / 8) + 1;
+        const int stripeRows = static_cast<int>(std::max<size_t>(1, StripeBytes / rowBytes));
+        const int stripeCount = (image.rows + stripeRows - 1) / stripeRows;
+        level = std::clamp(level, 1, 9);
+
+        uint8_t header[13];
+        putUint32(header, static_cast<uint32_t>(image.cols));
+        putUint32(header + 4, static_cast<uint32_t>(image.rows));
+        header[8] = static_cast<uint8_t>(bitDepth);
+        header[9] = 0;  // Оттенки серого
+        header[10] = 0; // deflate
+        header[11] = 0; // Адаптивная фильтрация
+        header[12] = 0; // Без чересстрочности
+        if (device.write(reinterpret_cast<const char*>(PngSignature), 8) != 8 || !writeChunk(device, "IHDR", header, sizeof(header))) {
+            return false;
+        }
+
+        // Заголовок zlib отдельным блоком IDAT: CMF - deflate с окном 32 КБ,
+        // FLG - уровень сжатия и контрольные биты
+        const int levelFlag = level == 1 ? 0 : (level < 6 ? 1 : (level == 6 ? 2 : 3));
+        uint8_t zlibHeader[2] = { 0x78, static_cast<uint8_t>(levelFlag << 6) };
+        zlibHeader[1] = static_cast<uint8_t>(zlibHeader[1] + 31 - ((zlibHeader[0] << 8 | zlibHeader[1]) % 31));
+        if (!writeChunk(device, "IDAT", zlibHeader, sizeof(zlibHeader))) {
+            return false;
+        }
+
+        uLong adler = adler32(0L, Z_NULL, 0);
+        const int batch = std::max(cv::getNumThreads(), 1) * 2;
+        std::vector<Stripe> stripes(size_t(std::min(batch, stripeCount)));
+        for (int first = 0; first < stripeCount; first += batch) {
+            const int count = std::min(batch, stripeCount - first);
+            cv::parallel_for_(cv::Range(0, count), [&](const cv::Range& range) {
+                for (int i = range.start; i < range.end; ++i) {
+                    const int index = first + i;
+                    stripes[i] = Stripe();
+                    compressStripe(image, lut, index * stripeRows, std::min(image.rows, (index + 1) * stripeRows),
+                        level, index == stripeCount - 1, stripes[i]);
+                }
+            });
+            for (int i = 0; i < count; ++i) {
+                const Stripe& stripe = stripes[i];
+                if (!stripe.ok || !writeChunk(device, "IDAT", stripe.compressed.data(), stripe.compressed.size())) {
+                    return false;
+                }
+                adler = adler32_combine(adler, stripe.adler, static_cast<z_off_t>(stripe.rawSize));
+            }
+        }
+
+        uint8_t trailer[4];
+        putUint32(trailer, static_cast<uint32_t>(adler));
+        return writeChunk(device, "IDAT", trailer, sizeof(trailer)) && writeChunk(device, "IEND", nullptr, 0);
+    }
+
+    bool savePngFile(const cv::Mat& image, const uchar* lut, int level, const QString& fileName) {
+        QSaveFile file(fileName);
+        return file.open(QIODevice::WriteOnly) && writePng(image, lut, level, file) && file.commit();
+    }
+
+    cv::Mat grayscale(const cv::Mat& image) {
+        if (image.channels() == 1) {
+            return image;
+        }
+        cv::Mat gray;
+        cv::cvtColor(image, gray, image.channels() == 4 ? cv::COLOR_BGRA2GRAY : cv::COLOR_BGR2GRAY);
+        return gray;
+    }
+
+    // Медиана времени runs прогонов операции, мс
+    double medianTime(int runs, const std::function<bool()>& operation, bool& ok) {
+        std::vector<double> times;
+        for (int i = 0; i < std::max(runs, 1); ++i) {
+            QElapsedTimer timer;
+            timer.start();
+            ok = operation() && ok;
+            times.push_back(timer.nsecsElapsed() / 1e6);
+        }
+        std::sort(times.begin(), times.end());
+        return times[times.size() / 2];
+    }
+
+} // namespace
+
+namespace ImageExport {
+
+    bool savePng(const cv::Mat& image, const QString& fileName, int level) {
+        if (image.empty() || (image.type() != CV_8UC1 && image.type() != CV_16UC1)) {
+            return false;
+        }
+        return savePngFile(image, nullptr, level, fileName);
+    }
+
+    bool saveReport(const cv::Mat& image, const QString& fileName, double low, double high, int level, int jpegQuality) {
+        if (image.empty()) {
+            return false;
+        }
+        const cv::Mat gray = grayscale(image);
+        if (gray.depth() != CV_8U && gray.depth() != CV_16U) {
+            return false;
+        }
+
+        if (fileName.endsWith(".png", Qt::CaseInsensitive)) {
+            const std::vector<uchar> lut = ImageProcessor::windowTable(low, high);
+            return savePngFile(gray, lut.data(), level, fileName);
+        }
+
+        // Кодирование в память: cv::imwrite не понимает не-ASCII пути в Windows,
+        // а QSaveFile заменяет целевой файл только после полной записи
+        const cv::Mat display = ImageProcessor::applyWindow(gray, low, high);
+        const std::string extension = "." + QFileInfo(fileName).suffix().toLower().toStdString();
+        std::vector<uchar> encoded;
+        try {
+            if (!cv::imencode(extension, display, encoded, { cv::IMWRITE_JPEG_QUALITY, jpegQuality })) {
+                return false;
+            }
+        }
+        catch (const cv::Exception&) {
+            return false; // Формат не поддерживается OpenCV
+        }
+        QSaveFile file(fileName);
+        return file.open(QIODevice::WriteOnly)
+            && file.write(reinterpret_cast<const char*>(encoded.data()), qint64(encoded.size())) == qint64(encoded.size())
+            && file.commit();
+    }
+
+    int runBenchmark(int size, int runs, std::ostream& out) {
+        if (size <= 0 || size > LatencySuite::MaxFilmSize) {
+            out << "Unsupported film size " << size << " (1.." << LatencySuite::MaxFilmSize << ")\n";
+            return 1;
+        }
+        if (runs <= 0) {
+            out << "Unsupported number of runs " << runs << "\n";
+            return 1;
+        }
+        QTemporaryDir directory;
+        if (!directory.isValid()) {
+            out << "Cannot create temporary directory\n";
+            return 1;
+        }
+        const cv::Mat film = LatencySuite::generateFilm(size, 16, 1);
+        double minValue = 0.0, maxValue = 0.0;
+        cv::minMaxLoc(film, &minValue, &maxValue);
+        const double low = minValue;
+        const double high = maxValue;
+        const double megapixels = static_cast<double>(size) * size / 1e6;
+
+        out << "Film: " << size << "x" << size << " 16-bit, runs: " << runs << ", threads: " << cv::getNumThreads() << "\n";
+        out << std::left << std::setw(36) << "path" << std::right << std::setw(12) << "median ms"
+            << std::setw(10) << "Mpx/s" << std::setw(12) << "size KB" << "\n";
+        out << std::fixed << std::setprecision(1);
+
+        bool ok = true;
+        auto report = [&](const char* name, const QString& fileName, const std::function<bool()>& operation) {
+            const double time = medianTime(runs, operation, ok);
+            out << std::left << std::setw(36) << name << std::right << std::setw(12) << time
+                << std::setw(10) << megapixels / (time / 1e3) << std::setw(12) << QFileInfo(fileName).size() / 1024.0 << "\n";
+        };
+
+        // Прежний путь: 8-битная картинка экрана через QPixmap и кодировщики Qt
+        const QString pixmapPng = directory.filePath("pixmap.png");
+        const QString pixmapJpeg = directory.filePath("pixmap.jpg");
+        report("QPixmap::save PNG 8-bit", pixmapPng, [&]() {
+            return QPixmap::fromImage(ImageProcessor::cvMatToQImage(ImageProcessor::applyWindow(film, low, high))).save(pixmapPng);
+        });
+        report("QPixmap::save JPEG", pixmapJpeg, [&]() {
+            return QPixmap::fromImage(ImageProcessor::cvMatToQImage(ImageProcessor::applyWindow(film, low, high))).save(pixmapJpeg, nullptr, 90);
+        });
+        const QString qimagePng = directory.filePath("qimage16.png");
+        report("QImage::save PNG 16-bit", qimagePng, [&]() {
+            return ImageProcessor::cvMatToQImage(film).save(qimagePng);
+        });
+
+        const QString png16 = directory.filePath("export16.png");
+        const QString png16Fast = directory.filePath("export16_fast.png");
+        const QString reportPng = directory.filePath("report.png");
+        const QString reportJpeg = directory.filePath("report.jpg");
+        report("ImageExport PNG 16-bit", png16, [&]() { return ImageExport::savePng(film, png16); });
+        report("ImageExport PNG 16-bit fast", png16Fast, [&]() { return ImageExport::savePng(film, png16Fast, FastPngLevel); });
+        report("ImageExport report PNG 8-bit", reportPng, [&]() { return ImageExport::saveReport(film, reportPng, low, high); });
+        report("ImageExport report JPEG", reportJpeg, [&]() { return ImageExport::saveReport(film, reportJpeg, low, high); });
+
+        // Проверка без потерь: чтение кодировщиком Qt и сравнение с исходником
+        const QImage decoded(png16);
+        const cv::Mat restored = decoded.format() == QImage::Format_Grayscale16 ? ImageProcessor::QImageToCvMat(decoded) : cv::Mat();
+        const bool lossless = !restored.empty() && restored.size() == film.size() && cv::norm(restored, film, cv::NORM_INF) == 0.0;
+        out << "16-bit PNG lossless: " << (lossless ? "yes" : "NO") << "\n";
+
+        const bool passed = ok && lossless;
+        out << (passed ? "PASS" : "FAIL") << "\n";
+        return passed ? 0 : 1;
+    }
+
+} // namespace ImageExport
@@ -0,0 +1,36 @@
+#ifndef IMAGEEXPORT_H
+#define IMAGEEXPORT_H
+
+#include <QString>
+#include <opencv2/opencv.hpp>
+#include <ostream>
+
+// Экспорт в общие форматы для отчетов: PNG пишется собственным кодировщиком,
+// который фильтрует и сжимает полосы строк параллельно (каждая полоса -
+// отдельный блок deflate, суммы Adler-32 полос объединяются), JPEG и прочие
+// форматы кодируются OpenCV
+namespace ImageExport {
+
+    const int FastPngLevel = 1;    // Уровень zlib для быстрого сжатия
+    const int DefaultPngLevel = 6;
+
+    // Серое изображение CV_8UC1 или CV_16UC1 в PNG той же разрядности без потерь.
+    // level - уровень сжатия zlib (1..9); при уровне ниже 3 строки фильтруются
+    // одним фильтром Up вместо выбора лучшего из пяти
+    bool savePng(const cv::Mat& image, const QString& fileName, int level = DefaultPngLevel);
+
+    // Изображение для отчета: окно [low, high] переводится в 8 бит. Для PNG окно
+    // применяется при подготовке строк к фильтрации, без промежуточного кадра;
+    // для JPEG (jpegQuality) и прочих форматов - одним проходом таблицы
+    bool saveReport(const cv::Mat& image, const QString& fileName, double low, double high,
+        int level = DefaultPngLevel, int jpegQuality = 90);
+
+    // Сравнение с прежним путем через QPixmap/QImage на синтетическом снимке
+    // size x size: время (медиана runs прогонов), объем файла и проверка
+    // 16-битного PNG без потерь. size - от 1 до LatencySuite::MaxFilmSize, иначе
+    // возвращается 1. Требует созданного QGuiApplication
+    int runBenchmark(int size, int runs, std::ostream& out);
+
+} // namespace ImageExport
+
+#endif // IMAGEEXPORT_H
@@ -0,0 +1,83 @@
+#include "ImageHistogram.h"
+#include <algorithm>
+
+namespace {
+
+    template <typename T>
+    void accumulateBand(const cv::Mat& image, const cv::Range& rows, uint32_t* hist) {
+        for (int y = rows.start; y < rows.end; ++y) {
+            const T* src = image.ptr<T>(y);
+            for (int x = 0; x < image.cols; ++x) {
+                ++hist[src[x]];
+            }
+        }
+    }
+
+} // namespace
+
+int ImageHistogram::percentile(double fraction) const {
+    if (isEmpty()) {
+        return 0;
+    }
+
+    const uint64_t target = static_cast<uint64_t>(std::clamp(fraction, 0.0, 1.0) * total);
+    uint64_t accumulated = 0;
+    for (int value = minValue; value <= maxValue; ++value) {
+        accumulated += bins[value];
+        if (accumulated > target) {
+            return value;
+        }
+    }
+    return maxValue;
+}
+
+ImageHistogram ImageHistogram::compute(const cv::Mat& image) {
+    ImageHistogram histogram;
+    if (image.empty() || image.channels() != 1 || (image.depth() != CV_8U && image.depth() != CV_16U)) {
+        return histogram;
+    }
+
+    const int64 start = cv::getTickCount();
+    const size_t binCount = image.depth() == CV_16U ? 65536 : 256;
+
+    // Каждая полоса строк заполняет собственную гистограмму без синхронизации
+    const int minBandRows = 64;
+    const int bandCount = std::max(1, std::min(cv::getNumThreads(), image.rows / minBandRows));
+    std::vector<std::vector<uint32_t>> partial(bandCount, std::vector<uint32_t>(binCount, 0));
+
+    cv::parallel_for_(cv::Range(0, bandCount), [&](const cv::Range& range) {
+        for (int band = range.start; band < range.end; ++band) {
+            const cv::Range rows(image.rows * band / bandCount, image.rows * (band + 1) / bandCount);
+            if (image.depth() == CV_16U) {
+                accumulateBand<uint16_t>(image, rows, partial[band].data());
+            }
+            else {
+                accumulateBand<uint8_t>(image, rows, partial[band].data());
+            }
+        }
+    });
+
+    // Слияние частичных гистограмм параллельно по диапазонам интервалов
+    histogram.bins.assign(binCount, 0);
+    const int mergeChunks = 16;
+    cv::parallel_for_(cv::Range(0, mergeChunks), [&](const cv::Range& range) {
+        for (int chunk = range.start; chunk < range.end; ++chunk) {
+            const size_t first = binCount * chunk / mergeChunks;
+            const size_t last = binCount * (chunk + 1) / mergeChunks;
+            for (const std::vector<uint32_t>& band : partial) {
+                for (size_t i = first; i < last; ++i) {
+                    histogram.bins[i] += band[i];
+                }
+            }
+        }
+    });
+
+    histogram.total = static_cast<uint64_t>(image.total());
+    auto first = std::find_if(histogram.bins.begin(), histogram.bins.end(), [](uint32_t count) { return count != 0; });
+    auto last = std::find_if(histogram.bins.rbegin(), histogram.bins.rend(), [](uint32_t count) { return count != 0; });
+    histogram.minValue = static_cast<int>(first - histogram.bins.begin());
+    histogram.maxValue = static_cast<int>(binCount - 1 - (last - histogram.bins.rbegin()));
+
+    histogram.elapsedMs = (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+    return histogram;
+}
@@ -0,0 +1,27 @@
+#ifndef IMAGEHISTOGRAM_H
+#define IMAGEHISTOGRAM_H
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <vector>
+
+// Гистограмма полутонового изображения: 65536 интервалов для 16-битных
+// данных и 256 для 8-битных, с минимумом, максимумом и процентилями
+struct ImageHistogram {
+    std::vector<uint32_t> bins;
+    int minValue = 0;
+    int maxValue = 0;
+    uint64_t total = 0;
+    double elapsedMs = 0.0; // Время построения
+
+    bool isEmpty() const { return total == 0; }
+
+    // Значение, ниже которого лежит доля fraction пикселей (0..1)
+    int percentile(double fraction) const;
+
+    // Построение параллельно по полосам строк; для цветных изображений
+    // возвращается пустая гистограмма
+    static ImageHistogram compute(const cv::Mat& image);
+};
+
+#endif // IMAGEHISTOGRAM_H
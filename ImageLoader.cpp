@@ -0,0 +1,98 @@
+#include "ImageLoader.h"
+#include "ImageProcessor.h"
+#include "DicomProcessor.h"
+#include "TiffProcessor.h"
+#include "DetectorCalibration.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QStringList>
+
+namespace {
+
+    // Файлы носителя DICOM (DICOMDIR) называются без расширения: формат
+    // узнается по метке DICM после 128-байтной преамбулы
+    bool isDicomFile(const QString& fileName) {
+        if (fileName.endsWith(".dcm", Qt::CaseInsensitive)) {
+            return true;
+        }
+        if (!QFileInfo(fileName).suffix().isEmpty()) {
+            return false;
+        }
+        QFile file(fileName);
+        return file.open(QIODevice::ReadOnly) && file.read(132).mid(128) == "DICM";
+    }
+
+} // namespace
+
+namespace ImageLoader {
+
+    QMap<QString, QString> parseInfoTags(const QString& infoMsg) {
+        QMap<QString, QString> tagsMap;
+        QStringList lines = infoMsg.split("\n"); // Разделение информации на строки
+
+        foreach(const QString & line, lines) {
+            if (line.trimmed().isEmpty()) continue; // Пропускаем пустые строки
+
+            // Разделяем строку на ключ и значение по первому вхождению двоеточия
+            int splitIndex = line.indexOf(":");
+            if (splitIndex == -1) continue; // Если двоеточие не найдено, пропускаем строку
+
+            QString key = line.left(splitIndex).trimmed();
+            QString value = line.mid(splitIndex + 1).trimmed();
+
+            if (!key.isEmpty() && !value.isEmpty()) {
+                tagsMap.insert(key, value); // Добавляем пару ключ-значение в карту
+            }
+        }
+
+        return tagsMap;
+    }
+
+    LoadedImage load(const QString& fileName) {
+        LoadedImage loaded;
+
+        if (fileName.endsWith(".raw", Qt::CaseInsensitive)) {
+            loaded.image = ImageProcessor::readImageFromRawFile(fileName.toStdString(), loaded.tags);
+            if (loaded.image.empty()) {
+                throw std::runtime_error("Не удалось открыть изображение .raw");
+            }
+            loaded.bitDepth = static_cast<int>(loaded.image.elemSize() * 8);
+        }
+        else if (isDicomFile(fileName)) {
+            QString infoMsg;
+            QImage qImage = DicomProcessor::processDicom(fileName, infoMsg);
+            loaded.tags = parseInfoTags(infoMsg);
+            if (qImage.isNull()) {
+                throw std::runtime_error("Не удалось открыть DICOM изображение");
+            }
+            loaded.bitDepth = qImage.depth();
+            loaded.image = ImageProcessor::QImageToCvMat(std::move(qImage), false);
+            loaded.dpi = 96; // Assuming default DPI for DICOM images
+        }
+        else if (fileName.endsWith(".tiff", Qt::CaseInsensitive) || fileName.endsWith(".tif", Qt::CaseInsensitive)) {
+            if (!TiffProcessor::loadTiffWithTags(fileName, loaded.image, loaded.tags) || loaded.image.empty()) {
+                throw std::runtime_error("Не удалось открыть изображение .tiff");
+            }
+            loaded.bitDepth = static_cast<int>(loaded.image.elemSize() * 8);
+            loaded.dpi = static_cast<int>(ImageProcessor::cvMatToQImage(loaded.image).dotsPerMeterX() * 0.0254); // Convert from dots per meter to DPI
+        }
+        else {
+            QImage image;
+            if (!image.load(fileName)) {
+                throw std::runtime_error("Не удалось открыть изображение");
+            }
+            loaded.bitDepth = image.depth();
+            loaded.dpi = static_cast<int>(image.dotsPerMeterX() * 0.0254); // Convert from dots per meter to DPI
+            loaded.image = ImageProcessor::QImageToCvMat(std::move(image), false);
+        }
+
+        // Коррекция темнового сигнала, усиления и дефектных пикселей по калибровке детектора
+        DetectorCalibration::apply(loaded.image, loaded.tags);
+
+        // Гистограмма (а с ней минимум и максимум) строится для всех форматов
+        loaded.histogram = ImageHistogram::compute(loaded.image);
+        return loaded;
+    }
+
+} // namespace ImageLoader
@@ -0,0 +1,30 @@
+#ifndef IMAGELOADER_H
+#define IMAGELOADER_H
+
+#include <QString>
+#include <QMap>
+#include <opencv2/opencv.hpp>
+#include "ImageHistogram.h"
+
+// Результат загрузки изображения
+struct LoadedImage {
+    cv::Mat image;                  // Исходные пиксели без изменения разрядности
+    QMap<QString, QString> tags;    // Теги файла
+    int bitDepth = 0;               // Глубина цвета, бит
+    int dpi = 0;                    // Разрешение, точек на дюйм
+    ImageHistogram histogram;       // Гистограмма, построенная при загрузке
+};
+
+namespace ImageLoader {
+
+    // Загрузка .raw, DICOM, TIFF и прочих форматов Qt с калибровкой детектора
+    // (если для него есть калибровка) и построением гистограммы.
+    // При ошибке выбрасывает std::runtime_error
+    LoadedImage load(const QString& fileName);
+
+    // Разбор текстового описания DICOM файла "ключ: значение" в теги
+    QMap<QString, QString> parseInfoTags(const QString& infoMsg);
+
+} // namespace ImageLoader
+
+#endif // IMAGELOADER_H
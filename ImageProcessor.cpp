@@ -1,4 +1,6 @@
 #include "ImageProcessor.h"
+#include "FileIntegrity.h"
+#include "Packed12.h"
 #include <fstream>
 #include <iostream>
 #include <QJsonDocument>
@@ -12,169 +14,351 @@ namespace ImageProcessor {
     };
 
     cv::Mat readImageFromRawFile(const std::string& imagePath, QMap<QString, QString>& tags) {
-        std::ifstream file(imagePath, std::ios::binary);
+        std::ifstream file(imagePath, std::ios::binary | std::ios::ate);
         if (!file.is_open()) {
             throw std::runtime_error("Не удалось открыть файл: " + imagePath);
         }
+        const std::streamoff fileSize = file.tellg();
+        file.seekg(0);
 
         uint16_t width, height;
         file.read(reinterpret_cast<char*>(&height), sizeof(height));
         file.read(reinterpret_cast<char*>(&width), sizeof(width));
-
-        cv::Mat image(height, width, CV_16UC1);
-        file.read(reinterpret_cast<char*>(image.data), width * height * sizeof(uint16_t));
-
-        // Проверка на конец файла
-        if (file.eof()) {
+        if (!file) {
             throw std::runtime_error("Файл поврежден или имеет неверный формат: " + imagePath);
         }
+        const std::streamoff headerBytes = 2 * sizeof(uint16_t);
 
-        // Позиционирование на конец файла для чтения длины JSON
-        file.seekg(-static_cast<int>(sizeof(uint32_t)), std::ios::end);
-        uint32_t jsonLength;
-        file.read(reinterpret_cast<char*>(&jsonLength), sizeof(jsonLength));
-
-        // Проверка корректности длины JSON
-        std::streamoff fileSize = file.tellg();
-        if (jsonLength <= 0 || jsonLength > fileSize - sizeof(uint32_t) - width * height * sizeof(uint16_t) - 2 * sizeof(uint16_t)) {
-            // Некорректная длина JSON, возвращаем изображение без тегов
-            file.close();
-            return image;
+        // Трейлер читается до пикселей: от признака упаковки зависит их объем.
+        // JSON строка и ее длина записаны в самом конце файла
+        QJsonObject json;
+        uint32_t jsonLength = 0;
+        if (fileSize >= headerBytes + std::streamoff(sizeof(jsonLength))) {
+            file.seekg(fileSize - std::streamoff(sizeof(jsonLength)));
+            file.read(reinterpret_cast<char*>(&jsonLength), sizeof(jsonLength));
+            if (file && jsonLength > 0 && std::streamoff(jsonLength) <= fileSize - headerBytes - std::streamoff(sizeof(jsonLength))) {
+                file.seekg(fileSize - std::streamoff(sizeof(jsonLength)) - jsonLength);
+                std::vector<char> jsonString(jsonLength);
+                file.read(jsonString.data(), jsonLength);
+                const QJsonDocument doc = QJsonDocument::fromJson(QByteArray(jsonString.data(), jsonLength));
+                if (file && doc.isObject()) {
+                    json = doc.object();
+                }
+            }
         }
 
-        // Чтение JSON строки
-        file.seekg(-static_cast<int>(sizeof(uint32_t) + jsonLength), std::ios::end);
-        std::vector<char> jsonString(jsonLength);
-        file.read(jsonString.data(), jsonLength);
-
-        // Проверка на конец файла после чтения JSON
-        if (file.eof()) {
+        int shift = json.contains(Packed12::RawPackingKey) ? json.value(Packed12::RawPackingKey).toString().toInt() : -1;
+        std::streamoff pixelBytes = shift >= 0
+            ? std::streamoff(Packed12::packedSize(width)) * height
+            : std::streamoff(width) * height * std::streamoff(sizeof(uint16_t));
+        // Трейлер не совпадает с объемом пикселей: файл без тегов (или записан не нами)
+        if (!json.isEmpty() && headerBytes + pixelBytes + jsonLength + std::streamoff(sizeof(jsonLength)) > fileSize) {
+            if (shift >= 0) {
+                throw std::runtime_error("Файл поврежден или имеет неверный формат: " + imagePath);
+            }
+            json = QJsonObject();
+        }
+        if ((shift != -1 && shift != 0 && shift != 4) || headerBytes + pixelBytes > fileSize) {
             throw std::runtime_error("Файл поврежден или имеет неверный формат: " + imagePath);
         }
 
-        QJsonDocument doc = QJsonDocument::fromJson(QByteArray(jsonString.data(), jsonLength));
-        if (doc.isNull() || !doc.isObject()) {
-            // Ошибка парсинга JSON, возвращаем изображение без тегов
-            file.close();
-            return image;
+        // Упакованные строки читаются как есть и распаковываются одним проходом
+        cv::Mat stored = shift >= 0 ? cv::Mat(height, static_cast<int>(Packed12::packedSize(width)), CV_8UC1) : cv::Mat(height, width, CV_16UC1);
+        file.seekg(headerBytes);
+        file.read(reinterpret_cast<char*>(stored.data), pixelBytes);
+        if (!file) {
+            throw std::runtime_error("Файл поврежден или имеет неверный формат: " + imagePath);
         }
+        file.close();
 
-        QJsonObject json = doc.object();
         for (auto it = json.begin(); it != json.end(); ++it) {
             tags.insert(it.key(), it.value().toString());
         }
+        tags.remove(Packed12::RawPackingKey);
 
-        file.close();
+        // Проверка контрольной суммы заголовка и пикселей в том виде, как они
+        // записаны на диск (файлы прежних версий ее не содержат)
+        const QString storedChecksum = tags.take(FileIntegrity::RawChecksumKey);
+        if (!storedChecksum.isEmpty()) {
+            const uint16_t header[2] = { height, width };
+            uint32_t crc = FileIntegrity::crc32c(0, header, sizeof(header));
+            crc = FileIntegrity::crc32c(crc, stored.data, size_t(pixelBytes));
+            if (FileIntegrity::checksumText(crc) != storedChecksum) {
+                throw std::runtime_error("Контрольная сумма не совпадает, файл поврежден: " + imagePath);
+            }
+        }
+
+        // Отдельный проход cv::minMaxLoc не нужен: значения CV_16UC1 не выходят
+        // за 16-битный диапазон, а минимум и максимум дает гистограмма загрузки
+        return shift >= 0 ? Packed12::unpack(stored, width, shift) : stored;
+    }
 
-        double minVal, maxVal;
-        cv::minMaxLoc(image, &minVal, &maxVal);
-        if (minVal < 0 || maxVal > 65535) {
-            throw std::runtime_error("Ошибка: значения пикселей выходят за пределы 16-битного диапазона.");
+    RawImageWriter::RawImageWriter(const std::string& filePath, const cv::Size& imageSize, int packShift)
+        : file(QString::fromStdString(filePath)), size(imageSize), shift(packShift), rowsWritten(0), checksum(0) {
+        if (shift >= 0) {
+            packedRow.resize(Packed12::packedSize(size.width));
+        }
+        // Размеры хранятся 16-битными
+        if (size.width > 65535 || size.height > 65535 || !file.open(QIODevice::WriteOnly)) {
+            return;
         }
 
-        return image;
+        const uint16_t header[2] = { static_cast<uint16_t>(size.height), static_cast<uint16_t>(size.width) };
+        file.write(reinterpret_cast<const char*>(header), sizeof(header));
+        checksum = FileIntegrity::crc32c(checksum, header, sizeof(header));
     }
 
-    bool saveImageToRawFormat(const cv::Mat& image, const std::string& filePath, const QMap<QString, QString>& tags) {
-        std::ofstream file(filePath, std::ios::binary);
-        if (!file.is_open()) {
+    bool RawImageWriter::isOpen() const {
+        return file.isOpen() && file.error() == QFileDevice::NoError;
+    }
+
+    bool RawImageWriter::writeRows(const cv::Mat& band) {
+        if (!isOpen() || band.type() != CV_16UC1 || band.cols != size.width || rowsWritten + band.rows > size.height) {
             return false;
         }
 
-        uint16_t width = static_cast<uint16_t>(image.cols);
-        uint16_t height = static_cast<uint16_t>(image.rows);
+        // Построчно: полоса может быть несплошным фрагментом большего изображения
+        const qint64 rowBytes = shift >= 0 ? qint64(packedRow.size()) : qint64(band.cols) * qint64(sizeof(uint16_t));
+        for (int y = 0; y < band.rows; ++y) {
+            const char* row = reinterpret_cast<const char*>(band.ptr<uint16_t>(y));
+            if (shift >= 0) {
+                Packed12::packRow(band.ptr<uint16_t>(y), packedRow.data(), size_t(band.cols), shift);
+                row = reinterpret_cast<const char*>(packedRow.data());
+            }
+            if (file.write(row, rowBytes) != rowBytes) {
+                return false;
+            }
+            checksum = FileIntegrity::crc32c(checksum, row, size_t(rowBytes));
+        }
+        rowsWritten += band.rows;
+        return true;
+    }
 
-        file.write(reinterpret_cast<const char*>(&height), sizeof(height));
-        file.write(reinterpret_cast<const char*>(&width), sizeof(width));
-        file.write(reinterpret_cast<const char*>(image.data), width * height * sizeof(uint16_t));
+    bool RawImageWriter::finish(const QMap<QString, QString>& tags) {
+        if (!isOpen() || rowsWritten != size.height) {
+            file.cancelWriting();
+            return false;
+        }
 
-        // Подготовка JSON строки с тегами
+        // Подготовка JSON строки с тегами и контрольной суммой
         QJsonObject json;
         for (auto it = tags.begin(); it != tags.end(); ++it) {
             json.insert(it.key(), it.value());
         }
-        QJsonDocument doc(json);
-        std::string jsonString = doc.toJson(QJsonDocument::Compact).toStdString();
-        uint32_t jsonLength = static_cast<uint32_t>(jsonString.size());
-
-        // Запись JSON строки
-        file.write(jsonString.c_str(), jsonLength);
+        json.insert(FileIntegrity::RawChecksumKey, FileIntegrity::checksumText(checksum));
+        if (shift >= 0) {
+            json.insert(Packed12::RawPackingKey, QString::number(shift));
+        }
+        const QByteArray jsonString = QJsonDocument(json).toJson(QJsonDocument::Compact);
+        const uint32_t jsonLength = static_cast<uint32_t>(jsonString.size());
 
-        // Запись длины JSON строки в самом конце файла
+        // Запись JSON строки и ее длины в самом конце файла
+        file.write(jsonString);
         file.write(reinterpret_cast<const char*>(&jsonLength), sizeof(jsonLength));
 
-        file.close();
-        return true;
+        // commit() завершается неудачей, если хотя бы одна запись не прошла
+        return file.commit();
     }
 
-    // Преобразование QImage в cv::Mat
-    cv::Mat QImageToCvMat(const QImage& inImage, bool inCloneImageData) {
-        switch (inImage.format()) {
-        case QImage::Format_ARGB32:
-        case QImage::Format_ARGB32_Premultiplied: {
-            cv::Mat mat(inImage.height(), inImage.width(), CV_8UC4, const_cast<uchar*>(inImage.bits()), static_cast<size_t>(inImage.bytesPerLine()));
-            return (inCloneImageData ? mat.clone() : mat);
-        }
-        case QImage::Format_RGB32: {
-            if (!inCloneImageData) {
-                std::cerr << "QImageToCvMat() - Conversion requires cloning because we use a temporary QImage" << std::endl;
+    bool saveImageToRawFormat(const cv::Mat& image, const std::string& filePath, const QMap<QString, QString>& tags) {
+        // 12-битные данные упаковываются, если это не теряет ни одного бита
+        RawImageWriter writer(filePath, image.size(), Packed12::losslessShift(image));
+        return writer.writeRows(image) && writer.finish(tags);
+    }
+
+    namespace {
+
+        // Аллокатор, связывающий время жизни cv::Mat с буфером QImage:
+        // в userdata хранится собственная копия QImage, которая
+        // освобождается вместе с последней ссылкой на матрицу.
+        // Матрица доступна для записи, поэтому буфер отделяется (bits()),
+        // если он еще разделяется с другими QImage.
+        class QImageAllocator : public cv::MatAllocator {
+        public:
+            cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+                cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override {
+                return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
             }
-            QImage swapped = inImage.rgbSwapped();
-            return cv::Mat(swapped.height(), swapped.width(), CV_8UC3, const_cast<uchar*>(swapped.bits()), static_cast<size_t>(swapped.bytesPerLine())).clone();
-        }
-        case QImage::Format_RGB888: {
-            if (!inCloneImageData) {
-                std::cerr << "QImageToCvMat() - Conversion requires cloning because we use a temporary QImage" << std::endl;
+
+            bool allocate(cv::UMatData* u, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override {
+                return cv::Mat::getStdAllocator()->allocate(u, accessFlags, usageFlags);
             }
-            QImage swapped = inImage.rgbSwapped();
-            return cv::Mat(swapped.height(), swapped.width(), CV_8UC3, const_cast<uchar*>(swapped.bits()), static_cast<size_t>(swapped.bytesPerLine())).clone();
+
+            void deallocate(cv::UMatData* u) const override {
+                if (!u) return;
+                CV_Assert(u->urefcount >= 0);
+                CV_Assert(u->refcount >= 0);
+                if (u->refcount == 0) {
+                    delete static_cast<QImage*>(u->userdata);
+                    delete u;
+                }
+            }
+
+            cv::Mat wrap(QImage image, int type) const {
+                QImage* owner = new QImage(std::move(image));
+                cv::Mat mat(owner->height(), owner->width(), type, owner->bits(), static_cast<size_t>(owner->bytesPerLine()));
+                cv::UMatData* u = new cv::UMatData(this);
+                u->data = u->origdata = mat.data;
+                u->size = static_cast<size_t>(owner->sizeInBytes());
+                u->userdata = owner;
+                mat.u = u;
+                mat.addref();
+                return mat;
+            }
+        };
+
+        const QImageAllocator& qImageAllocator() {
+            static QImageAllocator allocator;
+            return allocator;
         }
-        case QImage::Format_Indexed8:
-        case QImage::Format_Grayscale8: {
-            cv::Mat mat(inImage.height(), inImage.width(), CV_8UC1, const_cast<uchar*>(inImage.bits()), static_cast<size_t>(inImage.bytesPerLine()));
-            return (inCloneImageData ? mat.clone() : mat);
+
+        // Очистка буфера QImage, построенного поверх cv::Mat
+        void releaseMat(void* info) {
+            delete static_cast<cv::Mat*>(info);
         }
-        default:
-            std::cerr << "QImageToCvMat() - QImage format not handled in switch: " << inImage.format() << std::endl;
-            break;
+
+        QImage wrapMat(const cv::Mat& mat, QImage::Format format) {
+            cv::Mat* holder = new cv::Mat(mat);
+            return QImage(holder->data, holder->cols, holder->rows, static_cast<qsizetype>(holder->step), format, releaseMat, holder);
         }
 
-        return cv::Mat();
-    }
+    } // namespace
 
-    cv::Mat convertTo16BitGrayscale(const QImage& qImage) {
-        cv::Mat image;
+    // Преобразование QImage в cv::Mat
+    cv::Mat QImageToCvMat(QImage inImage, bool inCloneImageData) {
+        cv::Mat mat;
 
-        // Преобразование QImage в cv::Mat
-        switch (qImage.format()) {
+        switch (inImage.format()) {
         case QImage::Format_RGB32:
         case QImage::Format_ARGB32:
         case QImage::Format_ARGB32_Premultiplied:
-            image = cv::Mat(qImage.height(), qImage.width(), CV_8UC4, const_cast<uchar*>(qImage.bits()), qImage.bytesPerLine()).clone();
-            cv::cvtColor(image, image, cv::COLOR_BGRA2BGR);
+            // В памяти порядок байтов B, G, R, A - совпадает с BGRA OpenCV
+            mat = qImageAllocator().wrap(std::move(inImage), CV_8UC4);
             break;
-        case QImage::Format_RGB888:
-            image = cv::Mat(qImage.height(), qImage.width(), CV_8UC3, const_cast<uchar*>(qImage.bits()), qImage.bytesPerLine()).clone();
-            cv::cvtColor(image, image, cv::COLOR_RGB2BGR);
+        case QImage::Format_BGR888:
+            mat = qImageAllocator().wrap(std::move(inImage), CV_8UC3);
+            break;
+        case QImage::Format_RGB888: {
+            // Единственный случай, где требуется смена порядка каналов:
+            // перестановка выполняется за один проход без временного QImage;
+            // исходный буфер только читается
+            cv::Mat rgb(inImage.height(), inImage.width(), CV_8UC3, const_cast<uchar*>(inImage.constBits()), static_cast<size_t>(inImage.bytesPerLine()));
+            cv::cvtColor(rgb, mat, cv::COLOR_RGB2BGR);
+            return mat;
+        }
+        case QImage::Format_Indexed8:
+            if (!inImage.isGrayscale()) {
+                return QImageToCvMat(inImage.convertToFormat(QImage::Format_RGB32), false);
+            }
+            mat = qImageAllocator().wrap(std::move(inImage), CV_8UC1);
             break;
         case QImage::Format_Grayscale8:
-            image = cv::Mat(qImage.height(), qImage.width(), CV_8UC1, const_cast<uchar*>(qImage.bits()), qImage.bytesPerLine()).clone();
+            mat = qImageAllocator().wrap(std::move(inImage), CV_8UC1);
+            break;
+        case QImage::Format_Grayscale16:
+            mat = qImageAllocator().wrap(std::move(inImage), CV_16UC1);
             break;
         default:
+            if (inImage.isNull()) {
+                break;
+            }
+            // Прочие форматы (Mono, RGB16, RGBA64 и т.д.) приводятся к ближайшему поддерживаемому
+            if (inImage.isGrayscale()) {
+                return QImageToCvMat(inImage.convertToFormat(inImage.depth() > 8 ? QImage::Format_Grayscale16 : QImage::Format_Grayscale8), false);
+            }
+            return QImageToCvMat(inImage.convertToFormat(inImage.hasAlphaChannel() ? QImage::Format_ARGB32 : QImage::Format_RGB32), false);
+        }
+
+        return (inCloneImageData ? mat.clone() : mat);
+    }
+
+    // Преобразование cv::Mat в QImage без копирования данных
+    QImage cvMatToQImage(const cv::Mat& mat) {
+        switch (mat.type()) {
+        case CV_8UC1:
+            return wrapMat(mat, QImage::Format_Grayscale8);
+        case CV_16UC1:
+            return wrapMat(mat, QImage::Format_Grayscale16);
+        case CV_8UC3:
+            return wrapMat(mat, QImage::Format_BGR888);
+        case CV_8UC4:
+            // Альфа-канал для рентгенограмм не используется
+            return wrapMat(mat, QImage::Format_RGB32);
+        default:
+            if (!mat.empty()) {
+                std::cerr << "cvMatToQImage() - cv::Mat type not handled in switch: " << mat.type() << std::endl;
+            }
+            break;
+        }
+
+        return QImage();
+    }
+
+    std::vector<uchar> windowTable(double low, double high) {
+        const double scale = 255.0 / std::max(high - low, 1.0);
+        std::vector<uchar> lut(65536);
+        for (int value = 0; value < 65536; ++value) {
+            lut[value] = cv::saturate_cast<uchar>((value - low) * scale);
+        }
+        return lut;
+    }
+
+    cv::Mat applyWindow(const cv::Mat& image, double low, double high) {
+        cv::Mat display;
+        if (image.empty()) {
+            return display;
+        }
+
+        if (image.depth() != CV_16U) {
+            const double scale = 255.0 / std::max(high - low, 1.0);
+            image.convertTo(display, CV_8U, scale, -low * scale);
+            return display;
+        }
+
+        // Таблица на 65536 значений: оконное преобразование сводится к выборке
+        const std::vector<uchar> lut = windowTable(low, high);
+
+        display.create(image.size(), CV_8UC(image.channels()));
+        cv::parallel_for_(cv::Range(0, image.rows), [&](const cv::Range& range) {
+            const int count = image.cols * image.channels();
+            for (int y = range.start; y < range.end; ++y) {
+                const uint16_t* src = image.ptr<uint16_t>(y);
+                uchar* dst = display.ptr<uchar>(y);
+                for (int x = 0; x < count; ++x) {
+                    dst[x] = lut[src[x]];
+                }
+            }
+        });
+        return display;
+    }
+
+    cv::Mat convertTo16BitGrayscale(const QImage& qImage) {
+        // qImage остается у вызывающего, поэтому буфер матрицы отделяется от него
+        cv::Mat image = QImageToCvMat(qImage, false);
+        if (image.empty()) {
             throw std::runtime_error("Неподдерживаемый формат изображения");
         }
+        return convertTo16BitGrayscale(image);
+    }
 
+    cv::Mat convertTo16BitGrayscale(const cv::Mat& image) {
         // Преобразование в 16-битный серый формат
         cv::Mat image16Bit;
-        if (image.type() == CV_8UC1) {
-            // Если изображение уже в градациях серого, просто конвертируем его в 16-бит
+        switch (image.type()) {
+        case CV_16UC1:
+            // Уже 16-битное изображение - копирование не требуется
+            image16Bit = image;
+            break;
+        case CV_8UC1:
             image.convertTo(image16Bit, CV_16U, 65535.0 / 255.0);
-        }
-        else {
+            break;
+        default: {
             // Если изображение в цвете, сначала переводим в градации серого, затем в 16-бит
             cv::Mat imageGray;
-            cv::cvtColor(image, imageGray, cv::COLOR_BGR2GRAY);
+            cv::cvtColor(image, imageGray, image.channels() == 4 ? cv::COLOR_BGRA2GRAY : cv::COLOR_BGR2GRAY);
             imageGray.convertTo(image16Bit, CV_16U, 65535.0 / 255.0);
+            break;
+        }
         }
 
         return image16Bit;
@@ -3,24 +3,71 @@
 
 #include <opencv2/opencv.hpp>
 #include <QImage>
+#include <QSaveFile>
 #include <string>
+#include <fstream>
+#include <vector>
 
 namespace ImageProcessor {
 
 	// Проверка окончания строки
 	bool endsWith(const std::string& str, const std::string& suffix);
 
-	// Чтение изображения из файла
+	// Чтение изображения из файла. Если в трейлере записана контрольная сумма,
+	// она проверяется; при несовпадении выбрасывается std::runtime_error
 	cv::Mat readImageFromRawFile(const std::string& imagePath, QMap<QString, QString>& tags);
 
-	// Преобразование QImage в cv::Mat
-	cv::Mat QImageToCvMat(const QImage& inImage, bool inCloneImageData = true);
+	// Преобразование QImage в cv::Mat. Без клонирования матрица удерживает
+	// буфер QImage до освобождения последней ссылки. Запись в матрицу не
+	// затрагивает другие QImage: разделяемый буфер отделяется, поэтому
+	// копирования нет, только если изображение передано через std::move
+	cv::Mat QImageToCvMat(QImage inImage, bool inCloneImageData = true);
 
-	// Сохранение изображения в техническом формате
+	// Преобразование cv::Mat в QImage без копирования: QImage удерживает
+	// ссылку на данные матрицы до своего уничтожения
+	QImage cvMatToQImage(const cv::Mat& mat);
+
+	// Потоковая запись изображения в техническом формате полосами строк.
+	// Данные пишутся во временный файл и попутно подсчитывается CRC32C;
+	// целевой файл заменяется только в finish(), поэтому прерванная или
+	// неудачная запись не оставляет обрезанного файла.
+	// При packShift >= 0 строки пишутся упакованными в 12 бит (Packed12)
+	// с этим сдвигом; значения полос должны укладываться в 12 бит
+	class RawImageWriter {
+	public:
+		RawImageWriter(const std::string& filePath, const cv::Size& size, int packShift = -1);
+		bool isOpen() const;
+
+		// Запись очередной полосы строк CV_16UC1 шириной size.width
+		bool writeRows(const cv::Mat& band);
+
+		// Запись тегов и контрольной суммы, сброс на диск и замена целевого
+		// файла; false при любой ошибке записи
+		bool finish(const QMap<QString, QString>& tags);
+
+	private:
+		QSaveFile file;
+		cv::Size size;
+		int shift;
+		std::vector<uint8_t> packedRow;
+		int rowsWritten;
+		uint32_t checksum;
+	};
+
+	// Сохранение изображения в техническом формате. Изображения, значения
+	// которых укладываются в 12 бит без потерь, записываются упакованными
 	bool saveImageToRawFormat(const cv::Mat& image, const std::string& filePath, const QMap<QString, QString>& tags);
 
+	// Отображение окна [low, high] исходных значений в 8-битный диапазон
+	cv::Mat applyWindow(const cv::Mat& image, double low, double high);
+
+	// Таблица того же преобразования на 65536 значений (для применения
+	// окна попутно с другой обработкой строк)
+	std::vector<uchar> windowTable(double low, double high);
+
 	// Преобразование QImage в 16-битное серое изображение
 	cv::Mat convertTo16BitGrayscale(const QImage& qImage);
+	cv::Mat convertTo16BitGrayscale(const cv::Mat& image);
 
 } // namespace ImageProcessor
 
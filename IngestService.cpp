@@ -0,0 +1,467 @@
+#include "IngestService.h"
+#include "ImageLoader.h"
+#include "ImageProcessor.h"
+#include "DicomProcessor.h"
+#include <QBuffer>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QFutureWatcher>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QSocketNotifier>
+#include <QTextStream>
+#include <QtConcurrent/QtConcurrent>
+#include <algorithm>
+
+#ifdef Q_OS_LINUX
+#include <sys/inotify.h>
+#endif
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+namespace {
+
+    const char* JournalName = "ingest.journal";
+    const char* MetricsName = "ingest.metrics";
+    const char* DicomDirName = "DICOMDIR";
+    const size_t LatencyWindow = 1024;
+
+    // Атомарная запись через временный файл в той же папке
+    bool writeAtomically(const QString& fileName, const QByteArray& data) {
+        QSaveFile file(fileName);
+        if (!file.open(QIODevice::WriteOnly)) {
+            return false;
+        }
+        file.write(data);
+        return file.commit();
+    }
+
+    // Оба формата записываются через временный файл с атомарной заменой
+    bool convert(const cv::Mat& image, const QMap<QString, QString>& tags, const QString& fileName, const QString& format) {
+        return format == "dcm"
+            ? DicomProcessor::saveDicom(image, fileName, tags)
+            : ImageProcessor::saveImageToRawFormat(image, fileName.toStdString(), tags);
+    }
+
+    QByteArray thumbnailPng(const LoadedImage& loaded, int thumbnailSize) {
+        // Окно по процентилям, чтобы одиночные выбросы не гасили контраст
+        double low = 0.0;
+        double high = 255.0;
+        if (!loaded.histogram.isEmpty()) {
+            low = loaded.histogram.percentile(0.005);
+            high = loaded.histogram.percentile(0.995);
+        }
+
+        const double factor = std::min(1.0, double(thumbnailSize) / std::max(loaded.image.cols, loaded.image.rows));
+        cv::Mat reduced;
+        if (factor < 1.0) {
+            cv::resize(loaded.image, reduced, cv::Size(), factor, factor, cv::INTER_AREA);
+        }
+        else {
+            reduced = loaded.image;
+        }
+        cv::Mat display = ImageProcessor::applyWindow(reduced, low, high);
+
+        QByteArray data;
+        QBuffer buffer(&data);
+        buffer.open(QIODevice::WriteOnly);
+        ImageProcessor::cvMatToQImage(display).save(&buffer, "PNG");
+        return data;
+    }
+
+} // namespace
+
+IngestService::IngestService(const IngestSettings& ingestSettings, QObject* parent)
+    : QObject(parent), settings(ingestSettings) {
+    pool.setMaxThreadCount(std::max(settings.workers, 1));
+    settleTimer.setInterval(500);
+    metricsTimer.setInterval(settings.metricsIntervalMs);
+    connect(&settleTimer, &QTimer::timeout, this, &IngestService::checkPending);
+    connect(&metricsTimer, &QTimer::timeout, this, &IngestService::writeMetrics);
+    connect(&metricsTimer, &QTimer::timeout, this, &IngestService::writeDicomDir);
+    connect(&watcher, &QFileSystemWatcher::directoryChanged, this, &IngestService::scanDirectory);
+}
+
+IngestService::~IngestService() {
+    stop();
+}
+
+bool IngestService::isIngestible(const QString& fileName) {
+    const QString suffix = QFileInfo(fileName).suffix().toLower();
+    return suffix == "dcm" || suffix == "raw" || suffix == "tif" || suffix == "tiff";
+}
+
+QString IngestService::journalKey(const QString& fileName) {
+    // Перезаписанный сканером файл с тем же именем обрабатывается заново
+    const QFileInfo info(fileName);
+    return QString("%1\t%2\t%3").arg(info.absoluteFilePath(), QString::number(info.size()), QString::number(info.lastModified().toMSecsSinceEpoch()));
+}
+
+bool IngestService::start(QString& error) {
+    if (!QDir(settings.watchDirectory).exists()) {
+        error = tr("Папка наблюдения не найдена: %1").arg(settings.watchDirectory);
+        return false;
+    }
+    if (!QDir().mkpath(settings.outputDirectory)) {
+        error = tr("Не удалось создать папку результатов: %1").arg(settings.outputDirectory);
+        return false;
+    }
+    // Результаты в папке наблюдения принимались бы снова как новые снимки
+    if (QFileInfo(settings.outputDirectory).canonicalFilePath() == QFileInfo(settings.watchDirectory).canonicalFilePath()) {
+        error = tr("Папка результатов совпадает с папкой наблюдения: %1").arg(settings.outputDirectory);
+        return false;
+    }
+
+    clock.start();
+    loadJournal();
+    loadDicomDir();
+
+#ifdef Q_OS_LINUX
+    // IN_CLOSE_WRITE приходит, когда сканер закрыл файл, IN_MOVED_TO -
+    // когда файл переименован в папку после записи во временный
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd >= 0 && inotify_add_watch(inotifyFd, QFile::encodeName(settings.watchDirectory).constData(), IN_CLOSE_WRITE | IN_MOVED_TO) >= 0) {
+        notifier = new QSocketNotifier(inotifyFd, QSocketNotifier::Read, this);
+        connect(notifier, &QSocketNotifier::activated, this, &IngestService::readNotifications);
+    }
+    else {
+        if (inotifyFd >= 0) {
+            ::close(inotifyFd);
+            inotifyFd = -1;
+        }
+        qWarning() << "inotify недоступен, используется опрос папки";
+    }
+#endif
+    if (!notifier) {
+        watcher.addPath(settings.watchDirectory);
+    }
+
+    // Файлы, появившиеся до запуска, принимаются после проверки на завершение записи
+    scanDirectory();
+    settleTimer.start();
+    metricsTimer.start();
+    return true;
+}
+
+void IngestService::stop() {
+    settleTimer.stop();
+    metricsTimer.stop();
+    if (!watcher.directories().isEmpty()) {
+        watcher.removePaths(watcher.directories());
+    }
+    delete notifier;
+    notifier = nullptr;
+#ifdef Q_OS_LINUX
+    if (inotifyFd >= 0) {
+        ::close(inotifyFd);
+        inotifyFd = -1;
+    }
+#endif
+    queue.clear();
+    pool.waitForDone();
+    writeDicomDir();
+}
+
+void IngestService::loadJournal() {
+    QFile file(QDir(settings.outputDirectory).filePath(JournalName));
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return;
+    }
+    // Строка: путь, размер, время изменения, результат, длительность.
+    // Оборванная при сбое последняя строка не распознается и файл повторяется
+    QTextStream stream(&file);
+    while (!stream.atEnd()) {
+        const QStringList fields = stream.readLine().split('\t');
+        if (fields.size() == 5 && fields[3] == "ok") {
+            journal.insert(QStringList(fields.mid(0, 3)).join('\t'));
+        }
+    }
+}
+
+void IngestService::loadDicomDir() {
+    // Индекс дополняется: снимки, обработанные до перезапуска, в нем уже есть
+    const QString fileName = QDir(settings.outputDirectory).filePath(DicomDirName);
+    if (settings.format != "dcm" || !QFileInfo::exists(fileName)) {
+        return;
+    }
+    try {
+        for (const DicomDirItem& item : DicomDirectory::images(DicomDirectory::read(fileName))) {
+            dicomDirItems.insert(item.fileName, item);
+        }
+    }
+    catch (const std::exception& e) {
+        qWarning() << "Индекс DICOMDIR будет построен заново:" << e.what();
+    }
+}
+
+void IngestService::writeDicomDir() {
+    // Индекс перезаписывается целиком не чаще периода метрик, а не после каждого файла
+    if (!dicomDirChanged) {
+        return;
+    }
+    if (DicomDirectory::write(QDir(settings.outputDirectory).filePath(DicomDirName), dicomDirItems.values())) {
+        dicomDirChanged = false;
+    }
+}
+
+void IngestService::appendJournal(const QString& key, const Outcome& outcome) {
+    QFile file(QDir(settings.outputDirectory).filePath(JournalName));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+        qWarning() << "Не удалось открыть журнал" << file.fileName();
+        return;
+    }
+    const QString line = key + (outcome.success ? "\tok\t" : "\tfailed\t") + QString::number(outcome.elapsedMs, 'f', 1) + "\n";
+    file.write(line.toUtf8());
+    file.flush();
+#ifdef Q_OS_UNIX
+    ::fsync(file.handle());
+#endif
+}
+
+void IngestService::readNotifications() {
+#ifdef Q_OS_LINUX
+    alignas(inotify_event) char buffer[16 * 1024];
+    for (;;) {
+        const ssize_t length = ::read(inotifyFd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            break;
+        }
+        for (ssize_t offset = 0; offset < length;) {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+            offset += sizeof(inotify_event) + event->len;
+            if (event->len == 0 || (event->mask & IN_ISDIR)) {
+                continue;
+            }
+            const QString fileName = QDir(settings.watchDirectory).filePath(QFile::decodeName(event->name));
+            if (isIngestible(fileName)) {
+                // Файл закрыт писателем: ждать стабилизации размера не нужно
+                candidates.remove(fileName);
+                enqueue(fileName);
+            }
+        }
+    }
+#endif
+}
+
+void IngestService::scanDirectory() {
+    const QDir dir(settings.watchDirectory);
+    for (const QString& name : dir.entryList(QDir::Files, QDir::Name)) {
+        const QString fileName = dir.filePath(name);
+        if (isIngestible(fileName)) {
+            observe(fileName);
+        }
+    }
+}
+
+void IngestService::observe(const QString& fileName) {
+    if (scheduled.contains(fileName) || candidates.contains(fileName) || journal.contains(journalKey(fileName))) {
+        return;
+    }
+    Candidate candidate;
+    candidate.unchanged.start();
+    candidates.insert(fileName, candidate);
+}
+
+void IngestService::checkPending() {
+    // Файл считается дописанным, если его размер и время изменения
+    // не менялись settleMs миллисекунд
+    for (auto it = candidates.begin(); it != candidates.end();) {
+        const QFileInfo info(it.key());
+        if (!info.exists()) {
+            it = candidates.erase(it);
+            continue;
+        }
+        const qint64 modified = info.lastModified().toMSecsSinceEpoch();
+        if (info.size() != it->size || modified != it->modified) {
+            it->size = info.size();
+            it->modified = modified;
+            it->unchanged.restart();
+            ++it;
+        }
+        else if (it->unchanged.elapsed() >= settings.settleMs) {
+            const QString fileName = it.key();
+            it = candidates.erase(it);
+            enqueue(fileName);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+void IngestService::enqueue(const QString& fileName) {
+    if (scheduled.contains(fileName)) {
+        return;
+    }
+    if (journal.contains(journalKey(fileName))) {
+        ++skipped;
+        return;
+    }
+    scheduled.insert(fileName);
+    queue.enqueue(qMakePair(fileName, clock.elapsed()));
+    dispatch();
+}
+
+void IngestService::dispatch() {
+    // В пул отдается не больше задач, чем в нем потоков: остальные ждут
+    // в очереди путей и не занимают память декодированными снимками
+    while (active < pool.maxThreadCount() && !queue.isEmpty()) {
+        const QPair<QString, qint64> item = queue.dequeue();
+        const QString fileName = item.first;
+        const QString key = journalKey(fileName);
+        ++active;
+
+        QFutureWatcher<Outcome>* futureWatcher = new QFutureWatcher<Outcome>(this);
+        connect(futureWatcher, &QFutureWatcher<Outcome>::finished, this, [this, futureWatcher, fileName, key, item]() {
+            finish(fileName, key, futureWatcher->result(), item.second);
+            futureWatcher->deleteLater();
+        });
+        futureWatcher->setFuture(QtConcurrent::run(&pool, &IngestService::processFile, fileName, settings));
+    }
+}
+
+IngestService::Outcome IngestService::processFile(const QString& fileName, const IngestSettings& settings) {
+    Outcome outcome;
+    QElapsedTimer timer;
+    timer.start();
+
+    try {
+        LoadedImage loaded = ImageLoader::load(fileName);
+        const QDir output(settings.outputDirectory);
+        const QString name = QFileInfo(fileName).fileName();
+        if (settings.format == "dcm") {
+            // UID назначаются заранее: те же теги попадут в файл и в DICOMDIR
+            DicomProcessor::assignInstanceUids(loaded.tags);
+            loaded.tags.insert("Исходный файл", name);
+        }
+
+        // Теги
+        QJsonObject tagObject;
+        for (auto it = loaded.tags.cbegin(); it != loaded.tags.cend(); ++it) {
+            if (it.key() != DicomProcessor::AssignedInstanceUidKey) {
+                tagObject.insert(it.key(), it.value());
+            }
+        }
+        if (!writeAtomically(output.filePath(name + ".json"), QJsonDocument(tagObject).toJson())) {
+            throw std::runtime_error("Не удалось записать теги");
+        }
+
+        // Миниатюра
+        if (!writeAtomically(output.filePath(name + ".png"), thumbnailPng(loaded, settings.thumbnailSize))) {
+            throw std::runtime_error("Не удалось записать миниатюру");
+        }
+
+        // Конвертация в 16-битный формат архива
+        cv::Mat image = loaded.image;
+        if (image.type() != CV_16UC1) {
+            image = ImageProcessor::convertTo16BitGrayscale(image);
+        }
+        // Снимки DICOMDIR называются допустимыми в ReferencedFileID путями по хешу
+        // полного имени источника; исходное имя хранится в теге "Исходный файл".
+        // Остальные форматы сохраняют расширение источника, как .json и .png:
+        // x.dcm и x.tif дают разные результаты
+        const QString converted = output.filePath(settings.format == "dcm"
+            ? DicomDirectory::fileId(name) : name + "." + settings.format);
+        if (!QDir().mkpath(QFileInfo(converted).path())) {
+            throw std::runtime_error("Не удалось создать папку результата");
+        }
+        if (!convert(image, loaded.tags, converted, settings.format)) {
+            throw std::runtime_error("Не удалось сконвертировать изображение");
+        }
+
+        outcome.success = true;
+        outcome.converted = converted;
+        outcome.tags = loaded.tags;
+        outcome.tags.insert("Количество строк", QString::number(image.rows));
+        outcome.tags.insert("Количество столбцов", QString::number(image.cols));
+        if (settings.format == "dcm") {
+            outcome.tags.insert("Синтаксис передачи", UID_LittleEndianExplicitTransferSyntax);
+        }
+    }
+    catch (const std::exception& e) {
+        outcome.message = QString::fromUtf8(e.what());
+    }
+
+    outcome.elapsedMs = timer.nsecsElapsed() / 1e6;
+    return outcome;
+}
+
+void IngestService::finish(const QString& fileName, const QString& key, const Outcome& outcome, qint64 detectedAt) {
+    --active;
+    scheduled.remove(fileName);
+
+    // Запись в журнал - последний шаг: при сбое до нее файл обработается повторно
+    // Неудачный файл до перезапуска или изменения повторно не берется
+    appendJournal(key, outcome);
+    journal.insert(key);
+    if (outcome.success) {
+        ++processed;
+        if (settings.format == "dcm") {
+            const QString converted = QFileInfo(outcome.converted).absoluteFilePath();
+            const auto existing = dicomDirItems.constFind(converted);
+            // Исходное имя известно для снимков этого запуска: индекс его не хранит
+            if (existing != dicomDirItems.cend() && existing->tags.contains("Исходный файл")
+                && existing->tags.value("Исходный файл") != outcome.tags.value("Исходный файл")) {
+                qWarning() << "Совпадение имен в DICOMDIR:" << existing->tags.value("Исходный файл") << "заменен" << fileName;
+            }
+            dicomDirItems.insert(converted, DicomDirItem{ converted, outcome.tags });
+            dicomDirChanged = true;
+        }
+    }
+    else {
+        ++failed;
+        qWarning() << "Ошибка обработки" << fileName << ":" << outcome.message;
+    }
+
+    processingTotalMs += outcome.elapsedMs;
+    latencies.push_back(double(clock.elapsed() - detectedAt));
+    if (latencies.size() > LatencyWindow) {
+        latencies.pop_front();
+    }
+
+    emit fileProcessed(fileName, outcome.success, outcome.message);
+    dispatch();
+}
+
+IngestMetrics IngestService::metrics() const {
+    IngestMetrics result;
+    result.queued = queue.size();
+    result.watching = candidates.size();
+    result.active = active;
+    result.processed = processed;
+    result.failed = failed;
+    result.skipped = skipped;
+    if (processed + failed > 0) {
+        result.processingMeanMs = processingTotalMs / double(processed + failed);
+    }
+    if (!latencies.empty()) {
+        std::vector<double> sorted(latencies.begin(), latencies.end());
+        std::sort(sorted.begin(), sorted.end());
+        result.latencyP50Ms = sorted[sorted.size() / 2];
+        result.latencyP99Ms = sorted[std::min(sorted.size() - 1, sorted.size() * 99 / 100)];
+    }
+    return result;
+}
+
+void IngestService::writeMetrics() {
+    // Текстовый формат Prometheus: файл читает node_exporter (textfile collector)
+    // или любой агент мониторинга
+    const IngestMetrics current = metrics();
+    QString text;
+    QTextStream stream(&text);
+    stream << "ndt_ingest_queue_depth " << current.queued << "\n"
+           << "ndt_ingest_files_settling " << current.watching << "\n"
+           << "ndt_ingest_active " << current.active << "\n"
+           << "ndt_ingest_processed_total " << current.processed << "\n"
+           << "ndt_ingest_failed_total " << current.failed << "\n"
+           << "ndt_ingest_skipped_total " << current.skipped << "\n"
+           << "ndt_ingest_latency_ms{quantile=\"0.5\"} " << current.latencyP50Ms << "\n"
+           << "ndt_ingest_latency_ms{quantile=\"0.99\"} " << current.latencyP99Ms << "\n"
+           << "ndt_ingest_processing_mean_ms " << current.processingMeanMs << "\n";
+    stream.flush();
+    writeAtomically(QDir(settings.outputDirectory).filePath(MetricsName), text.toUtf8());
+}
@@ -0,0 +1,129 @@
+#ifndef INGESTSERVICE_H
+#define INGESTSERVICE_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QQueue>
+#include <QSet>
+#include <QThreadPool>
+#include <QTimer>
+#include <deque>
+#include "DicomDirectory.h"
+
+class QSocketNotifier;
+
+// Настройки службы приема файлов из папки сканеров
+struct IngestSettings {
+    QString watchDirectory;      // Папка, куда сканеры складывают снимки
+    QString outputDirectory;     // Папка результатов, журнала и метрик; не совпадает с папкой наблюдения
+    QString format = "raw";      // Формат конвертации: raw или dcm
+    int workers = 2;             // Число потоков обработки
+    int thumbnailSize = 256;     // Наибольшая сторона миниатюры, пикс.
+    int settleMs = 2000;         // Время без изменений, после которого файл считается дописанным
+    int metricsIntervalMs = 5000;
+};
+
+// Метрики очереди обработки
+struct IngestMetrics {
+    int queued = 0;              // Готовые файлы, ожидающие свободного потока
+    int watching = 0;            // Файлы, которые еще дописываются
+    int active = 0;              // Обрабатываются сейчас
+    qint64 processed = 0;
+    qint64 failed = 0;
+    qint64 skipped = 0;          // Повторно закрытые писателем уже обработанные файлы
+    double latencyP50Ms = 0.0;   // От обнаружения готового файла до записи в журнал
+    double latencyP99Ms = 0.0;
+    double processingMeanMs = 0.0;
+};
+
+// Служба без графического интерфейса: отслеживает папку (inotify в Linux,
+// QFileSystemWatcher с опросом на остальных системах), дожидается окончания
+// записи файлов .dcm/.raw/.tif, извлекает теги, строит миниатюру и
+// конвертирует снимок пулом потоков ограниченного размера. Завершение
+// фиксируется в журнале после атомарной записи результатов, поэтому после
+// перезапуска обработанные файлы пропускаются, а прерванные - повторяются.
+// При конвертации в DICOM в папке результатов ведется индекс DICOMDIR,
+// который строится по уже извлеченным тегам без повторного чтения файлов
+class IngestService : public QObject {
+    Q_OBJECT
+
+public:
+    explicit IngestService(const IngestSettings& settings, QObject* parent = nullptr);
+    ~IngestService();
+
+    // Запуск наблюдения; false и описание ошибки, если папки недоступны
+    bool start(QString& error);
+
+    // Остановка наблюдения с ожиданием обрабатываемых файлов
+    void stop();
+
+    IngestMetrics metrics() const;
+
+    static bool isIngestible(const QString& fileName);
+
+signals:
+    void fileProcessed(const QString& fileName, bool success, const QString& message);
+
+private slots:
+    void readNotifications();
+    void scanDirectory();
+    void checkPending();
+    void writeMetrics();
+    void writeDicomDir();
+
+private:
+    // Файл, который еще может дописываться
+    struct Candidate {
+        qint64 size = -1;
+        qint64 modified = 0;
+        QElapsedTimer unchanged;
+    };
+
+    // Результат обработки одного файла в потоке пула
+    struct Outcome {
+        bool success = false;
+        QString message;
+        double elapsedMs = 0.0;
+        QString converted;             // Файл результата
+        QMap<QString, QString> tags;   // Теги, с которыми он записан
+    };
+
+    static QString journalKey(const QString& fileName);
+    static Outcome processFile(const QString& fileName, const IngestSettings& settings);
+
+    void loadJournal();
+    void loadDicomDir();
+    void appendJournal(const QString& key, const Outcome& outcome);
+    void observe(const QString& fileName);
+    void enqueue(const QString& fileName);
+    void dispatch();
+    void finish(const QString& fileName, const QString& key, const Outcome& outcome, qint64 detectedAt);
+
+    IngestSettings settings;
+    QThreadPool pool;
+    QTimer settleTimer;
+    QTimer metricsTimer;
+    QFileSystemWatcher watcher;
+    QSocketNotifier* notifier = nullptr;
+    int inotifyFd = -1;
+
+    QSet<QString> journal;                  // Ключи завершенных файлов (и неудачных в этом запуске)
+    QSet<QString> scheduled;                // Пути в очереди или в обработке
+    QHash<QString, Candidate> candidates;
+    QQueue<QPair<QString, qint64>> queue;   // Путь и момент готовности
+    int active = 0;
+    QElapsedTimer clock;
+
+    qint64 processed = 0;
+    qint64 failed = 0;
+    qint64 skipped = 0;
+    double processingTotalMs = 0.0;
+    std::deque<double> latencies;           // Последние задержки для процентилей
+
+    QMap<QString, DicomDirItem> dicomDirItems; // Снимки индекса по пути файла
+    bool dicomDirChanged = false;
+};
+
+#endif // INGESTSERVICE_H
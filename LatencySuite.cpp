@@ -0,0 +1,492 @@
+#include "LatencySuite.h"
+#include "MainWindow.h"
+#include "ImageProcessor.h"
+#include "DicomProcessor.h"
+#include "TiffProcessor.h"
+#include "ImageLoader.h"
+#include "ImageHistogram.h"
+#include "AnnotationStore.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QThreadPool>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <thread>
+#include <vector>
+
+#ifdef Q_OS_WIN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+    const double noiseSigma = 150.0;
+    const int rssSampleMs = 2; // Период опроса RSS во время сценария
+
+    // Текущий объем резидентной памяти процесса, байт
+    qint64 currentRss() {
+#ifdef Q_OS_WIN
+        PROCESS_MEMORY_COUNTERS counters;
+        if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+            return static_cast<qint64>(counters.WorkingSetSize);
+        }
+        return 0;
+#else
+        // Второе поле statm - резидентные страницы
+        QFile statm("/proc/self/statm");
+        if (!statm.open(QIODevice::ReadOnly)) {
+            return 0;
+        }
+        const QList<QByteArray> fields = statm.readAll().split(' ');
+        return fields.size() > 1 ? fields[1].toLongLong() * sysconf(_SC_PAGESIZE) : 0;
+#endif
+    }
+
+    // Пиковый RSS за время жизни объекта. Счетчик пика процесса сбросить
+    // нельзя, поэтому пик каждого сценария набирается опросом в отдельном потоке
+    class RssSampler {
+    public:
+        RssSampler() : peakBytes(currentRss()), running(true) {
+            thread = std::thread([this]() {
+                while (running) {
+                    update();
+                    std::this_thread::sleep_for(std::chrono::milliseconds(rssSampleMs));
+                }
+            });
+        }
+
+        ~RssSampler() {
+            stop();
+        }
+
+        qint64 stop() {
+            if (thread.joinable()) {
+                running = false;
+                thread.join();
+                update();
+            }
+            return peakBytes;
+        }
+
+    private:
+        void update() {
+            const qint64 rss = currentRss();
+            qint64 peak = peakBytes;
+            while (rss > peak && !peakBytes.compare_exchange_weak(peak, rss)) {
+            }
+        }
+
+        std::atomic<qint64> peakBytes;
+        std::atomic_bool running;
+        std::thread thread;
+    };
+
+    // Замеры одного сценария одного файла
+    struct FlowSamples {
+        std::vector<double> times; // мс
+        qint64 peakRss = 0;
+        QString error;
+    };
+
+    struct FlowResult {
+        double p50 = 0.0;
+        double p99 = 0.0;
+        double peakRssMb = 0.0;
+    };
+
+    // Процентиль по ближайшему рангу: при малом числе прогонов p99 - максимум
+    double percentile(std::vector<double> values, double fraction) {
+        if (values.empty()) {
+            return 0.0;
+        }
+        std::sort(values.begin(), values.end());
+        const size_t rank = static_cast<size_t>(std::ceil(fraction * values.size()));
+        return values[std::clamp<size_t>(rank, 1, values.size()) - 1];
+    }
+
+    // Завершение фоновых задач окна (статистика, запись) между замерами,
+    // чтобы они не попадали в следующий сценарий
+    void settle() {
+        QThreadPool::globalInstance()->waitForDone();
+        QCoreApplication::processEvents();
+    }
+
+    QMap<QString, QString> corpusTags(int size, int bits, unsigned int seed) {
+        QMap<QString, QString> tags;
+        tags.insert("Название объекта", "Синтетический снимок");
+        tags.insert("ID объекта", QString("SYN-%1-%2-%3").arg(size).arg(bits).arg(seed));
+        tags.insert("Модальность", "DX");
+        tags.insert("Описание исследования", "Корпус замеров задержек");
+        tags.insert("Материал объекта", "Сталь");
+        tags.insert("Толщина объекта (мм)", "12");
+        tags.insert("Номер шва", "1");
+        tags.insert("Размер пикселя (мм)", "0.1\\0.1");
+        tags.insert("Фотометрическая интерпретация", "MONOCHROME2");
+        return tags;
+    }
+
+    // Путь .raw -> .dcm -> открытие: пиксели должны совпасть с загруженными из .raw,
+    // в том числе 12-битные значения без сдвига (меньше 4096)
+    bool rawDicomRoundTrip(const QString& rawFile, const QString& dicomFile) {
+        try {
+            const LoadedImage raw = ImageLoader::load(rawFile);
+            if (!DicomProcessor::saveDicom(raw.image, dicomFile, raw.tags)) {
+                return false;
+            }
+            const cv::Mat reopened = ImageLoader::load(dicomFile).image;
+            return reopened.size() == raw.image.size() && reopened.type() == raw.image.type()
+                && cv::norm(reopened, raw.image, cv::NORM_INF) == 0.0;
+        }
+        catch (const std::exception&) {
+            return false;
+        }
+    }
+
+    // Аннотации, записанные saveDicom в частную последовательность, должны
+    // вернуться из processDicom тем же JSON: рамка, отрезок и все поля записи
+    bool annotationRoundTrip(const QString& dicomFile, unsigned int seed) {
+        AnnotationStore store;
+        Annotation defect;
+        defect.kind = AnnotationKind::Defect;
+        defect.rect = QRectF(12.5, 20.25, 7.0, 3.75);
+        defect.text = "Пора";
+        defect.category = 0;
+        defect.score = 6.125;
+        defect.detected = true;
+        store.add(defect);
+        Annotation measurement;
+        measurement.kind = AnnotationKind::Measurement;
+        measurement.line = QLineF(3.0, 4.5, 40.25, 17.0);
+        measurement.text = "37.5 мм";
+        store.add(measurement);
+
+        QMap<QString, QString> tags = corpusTags(64, 16, seed);
+        tags.insert(AnnotationStore::TagKey, store.toJson());
+        if (!DicomProcessor::saveDicom(LatencySuite::generateFilm(64, 16, seed), dicomFile, tags)) {
+            return false;
+        }
+        QString infoMsg;
+        if (DicomProcessor::processDicom(dicomFile, infoMsg).isNull()) {
+            return false;
+        }
+        return ImageLoader::parseInfoTags(infoMsg).value(AnnotationStore::TagKey) == store.toJson();
+    }
+
+    QString flowKey(const QString& fileName, const char* flow) {
+        return fileName + "/" + flow;
+    }
+
+    QJsonObject toJson(const FlowResult& result) {
+        QJsonObject object;
+        object.insert("p50", result.p50);
+        object.insert("p99", result.p99);
+        object.insert("peakRssMb", result.peakRssMb);
+        return object;
+    }
+
+}
+
+namespace LatencySuite {
+
+    cv::Mat generateFilm(int size, int bits, unsigned int seed) {
+        CV_Assert(size > 0 && size <= MaxFilmSize && (bits == 8 || bits == 12 || bits == 16));
+        cv::Mat film(size, size, CV_16UC1);
+
+        // Фон около 20000 с горизонтальным градиентом; шов - более плотная
+        // полоса по середине высоты с размытыми краями
+        const double beadTop = size * 0.4;
+        const double beadBottom = size * 0.6;
+        const double edge = std::max(size / 128.0, 1.0);
+        cv::parallel_for_(cv::Range(0, size), [&](const cv::Range& range) {
+            cv::Mat noise(1, size, CV_32F);
+            for (int y = range.start; y < range.end; ++y) {
+                cv::RNG rng((static_cast<uint64>(seed) << 32) | static_cast<uint32_t>(y + 1));
+                rng.fill(noise, cv::RNG::NORMAL, 0.0, noiseSigma);
+                const double bead = 1.0 / (1.0 + std::exp((beadTop - y) / edge)) - 1.0 / (1.0 + std::exp((beadBottom - y) / edge));
+                const float* noiseRow = noise.ptr<float>();
+                uint16_t* row = film.ptr<uint16_t>(y);
+                for (int x = 0; x < size; ++x) {
+                    row[x] = cv::saturate_cast<uint16_t>(18000.0 + 4000.0 * x / size - 3000.0 * bead + noiseRow[x]);
+                }
+            }
+        });
+
+        // Поры: светлые круги в шве по сетке ячеек, поочередно выше и ниже оси шва
+        cv::RNG rng(seed);
+        const int cell = std::max(size / 16, 64);
+        for (int x = cell / 2, index = 0; x < size; x += cell, ++index) {
+            const cv::Point center(x, size / 2 + (index % 2 == 0 ? -1 : 1) * static_cast<int>(size * 0.05));
+            const double level = film.at<uint16_t>(std::clamp(center.y, 0, size - 1), x) + 2000.0;
+            cv::circle(film, center, rng.uniform(3, 9), cv::Scalar(level), cv::FILLED);
+        }
+
+        if (bits == 8) {
+            film.convertTo(film, CV_8U, 1.0 / 256);
+        }
+        else if (bits == 12) {
+            film.convertTo(film, CV_16U, 1.0 / 16);
+        }
+        return film;
+    }
+
+    int generateCorpus(const QString& directory, const QList<int>& sizes, unsigned int seed, std::ostream& out) {
+        if (!QDir().mkpath(directory)) {
+            out << "Cannot create directory " << directory.toStdString() << "\n";
+            return 1;
+        }
+        const QDir corpus(directory);
+        QTemporaryDir roundTripDirectory;
+        if (!roundTripDirectory.isValid()) {
+            out << "Cannot create temporary directory\n";
+            return 1;
+        }
+        bool success = annotationRoundTrip(roundTripDirectory.filePath("annotations.dcm"), seed);
+        out << "Annotations .dcm -> open: " << (success ? "identical" : "FAILED") << "\n";
+        for (int size : sizes) {
+            if (size < 16 || size > MaxFilmSize) {
+                out << "Unsupported film size " << size << " (16.." << MaxFilmSize << ")\n";
+                return 1;
+            }
+            for (int bits : { 8, 12, 16 }) {
+                QElapsedTimer timer;
+                timer.start();
+                const cv::Mat film = generateFilm(size, bits, seed);
+                const QMap<QString, QString> tags = corpusTags(size, bits, seed);
+                const QString baseName = corpus.filePath(QString("film_%1_%2bit").arg(size).arg(bits));
+                out << "Film " << size << "x" << size << " " << bits << "-bit: generated in "
+                    << timer.nsecsElapsed() / 1e6 << " ms\n";
+
+                // .raw хранит 16-битные значения: 8-битный снимок пишется
+                // в 16-битном контейнере (и упаковывается как 12-битный)
+                cv::Mat raw = film;
+                if (film.depth() == CV_8U) {
+                    film.convertTo(raw, CV_16U);
+                }
+                const struct {
+                    QString fileName;
+                    std::function<bool(const QString&)> write;
+                } outputs[] = {
+                    { baseName + ".dcm", [&](const QString& name) { return DicomProcessor::saveDicom(film, name, tags); } },
+                    { baseName + "_rle.dcm", [&](const QString& name) { return DicomProcessor::saveDicom(film, name, tags, true); } },
+                    { baseName + ".raw", [&](const QString& name) { return ImageProcessor::saveImageToRawFormat(raw, name.toStdString(), tags); } },
+                    { baseName + ".tiff", [&](const QString& name) { return TiffProcessor::saveTiffWithTags(film, name, tags); } },
+                };
+                for (const auto& output : outputs) {
+                    timer.restart();
+                    const bool written = output.write(output.fileName);
+                    success = success && written;
+                    out << "  " << (written ? "" : "FAILED ") << QFileInfo(output.fileName).fileName().toStdString()
+                        << ": " << QFileInfo(output.fileName).size() / (1024 * 1024) << " MB, "
+                        << timer.nsecsElapsed() / 1e6 << " ms\n";
+                }
+
+                const bool roundTrip = rawDicomRoundTrip(baseName + ".raw", roundTripDirectory.filePath("film.dcm"));
+                success = success && roundTrip;
+                out << "  .raw -> .dcm -> open: " << (roundTrip ? "identical" : "FAILED") << "\n";
+            }
+        }
+        return success ? 0 : 1;
+    }
+
+    int run(const QString& corpusDirectory, int runs, const QString& baselineFile, bool updateBaseline,
+        double tolerance, std::ostream& out) {
+        const QDir corpus(corpusDirectory);
+        const QStringList fileNames = corpus.entryList({ "*.dcm", "*.raw", "*.tif", "*.tiff" }, QDir::Files, QDir::Name);
+        if (fileNames.isEmpty()) {
+            out << "No films in " << corpusDirectory.toStdString() << "\n";
+            return 1;
+        }
+        QTemporaryDir outputDirectory;
+        if (!outputDirectory.isValid()) {
+            out << "Cannot create temporary directory\n";
+            return 1;
+        }
+        runs = std::max(runs, 1);
+
+        // Окно показывается (на платформе offscreen - без экрана), чтобы
+        // отрисовка видимых тайлов входила в сценарии, как у пользователя
+        MainWindow window;
+        window.setScripted(true);
+        window.show();
+        settle();
+
+        const char* const flows[] = { "open", "adjust", "save", "histogram", "minMaxLoc" };
+        std::map<QString, FlowSamples> samples;
+        for (const QString& fileName : fileNames) {
+            const QString path = corpus.filePath(fileName);
+            // Сохраняется в тот же формат; сжатый DICOM записывается без сжатия, как из меню
+            const QString target = QDir(outputDirectory.path()).filePath(fileName);
+            FlowSamples& open = samples[flowKey(fileName, flows[0])];
+            FlowSamples& adjust = samples[flowKey(fileName, flows[1])];
+            FlowSamples& save = samples[flowKey(fileName, flows[2])];
+
+            for (int i = 0; i < runs && open.error.isEmpty() && save.error.isEmpty(); ++i) {
+                // Открытие без кэша: каждый прогон декодирует файл заново
+                window.clearImageCache();
+                settle();
+                {
+                    RssSampler sampler;
+                    QElapsedTimer timer;
+                    timer.start();
+                    const bool opened = window.openPath(path);
+                    window.renderView();
+                    open.times.push_back(timer.nsecsElapsed() / 1e6);
+                    open.peakRss = std::max(open.peakRss, sampler.stop());
+                    if (!opened) {
+                        open.error = window.lastError();
+                        break;
+                    }
+                }
+                settle();
+
+                // Настройка: новое положение ползунков и перерисовка видимых тайлов
+                {
+                    RssSampler sampler;
+                    QElapsedTimer timer;
+                    timer.start();
+                    window.setAdjustment(80 + (i % 5) * 30, i % 2 == 0 ? 10 : -10);
+                    window.renderView();
+                    adjust.times.push_back(timer.nsecsElapsed() / 1e6);
+                    adjust.peakRss = std::max(adjust.peakRss, sampler.stop());
+                }
+                settle();
+
+                // Сохранение идет в фоне; замер - до сигнала о завершении
+                {
+                    QString error;
+                    bool finished = false;
+                    QEventLoop loop;
+                    const QMetaObject::Connection connection = QObject::connect(&window, &MainWindow::saveFinished, &loop,
+                        [&error, &finished, &loop](const QString&, const QString& saveError) {
+                            error = saveError;
+                            finished = true;
+                            loop.quit();
+                        });
+                    RssSampler sampler;
+                    QElapsedTimer timer;
+                    timer.start();
+                    window.saveAs(target);
+                    if (!finished) {
+                        loop.exec();
+                    }
+                    save.times.push_back(timer.nsecsElapsed() / 1e6);
+                    save.peakRss = std::max(save.peakRss, sampler.stop());
+                    QObject::disconnect(connection);
+                    save.error = error;
+                }
+                settle();
+            }
+            QFile::remove(target);
+
+            // Гистограмма при загрузке против прежнего прохода cv::minMaxLoc
+            // в readImageFromRawFile на тех же пикселях
+            if (open.error.isEmpty()) {
+                cv::Mat pixels;
+                try {
+                    pixels = ImageLoader::load(path).image.reshape(1);
+                }
+                catch (const std::exception&) {
+                    continue;
+                }
+                FlowSamples& histogram = samples[flowKey(fileName, flows[3])];
+                FlowSamples& minMax = samples[flowKey(fileName, flows[4])];
+                for (int i = 0; i < runs; ++i) {
+                    QElapsedTimer timer;
+                    timer.start();
+                    ImageHistogram::compute(pixels);
+                    histogram.times.push_back(timer.nsecsElapsed() / 1e6);
+
+                    double minValue = 0.0;
+                    double maxValue = 0.0;
+                    timer.restart();
+                    cv::minMaxLoc(pixels, &minValue, &maxValue);
+                    minMax.times.push_back(timer.nsecsElapsed() / 1e6);
+                }
+            }
+        }
+
+        // Сравнение с базой: ухудшение задержки или памяти больше допуска
+        QJsonObject baseline;
+        if (!baselineFile.isEmpty() && !updateBaseline) {
+            QFile file(baselineFile);
+            if (!file.open(QIODevice::ReadOnly)) {
+                out << "Cannot read baseline " << baselineFile.toStdString() << "\n";
+                return 1;
+            }
+            baseline = QJsonDocument::fromJson(file.readAll()).object().value("flows").toObject();
+        }
+
+        out << "Corpus: " << corpusDirectory.toStdString() << ", files: " << fileNames.size()
+            << ", runs: " << runs << ", threads: " << QThreadPool::globalInstance()->maxThreadCount() << "\n";
+        out << std::left << std::setw(40) << "flow" << std::right << std::setw(12) << "p50 ms" << std::setw(12) << "p99 ms"
+            << std::setw(14) << "peak RSS MB" << "  status\n";
+        out << std::fixed << std::setprecision(1);
+
+        QJsonObject flowsJson;
+        int regressions = 0;
+        int failures = 0;
+        for (const auto& entry : samples) {
+            const FlowSamples& flow = entry.second;
+            if (flow.times.empty() && flow.error.isEmpty()) {
+                continue; // Сценарий не выполнялся: файл не открылся
+            }
+            FlowResult result;
+            result.p50 = percentile(flow.times, 0.50);
+            result.p99 = percentile(flow.times, 0.99);
+            result.peakRssMb = flow.peakRss / (1024.0 * 1024.0);
+            flowsJson.insert(entry.first, toJson(result));
+
+            QString status = "new";
+            if (!flow.error.isEmpty()) {
+                status = "FAILED: " + flow.error;
+                ++failures;
+            }
+            else if (baseline.contains(entry.first)) {
+                const QJsonObject base = baseline.value(entry.first).toObject();
+                const bool slower = result.p50 > base.value("p50").toDouble() * (1.0 + tolerance)
+                    || result.p99 > base.value("p99").toDouble() * (1.0 + tolerance);
+                const bool larger = result.peakRssMb > base.value("peakRssMb").toDouble() * (1.0 + tolerance);
+                status = slower || larger ? QString("REGRESSION (base p50 %1, p99 %2, RSS %3)")
+                    .arg(base.value("p50").toDouble(), 0, 'f', 1).arg(base.value("p99").toDouble(), 0, 'f', 1)
+                    .arg(base.value("peakRssMb").toDouble(), 0, 'f', 1) : QString("ok");
+                regressions += slower || larger ? 1 : 0;
+            }
+            out << std::left << std::setw(40) << entry.first.toStdString() << std::right << std::setw(12) << result.p50
+                << std::setw(12) << result.p99 << std::setw(14) << result.peakRssMb << "  " << status.toStdString() << "\n";
+        }
+
+        if (updateBaseline && !baselineFile.isEmpty()) {
+            QJsonObject document;
+            document.insert("runs", runs);
+            document.insert("flows", flowsJson);
+            QFile file(baselineFile);
+            if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(QJsonDocument(document).toJson()) < 0) {
+                out << "Cannot write baseline " << baselineFile.toStdString() << "\n";
+                return 1;
+            }
+            out << "Baseline written to " << baselineFile.toStdString() << "\n";
+        }
+
+        const bool passed = regressions == 0 && failures == 0;
+        out << (passed ? "PASS" : "FAIL") << ": regressions " << regressions << ", failures " << failures
+            << ", tolerance " << tolerance * 100.0 << "%\n";
+        return passed ? 0 : 1;
+    }
+
+}
@@ -0,0 +1,41 @@
+#ifndef LATENCYSUITE_H
+#define LATENCYSUITE_H
+
+#include <QList>
+#include <QString>
+#include <opencv2/opencv.hpp>
+#include <ostream>
+
+// Воспроизводимый синтетический корпус снимков и замер задержек сквозных
+// сценариев главного окна на нем: открытие, настройка окна отображения,
+// сохранение. Снимки заказчиков передавать нельзя, поэтому корпус
+// полностью задается размерами и зерном генератора
+namespace LatencySuite {
+
+    const int MaxFilmSize = 30000;
+
+    // Снимок size x size разрядности bits (8 - CV_8UC1, 12 и 16 - CV_16UC1):
+    // фон с градиентом экспозиции, сварной шов, шум и поры. Шум каждой строки
+    // задается своим зерном, поэтому результат не зависит от числа потоков
+    cv::Mat generateFilm(int size, int bits, unsigned int seed);
+
+    // Корпус в directory: для каждого размера и разрядностей 8/12/16 -
+    // DICOM без сжатия и со сжатием RLE, .raw с тегами и TIFF. Каждый .raw
+    // проверяется сохранением в DICOM и повторным открытием без изменения пикселей,
+    // аннотации - сохранением в DICOM и чтением обратно в тот же JSON.
+    // Отчет выводится в out; возвращает 0 при успехе
+    int generateCorpus(const QString& directory, const QList<int>& sizes, unsigned int seed, std::ostream& out);
+
+    // Сценарии открытия, настройки и сохранения главного окна без диалогов,
+    // runs раз для каждого файла корпуса. Отчет - p50/p99 задержки и пиковый RSS
+    // процесса во время сценария; для сравнения также время построения гистограммы
+    // загрузки и прохода cv::minMaxLoc по тем же пикселям. Если baselineFile задан, результаты сравниваются
+    // с ним с допуском tolerance (доля) и при ухудшении возвращается 1;
+    // updateBaseline - записать результаты в baselineFile как новую базу.
+    // Требует созданного QApplication
+    int run(const QString& corpusDirectory, int runs, const QString& baselineFile, bool updateBaseline,
+        double tolerance, std::ostream& out);
+
+}
+
+#endif // LATENCYSUITE_H
@@ -1,7 +1,14 @@
 #include "MainWindow.h"
 #include "ImageProcessor.h"
 #include "DicomProcessor.h"
+#include "ImageLoader.h"
 #include "TiffProcessor.h"
+#include "Stitcher.h"
+#include "FileIntegrity.h"
+#include "Packed12.h"
+#include "FrameIntegrator.h"
+#include "DicomDirectory.h"
+#include "ImageExport.h"
 #include <QMenuBar>
 #include <QToolBar>
 #include <QStatusBar>
@@ -18,11 +25,33 @@
 #include <QScreen>
 #include <QGuiApplication>
 #include <QSplitter>
+#include <QActionGroup>
+#include <QMouseEvent>
+#include <QElapsedTimer>
+#include <QDir>
+#include <QProgressDialog>
+#include <QCollator>
+#include <QPointer>
+#include <QInputDialog>
+#include <QSaveFile>
+#include <QToolTip>
+#include <QHelpEvent>
+#include <QContextMenuEvent>
+#include <QMenu>
+#include <QtConcurrent/QtConcurrent>
 #include <iostream>
+#include <atomic>
 #include <dcmtk/config/osconfig.h>
 #include <dcmtk/dcmdata/dctk.h>
 #include <dcmtk/dcmimgle/dcmimage.h>
 
+namespace {
+
+    // Прерывание фоновой записи по кнопке отмены
+    struct SaveCancelled {};
+
+} // namespace
+
 MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent)
 {
     // Устанавливаем фиксированный размер окна
@@ -40,7 +69,18 @@ MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent)
     view = new QGraphicsView(scene, this);
     setCentralWidget(view);
 
-    currentPixmapItem = nullptr;
+    imageItem = nullptr;
+    roiItem = nullptr;
+    profileItem = nullptr;
+    windowLow = 0.0;
+    windowHigh = 65535.0;
+    displayLow = windowLow;
+    displayHigh = windowHigh;
+    measureTool = MeasureTool::None;
+    measuring = false;
+    directoryIndex = -1;
+    navigationStep = 1;
+    scripted = false;
 
     // Настраиваем QGraphicsView
     view->setTransformationAnchor(QGraphicsView::AnchorUnderMouse);
@@ -85,8 +125,15 @@ MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent)
     QWidget* tagsContainer = new QWidget;
     tagsContainer->setLayout(tagsLayout);
 
+    // Окно просмотра и режим сравнения занимают одно место
+    compareWidget = new CompareWidget(this);
+    connect(compareWidget, &CompareWidget::closeRequested, this, &MainWindow::closeComparison);
+    centralStack = new QStackedWidget(this);
+    centralStack->addWidget(view);
+    centralStack->addWidget(compareWidget);
+
     QSplitter* splitter = new QSplitter(Qt::Horizontal, this);
-    splitter->addWidget(view);
+    splitter->addWidget(centralStack);
     splitter->addWidget(tagsContainer);
 
     QList<int> sizes;
@@ -137,12 +184,73 @@ MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent)
     QMenu* fileMenu = menuBar()->addMenu(tr("&Файл"));
     QAction* openAction = fileMenu->addAction(tr("&Открыть"), this, &MainWindow::openFile);
     QAction* saveAction = fileMenu->addAction(tr("&Сохранить"), this, &MainWindow::saveFile);
+    fileMenu->addAction(tr("Сшить с&нимки..."), this, &MainWindow::stitchFiles);
+    fileMenu->addAction(tr("Проверка &целостности архива..."), this, &MainWindow::verifyArchive);
+    fileMenu->addAction(tr("&Накопление кадров..."), this, &MainWindow::integrateFrames);
+    fileMenu->addAction(tr("Сра&внение снимков..."), this, &MainWindow::compareFilms);
+    fastPngAction = fileMenu->addAction(tr("Быстрое сжатие PNG"));
+    fastPngAction->setCheckable(true);
+    fastPngAction->setToolTip(tr("Большие снимки сохраняются в PNG быстрее ценой большего размера файла"));
+    fileMenu->addSeparator();
+    QAction* previousAction = fileMenu->addAction(tr("&Предыдущий снимок"), this, &MainWindow::openPreviousFile);
+    previousAction->setShortcut(Qt::Key_PageUp);
+    QAction* nextAction = fileMenu->addAction(tr("С&ледующий снимок"), this, &MainWindow::openNextFile);
+    nextAction->setShortcut(Qt::Key_PageDown);
     fileMenu->addSeparator();
     QAction* exitAction = fileMenu->addAction(tr("Вы&ход"), this, &MainWindow::close);
 
+    // Меню "Правка"
+    QMenu* editMenu = menuBar()->addMenu(tr("&Правка"));
+    undoAction = editMenu->addAction(tr("&Отменить"), this, &MainWindow::undoEdit);
+    undoAction->setShortcut(QKeySequence::Undo);
+    redoAction = editMenu->addAction(tr("&Повторить"), this, &MainWindow::redoEdit);
+    redoAction->setShortcut(QKeySequence::Redo);
+    editMenu->addSeparator();
+    editMenu->addAction(tr("Применить &фильтры"), this, &MainWindow::applyFilters);
+    editMenu->addAction(tr("Память истории..."), this, &MainWindow::setHistoryLimit);
+
+    // Меню "Изображение": геометрические преобразования отображения
+    QMenu* imageMenu = menuBar()->addMenu(tr("&Изображение"));
+    imageMenu->addAction(tr("Повернуть по часовой стрелке"), this, [this]() {
+        changeViewTransform([](ViewTransform& transform) { transform.rotateClockwise(); });
+    });
+    imageMenu->addAction(tr("Повернуть против часовой стрелки"), this, [this]() {
+        changeViewTransform([](ViewTransform& transform) { transform.rotateCounterClockwise(); });
+    });
+    imageMenu->addAction(tr("Отразить по горизонтали"), this, [this]() {
+        changeViewTransform([](ViewTransform& transform) { transform.flipHorizontal(); });
+    });
+    imageMenu->addAction(tr("Отразить по вертикали"), this, [this]() {
+        changeViewTransform([](ViewTransform& transform) { transform.flipVertical(); });
+    });
+    imageMenu->addSeparator();
+    imageMenu->addAction(tr("Обрезать по области"), this, &MainWindow::cropToRoi);
+    imageMenu->addAction(tr("Масштаб..."), this, &MainWindow::scaleImage);
+    imageMenu->addSeparator();
+    imageMenu->addAction(tr("Сбросить преобразования"), this, [this]() {
+        changeViewTransform([](ViewTransform& transform) { transform.reset(); });
+    });
+
     // Меню "Вид"
     QMenu* viewMenu = menuBar()->addMenu(tr("&Вид"));
 
+    // Меню "Анализ"
+    QMenu* analysisMenu = menuBar()->addMenu(tr("&Анализ"));
+    detectAction = analysisMenu->addAction(tr("&Поиск дефектов"), this, &MainWindow::detectDefects);
+    showDefectsAction = analysisMenu->addAction(tr("Показывать &индикации"));
+    showDefectsAction->setCheckable(true);
+    showDefectsAction->setChecked(true);
+    connect(showDefectsAction, &QAction::toggled, this, [this](bool checked) {
+        if (annotationLayer) {
+            annotationLayer->setDetectedVisible(checked);
+        }
+    });
+    analysisMenu->addSeparator();
+    analysisMenu->addAction(tr("Отметить индикацию в &области..."), this, &MainWindow::markDefect);
+    analysisMenu->addAction(tr("Сохранить &измерение"), this, &MainWindow::addMeasurementAnnotation);
+    analysisMenu->addAction(tr("&Комментарий к области..."), this, &MainWindow::addComment);
+    analysisMenu->addAction(tr("Удалить все аннотации"), this, &MainWindow::clearAnnotations);
+
     // Меню "Помощь"
     QMenu* helpMenu = menuBar()->addMenu(tr("&Помощь"));
     QAction* aboutAction = helpMenu->addAction(tr("&О программе"), this, &MainWindow::about);
@@ -151,6 +259,87 @@ MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent)
     QToolBar* toolBar = addToolBar(tr("Инструменты"));
     toolBar->addAction(zoomInAction);
     toolBar->addAction(zoomOutAction);
+    toolBar->addSeparator();
+    toolBar->addAction(previousAction);
+    toolBar->addAction(nextAction);
+    toolBar->addSeparator();
+
+    // Инструменты измерений: область интереса и профиль
+    QActionGroup* measureGroup = new QActionGroup(this);
+    QAction* navigateAction = toolBar->addAction(tr("Навигация"));
+    QAction* roiAction = toolBar->addAction(tr("Область"));
+    QAction* profileAction = toolBar->addAction(tr("Профиль"));
+    for (QAction* action : { navigateAction, roiAction, profileAction }) {
+        action->setCheckable(true);
+        measureGroup->addAction(action);
+    }
+    navigateAction->setChecked(true);
+    connect(navigateAction, &QAction::triggered, this, [this]() { measureTool = MeasureTool::None; });
+    connect(roiAction, &QAction::triggered, this, [this]() { measureTool = MeasureTool::Roi; });
+    connect(profileAction, &QAction::triggered, this, [this]() {
+        measureTool = MeasureTool::Profile;
+        profileDock->show();
+    });
+
+    profileWidthSpin = new QSpinBox(this);
+    profileWidthSpin->setRange(1, 101);
+    profileWidthSpin->setValue(5);
+    profileWidthSpin->setPrefix(tr("Ширина: "));
+    profileWidthSpin->setSuffix(tr(" пикс."));
+    toolBar->addWidget(profileWidthSpin);
+    connect(profileWidthSpin, QOverload<int>::of(&QSpinBox::valueChanged), this, &MainWindow::updateLineProfile);
+
+    // Панель профиля
+    profilePlot = new ProfilePlotWidget(this);
+    profileDock = new QDockWidget(tr("Профиль"), this);
+    profileDock->setWidget(profilePlot);
+    addDockWidget(Qt::BottomDockWidgetArea, profileDock);
+    profileDock->hide();
+    viewMenu->addAction(profileDock->toggleViewAction());
+
+    // Панель гистограммы
+    histogramWidget = new HistogramWidget(this);
+    QDockWidget* histogramDock = new QDockWidget(tr("Гистограмма"), this);
+    histogramDock->setWidget(histogramWidget);
+    addDockWidget(Qt::BottomDockWidgetArea, histogramDock);
+    viewMenu->addAction(histogramDock->toggleViewAction());
+
+    // Цепочка фильтров и панель ее настройки
+    filterChain.addNode(std::make_shared<MedianDenoiseNode>());
+    filterChain.addNode(std::make_shared<BackgroundSubtractionNode>());
+    filterChain.addNode(std::make_shared<ClaheNode>());
+    filterChain.addNode(std::make_shared<UnsharpMaskNode>());
+    filterPanel = new FilterPanelWidget(&filterChain, this);
+    QDockWidget* filterDock = new QDockWidget(tr("Фильтры"), this);
+    filterDock->setWidget(filterPanel);
+    addDockWidget(Qt::RightDockWidgetArea, filterDock);
+    viewMenu->addAction(filterDock->toggleViewAction());
+
+    // Панель носителя DICOMDIR
+    dicomDirWidget = new DicomDirWidget(this);
+    dicomDirDock = new QDockWidget(tr("Носитель DICOM"), this);
+    dicomDirDock->setWidget(dicomDirWidget);
+    addDockWidget(Qt::LeftDockWidgetArea, dicomDirDock);
+    dicomDirDock->hide();
+    viewMenu->addAction(dicomDirDock->toggleViewAction());
+    connect(dicomDirWidget, &DicomDirWidget::fileActivated, this, &MainWindow::openDicomDirImage);
+    connect(filterPanel, &FilterPanelWidget::filtersChanged, this, [this]() {
+        history.setState(filterState());
+        if (imageItem) {
+            imageItem->invalidate();
+        }
+    });
+
+    view->viewport()->installEventFilter(this);
+
+    // Фоновое построение таблиц накопленных сумм
+    statisticsWatcher = new QFutureWatcher<std::shared_ptr<const RegionStatistics>>(this);
+    connect(statisticsWatcher, &QFutureWatcher<std::shared_ptr<const RegionStatistics>>::finished, this, &MainWindow::onStatisticsReady);
+
+    // Фоновый поиск дефектов
+    annotationLayer = nullptr;
+    defectWatcher = new QFutureWatcher<DefectScan>(this);
+    connect(defectWatcher, &QFutureWatcher<DefectScan>::finished, this, &MainWindow::onDefectsReady);
 
     // Строка состояния
     statusLabel = new QLabel(this);
@@ -159,6 +348,7 @@ MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent)
 
     // Подключаем кнопку добавления тега к слоту addTag
     connect(addTagButton, &QPushButton::clicked, this, &MainWindow::addTag);
+    updateEditActions();
 }
 
 MainWindow::~MainWindow()
@@ -174,6 +364,13 @@ void MainWindow::addTag() {
         QMap<QString, QString> tags = tagsWidget->getTags();
         tags.insert(key, value);
         tagsWidget->setTags(tags);
+        try {
+            history.commitTags(tr("Тег «%1»").arg(key), tags);
+        }
+        catch (const std::exception& ex) {
+            reportError(tr(ex.what()));
+        }
+        updateEditActions();
 
         // Очистка полей ввода после добавления тега
         editTagKey->clear();
@@ -185,190 +382,822 @@ void MainWindow::addTag() {
 }
 
 
-QMap<QString, QString> MainWindow::extractTags(const QString& infoMsg) {
-    QMap<QString, QString> tagsMap;
-    QStringList lines = infoMsg.split("\n"); // Разделение информации на строки
+void MainWindow::openFile() {
+    QString fileName = QFileDialog::getOpenFileName(this, tr("Открыть файл"), "", tr("Изображения (*.png *.jpg *.bmp *.tiff *.tif *.raw *.dcm);;Панорамы (*.tiles);;Носители DICOM (DICOMDIR)"));
+    if (fileName.isEmpty()) {
+        return;
+    }
+    if (!fileName.endsWith(".tiles", Qt::CaseInsensitive) && !DicomDirectory::isDicomDir(fileName)) {
+        navigationStep = 1;
+        updateDirectoryListing(fileName);
+    }
+    openPath(fileName);
+}
+
+bool MainWindow::openPath(const QString& fileName) {
+    lastErrorText.clear();
+    if (fileName.endsWith(".tiles", Qt::CaseInsensitive)) {
+        openPanorama(fileName);
+        return panorama != nullptr;
+    }
+    if (DicomDirectory::isDicomDir(fileName)) {
+        return openDicomDir(fileName);
+    }
+    return loadFile(fileName);
+}
 
-    foreach(const QString & line, lines) {
-        if (line.trimmed().isEmpty()) continue; // Пропускаем пустые строки
+bool MainWindow::openDicomDir(const QString& fileName) {
+    // Читается только индекс: снимки открываются по выбору в дереве
+    try {
+        QElapsedTimer timer;
+        timer.start();
+        const DicomDirRecord root = DicomDirectory::read(fileName);
+        dicomDirWidget->setIndex(root);
+        dicomDirDock->show();
+        statusLabel->setText(tr("DICOMDIR: снимков %1, чтение индекса: %2 мс")
+            .arg(dicomDirWidget->imageFiles().size()).arg(timer.nsecsElapsed() / 1e6, 0, 'f', 1));
+        return true;
+    }
+    catch (const std::exception& ex) {
+        reportError(tr(ex.what()));
+        return false;
+    }
+}
 
-        // Разделяем строку на ключ и значение по первому вхождению двоеточия
-        int splitIndex = line.indexOf(":");
-        if (splitIndex == -1) continue; // Если двоеточие не найдено, пропускаем строку
+void MainWindow::openDicomDirImage(const QString& fileName) {
+    // Переход к соседним снимкам идет по порядку носителя, а не папки
+    directoryFiles = dicomDirWidget->imageFiles();
+    directoryIndex = directoryFiles.indexOf(fileName);
+    navigationStep = 1;
+    loadFile(fileName);
+}
 
-        QString key = line.left(splitIndex).trimmed();
-        QString value = line.mid(splitIndex + 1).trimmed();
+void MainWindow::setScripted(bool enabled) {
+    scripted = enabled;
+}
 
-        if (!key.isEmpty() && !value.isEmpty()) {
-            tagsMap.insert(key, value); // Добавляем пару ключ-значение в карту
-        }
+void MainWindow::reportError(const QString& message) {
+    // В сценарном режиме модальное окно остановило бы прогон
+    lastErrorText = message;
+    if (!scripted) {
+        QMessageBox::warning(this, tr("Ошибка"), message);
     }
+}
 
-    return tagsMap;
+void MainWindow::setAdjustment(int contrast, int brightness) {
+    // Ползунки вызывают adjustImage так же, как при перетаскивании мышью
+    sliderContrast->setValue(contrast);
+    sliderBrightness->setValue(brightness);
 }
 
+void MainWindow::renderView() {
+    view->viewport()->repaint();
+}
 
-void MainWindow::openFile() {
-    QString fileName = QFileDialog::getOpenFileName(this, tr("Открыть файл"), "", tr("Изображения (*.png *.jpg *.bmp *.tiff *.tif *.raw *.dcm)"));
-    if (fileName.isEmpty()) {
+void MainWindow::clearImageCache() {
+    imageCache.clear();
+}
+
+void MainWindow::openNextFile() {
+    openNeighbor(1);
+}
+
+void MainWindow::openPreviousFile() {
+    openNeighbor(-1);
+}
+
+void MainWindow::openNeighbor(int step) {
+    const int index = directoryIndex + step;
+    if (directoryIndex < 0 || index < 0 || index >= directoryFiles.size()) {
         return;
     }
+    navigationStep = step;
+    directoryIndex = index;
+    loadFile(directoryFiles[index]);
+}
+
+void MainWindow::updateDirectoryListing(const QString& fileName) {
+    QFileInfo fileInfo(fileName);
+    QDir directory = fileInfo.absoluteDir();
+    directory.setNameFilters({ "*.png", "*.jpg", "*.bmp", "*.tiff", "*.tif", "*.raw", "*.dcm" });
+    directory.setSorting(QDir::Name | QDir::LocaleAware | QDir::IgnoreCase);
 
-    QPixmap pixmap;
-    int imageWidth = 0;
-    int imageHeight = 0;
-    int bitDepth = 0;
-    int dpiX = 0;
-    int dpiY = 0;
+    directoryFiles.clear();
+    for (const QFileInfo& entry : directory.entryInfoList(QDir::Files)) {
+        directoryFiles.append(entry.absoluteFilePath());
+    }
+    directoryIndex = directoryFiles.indexOf(fileInfo.absoluteFilePath());
+}
 
+bool MainWindow::loadFile(const QString& fileName) {
     try {
-        if (fileName.endsWith(".raw", Qt::CaseInsensitive)) {
-            QMap<QString, QString> tags;
-            cv::Mat cvImage = ImageProcessor::readImageFromRawFile(fileName.toStdString(), tags);
-            tagsWidget->setTags(tags.isEmpty() ? QMap<QString, QString>() : tags);
-            if (!cvImage.empty()) {
-                QImage qImage = QImage(cvImage.data, cvImage.cols, cvImage.rows, static_cast<int>(cvImage.step), QImage::Format_Grayscale16);
-                pixmap = QPixmap::fromImage(qImage);
-                currentImage = cvImage;
-                imageWidth = cvImage.cols;
-                imageHeight = cvImage.rows;
-                bitDepth = cvImage.elemSize() * 8;
-            }
-            else {
-                throw std::runtime_error("Не удалось открыть изображение .raw");
+        QElapsedTimer timer;
+        timer.start();
+        LoadedImage loaded = imageCache.load(fileName);
+        const double loadMs = timer.nsecsElapsed() / 1e6;
+
+        currentImage = loaded.image;
+        panorama.reset();
+        currentHistogram = loaded.histogram;
+        // Аннотации хранятся среди тегов файла, но в таблице тегов не показываются
+        QMap<QString, QString> tags = loaded.tags;
+        annotations.fromJson(tags.take(AnnotationStore::TagKey));
+        tagsWidget->setTags(tags);
+        histogramWidget->setHistogram(currentHistogram);
+
+        resetMeasurements();
+        view->scene()->clear();
+        filterChain.setSource(currentImage);
+        viewTransform.reset();
+        createImageItem();
+        applyAutoWindow(tags);
+        fitInView();
+        startStatisticsComputation();
+        // Исходная версия ссылается на изображение без копирования:
+        // тайлы создаются только при первой правке
+        history.reset(currentImage, tags, filterState());
+        updateEditActions();
+
+        // Предзагрузка соседей: по одному с каждой стороны и еще один по ходу просмотра
+        if (directoryIndex >= 0) {
+            QStringList neighbors;
+            for (int offset : { navigationStep, -navigationStep, 2 * navigationStep }) {
+                const int index = directoryIndex + offset;
+                if (index >= 0 && index < directoryFiles.size()) {
+                    neighbors.append(directoryFiles[index]);
+                }
             }
+            imageCache.prefetch(neighbors);
         }
-        else if (fileName.endsWith(".dcm", Qt::CaseInsensitive)) {
-            QString infoMsg;
-            QImage qImage = DicomProcessor::processDicom(fileName, infoMsg);
-            QMap<QString, QString> tags = extractTags(infoMsg);
-            tagsWidget->setTags(tags.isEmpty() ? QMap<QString, QString>() : tags);
-            if (!qImage.isNull()) {
-                pixmap = QPixmap::fromImage(qImage);
-                currentImage = ImageProcessor::QImageToCvMat(qImage);
-                dpiX = dpiY = 96; // Assuming default DPI for DICOM images
-                imageWidth = qImage.width();
-                imageHeight = qImage.height();
-                bitDepth = qImage.depth();
-            }
-            else {
-                throw std::runtime_error("Не удалось открыть DICOM изображение");
-            }
+
+        const ImageCacheStatistics cache = imageCache.statistics();
+        QString statusMessage = tr("Файл открыт: %1x%2, Глубина цвета: %3 бит, DPI: %4, загрузка: %5 мс, гистограмма: %6 мс")
+            .arg(currentImage.cols).arg(currentImage.rows).arg(loaded.bitDepth).arg(loaded.dpi)
+            .arg(loadMs, 0, 'f', 1).arg(currentHistogram.elapsedMs, 0, 'f', 1);
+        statusMessage += tr(" | Кэш: попаданий %1, ожиданий %2, промахов %3, %4/%5 МБ")
+            .arg(cache.hits).arg(cache.waits).arg(cache.misses)
+            .arg(cache.usedBytes / (1024 * 1024)).arg(cache.limitBytes / (1024 * 1024));
+        statusLabel->setText(statusMessage); // Обновление текста QLabel в статусной строке
+
+        // Обновление заголовка окна с именем файла и позицией в каталоге
+        QFileInfo fileInfo(fileName);
+        QString title = tr("Просмотр изображения - %1").arg(fileInfo.fileName());
+        if (directoryIndex >= 0) {
+            title += QString(" [%1/%2]").arg(directoryIndex + 1).arg(directoryFiles.size());
         }
-        else if (fileName.endsWith(".tiff", Qt::CaseInsensitive) || fileName.endsWith(".tif", Qt::CaseInsensitive)) {
-            cv::Mat cvImage;
-            QMap<QString, QString> tags;
-            if (TiffProcessor::loadTiffWithTags(fileName, cvImage, tags)) {
-                QImage qImage = QImage(cvImage.data, cvImage.cols, cvImage.rows, static_cast<int>(cvImage.step), cvImage.channels() == 1 ? QImage::Format_Grayscale8 : QImage::Format_RGB888);
-                pixmap = QPixmap::fromImage(qImage);
-                currentImage = cvImage;
-                imageWidth = cvImage.cols;
-                imageHeight = cvImage.rows;
-                bitDepth = cvImage.elemSize() * 8;
-                dpiX = qImage.dotsPerMeterX() * 0.0254; // Convert from dots per meter to DPI
-                dpiY = qImage.dotsPerMeterY() * 0.0254; // Convert from dots per meter to DPI
-                tagsWidget->setTags(tags.isEmpty() ? QMap<QString, QString>() : tags);
-            }
-            else {
-                throw std::runtime_error("Не удалось открыть изображение .tiff");
+        setWindowTitle(title);
+        return true;
+    }
+    catch (const std::exception& ex) {
+        reportError(tr(ex.what()));
+        return false;
+    }
+}
+
+void MainWindow::stitchFiles() {
+    QStringList fileNames = QFileDialog::getOpenFileNames(this, tr("Снимки для сшивки"), "", tr("Изображения (*.png *.jpg *.bmp *.tiff *.tif *.raw *.dcm)"));
+    if (fileNames.isEmpty()) {
+        return;
+    }
+    if (fileNames.size() < 2) {
+        QMessageBox::warning(this, tr("Ошибка"), tr("Для сшивки нужно не менее двух снимков"));
+        return;
+    }
+    // Снимки сшиваются в порядке имен (номера пластин или полос)
+    QCollator collator;
+    collator.setNumericMode(true);
+    std::sort(fileNames.begin(), fileNames.end(), collator);
+
+    const QString outputName = QFileDialog::getSaveFileName(this, tr("Файл панорамы"),
+        QFileInfo(fileNames.first()).absoluteDir().filePath("panorama.tiles"), tr("Панорамы (*.tiles)"));
+    if (outputName.isEmpty()) {
+        return;
+    }
+    // Открытая панорама не может быть перезаписана, пока из нее читаются тайлы
+    if (panorama && QFileInfo(panorama->fileName()) == QFileInfo(outputName)) {
+        resetMeasurements();
+        view->scene()->clear();
+        imageItem = nullptr;
+        panorama.reset();
+    }
+
+    QProgressDialog* progressDialog = new QProgressDialog(tr("Сшивка снимков..."), tr("Отмена"), 0, 1000, this);
+    progressDialog->setWindowModality(Qt::WindowModal);
+    progressDialog->setMinimumDuration(0);
+    progressDialog->setAutoClose(false);
+    progressDialog->setAutoReset(false);
+
+    // Ход выполнения передается в GUI поток очередью событий
+    auto cancelled = std::make_shared<std::atomic_bool>(false);
+    connect(progressDialog, &QProgressDialog::canceled, this, [cancelled]() { *cancelled = true; });
+    QPointer<QProgressDialog> dialog(progressDialog);
+    Stitcher::Progress progress = [this, dialog, cancelled](const QString& stage, double fraction) {
+        QMetaObject::invokeMethod(this, [dialog, stage, fraction]() {
+            if (dialog) {
+                dialog->setLabelText(stage);
+                dialog->setValue(static_cast<int>(fraction * 1000));
             }
+        }, Qt::QueuedConnection);
+        return !*cancelled;
+    };
+
+    // Результат фоновой задачи - текст ошибки (пустой при успехе)
+    QFutureWatcher<QString>* watcher = new QFutureWatcher<QString>(this);
+    connect(watcher, &QFutureWatcher<QString>::finished, this, [this, watcher, dialog, cancelled, outputName]() {
+        const QString error = watcher->result();
+        watcher->deleteLater();
+        if (dialog) {
+            dialog->deleteLater();
+        }
+        if (*cancelled) {
+            QFile::remove(outputName);
+            statusBar()->showMessage(tr("Сшивка отменена"), 2000);
+        }
+        else if (!error.isEmpty()) {
+            QMessageBox::warning(this, tr("Ошибка"), error);
         }
         else {
-            QImage image;
-            if (image.load(fileName)) {
-                pixmap = QPixmap::fromImage(image);
-                currentImage = ImageProcessor::QImageToCvMat(image);
-                imageWidth = image.width();
-                imageHeight = image.height();
-                bitDepth = image.depth();
-                dpiX = image.dotsPerMeterX() * 0.0254; // Convert from dots per meter to DPI
-                dpiY = image.dotsPerMeterY() * 0.0254; // Convert from dots per meter to DPI
-                tagsWidget->setTags(QMap<QString, QString>());
-            }
-            else {
-                throw std::runtime_error("Не удалось открыть изображение");
+            openPanorama(outputName);
+        }
+    });
+    watcher->setFuture(QtConcurrent::run([fileNames, outputName, progress]() {
+        try {
+            const std::vector<FilmPlacement> placements = Stitcher::registerFilms(fileNames, progress);
+            if (!placements.empty()) {
+                Stitcher::compose(placements, outputName, progress);
             }
+            return QString();
+        }
+        catch (const std::exception& ex) {
+            return QString::fromStdString(ex.what());
         }
+    }));
+}
 
+void MainWindow::openPanorama(const QString& fileName) {
+    try {
+        panorama = TiledStore::open(fileName);
+        currentImage.release();
+        currentHistogram = panorama->histogram();
+        tagsWidget->setTags(QMap<QString, QString>());
+        annotations.clear();
+        histogramWidget->setHistogram(currentHistogram);
+
+        resetMeasurements();
         view->scene()->clear();
-        view->scene()->addItem(new QGraphicsPixmapItem(pixmap));
-        currentPixmapItem = view->scene()->addPixmap(pixmap);
-        view->scene()->setSceneRect(pixmap.rect());
+        filterChain.setSource(cv::Mat());
+        viewTransform.reset();
+        regionStatistics.reset();
+        createImageItem();
+        const cv::Size size = panorama->size();
+        view->scene()->setSceneRect(0, 0, size.width, size.height);
+        applyAutoWindow(QMap<QString, QString>());
         fitInView();
 
-        QString statusMessage = tr("Файл открыт: %1x%2, Глубина цвета: %3 бит, DPI: %4").arg(imageWidth).arg(imageHeight).arg(bitDepth).arg(dpiX);
-        statusLabel->setText(statusMessage); // Обновление текста QLabel в статусной строке
+        directoryFiles.clear();
+        directoryIndex = -1;
+        history.clear();
+        updateEditActions();
+        statusLabel->setText(tr("Панорама: %1x%2, уровней пирамиды: %3").arg(size.width).arg(size.height).arg(panorama->levelCount()));
+        setWindowTitle(tr("Просмотр изображения - %1").arg(QFileInfo(fileName).fileName()));
+    }
+    catch (const std::exception& ex) {
+        panorama.reset();
+        reportError(tr(ex.what()));
+    }
+}
 
-        // Обновление заголовка окна с именем файла
-        QFileInfo fileInfo(fileName);
-        setWindowTitle(tr("Просмотр изображения - %1").arg(fileInfo.fileName()));
+void MainWindow::savePanorama(const QString& fileName) {
+    // Панорама может не помещаться в память, поэтому выгружается только в .raw полосами тайлов
+    const cv::Size size = panorama->size();
+    if (!fileName.endsWith(".raw", Qt::CaseInsensitive) || size.width > 65535 || size.height > 65535) {
+        reportError(tr("Панорама хранится в файле %1 и может быть выгружена только в .raw размером до 65535 пикселей").arg(panorama->fileName()));
+        emit saveFinished(fileName, lastErrorText);
+        return;
+    }
+
+    // Хранилище тайлов потокобезопасно: запись идет параллельно с отрисовкой
+    const std::shared_ptr<TiledStore> store = panorama;
+    const QMap<QString, QString> tags = tagsWidget->getTags();
+    runSave(fileName, [store, size, tags, fileName](const std::function<bool(double)>& progress) {
+        ImageProcessor::RawImageWriter writer(fileName.toStdString(), size);
+        bool written = writer.isOpen();
+        for (int y = 0; written && y < size.height; y += TiledStore::TileSize) {
+            if (!progress(double(y) / size.height)) {
+                throw SaveCancelled();
+            }
+            written = writer.writeRows(store->readRegion(cv::Rect(0, y, size.width, TiledStore::TileSize), 0));
+        }
+        return written && writer.finish(tags) ? QString() : tr("Не удалось сохранить изображение в формате .raw");
+    });
+}
+
+void MainWindow::undoEdit() {
+    stepHistory(false);
+}
+
+void MainWindow::redoEdit() {
+    stepHistory(true);
+}
+
+void MainWindow::stepHistory(bool forward) {
+    // Чтение выгруженных тайлов может завершиться ошибкой файла истории
+    try {
+        const quint64 imageVersion = history.imageVersion();
+        if (forward) {
+            history.redo();
+        }
+        else {
+            history.undo();
+        }
+        if (history.imageVersion() != imageVersion) {
+            setWorkingImage(history.image());
+        }
+        tagsWidget->setTags(history.tags());
+        restoreFilterState(history.state());
     }
     catch (const std::exception& ex) {
-        QMessageBox::warning(this, tr("Ошибка"), tr(ex.what()));
+        // Версия, изображение которой не прочитано, не становится текущей
+        if (forward) {
+            history.undo();
+        }
+        else {
+            history.redo();
+        }
+        reportError(tr(ex.what()));
+    }
+    updateEditActions();
+}
+
+QByteArray MainWindow::filterState() const {
+    QByteArray state;
+    for (const std::shared_ptr<FilterNode>& node : filterChain.nodes()) {
+        state.append(node->isEnabled() ? '1' : '0');
+    }
+    return state;
+}
+
+void MainWindow::restoreFilterState(const QByteArray& state) {
+    const std::vector<std::shared_ptr<FilterNode>>& nodes = filterChain.nodes();
+    if (state.size() != static_cast<qsizetype>(nodes.size()) || state == filterState()) {
+        return;
+    }
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        nodes[i]->setEnabled(state[static_cast<qsizetype>(i)] == '1');
+    }
+    filterPanel->refresh();
+    if (imageItem) {
+        imageItem->invalidate();
+    }
+}
+
+void MainWindow::applyFilters() {
+    if (currentImage.empty() || !filterChain.hasActiveNodes()) {
+        return;
+    }
+
+    // После запекания узлы выключаются, иначе фильтры применились бы повторно.
+    // Версия до применения помнит включенные узлы: отмена возвращает и их
+    cv::Mat baked = filterChain.bakeAll();
+    QByteArray disabled(static_cast<qsizetype>(filterChain.nodes().size()), '0');
+    const quint64 imageVersion = history.imageVersion();
+    try {
+        history.setState(filterState());
+        history.commit(tr("Применение фильтров"), baked, tagsWidget->getTags(), disabled);
+    }
+    catch (const std::exception& ex) {
+        // Ошибка выгрузки после добавления версии не отменяет саму правку
+        reportError(tr(ex.what()));
+    }
+    if (history.imageVersion() == imageVersion) {
+        updateEditActions();
+        return;
+    }
+    restoreFilterState(disabled);
+    setWorkingImage(baked);
+    updateEditActions();
+}
+
+void MainWindow::setHistoryLimit() {
+    bool ok = false;
+    const int megabytes = QInputDialog::getInt(this, tr("Память истории"), tr("Объем памяти под историю правок, МБ:"),
+        static_cast<int>(history.memoryLimit() / (1024 * 1024)), 16, 65536, 64, &ok);
+    if (ok) {
+        try {
+            history.setMemoryLimit(qint64(megabytes) * 1024 * 1024);
+        }
+        catch (const std::exception& ex) {
+            reportError(tr(ex.what()));
+        }
+        updateEditActions();
+    }
+}
+
+void MainWindow::setWorkingImage(const cv::Mat& image) {
+    // Замена изображения без сброса окна отображения и масштаба
+    const bool resized = image.size() != currentImage.size();
+    currentImage = image;
+    currentHistogram = ImageHistogram::compute(currentImage);
+    histogramWidget->setHistogram(currentHistogram);
+    histogramWidget->setWindow(displayLow, displayHigh);
+    filterChain.setSource(currentImage);
+
+    if (resized) {
+        resetMeasurements();
+        view->scene()->clear();
+        createImageItem();
+        fitInView();
+    }
+    else if (imageItem) {
+        imageItem->invalidate();
+    }
+    startStatisticsComputation();
+    updateLineProfile();
+}
+
+void MainWindow::updateEditActions() {
+    undoAction->setEnabled(history.canUndo());
+    redoAction->setEnabled(history.canRedo());
+    undoAction->setText(history.canUndo() ? tr("&Отменить: %1").arg(history.undoText()) : tr("&Отменить"));
+    redoAction->setText(history.canRedo() ? tr("&Повторить: %1").arg(history.redoText()) : tr("&Повторить"));
+    if (history.memoryUsage() + history.spilledBytes() > 0) {
+        statusBar()->showMessage(tr("История правок: %1 МБ в памяти, %2 МБ на диске")
+            .arg(history.memoryUsage() / (1024 * 1024)).arg(history.spilledBytes() / (1024 * 1024)), 3000);
     }
 }
 
 void MainWindow::saveFile()
 {
-    QString fileName = QFileDialog::getSaveFileName(this, tr("Сохранить файл"), "", tr("Изображения (*.png *.jpg *.bmp *.raw *.dcm *.tiff)"));
-    if (!fileName.isEmpty()) {
-        QGraphicsPixmapItem* item = qgraphicsitem_cast<QGraphicsPixmapItem*>(view->scene()->items().first());
-        if (item) {
-            QPixmap pixmap = item->pixmap();
-            if (fileName.endsWith(".raw", Qt::CaseInsensitive)) {
-                // Получаем изображение из QGraphicsPixmapItem
-                QImage qImage = item->pixmap().toImage();
-                cv::Mat image = ImageProcessor::convertTo16BitGrayscale(qImage);
-
-                // Сохраняем изображение в формате .raw
-                QMap<QString, QString> tags = tagsWidget->getTags();
-                if (ImageProcessor::saveImageToRawFormat(image, fileName.toStdString(), tags)) {
-                    statusBar()->showMessage(tr("Файл сохранен"), 2000);
-                }
-                else {
-                    QMessageBox::warning(this, tr("Ошибка"), tr("Не удалось сохранить изображение в формате .raw"));
+    // PNG из списка изображений сохраняется без потерь в разрядности исходника,
+    // отдельный фильтр - 8-битный PNG для отчета с окном экрана
+    const QString reportFilter = tr("Отчет PNG, 8 бит с окном экрана (*.png)");
+    QString selectedFilter;
+    QString fileName = QFileDialog::getSaveFileName(this, tr("Сохранить файл"), "",
+        tr("Изображения (*.png *.jpg *.bmp *.raw *.dcm *.tiff)") + ";;" + reportFilter, &selectedFilter);
+    if (fileName.isEmpty()) {
+        return;
+    }
+    saveAs(fileName, selectedFilter == reportFilter);
+}
+
+void MainWindow::saveAs(const QString& fileName, bool report)
+{
+    lastErrorText.clear();
+    if (panorama) {
+        savePanorama(fileName);
+        return;
+    }
+    if (currentImage.empty()) {
+        reportError(tr("Изображение не открыто"));
+        emit saveFinished(fileName, lastErrorText);
+        return;
+    }
+
+    // Фоновая запись работает со снимком состояния: цепочка копируется вместе
+    // с кэшами и копиями узлов, поэтому изменения параметров в панели и отрисовка
+    // тайлов в GUI потоке не пересекаются с запеканием.
+    // Сохраняются исходные пиксели с примененной цепочкой фильтров,
+    // а не 8-битное изображение на экране
+    QMap<QString, QString> tags = tagsWidget->getTags();
+    viewTransform.updateTags(tags, currentImage.size());
+    if (!annotations.isEmpty()) {
+        // Аннотации переводятся в координаты сохраняемого изображения
+        const cv::Size output = viewTransform.outputSize(currentImage.size());
+        tags.insert(AnnotationStore::TagKey, annotations.toJson(viewTransform.sceneToSource(currentImage.size()).inverted(),
+            QRectF(0, 0, output.width, output.height)));
+    }
+    FilterChain chain = filterChain.snapshot();
+    const ViewTransform transform = viewTransform;
+    const double low = displayLow;
+    const double high = displayHigh;
+    const int pngLevel = fastPngAction->isChecked() ? ImageExport::FastPngLevel : ImageExport::DefaultPngLevel;
+
+    runSave(fileName, [fileName, report, tags, chain, transform, low, high, pngLevel](const std::function<bool(double)>& progress) mutable {
+        const cv::Mat& source = chain.source();
+
+        if (fileName.endsWith(".raw", Qt::CaseInsensitive) && transform.isIdentity()) {
+            // Цепочка запекается полосами прямо в файл. Без активных фильтров полосы
+            // совпадают с исходником, и 12-битный исходник пишется упакованным
+            const int packShift = chain.hasActiveNodes() ? -1 : Packed12::losslessShift(source);
+            ImageProcessor::RawImageWriter writer(fileName.toStdString(), source.size(), packShift);
+            bool written = writer.isOpen();
+            chain.bake(256, [&writer, &written, &progress, &source](const cv::Mat& band, int y) {
+                if (!progress(double(y) / source.rows)) {
+                    throw SaveCancelled();
                 }
+                written = written && writer.writeRows(ImageProcessor::convertTo16BitGrayscale(band));
+            });
+            return written && writer.finish(tags) ? QString() : tr("Не удалось сохранить изображение в формате .raw");
+        }
+
+        // Остальным форматам нужен кадр целиком: запекание дает первую половину хода
+        cv::Mat baked(source.size(), source.type());
+        chain.bake(512, [&baked, &progress, &source](const cv::Mat& band, int y) {
+            if (!progress(0.5 * y / source.rows)) {
+                throw SaveCancelled();
             }
-            else if (fileName.endsWith(".dcm", Qt::CaseInsensitive)) {
-                // Получаем изображение из QGraphicsPixmapItem
-                QImage qImage = item->pixmap().toImage();
-                cv::Mat image = ImageProcessor::convertTo16BitGrayscale(qImage);
-
-                // Сохраняем изображение в формате DICOM
-                QMap<QString, QString> tags = tagsWidget->getTags(); // Предполагается, что tagsWidget имеет метод getTags()
-                if (DicomProcessor::saveDicom(image, fileName, tags)) {
-                    statusBar()->showMessage(tr("Файл сохранен"), 2000);
-                }
-                else {
-                    QMessageBox::warning(this, tr("Ошибка"), tr("Не удалось сохранить изображение в формате DICOM"));
-                }
+            band.copyTo(baked(cv::Rect(0, y, band.cols, band.rows)));
+        });
+        // Геометрия применяется одним проходом к запеченному изображению
+        baked = transform.apply(baked);
+        if (!progress(0.5)) {
+            throw SaveCancelled();
+        }
+
+        if (fileName.endsWith(".raw", Qt::CaseInsensitive)) {
+            return ImageProcessor::saveImageToRawFormat(ImageProcessor::convertTo16BitGrayscale(baked), fileName.toStdString(), tags)
+                ? QString() : tr("Не удалось сохранить изображение в формате .raw");
+        }
+        if (fileName.endsWith(".dcm", Qt::CaseInsensitive)) {
+            return DicomProcessor::saveDicom(ImageProcessor::convertTo16BitGrayscale(baked), fileName, tags)
+                ? QString() : tr("Не удалось сохранить изображение в формате DICOM");
+        }
+        if (fileName.endsWith(".tiff", Qt::CaseInsensitive)) {
+            // TIFF пишется во временный файл и заменяет целевой после сброса на диск
+            const QString temporaryName = FileIntegrity::temporaryFileName(fileName);
+            if (TiffProcessor::saveTiffWithTags(ImageProcessor::convertTo16BitGrayscale(baked), temporaryName, tags)
+                && FileIntegrity::commitFile(temporaryName, fileName)) {
+                return QString();
             }
-            else if (fileName.endsWith(".tiff", Qt::CaseInsensitive)) {
-                // Сохранение в TIFF формате
-                QImage qImage = item->pixmap().toImage();
-                cv::Mat image = ImageProcessor::convertTo16BitGrayscale(qImage);
-                QMap<QString, QString> tags = tagsWidget->getTags();
-                if (TiffProcessor::saveTiffWithTags(image, fileName, tags)) {
-                    statusBar()->showMessage(tr("Файл сохранен"), 2000);
-                }
-                else {
-                    QMessageBox::warning(this, tr("Ошибка"), tr("Не удалось сохранить изображение в формате TIFF"));
-                }
+            QFile::remove(temporaryName);
+            return tr("Не удалось сохранить изображение в формате TIFF");
+        }
+
+        if (!report && fileName.endsWith(".png", Qt::CaseInsensitive)) {
+            // PNG без потерь из исходного буфера: 8 или 16 бит на пиксель. Цветные
+            // изображения собственный кодировщик не пишет - они сохраняются кодировщиком
+            // Qt в RGB без окна, чтобы не потерять цвет
+            if (baked.channels() == 1) {
+                const cv::Mat png = baked.depth() == CV_8U || baked.depth() == CV_16U ? baked : ImageProcessor::convertTo16BitGrayscale(baked);
+                return ImageExport::savePng(png, fileName, pngLevel) ? QString() : tr("Не удалось сохранить изображение в формате PNG");
             }
-            else {
-                // Сохраняем изображение в других поддерживаемых форматах
-                if (pixmap.save(fileName)) {
-                    statusBar()->showMessage(tr("Файл сохранен"), 2000);
-                }
-                else {
-                    QMessageBox::warning(this, tr("Ошибка"), tr("Не удалось сохранить изображение"));
-                }
+            cv::Mat color = baked;
+            if (baked.depth() != CV_8U) {
+                baked.convertTo(color, CV_8U, baked.depth() == CV_16U ? 1.0 / 256 : 1.0);
+            }
+            const QImage image = ImageProcessor::cvMatToQImage(color);
+            QSaveFile file(fileName);
+            if (!image.isNull() && file.open(QIODevice::WriteOnly) && image.save(&file, "PNG") && file.commit()) {
+                return QString();
+            }
+            return tr("Не удалось сохранить изображение в формате PNG");
+        }
+        const QString suffix = QFileInfo(fileName).suffix().toLower();
+        if (suffix == "png" || suffix == "jpg" || suffix == "jpeg" || suffix == "bmp") {
+            // Отчет: окно экрана применяется за один проход по исходнику
+            return ImageExport::saveReport(baked, fileName, low, high, pngLevel) ? QString() : tr("Не удалось сохранить изображение");
+        }
+
+        // Прочие форматы сохраняются кодировщиками Qt так, как изображение показано на экране
+        QImage image = ImageProcessor::cvMatToQImage(ImageProcessor::applyWindow(baked, low, high));
+        QSaveFile file(fileName);
+        const QByteArray format = QFileInfo(fileName).suffix().toLatin1();
+        if (file.open(QIODevice::WriteOnly) && image.save(&file, format.isEmpty() ? nullptr : format.constData()) && file.commit()) {
+            return QString();
+        }
+        return tr("Не удалось сохранить изображение");
+    });
+}
+
+void MainWindow::runSave(const QString& fileName, const SaveJob& job, const QString& label, const std::function<void()>& onSaved)
+{
+    const QString text = label.isEmpty() ? tr("Сохранение %1...").arg(QFileInfo(fileName).fileName()) : label;
+    QProgressDialog* progressDialog = new QProgressDialog(text, tr("Отмена"), 0, 1000, this);
+    progressDialog->setWindowModality(Qt::WindowModal);
+    progressDialog->setMinimumDuration(300);
+    progressDialog->setAutoClose(false);
+    progressDialog->setAutoReset(false);
+
+    // Ход выполнения передается в GUI поток очередью событий
+    auto cancelled = std::make_shared<std::atomic_bool>(false);
+    connect(progressDialog, &QProgressDialog::canceled, this, [cancelled]() { *cancelled = true; });
+    QPointer<QProgressDialog> dialog(progressDialog);
+    std::function<bool(double)> progress = [this, dialog, cancelled](double fraction) {
+        QMetaObject::invokeMethod(this, [dialog, fraction]() {
+            if (dialog) {
+                dialog->setValue(static_cast<int>(fraction * 1000));
             }
+        }, Qt::QueuedConnection);
+        return !*cancelled;
+    };
+
+    // Результат фоновой задачи - текст ошибки (пустой при успехе).
+    // Запись идет во временный файл, поэтому при отмене или ошибке
+    // прежнее содержимое целевого файла сохраняется
+    QFutureWatcher<QString>* watcher = new QFutureWatcher<QString>(this);
+    connect(watcher, &QFutureWatcher<QString>::finished, this, [this, watcher, dialog, cancelled, onSaved, fileName]() {
+        QString error = watcher->result();
+        watcher->deleteLater();
+        if (dialog) {
+            dialog->deleteLater();
+        }
+        if (*cancelled) {
+            error = tr("Сохранение отменено");
+            statusBar()->showMessage(error, 2000);
+        }
+        else if (!error.isEmpty()) {
+            reportError(error);
         }
         else {
-            QMessageBox::warning(this, tr("Ошибка"), tr("Изображение не открыто"));
+            statusBar()->showMessage(tr("Файл сохранен"), 2000);
+            if (onSaved) {
+                onSaved();
+            }
+        }
+        emit saveFinished(fileName, error);
+    });
+    watcher->setFuture(QtConcurrent::run([job, progress]() {
+        try {
+            return job(progress);
+        }
+        catch (const SaveCancelled&) {
+            return QString();
+        }
+        catch (const std::exception& ex) {
+            return QString::fromStdString(ex.what());
         }
+    }));
+}
+
+void MainWindow::integrateFrames()
+{
+    QStringList fileNames = QFileDialog::getOpenFileNames(this, tr("Кадры серии"), "", tr("Многокадровый DICOM или кадры .raw (*.dcm *.raw)"));
+    if (fileNames.isEmpty()) {
+        return;
+    }
+    // Кадры .raw накапливаются в порядке номеров в именах
+    QCollator collator;
+    collator.setNumericMode(true);
+    std::sort(fileNames.begin(), fileNames.end(), collator);
+
+    const QStringList methods = {
+        FrameIntegrator::methodName(IntegrationMethod::Mean),
+        FrameIntegrator::methodName(IntegrationMethod::MinMaxRejection),
+        FrameIntegrator::methodName(IntegrationMethod::SigmaClipping)
+    };
+    bool ok = false;
+    const QString methodText = QInputDialog::getItem(this, tr("Накопление кадров"), tr("Способ объединения:"), methods, 0, false, &ok);
+    if (!ok) {
+        return;
+    }
+    const IntegrationMethod method = static_cast<IntegrationMethod>(methods.indexOf(methodText));
+    double clipSigma = 3.0;
+    if (method == IntegrationMethod::SigmaClipping) {
+        clipSigma = QInputDialog::getDouble(this, tr("Накопление кадров"), tr("Порог отсечения, СКО:"), 3.0, 1.0, 10.0, 1, &ok);
+        if (!ok) {
+            return;
+        }
+    }
+
+    const QString outputName = QFileDialog::getSaveFileName(this, tr("Результат накопления"),
+        QFileInfo(fileNames.first()).absoluteDir().filePath("integrated.raw"), tr("Изображения (*.raw *.dcm)"));
+    if (outputName.isEmpty()) {
+        return;
     }
+
+    // Накопление дает почти весь ход выполнения, запись - остаток
+    runSave(outputName, [fileNames, outputName, method, clipSigma](const std::function<bool(double)>& progress) {
+        FrameSequence sequence(fileNames);
+        QMap<QString, QString> tags;
+        const cv::Mat result = FrameIntegrator::integrate(sequence, method, clipSigma,
+            [&progress](double fraction) { return progress(0.95 * fraction); }, tags);
+        if (result.empty()) {
+            throw SaveCancelled();
+        }
+        if (outputName.endsWith(".dcm", Qt::CaseInsensitive)) {
+            return DicomProcessor::saveDicom(result, outputName, tags) ? QString() : tr("Не удалось сохранить изображение в формате DICOM");
+        }
+        return ImageProcessor::saveImageToRawFormat(result, outputName.toStdString(), tags)
+            ? QString() : tr("Не удалось сохранить изображение в формате .raw");
+    }, tr("Накопление кадров..."), [this, outputName]() { loadFile(outputName); });
+}
+
+void MainWindow::compareFilms()
+{
+    // Открытый снимок служит эталоном, если выбран один файл
+    QStringList fileNames = QFileDialog::getOpenFileNames(this, tr("Снимки для сравнения (эталон, затем текущий)"), "",
+        tr("Изображения (*.png *.jpg *.bmp *.tiff *.tif *.raw *.dcm)"));
+    if (fileNames.isEmpty()) {
+        return;
+    }
+    cv::Mat openedImage;
+    if (fileNames.size() == 1 && !currentImage.empty()) {
+        openedImage = currentImage;
+    }
+    else if (fileNames.size() != 2) {
+        QMessageBox::warning(this, tr("Ошибка"), tr("Выберите два снимка или один снимок для сравнения с открытым"));
+        return;
+    }
+    else {
+        QCollator collator;
+        collator.setNumericMode(true);
+        std::sort(fileNames.begin(), fileNames.end(), collator);
+    }
+
+    QProgressDialog* progressDialog = new QProgressDialog(tr("Совмещение снимков..."), QString(), 0, 0, this);
+    progressDialog->setWindowModality(Qt::WindowModal);
+    progressDialog->setMinimumDuration(300);
+
+    // Загрузка, пирамиды и совмещение выполняются в фоне
+    struct Comparison {
+        FilmComparison::Pyramid reference;
+        FilmComparison::Pyramid comparison;
+        FilmAlignment alignment;
+        QString error;
+    };
+    QFutureWatcher<Comparison>* watcher = new QFutureWatcher<Comparison>(this);
+    connect(watcher, &QFutureWatcher<Comparison>::finished, this, [this, watcher, progressDialog]() {
+        const Comparison result = watcher->result();
+        watcher->deleteLater();
+        progressDialog->deleteLater();
+        if (!result.error.isEmpty()) {
+            QMessageBox::warning(this, tr("Ошибка"), result.error);
+            return;
+        }
+        compareWidget->setFilms(result.reference, result.comparison, result.alignment);
+        centralStack->setCurrentWidget(compareWidget);
+        if (result.alignment.response < 0.05) {
+            statusBar()->showMessage(tr("Слабый отклик совмещения: снимки могут быть совмещены неверно"), 5000);
+        }
+    });
+    watcher->setFuture(QtConcurrent::run([this, fileNames, openedImage]() {
+        Comparison result;
+        try {
+            const cv::Mat reference = ImageProcessor::convertTo16BitGrayscale(openedImage.empty() ? imageCache.load(fileNames.first()).image : openedImage);
+            const cv::Mat comparison = ImageProcessor::convertTo16BitGrayscale(imageCache.load(fileNames.last()).image);
+            result.reference = FilmComparison::buildPyramid(reference, TiledImageItem::TileSize);
+            result.comparison = FilmComparison::buildPyramid(comparison, TiledImageItem::TileSize);
+            result.alignment = FilmComparison::align(result.reference, result.comparison);
+        }
+        catch (const std::exception& ex) {
+            result.error = QString::fromStdString(ex.what());
+        }
+        return result;
+    }));
+}
+
+void MainWindow::closeComparison()
+{
+    compareWidget->clear();
+    centralStack->setCurrentWidget(view);
+}
+
+void MainWindow::verifyArchive()
+{
+    const QString directory = QFileDialog::getExistingDirectory(this, tr("Каталог архива"));
+    if (directory.isEmpty()) {
+        return;
+    }
+    const QStringList fileNames = FileIntegrity::collectFiles(directory);
+    if (fileNames.isEmpty()) {
+        QMessageBox::information(this, tr("Проверка целостности"), tr("В каталоге нет файлов .raw и .dcm"));
+        return;
+    }
+
+    QProgressDialog* progressDialog = new QProgressDialog(tr("Проверка контрольных сумм..."), tr("Отмена"), 0, fileNames.size(), this);
+    progressDialog->setWindowModality(Qt::WindowModal);
+    progressDialog->setMinimumDuration(0);
+    progressDialog->setAutoClose(false);
+    progressDialog->setAutoReset(false);
+
+    // Файлы проверяются параллельно глобальным пулом потоков
+    QFutureWatcher<FileIntegrity::VerifyResult>* watcher = new QFutureWatcher<FileIntegrity::VerifyResult>(this);
+    connect(watcher, &QFutureWatcher<FileIntegrity::VerifyResult>::progressValueChanged, progressDialog, &QProgressDialog::setValue);
+    connect(progressDialog, &QProgressDialog::canceled, watcher, &QFutureWatcher<FileIntegrity::VerifyResult>::cancel);
+    connect(watcher, &QFutureWatcher<FileIntegrity::VerifyResult>::finished, this, [this, watcher, progressDialog]() {
+        progressDialog->deleteLater();
+        watcher->deleteLater();
+
+        int valid = 0;
+        int unprotected = 0;
+        QStringList problems;
+        const QList<FileIntegrity::VerifyResult> results = watcher->future().results();
+        for (const FileIntegrity::VerifyResult& result : results) {
+            switch (result.status) {
+            case FileIntegrity::VerifyResult::Valid:
+                ++valid;
+                break;
+            case FileIntegrity::VerifyResult::Unprotected:
+                ++unprotected;
+                break;
+            default:
+                problems << QString("%1: %2").arg(QDir::toNativeSeparators(result.fileName), result.message);
+                break;
+            }
+        }
+
+        QMessageBox box(problems.isEmpty() ? QMessageBox::Information : QMessageBox::Warning, tr("Проверка целостности"),
+            tr("Проверено файлов: %1\nКонтрольная сумма совпала: %2\nБез контрольной суммы: %3\nПоврежденных или нечитаемых: %4")
+                .arg(results.size()).arg(valid).arg(unprotected).arg(problems.size()), QMessageBox::Ok, this);
+        if (watcher->isCanceled()) {
+            box.setInformativeText(tr("Проверка прервана"));
+        }
+        if (!problems.isEmpty()) {
+            box.setDetailedText(problems.join('\n'));
+        }
+        box.exec();
+    });
+    watcher->setFuture(QtConcurrent::mapped(fileNames, &FileIntegrity::verifyFile));
 }
 
 void MainWindow::about()
@@ -377,41 +1206,465 @@ void MainWindow::about()
 }
 
 void MainWindow::zoomIn() {
+    if (centralStack->currentWidget() == compareWidget) {
+        compareWidget->zoomIn();
+        return;
+    }
     view->scale(1.1, 1.1);
 }
 
 void MainWindow::zoomOut() {
+    if (centralStack->currentWidget() == compareWidget) {
+        compareWidget->zoomOut();
+        return;
+    }
     view->scale(0.9, 0.9);
 }
 
 void MainWindow::fitInView() {
+    if (centralStack->currentWidget() == compareWidget) {
+        compareWidget->fitInView();
+        return;
+    }
     view->fitInView(view->scene()->sceneRect(), Qt::KeepAspectRatio);
 }
 
+void MainWindow::applyAutoWindow(const QMap<QString, QString>& tags) {
+    // Окно из тегов DICOM имеет приоритет над процентилями гистограммы
+    bool hasCenter = false;
+    bool hasWidth = false;
+    const double center = tags.value("Центр окна").toDouble(&hasCenter);
+    const double width = tags.value("Ширина окна").toDouble(&hasWidth);
+
+    // DICOM с 13-16 битами DCMTK декодирует в 8 бит по всему диапазону значений:
+    // окно из тегов задано в исходных единицах и к такому изображению не подходит
+    const int bitsStored = tags.value("Биты сохранены").toInt();
+    const bool narrowed = currentImage.depth() == CV_8U && bitsStored > 8;
+
+    if (hasCenter && hasWidth && width > 0.0 && !narrowed) {
+        // Значения 12-битных DICOM сдвинуты к старшим разрядам при загрузке
+        const double scale = (currentImage.depth() == CV_16U && bitsStored > 0 && bitsStored < 16) ? (1 << (16 - bitsStored)) : 1.0;
+        windowLow = (center - width / 2.0) * scale;
+        windowHigh = (center + width / 2.0) * scale;
+    }
+    else if (!currentHistogram.isEmpty()) {
+        windowLow = currentHistogram.percentile(0.005);
+        windowHigh = currentHistogram.percentile(0.995);
+    }
+    else {
+        windowLow = 0.0;
+        windowHigh = currentImage.depth() == CV_16U ? 65535.0 : 255.0;
+    }
+    if (windowHigh <= windowLow) {
+        windowHigh = windowLow + 1.0;
+    }
+
+    // Ползунки возвращаются в нейтральное положение относительно нового окна
+    sliderContrast->blockSignals(true);
+    sliderBrightness->blockSignals(true);
+    sliderContrast->setValue(100);
+    sliderBrightness->setValue(0);
+    sliderContrast->blockSignals(false);
+    sliderBrightness->blockSignals(false);
+
+    adjustImage();
+}
+
 void MainWindow::adjustImage() {
-    double contrastValue = sliderContrast->value() / 50.0;
-    double brightnessValue = static_cast<double>(sliderBrightness->value());
+    if (currentImage.empty() || !imageItem) {
+        return;
+    }
+
+    // Контраст сужает окно относительно базового (100 - без изменений),
+    // яркость сдвигает его центр на долю ширины окна
+    double contrastValue = std::max(sliderContrast->value(), 1) / 100.0;
+    double brightnessValue = sliderBrightness->value() / 100.0;
+
+    const double baseWidth = windowHigh - windowLow;
+    const double width = baseWidth / contrastValue;
+    const double center = (windowLow + windowHigh) / 2.0 - brightnessValue * baseWidth;
+    displayLow = center - width / 2.0;
+    displayHigh = center + width / 2.0;
+    histogramWidget->setWindow(displayLow, displayHigh);
+
+    // Тайлы перестраиваются при отрисовке и только в видимой области
+    if (imageItem) {
+        imageItem->invalidate();
+    }
+}
+
+void MainWindow::createImageItem() {
+    if (panorama) {
+        // Панорама читается с диска по тайлам нужного уровня пирамиды
+        const cv::Size size = panorama->size();
+        std::shared_ptr<TiledStore> store = panorama;
+        imageItem = new TiledImageItem(QSize(size.width, size.height), [this, store](const QRect& rect, int level) {
+            cv::Mat region = store->readRegion(cv::Rect(rect.x(), rect.y(), rect.width(), rect.height()), std::min(level, store->levelCount() - 1));
+            return ImageProcessor::cvMatToQImage(ImageProcessor::applyWindow(region, displayLow, displayHigh));
+        });
+        view->scene()->addItem(imageItem);
+        return;
+    }
+
+    // Тайлы строятся в ориентированных координатах; масштаб задается преобразованием элемента
+    const cv::Size sourceSize = currentImage.size();
+    const cv::Size oriented = viewTransform.orientedSize(sourceSize);
+    imageItem = new TiledImageItem(QSize(oriented.width, oriented.height), [this, sourceSize](const QRect& rect, int level) {
+        cv::Mat region = viewTransform.renderTile(rect, level, sourceSize, [this](const cv::Rect& sourceRect, int sourceLevel) {
+            return filterChain.evaluate(sourceRect, sourceLevel);
+        });
+        return ImageProcessor::cvMatToQImage(ImageProcessor::applyWindow(region, displayLow, displayHigh));
+    });
+    // Цепочка считается один раз для всех недостающих тайлов, затем тайлы
+    // вырезаются из запомненного результата последнего узла
+    imageItem->setPrefetch([this, sourceSize](const QRect& rect, int level) {
+        if (filterChain.hasActiveNodes()) {
+            filterChain.evaluate(viewTransform.sourceRegion(rect, level, sourceSize), level);
+        }
+    });
+    imageItem->setTransform(QTransform::fromScale(viewTransform.scale(), viewTransform.scale()));
+    view->scene()->addItem(imageItem);
+
+    const cv::Size output = viewTransform.outputSize(sourceSize);
+    view->scene()->setSceneRect(0, 0, output.width, output.height);
+
+    // Аннотации рисуются в координатах исходного изображения в пределах показанной области
+    const QTransform sceneToSource = viewTransform.sceneToSource(sourceSize);
+    annotationLayer = new AnnotationLayerItem(&annotations, sceneToSource.mapRect(QRectF(0, 0, output.width, output.height)));
+    annotationLayer->setTransform(sceneToSource.inverted());
+    annotationLayer->setDetectedVisible(showDefectsAction->isChecked());
+    view->scene()->addItem(annotationLayer);
+}
+
+void MainWindow::changeViewTransform(const std::function<void(ViewTransform&)>& change) {
+    if (currentImage.empty()) {
+        return;
+    }
+    change(viewTransform);
 
-    cv::Mat adjustedImage;
-    if (currentImage.depth() == CV_8U) {
-        currentImage.convertTo(adjustedImage, CV_8U, contrastValue, brightnessValue);
+    // Пиксели не копируются: пересоздается только элемент сцены с новой геометрией
+    resetMeasurements();
+    view->scene()->clear();
+    createImageItem();
+    fitInView();
+
+    const cv::Size output = viewTransform.outputSize(currentImage.size());
+    statusBar()->showMessage(tr("Размер отображения: %1x%2").arg(output.width).arg(output.height), 2000);
+}
+
+void MainWindow::cropToRoi() {
+    if (!roiItem || currentImage.empty()) {
+        QMessageBox::warning(this, tr("Ошибка"), tr("Выделите область инструментом \"Область\""));
+        return;
     }
-    else if (currentImage.depth() == CV_16U) {
-        currentImage.convertTo(adjustedImage, CV_16U, contrastValue, brightnessValue);
+    const QRectF rect = roiItem->rect();
+    const cv::Size sourceSize = currentImage.size();
+    changeViewTransform([rect, sourceSize](ViewTransform& transform) { transform.crop(rect, sourceSize); });
+}
+
+void MainWindow::scaleImage() {
+    if (currentImage.empty()) {
+        return;
     }
 
-    QImage qImage;
-    if (adjustedImage.depth() == CV_8U) {
-        qImage = QImage((uchar*)adjustedImage.data, adjustedImage.cols, adjustedImage.rows, adjustedImage.step,
-            adjustedImage.channels() == 1 ? QImage::Format_Grayscale8 : QImage::Format_RGB888).copy();
+    // При известном размере пикселя масштаб задается целевым размером пикселя
+    QMap<QString, QString> tags = tagsWidget->getTags();
+    ViewTransform unscaled = viewTransform;
+    unscaled.setScale(1.0);
+    unscaled.updateTags(tags, currentImage.size());
+    bool hasSpacing = false;
+    const double spacing = tags.value("Размер пикселя (мм)").section('\\', -1).toDouble(&hasSpacing);
+
+    bool ok = false;
+    double scale = 1.0;
+    if (hasSpacing && spacing > 0.0) {
+        const double target = QInputDialog::getDouble(this, tr("Масштаб"), tr("Размер пикселя, мм (сейчас %1):").arg(spacing),
+            spacing / viewTransform.scale(), 0.001, 100.0, 4, &ok);
+        scale = spacing / target;
+    }
+    else {
+        scale = QInputDialog::getDouble(this, tr("Масштаб"), tr("Коэффициент масштабирования:"), viewTransform.scale(), 0.05, 20.0, 3, &ok);
     }
-    else if (adjustedImage.depth() == CV_16U) {
-        qImage = QImage((uchar*)adjustedImage.data, adjustedImage.cols, adjustedImage.rows, adjustedImage.step,
-            QImage::Format_Grayscale16).copy();
+    if (ok) {
+        changeViewTransform([scale](ViewTransform& transform) { transform.setScale(scale); });
     }
+}
 
-    QPixmap pixmap = QPixmap::fromImage(qImage);
-    currentPixmapItem->setPixmap(pixmap);
-    view->scene()->update();
+void MainWindow::startStatisticsComputation() {
+    regionStatistics.reset();
+    if (currentImage.empty()) {
+        return;
+    }
+
+    // Матрица захватывается по значению: счетчик ссылок удерживает данные
+    cv::Mat image = currentImage;
+    statisticsWatcher->setFuture(QtConcurrent::run([image]() {
+        return std::shared_ptr<const RegionStatistics>(std::make_shared<RegionStatistics>(image));
+    }));
+}
+
+void MainWindow::onStatisticsReady() {
+    regionStatistics = statisticsWatcher->result();
+    updateRoiStatistics();
+}
+
+void MainWindow::detectDefects() {
+    if (currentImage.empty()) {
+        QMessageBox::warning(this, tr("Ошибка"), tr("Изображение не открыто"));
+        return;
+    }
+    if (defectWatcher->isRunning()) {
+        return;
+    }
+
+    detectAction->setEnabled(false);
+    statusBar()->showMessage(tr("Поиск дефектов..."));
+    defectSource = currentImage;
+    cv::Mat image = currentImage;
+    defectWatcher->setFuture(QtConcurrent::run([image]() {
+        QElapsedTimer timer;
+        timer.start();
+        DefectScan scan;
+        scan.candidates = DefectDetector().detect(image);
+        scan.elapsedMs = timer.nsecsElapsed() / 1e6;
+        return scan;
+    }));
 }
 
+void MainWindow::onDefectsReady() {
+    detectAction->setEnabled(true);
+    const DefectScan scan = defectWatcher->result();
+
+    // За время поиска могли открыть другое изображение
+    if (defectSource.data != currentImage.data) {
+        defectSource.release();
+        statusBar()->clearMessage();
+        return;
+    }
+    defectSource.release();
+
+    // Результаты предыдущего поиска заменяются, отметки оператора сохраняются
+    annotations.removeDetected();
+    for (const DefectCandidate& candidate : scan.candidates) {
+        Annotation annotation;
+        annotation.kind = AnnotationKind::Defect;
+        annotation.rect = QRectF(candidate.box.x, candidate.box.y, candidate.box.width, candidate.box.height);
+        annotation.text = DefectDetector::typeName(candidate.type);
+        annotation.category = static_cast<int>(candidate.type);
+        annotation.score = candidate.score;
+        annotation.detected = true;
+        annotations.add(annotation);
+    }
+    if (annotationLayer) {
+        annotationLayer->update();
+    }
+
+    statusBar()->showMessage(tr("Найдено индикаций: %1 за %2 мс").arg(scan.candidates.size()).arg(scan.elapsedMs, 0, 'f', 0));
+}
+
+void MainWindow::resetMeasurements() {
+    // Элементы сцены удаляются вместе с ней при очистке
+    roiItem = nullptr;
+    profileItem = nullptr;
+    annotationLayer = nullptr;
+    measuring = false;
+    profilePlot->clear();
+}
+
+bool MainWindow::eventFilter(QObject* watched, QEvent* event) {
+    if (watched == view->viewport() && annotationLayer) {
+        if (event->type() == QEvent::ToolTip) {
+            QHelpEvent* helpEvent = static_cast<QHelpEvent*>(event);
+            const Annotation* annotation = annotations.find(annotationAt(helpEvent->pos()));
+            if (annotation) {
+                QToolTip::showText(helpEvent->globalPos(), annotationDescription(*annotation), view->viewport());
+            }
+            else {
+                QToolTip::hideText();
+            }
+            return true;
+        }
+        if (event->type() == QEvent::ContextMenu) {
+            QContextMenuEvent* menuEvent = static_cast<QContextMenuEvent*>(event);
+            const quint64 id = annotationAt(menuEvent->pos());
+            if (id != 0) {
+                QMenu menu;
+                QAction* removeAction = menu.addAction(tr("Удалить аннотацию"));
+                if (menu.exec(menuEvent->globalPos()) == removeAction) {
+                    annotations.remove(id);
+                    annotationLayer->update();
+                }
+                return true;
+            }
+        }
+    }
+    if (watched == view->viewport() && measureTool != MeasureTool::None && !currentImage.empty()) {
+        switch (event->type()) {
+        case QEvent::MouseButtonPress: {
+            QMouseEvent* mouseEvent = static_cast<QMouseEvent*>(event);
+            if (mouseEvent->button() == Qt::LeftButton) {
+                measuring = true;
+                measureOrigin = view->mapToScene(mouseEvent->position().toPoint());
+                updateMeasurement(measureOrigin);
+                return true;
+            }
+            break;
+        }
+        case QEvent::MouseMove:
+            if (measuring) {
+                updateMeasurement(view->mapToScene(static_cast<QMouseEvent*>(event)->position().toPoint()));
+                return true;
+            }
+            break;
+        case QEvent::MouseButtonRelease:
+            if (measuring) {
+                measuring = false;
+                return true;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    return QMainWindow::eventFilter(watched, event);
+}
+
+void MainWindow::updateMeasurement(const QPointF& scenePos) {
+    QPen pen(Qt::yellow);
+    pen.setCosmetic(true);
+
+    if (measureTool == MeasureTool::Roi) {
+        QRectF rect = QRectF(measureOrigin, scenePos).normalized();
+        if (!roiItem) {
+            roiItem = view->scene()->addRect(rect, pen);
+        }
+        roiItem->setRect(rect);
+        updateRoiStatistics();
+    }
+    else if (measureTool == MeasureTool::Profile) {
+        QLineF line(measureOrigin, scenePos);
+        if (!profileItem) {
+            profileItem = view->scene()->addLine(line, pen);
+        }
+        profileItem->setLine(line);
+        updateLineProfile();
+    }
+}
+
+void MainWindow::updateRoiStatistics() {
+    if (!roiItem) {
+        return;
+    }
+
+    // Область в координатах исходного изображения (с учетом поворота, обрезки и масштаба)
+    const QRect rect = viewTransform.sceneToSource(currentImage.size()).mapRect(roiItem->rect()).toAlignedRect();
+    if (!regionStatistics) {
+        statusBar()->showMessage(tr("Область %1x%2: статистика вычисляется...").arg(rect.width()).arg(rect.height()));
+        return;
+    }
+
+    // Целые плитки берутся из таблиц сумм, края суммируются по пикселям:
+    // время растет с периметром области, а не с ее площадью
+    RegionStats stats = regionStatistics->regionStats(cv::Rect(rect.x(), rect.y(), rect.width(), rect.height()));
+    statusBar()->showMessage(tr("Область %1x%2: среднее %3, СКО %4, ОСШ %5")
+        .arg(rect.width()).arg(rect.height())
+        .arg(stats.mean, 0, 'f', 1).arg(stats.stdDev, 0, 'f', 1).arg(stats.snr, 0, 'f', 1));
+}
+
+void MainWindow::updateLineProfile() {
+    if (!profileItem || currentImage.empty()) {
+        return;
+    }
+
+    const QLineF line = viewTransform.sceneToSource(currentImage.size()).map(profileItem->line());
+    const int width = std::max(1, static_cast<int>(std::lround(profileWidthSpin->value() / viewTransform.scale())));
+    std::vector<float> profile = RegionStatistics::lineProfile(currentImage,
+        cv::Point2f(static_cast<float>(line.x1()), static_cast<float>(line.y1())),
+        cv::Point2f(static_cast<float>(line.x2()), static_cast<float>(line.y2())),
+        width);
+    profilePlot->setProfile(profile);
+    statusBar()->showMessage(tr("Профиль: длина %1 пикс., ширина %2 пикс.").arg(line.length(), 0, 'f', 1).arg(profileWidthSpin->value()));
+}
+
+quint64 MainWindow::annotationAt(const QPoint& viewportPos) const {
+    // Допуск попадания - 4 пикселя экрана в координатах изображения
+    const QTransform sceneToSource = viewTransform.sceneToSource(currentImage.size());
+    const QPointF point = sceneToSource.map(view->mapToScene(viewportPos));
+    const QPointF edge = sceneToSource.map(view->mapToScene(viewportPos + QPoint(4, 0)));
+    return annotations.hitTest(point, QLineF(point, edge).length());
+}
+
+QString MainWindow::annotationDescription(const Annotation& annotation) const {
+    if (annotation.kind == AnnotationKind::Defect && annotation.score > 0.0) {
+        return tr("%1, отклик %2σ").arg(annotation.text).arg(annotation.score, 0, 'f', 1);
+    }
+    return annotation.text;
+}
+
+void MainWindow::markDefect() {
+    if (!roiItem || currentImage.empty()) {
+        QMessageBox::warning(this, tr("Ошибка"), tr("Выделите область инструментом \"Область\""));
+        return;
+    }
+    QStringList types;
+    for (DefectType type : { DefectType::Pore, DefectType::Inclusion, DefectType::Crack, DefectType::LackOfFusion }) {
+        types << DefectDetector::typeName(type);
+    }
+    bool ok = false;
+    const QString type = QInputDialog::getItem(this, tr("Индикация"), tr("Класс индикации:"), types, 0, false, &ok);
+    if (!ok) {
+        return;
+    }
+
+    Annotation annotation;
+    annotation.kind = AnnotationKind::Defect;
+    annotation.rect = viewTransform.sceneToSource(currentImage.size()).mapRect(roiItem->rect());
+    annotation.text = type;
+    annotation.category = types.indexOf(type);
+    annotations.add(annotation);
+    annotationLayer->update();
+}
+
+void MainWindow::addMeasurementAnnotation() {
+    if (!profileItem || currentImage.empty()) {
+        QMessageBox::warning(this, tr("Ошибка"), tr("Проведите отрезок инструментом \"Профиль\""));
+        return;
+    }
+
+    Annotation annotation;
+    annotation.kind = AnnotationKind::Measurement;
+    annotation.line = viewTransform.sceneToSource(currentImage.size()).map(profileItem->line());
+    // Длина в миллиметрах, если известен размер пикселя детектора
+    const double spacing = tagsWidget->getTags().value("Размер пикселя (мм)").section('\\', 0, 0).toDouble();
+    annotation.text = spacing > 0.0
+        ? tr("%1 мм").arg(annotation.line.length() * spacing, 0, 'f', 2)
+        : tr("%1 пикс.").arg(annotation.line.length(), 0, 'f', 1);
+    annotations.add(annotation);
+    annotationLayer->update();
+}
+
+void MainWindow::addComment() {
+    if (!roiItem || currentImage.empty()) {
+        QMessageBox::warning(this, tr("Ошибка"), tr("Выделите область инструментом \"Область\""));
+        return;
+    }
+    bool ok = false;
+    const QString text = QInputDialog::getText(this, tr("Комментарий"), tr("Текст комментария:"), QLineEdit::Normal, QString(), &ok);
+    if (!ok || text.isEmpty()) {
+        return;
+    }
+
+    Annotation annotation;
+    annotation.kind = AnnotationKind::Comment;
+    annotation.rect = viewTransform.sceneToSource(currentImage.size()).mapRect(roiItem->rect());
+    annotation.text = text;
+    annotations.add(annotation);
+    annotationLayer->update();
+}
+
+void MainWindow::clearAnnotations() {
+    annotations.clear();
+    if (annotationLayer) {
+        annotationLayer->update();
+    }
+}
@@ -2,14 +2,36 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QDockWidget>
 #include <QGraphicsView>
 #include <QResizeEvent>
 #include <QSlider>
 #include <QLabel>
 #include <QPushButton>
 #include <QLineEdit>
+#include <QSpinBox>
+#include <QFutureWatcher>
+#include <QGraphicsRectItem>
+#include <QGraphicsLineItem>
+#include <QStackedWidget>
+#include <memory>
 #include <opencv2/opencv.hpp>
 #include "DicomTagsWidget.h"
+#include "HistogramWidget.h"
+#include "ProfilePlotWidget.h"
+#include "RegionStatistics.h"
+#include "FilterGraph.h"
+#include "TiledImageItem.h"
+#include "DefectDetector.h"
+#include "ImageCache.h"
+#include "TiledStore.h"
+#include "EditHistory.h"
+#include "ViewTransform.h"
+#include "FilterPanelWidget.h"
+#include "AnnotationStore.h"
+#include "AnnotationLayerItem.h"
+#include "CompareWidget.h"
+#include "DicomDirWidget.h"
 
 class MainWindow : public QMainWindow
 {
@@ -19,19 +41,95 @@ public:
     explicit MainWindow(QWidget* parent = nullptr);
     ~MainWindow();
 
+    // Сценарный режим для замеров (LatencySuite): те же действия, что из меню,
+    // но без диалогов выбора файлов; ошибки не показываются окнами сообщений,
+    // а сохраняются в lastError()
+    void setScripted(bool enabled);
+    QString lastError() const { return lastErrorText; }
+    bool openPath(const QString& fileName);               // Как "Открыть", без просмотра каталога
+    void setAdjustment(int contrast, int brightness);     // Положение ползунков контраста и яркости
+    void saveAs(const QString& fileName, bool report = false); // Как "Сохранить" (report - 8-битный PNG отчета); завершение - saveFinished
+    void renderView();                                    // Синхронная отрисовка видимой области
+    void clearImageCache();
+
+signals:
+    // Фоновая запись завершена; error пустой при успехе
+    void saveFinished(const QString& fileName, const QString& error);
+
 private slots:
     void openFile();
+    void openNextFile();
+    void openPreviousFile();
+    void stitchFiles(); // Сшивка снимков с перекрытием в панораму
+    void undoEdit();
+    void redoEdit();
+    void applyFilters(); // Запекание цепочки фильтров в изображение
+    void setHistoryLimit();
+    void cropToRoi(); // Обрезка по выделенной области
+    void scaleImage(); // Масштабирование к заданному размеру пикселя
     void saveFile();
+    void verifyArchive(); // Массовая проверка контрольных сумм файлов каталога
+    void integrateFrames(); // Накопление серии кадров одной экспозиции
+    void compareFilms(); // Сравнение снимка с эталонным
+    void closeComparison();
     void about();
     void zoomIn();
     void zoomOut();
     void fitInView();
     void adjustImage();
     void addTag(); // Слот для добавления тега
+    void onStatisticsReady(); // Таблицы накопленных сумм построены
+    void detectDefects(); // Поиск кандидатов в индикации
+    void onDefectsReady();
+    void markDefect(); // Отметка индикации в выделенной области
+    void addMeasurementAnnotation(); // Сохранение профиля как измерения
+    void addComment(); // Комментарий к выделенной области
+    void clearAnnotations();
+
+protected:
+    bool eventFilter(QObject* watched, QEvent* event) override;
 
 private:
+    // Инструменты измерений на изображении
+    enum class MeasureTool { None, Roi, Profile };
+
+    // Результат фонового поиска дефектов
+    struct DefectScan {
+        std::vector<DefectCandidate> candidates;
+        double elapsedMs;
+    };
+
+    bool loadFile(const QString& fileName);
+    void reportError(const QString& message);
+    void stepHistory(bool forward); // Отмена или повтор с восстановлением фильтров
+    QByteArray filterState() const; // Включенные узлы цепочки фильтров
+    void restoreFilterState(const QByteArray& state);
+    void openPanorama(const QString& fileName);
+    bool openDicomDir(const QString& fileName);
+    void openDicomDirImage(const QString& fileName);
+    void setWorkingImage(const cv::Mat& image);
+    void updateEditActions();
+    void changeViewTransform(const std::function<void(ViewTransform&)>& change);
+    // Фоновая запись: задача получает функцию хода выполнения (0..1; false -
+    // отмена) и возвращает текст ошибки, пустой при успехе.
+    // onSaved вызывается в GUI потоке после успешной записи
+    using SaveJob = std::function<QString(const std::function<bool(double)>& progress)>;
+    void runSave(const QString& fileName, const SaveJob& job, const QString& label = QString(), const std::function<void()>& onSaved = nullptr);
+    void savePanorama(const QString& fileName);
+    void openNeighbor(int step);
+    void updateDirectoryListing(const QString& fileName);
+    void startStatisticsComputation();
+    void resetMeasurements();
+    void updateMeasurement(const QPointF& scenePos);
+    void updateRoiStatistics();
+    void updateLineProfile();
+    quint64 annotationAt(const QPoint& viewportPos) const;
+    QString annotationDescription(const Annotation& annotation) const;
+
     cv::Mat currentImage; // Храните текущее изображение как поле класса для изменений
-    QGraphicsPixmapItem* currentPixmapItem; // Храните текущий элемент сцены для обновления изображения
+    TiledImageItem* imageItem; // Элемент сцены, отрисовывающий изображение по тайлам
+    FilterChain filterChain; // Неразрушающая цепочка фильтров над currentImage
+    std::shared_ptr<TiledStore> panorama; // Открытая панорама (вместо currentImage)
 
     QGraphicsView* view;
     QSlider* sliderContrast; // Добавленный слайдер для контраста
@@ -41,7 +139,53 @@ private:
     QPushButton* addTagButton; // Кнопка для добавления тега
     DicomTagsWidget* tagsWidget;
     QLabel* statusLabel; // Добавленный QLabel для отображения информации в статусной строке
-    QMap<QString, QString> extractTags(const QString& infoMsg);
+    void applyAutoWindow(const QMap<QString, QString>& tags);
+    void createImageItem();
+
+    ImageHistogram currentHistogram; // Гистограмма, построенная при загрузке
+    double windowLow;  // Базовое окно отображения в исходных единицах
+    double windowHigh;
+    double displayLow; // Окно с учетом ползунков контраста и яркости
+    double displayHigh;
+    HistogramWidget* histogramWidget;
+
+    std::shared_ptr<const RegionStatistics> regionStatistics; // Таблицы сумм текущего изображения
+    QFutureWatcher<std::shared_ptr<const RegionStatistics>>* statisticsWatcher;
+    MeasureTool measureTool;
+    bool measuring; // Идет выделение мышью
+    QPointF measureOrigin;
+    QGraphicsRectItem* roiItem;
+    QGraphicsLineItem* profileItem;
+    ProfilePlotWidget* profilePlot;
+    QDockWidget* profileDock;
+    QSpinBox* profileWidthSpin; // Ширина полосы усреднения профиля
+
+    QFutureWatcher<DefectScan>* defectWatcher;
+    cv::Mat defectSource; // Изображение, по которому идет поиск
+    AnnotationStore annotations; // Отметки, измерения и комментарии в координатах изображения
+    AnnotationLayerItem* annotationLayer; // Элемент сцены, отрисовывающий аннотации
+    QAction* detectAction;
+    QAction* showDefectsAction;
+
+    ImageCache imageCache; // Декодированные снимки с предзагрузкой соседних
+    QStackedWidget* centralStack; // Основное окно просмотра или режим сравнения
+    CompareWidget* compareWidget;
+    DicomDirWidget* dicomDirWidget; // Иерархия открытого носителя DICOMDIR
+    QDockWidget* dicomDirDock;
+    QStringList directoryFiles; // Изображения каталога открытого файла
+    int directoryIndex; // Позиция открытого файла в directoryFiles
+    int navigationStep; // Направление последнего перехода (+1 / -1)
+
+    EditHistory history; // Отмена и повтор правок изображения и тегов
+    QAction* undoAction;
+    QAction* redoAction;
+    QAction* fastPngAction; // Уровень сжатия PNG: быстрый или по умолчанию
+    FilterPanelWidget* filterPanel;
+
+    ViewTransform viewTransform; // Поворот, отражение, обрезка и масштаб отображения
+
+    bool scripted; // Сценарный режим без окон сообщений
+    QString lastErrorText;
 };
 
 #endif // MAINWINDOW_H
\ No newline at end of file
@@ -0,0 +1,161 @@
+#include "Packed12.h"
+#include <cstring>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#include <tmmintrin.h>
+#define NDT_SSSE3_KERNELS
+#endif
+
+namespace {
+
+    void packScalar(const uint16_t* src, uint8_t* dst, size_t count, int shift) {
+        size_t i = 0;
+        for (; i + 1 < count; i += 2) {
+            const uint32_t a = src[i] >> shift;
+            const uint32_t b = src[i + 1] >> shift;
+            dst[0] = static_cast<uint8_t>(a);
+            dst[1] = static_cast<uint8_t>((a >> 8) | (b << 4));
+            dst[2] = static_cast<uint8_t>(b >> 4);
+            dst += 3;
+        }
+        // Непарный последний пиксель занимает два байта
+        if (i < count) {
+            const uint32_t a = src[i] >> shift;
+            dst[0] = static_cast<uint8_t>(a);
+            dst[1] = static_cast<uint8_t>(a >> 8);
+        }
+    }
+
+    void unpackScalar(const uint8_t* src, uint16_t* dst, size_t count, int shift) {
+        size_t i = 0;
+        for (; i + 1 < count; i += 2) {
+            dst[i] = static_cast<uint16_t>((src[0] | ((src[1] & 0x0F) << 8)) << shift);
+            dst[i + 1] = static_cast<uint16_t>(((src[1] >> 4) | (src[2] << 4)) << shift);
+            src += 3;
+        }
+        if (i < count) {
+            dst[i] = static_cast<uint16_t>((src[0] | ((src[1] & 0x0F) << 8)) << shift);
+        }
+    }
+
+#ifdef NDT_SSSE3_KERNELS
+    // 8 пикселей (16 байт) <-> 12 байт. Пара пикселей - 32-битная дорожка:
+    // при упаковке дорожка сводится к 24-битному слову, и pshufb убирает
+    // старшие байты; при распаковке - наоборот
+
+#if defined(__GNUC__) || defined(__clang__)
+    __attribute__((target("ssse3")))
+#endif
+    size_t packSsse3(const uint16_t* src, uint8_t* dst, size_t count, int shift) {
+        const __m128i lowMask = _mm_set1_epi32(0x00000FFF);
+        const __m128i highMask = _mm_set1_epi32(0x00FFF000);
+        const __m128i compact = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        const __m128i shiftCount = _mm_cvtsi32_si128(shift);
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m128i x = _mm_srl_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), shiftCount);
+            x = _mm_or_si128(_mm_and_si128(x, lowMask), _mm_and_si128(_mm_srli_epi32(x, 4), highMask));
+            x = _mm_shuffle_epi8(x, compact);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(dst), x);
+            const uint32_t tail = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(x, 8)));
+            std::memcpy(dst + 8, &tail, sizeof(tail));
+            dst += 12;
+        }
+        return i;
+    }
+
+#if defined(__GNUC__) || defined(__clang__)
+    __attribute__((target("ssse3")))
+#endif
+    size_t unpackSsse3(const uint8_t* src, uint16_t* dst, size_t count, int shift) {
+        const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        const __m128i lowMask = _mm_set1_epi32(0x00000FFF);
+        const __m128i highMask = _mm_set1_epi32(0x0FFF0000);
+        const __m128i shiftCount = _mm_cvtsi32_si128(shift);
+        size_t i = 0;
+        // Загружается 16 байт из 12 нужных: последний шаг оставляется скалярному коду,
+        // чтобы не читать за концом строки
+        for (; i + 8 <= count && (i / 2) * 3 + 16 <= Packed12::packedSize(count); i += 8) {
+            __m128i x = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src)), spread);
+            x = _mm_or_si128(_mm_and_si128(x, lowMask), _mm_and_si128(_mm_slli_epi32(x, 4), highMask));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_sll_epi16(x, shiftCount));
+            src += 12;
+        }
+        return i;
+    }
+#endif
+
+} // namespace
+
+namespace Packed12 {
+
+    size_t packedSize(size_t count) {
+        return count / 2 * 3 + (count % 2) * 2;
+    }
+
+    int losslessShift(const cv::Mat& image) {
+        if (image.empty() || image.type() != CV_16UC1) {
+            return -1;
+        }
+        // Объединение всех значений по ИЛИ показывает занятые биты
+        uint16_t used = 0;
+        for (int y = 0; y < image.rows; ++y) {
+            const uint16_t* row = image.ptr<uint16_t>(y);
+            for (int x = 0; x < image.cols; ++x) {
+                used |= row[x];
+            }
+        }
+        if ((used & 0xF000) == 0) {
+            return 0;
+        }
+        if ((used & 0x000F) == 0) {
+            return 4;
+        }
+        return -1;
+    }
+
+    void packRow(const uint16_t* src, uint8_t* dst, size_t count, int shift) {
+        size_t done = 0;
+#ifdef NDT_SSSE3_KERNELS
+        static const bool ssse3 = cv::checkHardwareSupport(CV_CPU_SSSE3);
+        if (ssse3) {
+            done = packSsse3(src, dst, count, shift);
+        }
+#endif
+        packScalar(src + done, dst + done / 2 * 3, count - done, shift);
+    }
+
+    void unpackRow(const uint8_t* src, uint16_t* dst, size_t count, int shift) {
+        size_t done = 0;
+#ifdef NDT_SSSE3_KERNELS
+        static const bool ssse3 = cv::checkHardwareSupport(CV_CPU_SSSE3);
+        if (ssse3) {
+            done = unpackSsse3(src, dst, count, shift);
+        }
+#endif
+        unpackScalar(src + done / 2 * 3, dst + done, count - done, shift);
+    }
+
+    cv::Mat pack(const cv::Mat& image, int shift) {
+        CV_Assert(image.type() == CV_16UC1 && (shift == 0 || shift == 4));
+        cv::Mat packed(image.rows, static_cast<int>(packedSize(image.cols)), CV_8UC1);
+        cv::parallel_for_(cv::Range(0, image.rows), [&](const cv::Range& range) {
+            for (int y = range.start; y < range.end; ++y) {
+                packRow(image.ptr<uint16_t>(y), packed.ptr<uint8_t>(y), image.cols, shift);
+            }
+        });
+        return packed;
+    }
+
+    cv::Mat unpack(const cv::Mat& packed, int width, int shift) {
+        CV_Assert(packed.type() == CV_8UC1 && size_t(packed.cols) == packedSize(width) && (shift == 0 || shift == 4));
+        cv::Mat image(packed.rows, width, CV_16UC1);
+        cv::parallel_for_(cv::Range(0, packed.rows), [&](const cv::Range& range) {
+            for (int y = range.start; y < range.end; ++y) {
+                unpackRow(packed.ptr<uint8_t>(y), image.ptr<uint16_t>(y), width, shift);
+            }
+        });
+        return image;
+    }
+
+} // namespace Packed12
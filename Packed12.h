@@ -0,0 +1,35 @@
+#ifndef PACKED12_H
+#define PACKED12_H
+
+#include <opencv2/core.hpp>
+#include <cstddef>
+#include <cstdint>
+
+// Упакованное 12-битное представление: два пикселя в трех байтах
+// (24-битное слово a | b << 12, младший байт первым). Строки упаковываются
+// независимо, поэтому полосы и тайлы распаковываются без соседних строк.
+// Упаковка без потерь возможна, если значения меньше 4096 (сдвиг 0) или
+// младшие 4 бита нулевые - 12-битные данные DICOM, растянутые на 16 бит (сдвиг 4)
+namespace Packed12 {
+
+    // Ключ сдвига упаковки в JSON-трейлере .raw; при его наличии
+    // пиксельные данные файла упакованы. В теги изображения не попадает
+    const char* const RawPackingKey = "_packed12";
+
+    // Байт на count упакованных пикселей
+    size_t packedSize(size_t count);
+
+    // Сдвиг, при котором изображение CV_16UC1 упаковывается без потерь; -1, если нельзя
+    int losslessShift(const cv::Mat& image);
+
+    // Упаковка и распаковка строки. На x86-64 с SSSE3 - по 8 пикселей за шаг
+    void packRow(const uint16_t* src, uint8_t* dst, size_t count, int shift);
+    void unpackRow(const uint8_t* src, uint16_t* dst, size_t count, int shift);
+
+    // Изображение CV_16UC1 -> CV_8UC1 из rows строк по packedSize(cols) байт и обратно
+    cv::Mat pack(const cv::Mat& image, int shift);
+    cv::Mat unpack(const cv::Mat& packed, int width, int shift);
+
+} // namespace Packed12
+
+#endif // PACKED12_H
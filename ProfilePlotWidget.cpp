@@ -0,0 +1,62 @@
+#include "ProfilePlotWidget.h"
+#include <QPainter>
+#include <QPainterPath>
+#include <algorithm>
+
+ProfilePlotWidget::ProfilePlotWidget(QWidget* parent) : QWidget(parent), minValue(0.0f), maxValue(0.0f) {
+    setMinimumHeight(120);
+    setAutoFillBackground(true);
+}
+
+void ProfilePlotWidget::setProfile(const std::vector<float>& values) {
+    profile = values;
+    if (!profile.empty()) {
+        auto range = std::minmax_element(profile.begin(), profile.end());
+        minValue = *range.first;
+        maxValue = *range.second;
+    }
+    update();
+}
+
+void ProfilePlotWidget::clear() {
+    profile.clear();
+    update();
+}
+
+void ProfilePlotWidget::paintEvent(QPaintEvent*) {
+    QPainter painter(this);
+    painter.fillRect(rect(), palette().base());
+
+    if (profile.size() < 2) {
+        painter.drawText(rect(), Qt::AlignCenter, tr("Нет профиля"));
+        return;
+    }
+
+    // Поля под подписи осей
+    const QRectF plot = QRectF(rect()).adjusted(50, 8, -8, -20);
+    const float span = std::max(maxValue - minValue, 1.0f);
+
+    QPainterPath path;
+    for (size_t i = 0; i < profile.size(); ++i) {
+        const double x = plot.left() + plot.width() * i / (profile.size() - 1);
+        const double y = plot.bottom() - plot.height() * (profile[i] - minValue) / span;
+        if (i == 0) {
+            path.moveTo(x, y);
+        }
+        else {
+            path.lineTo(x, y);
+        }
+    }
+
+    painter.setPen(palette().mid().color());
+    painter.drawRect(plot);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setPen(QPen(palette().highlight().color(), 1.5));
+    painter.drawPath(path);
+
+    painter.setPen(palette().text().color());
+    painter.drawText(QRectF(0, plot.top() - 6, 46, 14), Qt::AlignRight, QString::number(maxValue, 'f', 0));
+    painter.drawText(QRectF(0, plot.bottom() - 8, 46, 14), Qt::AlignRight, QString::number(minValue, 'f', 0));
+    painter.drawText(QRectF(plot.left(), plot.bottom() + 2, plot.width(), 16), Qt::AlignRight,
+        tr("%1 точек").arg(profile.size()));
+}
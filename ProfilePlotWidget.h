@@ -0,0 +1,25 @@
+#ifndef PROFILEPLOTWIDGET_H
+#define PROFILEPLOTWIDGET_H
+
+#include <QWidget>
+#include <vector>
+
+// Виджет отображения профиля яркости вдоль линии
+class ProfilePlotWidget : public QWidget {
+    Q_OBJECT
+
+public:
+    explicit ProfilePlotWidget(QWidget* parent = nullptr);
+    void setProfile(const std::vector<float>& values);
+    void clear();
+
+protected:
+    void paintEvent(QPaintEvent* event) override;
+
+private:
+    std::vector<float> profile;
+    float minValue;
+    float maxValue;
+};
+
+#endif // PROFILEPLOTWIDGET_H
@@ -0,0 +1,197 @@
+#include "RegionStatistics.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+    // Суммы значений и квадратов прямоугольника r
+    template <typename T>
+    void accumulateRect(const cv::Mat& image, const cv::Rect& r, uint64_t& sum, uint64_t& sqsum) {
+        for (int y = r.y; y < r.y + r.height; ++y) {
+            const T* src = image.ptr<T>(y) + r.x;
+            uint64_t rowSum = 0;
+            uint64_t rowSqSum = 0;
+            for (int x = 0; x < r.width; ++x) {
+                const uint64_t v = src[x];
+                rowSum += v;
+                rowSqSum += v * v;
+            }
+            sum += rowSum;
+            sqsum += rowSqSum;
+        }
+    }
+
+    // Накопление по столбцам таблицы плиток
+    void accumulateColumns(uint64_t* table, int rows, size_t stride) {
+        for (int y = 2; y <= rows; ++y) {
+            const uint64_t* prev = table + (y - 1) * stride;
+            uint64_t* line = table + y * stride;
+            for (size_t x = 0; x < stride; ++x) {
+                line[x] += prev[x];
+            }
+        }
+    }
+
+} // namespace
+
+RegionStatistics::RegionStatistics(const cv::Mat& image) {
+    if (image.empty()) {
+        return;
+    }
+
+    gray = image;
+    if (gray.channels() > 1) {
+        cv::cvtColor(image, gray, gray.channels() == 4 ? cv::COLOR_BGRA2GRAY : cv::COLOR_BGR2GRAY);
+    }
+    if (gray.depth() != CV_8U && gray.depth() != CV_16U) {
+        gray.release();
+        throw std::runtime_error("Статистика поддерживается только для 8- и 16-битных изображений");
+    }
+
+    cols = gray.cols;
+    rows = gray.rows;
+    tilesX = (cols + TileSize - 1) / TileSize;
+    tilesY = (rows + TileSize - 1) / TileSize;
+    const size_t stride = static_cast<size_t>(tilesX) + 1;
+    sum.assign(stride * (tilesY + 1), 0);
+    sqsum.assign(stride * (tilesY + 1), 0);
+
+    // Суммы плиток, строки плиток независимы и обрабатываются параллельно;
+    // затем префиксные суммы по строкам и столбцам таблицы
+    cv::parallel_for_(cv::Range(0, tilesY), [&](const cv::Range& range) {
+        for (int ty = range.start; ty < range.end; ++ty) {
+            uint64_t* s = sum.data() + (ty + 1) * stride;
+            uint64_t* q = sqsum.data() + (ty + 1) * stride;
+            for (int tx = 0; tx < tilesX; ++tx) {
+                uint64_t tileSum = 0;
+                uint64_t tileSqSum = 0;
+                accumulate(cv::Rect(tx * TileSize, ty * TileSize, TileSize, TileSize) & cv::Rect(0, 0, cols, rows), tileSum, tileSqSum);
+                s[tx + 1] = s[tx] + tileSum;
+                q[tx + 1] = q[tx] + tileSqSum;
+            }
+        }
+    });
+    accumulateColumns(sum.data(), tilesY, stride);
+    accumulateColumns(sqsum.data(), tilesY, stride);
+}
+
+void RegionStatistics::accumulate(const cv::Rect& r, uint64_t& s, uint64_t& q) const {
+    if (r.empty()) {
+        return;
+    }
+    if (gray.depth() == CV_16U) {
+        accumulateRect<uint16_t>(gray, r, s, q);
+    }
+    else {
+        accumulateRect<uint8_t>(gray, r, s, q);
+    }
+}
+
+RegionStats RegionStatistics::regionStats(const cv::Rect& roi) const {
+    RegionStats stats;
+    const cv::Rect r = roi & cv::Rect(0, 0, cols, rows);
+    if (r.empty()) {
+        return stats;
+    }
+
+    // Целые плитки внутри области: границы плиток по пикселям (последняя
+    // плитка может быть неполной и заканчивается краем изображения)
+    auto boundary = [](int tile, int limit) { return std::min(tile * TileSize, limit); };
+    const int tx0 = (r.x + TileSize - 1) / TileSize;
+    const int ty0 = (r.y + TileSize - 1) / TileSize;
+    const int tx1 = r.x + r.width == cols ? tilesX : (r.x + r.width) / TileSize;
+    const int ty1 = r.y + r.height == rows ? tilesY : (r.y + r.height) / TileSize;
+
+    uint64_t s = 0;
+    uint64_t q = 0;
+    if (tx0 >= tx1 || ty0 >= ty1) {
+        // Область уже двух плиток хотя бы в одном направлении
+        accumulate(r, s, q);
+    }
+    else {
+        const size_t stride = static_cast<size_t>(tilesX) + 1;
+        const size_t a = ty0 * stride + tx0;
+        const size_t b = ty0 * stride + tx1;
+        const size_t c = ty1 * stride + tx0;
+        const size_t d = ty1 * stride + tx1;
+        s = sum[d] - sum[b] - sum[c] + sum[a];
+        q = sqsum[d] - sqsum[b] - sqsum[c] + sqsum[a];
+
+        // Края области: полосы сверху и снизу на всю ширину, слева и справа - между ними
+        const int x0 = boundary(tx0, cols);
+        const int x1 = boundary(tx1, cols);
+        const int y0 = boundary(ty0, rows);
+        const int y1 = boundary(ty1, rows);
+        accumulate(cv::Rect(r.x, r.y, r.width, y0 - r.y), s, q);
+        accumulate(cv::Rect(r.x, y1, r.width, r.y + r.height - y1), s, q);
+        accumulate(cv::Rect(r.x, y0, x0 - r.x, y1 - y0), s, q);
+        accumulate(cv::Rect(x1, y0, r.x + r.width - x1, y1 - y0), s, q);
+    }
+
+    stats.count = r.area();
+    stats.mean = static_cast<double>(s) / stats.count;
+    const double variance = static_cast<double>(q) / stats.count - stats.mean * stats.mean;
+    stats.stdDev = std::sqrt(std::max(variance, 0.0));
+    stats.snr = stats.stdDev > 0.0 ? stats.mean / stats.stdDev : 0.0;
+    return stats;
+}
+
+std::vector<float> RegionStatistics::lineProfile(const cv::Mat& image, const cv::Point2f& p0, const cv::Point2f& p1, int width) {
+    std::vector<float> profile;
+    const cv::Point2f dir = p1 - p0;
+    const float length = std::sqrt(dir.dot(dir));
+    if (image.empty() || length < 1.0f) {
+        return profile;
+    }
+
+    width = std::max(width, 1);
+    const int samples = cvCeil(length) + 1;
+    const cv::Point2f step = dir * (1.0f / (samples - 1));
+    const cv::Point2f normal(-dir.y / length, dir.x / length);
+    const float halfWidth = (width - 1) * 0.5f;
+
+    // В float переводится только ограничивающий прямоугольник полосы профиля
+    std::vector<cv::Point2f> corners = {
+        p0 - normal * halfWidth, p0 + normal * halfWidth,
+        p1 - normal * halfWidth, p1 + normal * halfWidth
+    };
+    cv::Rect bounds = cv::boundingRect(corners);
+    bounds.x -= 1;
+    bounds.y -= 1;
+    bounds.width += 3;
+    bounds.height += 3;
+    bounds &= cv::Rect(0, 0, image.cols, image.rows);
+    if (bounds.empty()) {
+        return profile;
+    }
+
+    cv::Mat region = image(bounds);
+    if (region.channels() > 1) {
+        cv::cvtColor(region, region, region.channels() == 4 ? cv::COLOR_BGRA2GRAY : cv::COLOR_BGR2GRAY);
+    }
+    cv::Mat regionF;
+    region.convertTo(regionF, CV_32F);
+
+    // Карты координат: строка - смещение поперек отрезка, столбец - отсчет вдоль него
+    cv::Mat mapX(width, samples, CV_32F);
+    cv::Mat mapY(width, samples, CV_32F);
+    for (int row = 0; row < width; ++row) {
+        const cv::Point2f offset = normal * (row - halfWidth) - cv::Point2f(static_cast<float>(bounds.x), static_cast<float>(bounds.y));
+        float* mx = mapX.ptr<float>(row);
+        float* my = mapY.ptr<float>(row);
+        for (int i = 0; i < samples; ++i) {
+            const cv::Point2f p = p0 + step * static_cast<float>(i) + offset;
+            mx[i] = p.x;
+            my[i] = p.y;
+        }
+    }
+
+    // Векторизованная билинейная интерполяция и усреднение по ширине полосы
+    cv::Mat sampled;
+    cv::remap(regionF, sampled, mapX, mapY, cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+    cv::Mat averaged;
+    cv::reduce(sampled, averaged, 0, cv::REDUCE_AVG, CV_32F);
+
+    profile.assign(averaged.ptr<float>(0), averaged.ptr<float>(0) + samples);
+    return profile;
+}
@@ -0,0 +1,54 @@
+#ifndef REGIONSTATISTICS_H
+#define REGIONSTATISTICS_H
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <vector>
+
+// Статистика прямоугольной области изображения
+struct RegionStats {
+    int count = 0;       // Количество пикселей в области
+    double mean = 0.0;   // Среднее значение
+    double stdDev = 0.0; // Среднеквадратическое отклонение
+    double snr = 0.0;    // Отношение сигнал/шум (mean / stdDev)
+};
+
+// Статистика областей исходного изображения по плиткам: один раз после
+// загрузки строятся таблицы накопленных сумм (summed-area tables) по плиткам
+// TileSize x TileSize, а не по пикселям. Целые плитки области берутся из
+// таблиц по четырем отсчетам, неполные плитки по краям суммируются по
+// изображению, то есть за O(TileSize * (w + h)) независимо от площади.
+// Память таблиц - 16 байт на плитку вместо 16 байт на пиксель
+class RegionStatistics {
+public:
+    RegionStatistics() = default;
+    explicit RegionStatistics(const cv::Mat& image);
+
+    bool isEmpty() const { return cols == 0 || rows == 0; }
+    cv::Size size() const { return cv::Size(cols, rows); }
+
+    // Статистика области (обрезается по границам изображения)
+    RegionStats regionStats(const cv::Rect& roi) const;
+
+    // Профиль вдоль отрезка p0-p1 с субпиксельной (билинейной) интерполяцией,
+    // усредненный по полосе шириной width пикселей поперек отрезка
+    static std::vector<float> lineProfile(const cv::Mat& image, const cv::Point2f& p0, const cv::Point2f& p1, int width);
+
+    static const int TileSize = 64;
+
+private:
+    // Суммы значений и квадратов прямоугольника по пикселям изображения
+    void accumulate(const cv::Rect& r, uint64_t& s, uint64_t& q) const;
+
+    cv::Mat gray; // Изображение (разделяет данные с исходным, если оно серое)
+    int cols = 0;
+    int rows = 0;
+    int tilesX = 0;
+    int tilesY = 0;
+    // Целочисленные таблицы размером (tilesY + 1) x (tilesX + 1): суммы квадратов
+    // 16-битных значений превышают точность double уже для 4k x 4k
+    std::vector<uint64_t> sum;
+    std::vector<uint64_t> sqsum;
+};
+
+#endif // REGIONSTATISTICS_H
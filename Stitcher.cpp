@@ -0,0 +1,232 @@
+#include "Stitcher.h"
+#include "ImageLoader.h"
+#include "ImageProcessor.h"
+#include <QObject>
+#include <algorithm>
+#include <map>
+
+namespace {
+
+    const int CoarseSize = 512;     // Размер грубого уровня по большей стороне
+    const int SearchMargin = 4;     // Окно уточнения на каждом уровне, пикс.
+    const int MaxTemplateSize = 1024;
+    const double MinScore = 0.3;    // Минимальная корреляция совмещения
+    const int FeatherWidth = 64;    // Ширина плавного перехода у края снимка
+
+    cv::Mat loadFilm(const QString& fileName) {
+        return ImageProcessor::convertTo16BitGrayscale(ImageLoader::load(fileName).image);
+    }
+
+    cv::Mat toFloat(const cv::Mat& image) {
+        cv::Mat result;
+        image.convertTo(result, CV_32F);
+        return result;
+    }
+
+    // Наилучшее положение templ внутри search (нормированная корреляция)
+    cv::Point bestMatch(const cv::Mat& search, const cv::Mat& templ, double& score) {
+        cv::Mat response;
+        cv::matchTemplate(toFloat(search), toFloat(templ), response, cv::TM_CCOEFF_NORMED);
+        cv::Point location;
+        cv::minMaxLoc(response, nullptr, &score, nullptr, &location);
+        return location;
+    }
+
+    // Грубый поиск: начальная полоса b ищется во второй половине a
+    cv::Point coarseMatch(const cv::Mat& a, const cv::Mat& b, bool horizontal, double& score) {
+        cv::Rect templ, search;
+        if (horizontal) {
+            templ = cv::Rect(0, b.rows / 10, std::max(8, b.cols / 10), b.rows * 8 / 10);
+            search = cv::Rect(a.cols / 2, 0, a.cols - a.cols / 2, a.rows);
+        }
+        else {
+            templ = cv::Rect(b.cols / 10, 0, b.cols * 8 / 10, std::max(8, b.rows / 10));
+            search = cv::Rect(0, a.rows / 2, a.cols, a.rows - a.rows / 2);
+        }
+        if (search.width < templ.width || search.height < templ.height) {
+            score = -1.0;
+            return cv::Point();
+        }
+        const cv::Point location = bestMatch(a(search), b(templ), score);
+        return search.tl() + location - templ.tl();
+    }
+
+} // namespace
+
+namespace Stitcher {
+
+    cv::Point registerPair(const cv::Mat& a, const cv::Mat& b, double& score) {
+        std::vector<cv::Mat> pyramidA{ a }, pyramidB{ b };
+        while (std::max(pyramidA.back().cols, pyramidA.back().rows) > CoarseSize) {
+            cv::Mat nextA, nextB;
+            cv::pyrDown(pyramidA.back(), nextA);
+            cv::pyrDown(pyramidB.back(), nextB);
+            pyramidA.push_back(nextA);
+            pyramidB.push_back(nextB);
+        }
+
+        // Направление сшивки выбирается по лучшей корреляции
+        double horizontalScore, verticalScore;
+        const cv::Point horizontal = coarseMatch(pyramidA.back(), pyramidB.back(), true, horizontalScore);
+        const cv::Point vertical = coarseMatch(pyramidA.back(), pyramidB.back(), false, verticalScore);
+        cv::Point offset = horizontalScore >= verticalScore ? horizontal : vertical;
+        score = std::max(horizontalScore, verticalScore);
+
+        // Уточнение: на каждом уровне прогноз удваивается и ищется в окне +-SearchMargin
+        for (int level = static_cast<int>(pyramidA.size()) - 2; level >= 0; --level) {
+            const cv::Mat& levelA = pyramidA[level];
+            const cv::Mat& levelB = pyramidB[level];
+            offset *= 2;
+
+            const cv::Rect boundsA(0, 0, levelA.cols, levelA.rows);
+            cv::Rect overlap = boundsA & cv::Rect(offset, levelB.size());
+            overlap.x += SearchMargin;
+            overlap.y += SearchMargin;
+            overlap.width -= 2 * SearchMargin;
+            overlap.height -= 2 * SearchMargin;
+            if (overlap.width < 16 || overlap.height < 16) {
+                score = -1.0;
+                break;
+            }
+
+            // Центральная часть перекрытия ограниченного размера
+            cv::Rect templ = overlap;
+            if (templ.width > MaxTemplateSize) {
+                templ.x += (templ.width - MaxTemplateSize) / 2;
+                templ.width = MaxTemplateSize;
+            }
+            if (templ.height > MaxTemplateSize) {
+                templ.y += (templ.height - MaxTemplateSize) / 2;
+                templ.height = MaxTemplateSize;
+            }
+            const cv::Rect search = cv::Rect(templ.x - SearchMargin, templ.y - SearchMargin,
+                templ.width + 2 * SearchMargin, templ.height + 2 * SearchMargin) & boundsA;
+
+            const cv::Point location = bestMatch(levelA(search), levelB(templ - offset), score);
+            offset = search.tl() + location - (templ - offset).tl();
+        }
+        return offset;
+    }
+
+    std::vector<FilmPlacement> registerFilms(const QStringList& fileNames, const Progress& progress) {
+        std::vector<FilmPlacement> placements;
+        cv::Mat previous;
+
+        for (int i = 0; i < fileNames.size(); ++i) {
+            if (progress && !progress(QObject::tr("Совмещение снимков"), static_cast<double>(i) / fileNames.size())) {
+                return {};
+            }
+
+            cv::Mat film = loadFilm(fileNames[i]);
+            FilmPlacement placement{ fileNames[i], film.size(), cv::Point(0, 0), 1.0 };
+            if (i > 0) {
+                const cv::Point relative = registerPair(previous, film, placement.score);
+                if (placement.score < MinScore) {
+                    throw std::runtime_error(QObject::tr("Не удалось совместить снимки %1 и %2")
+                        .arg(fileNames[i - 1], fileNames[i]).toStdString());
+                }
+                placement.offset = placements.back().offset + relative;
+            }
+            placements.push_back(placement);
+            previous = film;
+        }
+
+        // Начало координат панорамы - левый верхний угол самого левого и самого верхнего снимков
+        cv::Point origin = placements.front().offset;
+        for (const FilmPlacement& placement : placements) {
+            origin.x = std::min(origin.x, placement.offset.x);
+            origin.y = std::min(origin.y, placement.offset.y);
+        }
+        for (FilmPlacement& placement : placements) {
+            placement.offset -= origin;
+        }
+        return placements;
+    }
+
+    cv::Size panoramaSize(const std::vector<FilmPlacement>& placements) {
+        cv::Rect bounds;
+        for (const FilmPlacement& placement : placements) {
+            bounds |= cv::Rect(placement.offset, placement.size);
+        }
+        return bounds.size();
+    }
+
+    bool compose(const std::vector<FilmPlacement>& placements, const QString& fileName, const Progress& progress) {
+        const cv::Size size = panoramaSize(placements);
+        std::unique_ptr<TiledStore> store = TiledStore::create(fileName, size);
+        const int tileSize = TiledStore::TileSize;
+
+        // Панорама собирается полосами тайлов поперек направления сшивки: каждую полосу
+        // пересекают лишь соседние снимки, и каждый снимок загружается один раз
+        const bool horizontal = size.width >= size.height;
+        const int stripes = horizontal ? store->tilesX(0) : store->tilesY(0);
+        const int tilesPerStripe = horizontal ? store->tilesY(0) : store->tilesX(0);
+        std::map<size_t, cv::Mat> loaded;
+
+        for (int stripe = 0; stripe < stripes; ++stripe) {
+            if (progress && !progress(QObject::tr("Сборка панорамы"), static_cast<double>(stripe) / stripes)) {
+                return false;
+            }
+
+            const int start = stripe * tileSize;
+            const int end = start + tileSize;
+            for (size_t i = 0; i < placements.size(); ++i) {
+                const int filmStart = horizontal ? placements[i].offset.x : placements[i].offset.y;
+                const int filmEnd = filmStart + (horizontal ? placements[i].size.width : placements[i].size.height);
+                const bool needed = filmStart < end && filmEnd > start;
+                if (needed && !loaded.count(i)) {
+                    loaded[i] = loadFilm(placements[i].fileName);
+                }
+                else if (!needed) {
+                    loaded.erase(i);
+                }
+            }
+
+            std::vector<cv::Mat> tiles(tilesPerStripe);
+            cv::parallel_for_(cv::Range(0, tilesPerStripe), [&](const cv::Range& range) {
+                for (int t = range.start; t < range.end; ++t) {
+                    const cv::Rect tileRect = horizontal ? cv::Rect(start, t * tileSize, tileSize, tileSize)
+                                                         : cv::Rect(t * tileSize, start, tileSize, tileSize);
+                    cv::Mat sum = cv::Mat::zeros(tileSize, tileSize, CV_32F);
+                    cv::Mat weight = cv::Mat::zeros(tileSize, tileSize, CV_32F);
+
+                    // Вес пикселя растет от края снимка на ширине FeatherWidth
+                    for (const auto& entry : loaded) {
+                        const FilmPlacement& placement = placements[entry.first];
+                        const cv::Mat& film = entry.second;
+                        const cv::Rect part = tileRect & cv::Rect(placement.offset, placement.size);
+                        for (int y = part.y; y < part.br().y; ++y) {
+                            const int ly = y - placement.offset.y;
+                            const ushort* src = film.ptr<ushort>(ly);
+                            float* s = sum.ptr<float>(y - tileRect.y);
+                            float* w = weight.ptr<float>(y - tileRect.y);
+                            const int edgeY = std::min(ly, film.rows - 1 - ly);
+                            for (int x = part.x; x < part.br().x; ++x) {
+                                const int lx = x - placement.offset.x;
+                                const float pixelWeight = static_cast<float>(std::min(std::min(edgeY, std::min(lx, film.cols - 1 - lx)) + 1, FeatherWidth));
+                                s[x - tileRect.x] += pixelWeight * src[lx];
+                                w[x - tileRect.x] += pixelWeight;
+                            }
+                        }
+                    }
+
+                    cv::Mat tile;
+                    cv::divide(sum, weight, sum);
+                    sum.setTo(0, weight == 0);
+                    sum.convertTo(tile, CV_16U);
+                    tiles[t] = tile;
+                }
+            });
+
+            for (int t = 0; t < tilesPerStripe; ++t) {
+                store->writeTile(0, horizontal ? stripe : t, horizontal ? t : stripe, tiles[t]);
+            }
+        }
+        loaded.clear();
+
+        return store->buildPyramid([&progress](double fraction) {
+            return !progress || progress(QObject::tr("Построение пирамиды"), fraction);
+        });
+    }
+
+} // namespace Stitcher
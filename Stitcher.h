@@ -0,0 +1,43 @@
+#ifndef STITCHER_H
+#define STITCHER_H
+
+#include <QString>
+#include <QStringList>
+#include <opencv2/opencv.hpp>
+#include <functional>
+#include <vector>
+#include "TiledStore.h"
+
+// Положение снимка в панораме
+struct FilmPlacement {
+    QString fileName;
+    cv::Size size;
+    cv::Point offset; // Левый верхний угол в координатах панорамы
+    double score;     // Корреляция с предыдущим снимком (1 для первого)
+};
+
+// Сшивка снимков с перекрытием (полосы и пластины кольцевого шва).
+// Одновременно в памяти находятся не более двух-трех снимков, панорама
+// собирается по тайлам прямо в файл TiledStore
+namespace Stitcher {
+
+    // Ход выполнения: этап и доля выполненного; false прерывает работу
+    using Progress = std::function<bool(const QString& stage, double fraction)>;
+
+    // Смещение b относительно a по перекрытию вдоль одной из осей:
+    // грубый поиск на уменьшенных копиях, затем уточнение на каждом уровне пирамиды
+    cv::Point registerPair(const cv::Mat& a, const cv::Mat& b, double& score);
+
+    // Совмещение последовательных снимков; смещения приведены к неотрицательным.
+    // Пустой результат - работа прервана. При ошибке выбрасывает std::runtime_error
+    std::vector<FilmPlacement> registerFilms(const QStringList& fileNames, const Progress& progress);
+
+    cv::Size panoramaSize(const std::vector<FilmPlacement>& placements);
+
+    // Сборка с плавным переходом в зонах перекрытия в файл fileName
+    // и построение пирамиды. false - работа прервана
+    bool compose(const std::vector<FilmPlacement>& placements, const QString& fileName, const Progress& progress);
+
+} // namespace Stitcher
+
+#endif // STITCHER_H
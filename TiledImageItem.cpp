@@ -0,0 +1,113 @@
+#include "TiledImageItem.h"
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+#include <cmath>
+#include <algorithm>
+
+TiledImageItem::TiledImageItem(const QSize& imageSize, TileRenderer tileRenderer, QGraphicsItem* parent)
+    : QGraphicsItem(parent), size(imageSize), levels(0), renderer(std::move(tileRenderer)) {
+    // exposedRect нужен для отрисовки только видимых тайлов
+    setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+    setCacheLimit(256 * 1024);
+
+    // Верхний уровень пирамиды помещается в один тайл
+    while (std::max(size.width(), size.height()) > (TileSize << levels)) {
+        ++levels;
+    }
+}
+
+void TiledImageItem::setPrefetch(RegionPrefetch regionPrefetch) {
+    prefetch = std::move(regionPrefetch);
+}
+
+void TiledImageItem::setCacheLimit(int kilobytes) {
+    tiles.setMaxCost(kilobytes);
+}
+
+void TiledImageItem::invalidate() {
+    tiles.clear();
+    update();
+}
+
+QSize TiledImageItem::levelSize(const QSize& size, int level) {
+    const int factor = 1 << level;
+    return QSize((size.width() + factor - 1) / factor, (size.height() + factor - 1) / factor);
+}
+
+quint64 TiledImageItem::tileKey(int level, int tx, int ty) {
+    return (static_cast<quint64>(level) << 56) | (static_cast<quint64>(ty) << 28) | static_cast<quint64>(tx);
+}
+
+QRectF TiledImageItem::boundingRect() const {
+    return QRectF(0, 0, size.width(), size.height());
+}
+
+void TiledImageItem::paint(QPainter* painter, const QStyleOptionGraphicsItem* option, QWidget*) {
+    if (size.isEmpty() || !renderer) {
+        return;
+    }
+
+    // Уровень, на котором пиксель уровня не мельче пикселя экрана
+    const qreal lod = option->levelOfDetailFromTransform(painter->worldTransform());
+    int level = 0;
+    if (lod > 0.0 && lod < 1.0) {
+        level = std::min(levels, static_cast<int>(std::floor(std::log2(1.0 / lod))));
+    }
+    const int factor = 1 << level;
+    const QSize levelDims = levelSize(size, level);
+
+    const QRectF exposed = option->exposedRect.intersected(boundingRect());
+    if (exposed.isEmpty()) {
+        return;
+    }
+    const int tx0 = static_cast<int>(exposed.left()) / factor / TileSize;
+    const int ty0 = static_cast<int>(exposed.top()) / factor / TileSize;
+    const int tx1 = std::min((static_cast<int>(std::ceil(exposed.right())) / factor) / TileSize, (levelDims.width() - 1) / TileSize);
+    const int ty1 = std::min((static_cast<int>(std::ceil(exposed.bottom())) / factor) / TileSize, (levelDims.height() - 1) / TileSize);
+
+    auto tileRect = [&](int tx, int ty) {
+        return QRect(tx * TileSize, ty * TileSize, TileSize, TileSize).intersected(QRect(QPoint(0, 0), levelDims));
+    };
+
+    // Недостающие тайлы подготавливаются одним запросом для их объединения
+    QRect missing;
+    for (int ty = ty0; ty <= ty1; ++ty) {
+        for (int tx = tx0; tx <= tx1; ++tx) {
+            if (!tiles.contains(tileKey(level, tx, ty))) {
+                missing = missing.united(tileRect(tx, ty));
+            }
+        }
+    }
+    if (!missing.isEmpty() && prefetch) {
+        prefetch(missing, level);
+    }
+
+    painter->save();
+    painter->setClipRect(boundingRect(), Qt::IntersectClip);
+    // При увеличении пиксели показываются без сглаживания
+    painter->setRenderHint(QPainter::SmoothPixmapTransform, lod * factor < 1.0);
+
+    for (int ty = ty0; ty <= ty1; ++ty) {
+        for (int tx = tx0; tx <= tx1; ++tx) {
+            const quint64 key = tileKey(level, tx, ty);
+            const QRect rect = tileRect(tx, ty);
+            QImage* tile = tiles.object(key);
+            if (!tile) {
+                QImage image = renderer(rect, level);
+                if (image.isNull()) {
+                    continue;
+                }
+                tile = new QImage(image);
+                const int cost = std::max(1, static_cast<int>(image.sizeInBytes() / 1024));
+                if (!tiles.insert(key, tile, cost)) {
+                    // Тайл больше лимита кэша: рисуется без сохранения
+                    painter->drawImage(QRectF(rect.x() * factor, rect.y() * factor, rect.width() * factor, rect.height() * factor), image);
+                    continue;
+                }
+            }
+            painter->drawImage(QRectF(rect.x() * factor, rect.y() * factor, rect.width() * factor, rect.height() * factor), *tile);
+        }
+    }
+
+    painter->restore();
+}
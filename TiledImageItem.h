@@ -0,0 +1,46 @@
+#ifndef TILEDIMAGEITEM_H
+#define TILEDIMAGEITEM_H
+
+#include <QGraphicsItem>
+#include <QCache>
+#include <QImage>
+#include <functional>
+
+// Элемент сцены, отрисовывающий изображение по тайлам. Отрисовываются только
+// тайлы, попавшие в видимую область, на уровне пирамиды, соответствующем
+// текущему масштабу; готовые тайлы хранятся в кэше, ограниченном по объему
+class TiledImageItem : public QGraphicsItem {
+public:
+    // Построение тайла: rect задан в координатах уровня level (уменьшение в 2^level раз)
+    using TileRenderer = std::function<QImage(const QRect& rect, int level)>;
+    // Подготовка области перед построением нескольких тайлов (необязательна)
+    using RegionPrefetch = std::function<void(const QRect& rect, int level)>;
+
+    static const int TileSize = 256;
+
+    TiledImageItem(const QSize& imageSize, TileRenderer renderer, QGraphicsItem* parent = nullptr);
+
+    void setPrefetch(RegionPrefetch prefetch);
+    void setCacheLimit(int kilobytes);
+
+    // Сброс построенных тайлов (например, после смены окна или фильтров)
+    void invalidate();
+
+    QSize imageSize() const { return size; }
+    int maxLevel() const { return levels; }
+    static QSize levelSize(const QSize& size, int level);
+
+    QRectF boundingRect() const override;
+    void paint(QPainter* painter, const QStyleOptionGraphicsItem* option, QWidget* widget = nullptr) override;
+
+private:
+    static quint64 tileKey(int level, int tx, int ty);
+
+    QSize size;
+    int levels;
+    TileRenderer renderer;
+    RegionPrefetch prefetch;
+    QCache<quint64, QImage> tiles;
+};
+
+#endif // TILEDIMAGEITEM_H
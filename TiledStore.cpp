@@ -0,0 +1,194 @@
+#include "TiledStore.h"
+#include <QMutexLocker>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+    // Заголовок файла: сигнатура, версия, размер изображения, размер тайла и число уровней
+    const char Magic[4] = { 'N', 'D', 'T', 'T' };
+    const quint32 Version = 1;
+    const qint64 HeaderSize = 64;
+
+    struct Header {
+        char magic[4];
+        quint32 version;
+        quint32 width;
+        quint32 height;
+        quint32 tileSize;
+        quint32 levels;
+    };
+
+    const qint64 TileBytes = static_cast<qint64>(TiledStore::TileSize) * TiledStore::TileSize * sizeof(ushort);
+
+} // namespace
+
+cv::Size TiledStore::levelSize(int level) const {
+    const int factor = 1 << level;
+    return cv::Size((baseSize.width + factor - 1) / factor, (baseSize.height + factor - 1) / factor);
+}
+
+int TiledStore::tilesX(int level) const {
+    return (levelSize(level).width + TileSize - 1) / TileSize;
+}
+
+int TiledStore::tilesY(int level) const {
+    return (levelSize(level).height + TileSize - 1) / TileSize;
+}
+
+qint64 TiledStore::tileOffset(int level, int tx, int ty) const {
+    qint64 index = 0;
+    for (int l = 0; l < level; ++l) {
+        index += static_cast<qint64>(tilesX(l)) * tilesY(l);
+    }
+    index += static_cast<qint64>(ty) * tilesX(level) + tx;
+    return HeaderSize + index * TileBytes;
+}
+
+quint64 TiledStore::tileKey(int level, int tx, int ty) {
+    return (static_cast<quint64>(level) << 56) | (static_cast<quint64>(ty) << 28) | static_cast<quint64>(tx);
+}
+
+std::unique_ptr<TiledStore> TiledStore::create(const QString& fileName, const cv::Size& size) {
+    if (size.width <= 0 || size.height <= 0) {
+        throw std::runtime_error("Некорректный размер изображения");
+    }
+
+    std::unique_ptr<TiledStore> store(new TiledStore());
+    store->baseSize = size;
+    // Как в TiledImageItem: верхний уровень помещается в один тайл
+    int maxLevel = 0;
+    while (std::max(size.width, size.height) > (TileSize << maxLevel)) {
+        ++maxLevel;
+    }
+    store->levels = maxLevel + 1;
+    store->setCacheLimit(64 * 1024);
+
+    store->file.setFileName(fileName);
+    if (!store->file.open(QIODevice::ReadWrite | QIODevice::Truncate)) {
+        throw std::runtime_error("Не удалось создать файл тайлов: " + fileName.toStdString());
+    }
+
+    char headerBytes[HeaderSize] = {};
+    Header header{ { Magic[0], Magic[1], Magic[2], Magic[3] }, Version,
+        static_cast<quint32>(size.width), static_cast<quint32>(size.height), TileSize, static_cast<quint32>(store->levels) };
+    std::memcpy(headerBytes, &header, sizeof(header));
+    // Файл сразу получает полный размер: незаписанные тайлы читаются нулями
+    if (store->file.write(headerBytes, HeaderSize) != HeaderSize ||
+        !store->file.resize(store->tileOffset(store->levels, 0, 0))) {
+        throw std::runtime_error("Недостаточно места для файла тайлов: " + fileName.toStdString());
+    }
+    return store;
+}
+
+std::unique_ptr<TiledStore> TiledStore::open(const QString& fileName) {
+    std::unique_ptr<TiledStore> store(new TiledStore());
+    store->file.setFileName(fileName);
+    if (!store->file.open(QIODevice::ReadOnly)) {
+        throw std::runtime_error("Не удалось открыть файл тайлов: " + fileName.toStdString());
+    }
+
+    Header header;
+    if (store->file.read(reinterpret_cast<char*>(&header), sizeof(header)) != sizeof(header) ||
+        std::memcmp(header.magic, Magic, sizeof(Magic)) != 0 || header.version != Version || header.tileSize != TileSize) {
+        throw std::runtime_error("Файл тайлов поврежден или имеет неверный формат: " + fileName.toStdString());
+    }
+    store->baseSize = cv::Size(static_cast<int>(header.width), static_cast<int>(header.height));
+    store->levels = static_cast<int>(header.levels);
+    store->setCacheLimit(64 * 1024);
+
+    if (store->levels <= 0 || store->file.size() < store->tileOffset(store->levels, 0, 0)) {
+        throw std::runtime_error("Файл тайлов поврежден или имеет неверный формат: " + fileName.toStdString());
+    }
+    return store;
+}
+
+void TiledStore::setCacheLimit(int kilobytes) {
+    QMutexLocker locker(&mutex);
+    cache.setMaxCost(kilobytes);
+}
+
+void TiledStore::writeTile(int level, int tx, int ty, const cv::Mat& tile) {
+    CV_Assert(tile.type() == CV_16UC1 && tile.rows == TileSize && tile.cols == TileSize);
+    const cv::Mat data = tile.isContinuous() ? tile : tile.clone();
+
+    QMutexLocker locker(&mutex);
+    if (!file.seek(tileOffset(level, tx, ty)) || file.write(reinterpret_cast<const char*>(data.data), TileBytes) != TileBytes) {
+        throw std::runtime_error("Ошибка записи файла тайлов: " + file.fileName().toStdString());
+    }
+    cache.insert(tileKey(level, tx, ty), new cv::Mat(data.clone()), static_cast<int>(TileBytes / 1024));
+}
+
+cv::Mat TiledStore::readTile(int level, int tx, int ty) {
+    QMutexLocker locker(&mutex);
+    const quint64 key = tileKey(level, tx, ty);
+    if (cv::Mat* cached = cache.object(key)) {
+        return *cached;
+    }
+
+    cv::Mat tile(TileSize, TileSize, CV_16UC1);
+    if (!file.seek(tileOffset(level, tx, ty)) || file.read(reinterpret_cast<char*>(tile.data), TileBytes) != TileBytes) {
+        throw std::runtime_error("Ошибка чтения файла тайлов: " + file.fileName().toStdString());
+    }
+    cache.insert(key, new cv::Mat(tile), static_cast<int>(TileBytes / 1024));
+    return tile;
+}
+
+cv::Mat TiledStore::readRegion(const cv::Rect& rect, int level) {
+    const cv::Size dims = levelSize(level);
+    const cv::Rect region = rect & cv::Rect(0, 0, dims.width, dims.height);
+    cv::Mat result(region.size(), CV_16UC1);
+    if (region.empty()) {
+        return result;
+    }
+
+    for (int ty = region.y / TileSize; ty <= (region.br().y - 1) / TileSize; ++ty) {
+        for (int tx = region.x / TileSize; tx <= (region.br().x - 1) / TileSize; ++tx) {
+            const cv::Rect tileRect(tx * TileSize, ty * TileSize, TileSize, TileSize);
+            const cv::Rect part = tileRect & region;
+            readTile(level, tx, ty)(part - tileRect.tl()).copyTo(result(part - region.tl()));
+        }
+    }
+    return result;
+}
+
+bool TiledStore::buildPyramid(const std::function<bool(double)>& progress) {
+    qint64 total = 0;
+    for (int level = 1; level < levels; ++level) {
+        total += static_cast<qint64>(tilesX(level)) * tilesY(level);
+    }
+
+    qint64 done = 0;
+    for (int level = 1; level < levels; ++level) {
+        const cv::Size below = levelSize(level - 1);
+        for (int ty = 0; ty < tilesY(level); ++ty) {
+            for (int tx = 0; tx < tilesX(level); ++tx) {
+                // Тайл уровня - усреднение 2x2 области вдвое большего размера уровнем ниже
+                const cv::Rect source = cv::Rect(tx * 2 * TileSize, ty * 2 * TileSize, 2 * TileSize, 2 * TileSize) & cv::Rect(0, 0, below.width, below.height);
+                cv::Mat region = readRegion(source, level - 1);
+                cv::copyMakeBorder(region, region, 0, region.rows % 2, 0, region.cols % 2, cv::BORDER_REPLICATE);
+
+                cv::Mat reduced;
+                cv::resize(region, reduced, cv::Size(region.cols / 2, region.rows / 2), 0, 0, cv::INTER_AREA);
+                cv::Mat tile = cv::Mat::zeros(TileSize, TileSize, CV_16UC1);
+                reduced.copyTo(tile(cv::Rect(0, 0, reduced.cols, reduced.rows)));
+                writeTile(level, tx, ty, tile);
+
+                if (progress && !progress(static_cast<double>(++done) / total)) {
+                    return false;
+                }
+            }
+        }
+    }
+    QMutexLocker locker(&mutex);
+    return file.flush();
+}
+
+ImageHistogram TiledStore::histogram() {
+    int level = 0;
+    while (level + 1 < levels && std::max(levelSize(level).width, levelSize(level).height) > 2048) {
+        ++level;
+    }
+    const cv::Size dims = levelSize(level);
+    return ImageHistogram::compute(readRegion(cv::Rect(0, 0, dims.width, dims.height), level));
+}
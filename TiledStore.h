@@ -0,0 +1,61 @@
+#ifndef TILEDSTORE_H
+#define TILEDSTORE_H
+
+#include <QCache>
+#include <QFile>
+#include <QMutex>
+#include <QString>
+#include <opencv2/opencv.hpp>
+#include <functional>
+#include <memory>
+#include "ImageHistogram.h"
+
+// 16-битное изображение на диске, разбитое на тайлы фиксированного размера,
+// с пирамидой уменьшенных копий. В памяти находится только ограниченный
+// кэш тайлов, поэтому размер изображения не ограничен объемом ОЗУ.
+// Уровни пирамиды совпадают с уровнями TiledImageItem
+class TiledStore {
+public:
+    static const int TileSize = 256;
+
+    // Создание файла под изображение size; тайлы заполнены нулями.
+    // При ошибке выбрасывает std::runtime_error
+    static std::unique_ptr<TiledStore> create(const QString& fileName, const cv::Size& size);
+    static std::unique_ptr<TiledStore> open(const QString& fileName);
+
+    QString fileName() const { return file.fileName(); }
+    cv::Size size() const { return levelSize(0); }
+    int levelCount() const { return levels; }
+    cv::Size levelSize(int level) const;
+    int tilesX(int level) const;
+    int tilesY(int level) const;
+
+    // Тайл CV_16UC1 TileSize x TileSize (краевые тайлы дополнены нулями)
+    void writeTile(int level, int tx, int ty, const cv::Mat& tile);
+    cv::Mat readTile(int level, int tx, int ty);
+
+    // Область уровня level, собранная из тайлов
+    cv::Mat readRegion(const cv::Rect& rect, int level);
+
+    // Построение уровней 1..levelCount()-1 из нулевого потоковым проходом.
+    // progress получает долю выполненного и может прервать построение, вернув false
+    bool buildPyramid(const std::function<bool(double)>& progress = nullptr);
+
+    // Гистограмма по верхнему уровню не крупнее 2048 пикселей по стороне
+    ImageHistogram histogram();
+
+    void setCacheLimit(int kilobytes);
+
+private:
+    TiledStore() = default;
+    qint64 tileOffset(int level, int tx, int ty) const;
+    static quint64 tileKey(int level, int tx, int ty);
+
+    QFile file;
+    QMutex mutex;
+    QCache<quint64, cv::Mat> cache;
+    cv::Size baseSize;
+    int levels = 0;
+};
+
+#endif // TILEDSTORE_H
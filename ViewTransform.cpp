@@ -0,0 +1,198 @@
+#include "ViewTransform.h"
+#include <QStringList>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+    const char* const PixelSpacingTag = "Размер пикселя (мм)";
+
+    // Отражение и поворот на четверть оборота без интерполяции, в новую матрицу
+    cv::Mat orient(cv::Mat image, bool flipped, int quarterTurns) {
+        if (flipped) {
+            cv::Mat flippedImage;
+            cv::flip(image, flippedImage, 1);
+            image = flippedImage;
+        }
+        if (quarterTurns != 0) {
+            static const cv::RotateFlags rotations[] = { cv::ROTATE_90_CLOCKWISE, cv::ROTATE_180, cv::ROTATE_90_COUNTERCLOCKWISE };
+            cv::Mat rotatedImage;
+            cv::rotate(image, rotatedImage, rotations[quarterTurns - 1]);
+            image = rotatedImage;
+        }
+        return image;
+    }
+
+    // Преобразование координат отображения (без масштаба) в координаты исходного
+    // изображения; координаты отсчитываются от границ пикселей
+    QTransform orientedToSource(int quarterTurns, bool flipped, const cv::Rect& crop) {
+        QTransform transform;
+        // Повороты отменяются с последнего: перед поворотом j изображение имело
+        // размер обрезки, повернутый j - 1 раз
+        for (int j = quarterTurns; j >= 1; --j) {
+            const int heightBefore = (j - 1) % 2 == 0 ? crop.height : crop.width;
+            transform *= QTransform(0, -1, 1, 0, 0, heightBefore);
+        }
+        if (flipped) {
+            transform *= QTransform(-1, 0, 0, 1, crop.width, 0);
+        }
+        transform *= QTransform::fromTranslate(crop.x, crop.y);
+        return transform;
+    }
+
+} // namespace
+
+ViewTransform::ViewTransform() {
+    reset();
+}
+
+void ViewTransform::reset() {
+    quarterTurns = 0;
+    flipped = false;
+    cropRect = cv::Rect();
+    factor = 1.0;
+}
+
+bool ViewTransform::isIdentity() const {
+    return quarterTurns == 0 && !flipped && cropRect.empty() && factor == 1.0;
+}
+
+void ViewTransform::rotateClockwise() {
+    quarterTurns = (quarterTurns + 1) % 4;
+}
+
+void ViewTransform::rotateCounterClockwise() {
+    quarterTurns = (quarterTurns + 3) % 4;
+}
+
+void ViewTransform::flipHorizontal() {
+    // H * R^q * F = R^-q * H * F: отражение переставляется в начало цепочки
+    quarterTurns = (4 - quarterTurns) % 4;
+    flipped = !flipped;
+}
+
+void ViewTransform::flipVertical() {
+    // Отражение по вертикали - это поворот на 180° после отражения по горизонтали
+    quarterTurns = (6 - quarterTurns) % 4;
+    flipped = !flipped;
+}
+
+void ViewTransform::crop(const QRectF& sceneRect, const cv::Size& source) {
+    const QRect mapped = sceneToSource(source).mapRect(sceneRect).toAlignedRect();
+    const cv::Rect region = cv::Rect(mapped.x(), mapped.y(), mapped.width(), mapped.height()) & cropRegion(source);
+    if (!region.empty()) {
+        cropRect = region;
+    }
+}
+
+void ViewTransform::setScale(double scale) {
+    factor = scale > 0.0 ? scale : 1.0;
+}
+
+cv::Rect ViewTransform::cropRegion(const cv::Size& source) const {
+    const cv::Rect bounds(0, 0, source.width, source.height);
+    return cropRect.empty() ? bounds : (cropRect & bounds);
+}
+
+cv::Size ViewTransform::orientedSize(const cv::Size& source) const {
+    const cv::Size size = cropRegion(source).size();
+    return swapsAxes() ? cv::Size(size.height, size.width) : size;
+}
+
+cv::Size ViewTransform::outputSize(const cv::Size& source) const {
+    const cv::Size size = orientedSize(source);
+    return cv::Size(std::max(1, static_cast<int>(std::lround(size.width * factor))),
+        std::max(1, static_cast<int>(std::lround(size.height * factor))));
+}
+
+QTransform ViewTransform::sceneToSource(const cv::Size& source) const {
+    return QTransform::fromScale(1.0 / factor, 1.0 / factor) * orientedToSource(quarterTurns, flipped, cropRegion(source));
+}
+
+cv::Rect ViewTransform::sourceRegion(const QRect& rect, int level, const cv::Size& source) const {
+    const int scale = 1 << level;
+    const cv::Size oriented = orientedSize(source);
+
+    // Область тайла на нулевом уровне и соответствующая ей область исходного изображения
+    const QRectF outputRect = QRectF(rect.x() * scale, rect.y() * scale, rect.width() * scale, rect.height() * scale)
+        .intersected(QRectF(0, 0, oriented.width, oriented.height));
+    const QRectF sourceRect = orientedToSource(quarterTurns, flipped, cropRegion(source)).mapRect(outputRect);
+
+    const cv::Size levelDims((source.width + scale - 1) / scale, (source.height + scale - 1) / scale);
+    const int x0 = static_cast<int>(std::floor(sourceRect.left() / scale));
+    const int y0 = static_cast<int>(std::floor(sourceRect.top() / scale));
+    const int x1 = static_cast<int>(std::ceil(sourceRect.right() / scale));
+    const int y1 = static_cast<int>(std::ceil(sourceRect.bottom() / scale));
+    return cv::Rect(x0, y0, x1 - x0, y1 - y0) & cv::Rect(0, 0, levelDims.width, levelDims.height);
+}
+
+cv::Mat ViewTransform::renderTile(const QRect& rect, int level, const cv::Size& source, const RegionSource& region) const {
+    // Результат источника может ссылаться на его кэш, поэтому ориентация - в новые матрицы
+    cv::Mat tile = orient(region(sourceRegion(rect, level, source), level), flipped, quarterTurns);
+
+    // Обрезка с нечетным смещением на уменьшенных уровнях дает расхождение в пиксель
+    if (tile.cols != rect.width() || tile.rows != rect.height()) {
+        cv::Mat resized;
+        cv::resize(tile, resized, cv::Size(rect.width(), rect.height()), 0, 0, cv::INTER_NEAREST);
+        tile = resized;
+    }
+    return tile;
+}
+
+cv::Mat ViewTransform::apply(const cv::Mat& source) const {
+    if (isIdentity()) {
+        return source;
+    }
+    const cv::Rect region = cropRegion(source.size());
+    if (quarterTurns == 0 && !flipped && factor == 1.0) {
+        return source(region).clone();
+    }
+
+    // Уменьшение: билинейная выборка warpAffine пропускает пиксели и дает
+    // наложение зерна пленки и мелких индикаций, а INTER_AREA он не
+    // поддерживает. Ориентация точная, затем усреднение по площади
+    if (factor < 1.0) {
+        cv::Mat result;
+        cv::resize(orient(source(region), flipped, quarterTurns), result, outputSize(source.size()), 0, 0, cv::INTER_AREA);
+        return result;
+    }
+
+    // Переход от координат границ пикселей к координатам центров:
+    // src = A * (dst + 0.5) + b - 0.5
+    const QTransform t = sceneToSource(source.size());
+    const cv::Matx23d inverse(
+        t.m11(), t.m21(), t.dx() + 0.5 * (t.m11() + t.m21()) - 0.5,
+        t.m12(), t.m22(), t.dy() + 0.5 * (t.m12() + t.m22()) - 0.5);
+
+    // Без масштаба координаты целые и ближайший сосед копирует пиксели без изменений
+    cv::Mat result;
+    cv::warpAffine(source, result, inverse, outputSize(source.size()),
+        (factor == 1.0 ? cv::INTER_NEAREST : cv::INTER_LINEAR) | cv::WARP_INVERSE_MAP, cv::BORDER_REPLICATE);
+    return result;
+}
+
+void ViewTransform::updateTags(QMap<QString, QString>& tags, const cv::Size& source) const {
+    const cv::Size size = outputSize(source);
+    if (tags.contains("Количество строк")) {
+        tags.insert("Количество строк", QString::number(size.height));
+    }
+    if (tags.contains("Количество столбцов")) {
+        tags.insert("Количество столбцов", QString::number(size.width));
+    }
+
+    // Размер пикселя DICOM: "между строками\между столбцами"
+    const QStringList spacing = tags.value(PixelSpacingTag).split('\\', Qt::SkipEmptyParts);
+    bool rowOk = false;
+    bool columnOk = false;
+    double rowSpacing = spacing.value(0).toDouble(&rowOk);
+    double columnSpacing = spacing.size() > 1 ? spacing.value(1).toDouble(&columnOk) : rowSpacing;
+    if (!rowOk || (spacing.size() > 1 && !columnOk)) {
+        return;
+    }
+    if (swapsAxes()) {
+        std::swap(rowSpacing, columnSpacing);
+    }
+    rowSpacing /= factor;
+    columnSpacing /= factor;
+    tags.insert(PixelSpacingTag, QString("%1\\%2").arg(rowSpacing, 0, 'g', 8).arg(columnSpacing, 0, 'g', 8));
+}
@@ -0,0 +1,69 @@
+#ifndef VIEWTRANSFORM_H
+#define VIEWTRANSFORM_H
+
+#include <QMap>
+#include <QRectF>
+#include <QString>
+#include <QTransform>
+#include <opencv2/opencv.hpp>
+#include <functional>
+
+// Геометрическое преобразование отображения: обрезка, поворот на 90°,
+// отражение и масштаб. Пиксели исходного изображения не копируются: тайлы
+// ориентируются при отрисовке, а результат вычисляется одним проходом при сохранении.
+// Порядок применения: обрезка, отражение по горизонтали, поворот по часовой
+// стрелке на quarterTurns * 90°, масштаб
+class ViewTransform {
+public:
+    // Источник области исходного изображения: rect в координатах уровня level
+    using RegionSource = std::function<cv::Mat(const cv::Rect& rect, int level)>;
+
+    ViewTransform();
+
+    void reset();
+    bool isIdentity() const;
+    bool isScaled() const { return factor != 1.0; }
+
+    void rotateClockwise();
+    void rotateCounterClockwise();
+    void flipHorizontal();
+    void flipVertical();
+
+    // Обрезка по прямоугольнику сцены (в координатах отображения)
+    void crop(const QRectF& sceneRect, const cv::Size& source);
+
+    void setScale(double scale);
+    double scale() const { return factor; }
+    bool swapsAxes() const { return quarterTurns % 2 != 0; }
+
+    // Размер после обрезки, отражения и поворота (без масштаба)
+    cv::Size orientedSize(const cv::Size& source) const;
+    // Размер результата с учетом масштаба
+    cv::Size outputSize(const cv::Size& source) const;
+
+    // Отображение координат сцены (с масштабом) в координаты исходного изображения
+    QTransform sceneToSource(const cv::Size& source) const;
+
+    // Область уровня level исходного изображения, покрывающая тайл rect
+    // уровня level в ориентированных координатах
+    cv::Rect sourceRegion(const QRect& rect, int level, const cv::Size& source) const;
+
+    // Тайл rect уровня level в ориентированных координатах
+    cv::Mat renderTile(const QRect& rect, int level, const cv::Size& source, const RegionSource& region) const;
+
+    // Результат для сохранения: один проход cv::warpAffine по исходному изображению
+    cv::Mat apply(const cv::Mat& source) const;
+
+    // Согласование тегов с результатом: размер пикселя и число строк и столбцов
+    void updateTags(QMap<QString, QString>& tags, const cv::Size& source) const;
+
+private:
+    cv::Rect cropRegion(const cv::Size& source) const;
+
+    int quarterTurns; // Поворот по часовой стрелке, 0..3
+    bool flipped;     // Отражение по горизонтали до поворота
+    cv::Rect cropRect; // В координатах исходного изображения; пустой - без обрезки
+    double factor;
+};
+
+#endif // VIEWTRANSFORM_H
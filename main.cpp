@@ -1,8 +1,191 @@
 #include "MainWindow.h"
+#include "DefectBenchmark.h"
+#include "IngestService.h"
+#include "FileIntegrity.h"
+#include "LatencySuite.h"
+#include "ImageExport.h"
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QtConcurrent/QtConcurrent>
+#include <cstring>
+#include <iostream>
+
+// Консольный прогон детектора дефектов на синтетических снимках
+static int runDetectorBenchmark(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("benchmark-detector", "Benchmark defect detection on synthetic films"));
+    parser.addOption(QCommandLineOption("size", "Film size in pixels", "pixels", "4096"));
+    parser.addOption(QCommandLineOption("runs", "Number of timed runs", "count", "5"));
+    parser.addOption(QCommandLineOption("seed", "Random seed", "seed", "1"));
+    parser.process(app);
+
+    return DefectBenchmark::run(parser.value("size").toInt(), parser.value("runs").toInt(),
+        parser.value("seed").toUInt(), std::cout);
+}
+
+// Служба приема снимков из папки сканеров без графического интерфейса
+static int runIngestService(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("ingest", "Watch folder for new films", "directory"));
+    parser.addOption(QCommandLineOption("output", "Output folder for converted films, thumbnails, journal and metrics", "directory"));
+    parser.addOption(QCommandLineOption("format", "Conversion format: raw or dcm", "format", "raw"));
+    parser.addOption(QCommandLineOption("workers", "Number of worker threads", "count", "2"));
+    parser.addOption(QCommandLineOption("settle", "Milliseconds without changes before a file is taken", "ms", "2000"));
+    parser.process(app);
+
+    IngestSettings settings;
+    settings.watchDirectory = parser.value("ingest");
+    settings.outputDirectory = parser.isSet("output") ? parser.value("output") : settings.watchDirectory + "/processed";
+    settings.format = parser.value("format").toLower();
+    settings.workers = parser.value("workers").toInt();
+    settings.settleMs = parser.value("settle").toInt();
+    if (settings.format != "raw" && settings.format != "dcm") {
+        std::cerr << "Unsupported format: " << settings.format.toStdString() << std::endl;
+        return 1;
+    }
+
+    IngestService service(settings);
+    QObject::connect(&service, &IngestService::fileProcessed, [](const QString& fileName, bool success, const QString& message) {
+        std::cout << (success ? "done   " : "failed ") << fileName.toStdString();
+        if (!success) {
+            std::cout << ": " << message.toStdString();
+        }
+        std::cout << std::endl;
+    });
+
+    QString error;
+    if (!service.start(error)) {
+        std::cerr << error.toStdString() << std::endl;
+        return 1;
+    }
+    return app.exec();
+}
+
+// Параллельная проверка контрольных сумм архива; код возврата 1 при повреждениях
+static int runArchiveVerification(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("verify", "Verify checksums of .raw and .dcm files in a directory tree", "directory"));
+    parser.addOption(QCommandLineOption("threads", "Number of verification threads", "count"));
+    parser.process(app);
+
+    if (parser.isSet("threads")) {
+        QThreadPool::globalInstance()->setMaxThreadCount(parser.value("threads").toInt());
+    }
+    const QStringList fileNames = FileIntegrity::collectFiles(parser.value("verify"));
+    const QList<FileIntegrity::VerifyResult> results = QtConcurrent::blockingMapped<QList<FileIntegrity::VerifyResult>>(fileNames, &FileIntegrity::verifyFile);
+
+    int valid = 0;
+    int unprotected = 0;
+    int damaged = 0;
+    for (const FileIntegrity::VerifyResult& result : results) {
+        switch (result.status) {
+        case FileIntegrity::VerifyResult::Valid:
+            ++valid;
+            break;
+        case FileIntegrity::VerifyResult::Unprotected:
+            ++unprotected;
+            break;
+        default:
+            ++damaged;
+            std::cout << "DAMAGED " << result.fileName.toStdString() << ": " << result.message.toStdString() << std::endl;
+            break;
+        }
+    }
+    std::cout << "files " << results.size() << ", valid " << valid << ", without checksum " << unprotected
+        << ", damaged " << damaged << std::endl;
+    return damaged > 0 ? 1 : 0;
+}
+
+// Генерация синтетического корпуса снимков для замеров
+static int runCorpusGenerator(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("generate-corpus", "Write synthetic 8/12/16-bit films as DICOM, .raw and TIFF", "directory"));
+    parser.addOption(QCommandLineOption("sizes", "Comma-separated film sizes in pixels (up to 30000)", "pixels", "4096"));
+    parser.addOption(QCommandLineOption("seed", "Random seed", "seed", "1"));
+    parser.process(app);
+
+    QList<int> sizes;
+    for (const QString& size : parser.value("sizes").split(',', Qt::SkipEmptyParts)) {
+        sizes.append(size.trimmed().toInt());
+    }
+    return LatencySuite::generateCorpus(parser.value("generate-corpus"), sizes, parser.value("seed").toUInt(), std::cout);
+}
+
+// Замер задержек открытия, настройки и сохранения на корпусе без диалогов;
+// код возврата 1 при ухудшении относительно базы
+static int runLatencySuite(int argc, char* argv[])
+{
+    // Окно нужно сценариям, но экран - нет
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("latency-suite", "Measure open/adjust/save latency on a film corpus", "directory"));
+    parser.addOption(QCommandLineOption("runs", "Number of runs per film and flow", "count", "20"));
+    parser.addOption(QCommandLineOption("baseline", "Baseline JSON file to compare with", "file"));
+    parser.addOption(QCommandLineOption("update-baseline", "Write results to the baseline file instead of comparing"));
+    parser.addOption(QCommandLineOption("tolerance", "Allowed regression, percent", "percent", "10"));
+    parser.process(app);
+
+    return LatencySuite::run(parser.value("latency-suite"), parser.value("runs").toInt(), parser.value("baseline"),
+        parser.isSet("update-baseline"), parser.value("tolerance").toDouble() / 100.0, std::cout);
+}
+
+// Сравнение экспорта PNG/JPEG с прежним сохранением через QPixmap
+static int runExportBenchmark(int argc, char* argv[])
+{
+    // QPixmap требует графического приложения, экран не нужен
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("benchmark-export", "Benchmark PNG/JPEG export against QPixmap::save"));
+    parser.addOption(QCommandLineOption("size", "Film size in pixels", "pixels", "8192"));
+    parser.addOption(QCommandLineOption("runs", "Number of timed runs", "count", "5"));
+    parser.process(app);
+
+    return ImageExport::runBenchmark(parser.value("size").toInt(), parser.value("runs").toInt(), std::cout);
+}
 
 int main(int argc, char* argv[])
 {
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--benchmark-detector") == 0) {
+            return runDetectorBenchmark(argc, argv);
+        }
+        if (std::strcmp(argv[i], "--ingest") == 0) {
+            return runIngestService(argc, argv);
+        }
+        if (std::strcmp(argv[i], "--verify") == 0) {
+            return runArchiveVerification(argc, argv);
+        }
+        if (std::strcmp(argv[i], "--generate-corpus") == 0) {
+            return runCorpusGenerator(argc, argv);
+        }
+        if (std::strcmp(argv[i], "--latency-suite") == 0) {
+            return runLatencySuite(argc, argv);
+        }
+        if (std::strcmp(argv[i], "--benchmark-export") == 0) {
+            return runExportBenchmark(argc, argv);
+        }
+    }
+
     QApplication app(argc, argv);
     MainWindow mainWindow;
     mainWindow.show();
@@ -0,0 +1,291 @@
+// Модуль Python над загрузчиками NDTAnalyzer.
+// Пиксели возвращаются массивами NumPy, разделяющими память с декодированным
+// буфером: массив удерживает копию заголовка cv::Mat (а через нее - счетчик
+// ссылок данных, в том числе буфер QImage для DICOM), поэтому копирования нет.
+// Декодирование выполняется без GIL, чтобы потоки concurrent.futures
+// масштабировались по ядрам.
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+#include <QDir>
+#include <QStringList>
+#include <deque>
+#include <future>
+#include "ImageProcessor.h"
+#include "DicomProcessor.h"
+#include "ImageLoader.h"
+#include "DetectorCalibration.h"
+
+namespace py = pybind11;
+
+namespace {
+
+    // Результат декодирования одного файла (формируется без GIL)
+    struct Decoded {
+        QString fileName;
+        cv::Mat image;
+        QMap<QString, QString> tags;
+    };
+
+    py::dtype dtypeOf(int depth) {
+        switch (depth) {
+        case CV_8U: return py::dtype::of<uint8_t>();
+        case CV_8S: return py::dtype::of<int8_t>();
+        case CV_16U: return py::dtype::of<uint16_t>();
+        case CV_16S: return py::dtype::of<int16_t>();
+        case CV_32S: return py::dtype::of<int32_t>();
+        case CV_32F: return py::dtype::of<float>();
+        case CV_64F: return py::dtype::of<double>();
+        }
+        throw std::runtime_error("Неподдерживаемая глубина изображения");
+    }
+
+    int depthOf(const py::dtype& dtype) {
+        if (dtype.is(py::dtype::of<uint8_t>())) return CV_8U;
+        if (dtype.is(py::dtype::of<int8_t>())) return CV_8S;
+        if (dtype.is(py::dtype::of<uint16_t>())) return CV_16U;
+        if (dtype.is(py::dtype::of<int16_t>())) return CV_16S;
+        if (dtype.is(py::dtype::of<int32_t>())) return CV_32S;
+        if (dtype.is(py::dtype::of<float>())) return CV_32F;
+        if (dtype.is(py::dtype::of<double>())) return CV_64F;
+        throw std::invalid_argument("Неподдерживаемый тип элементов массива");
+    }
+
+    // cv::Mat -> ndarray без копирования. Вызывается под GIL
+    py::array toArray(const cv::Mat& mat) {
+        if (mat.empty()) {
+            return py::array(py::dtype::of<uint16_t>(), std::vector<py::ssize_t>{ 0, 0 });
+        }
+        cv::Mat* owner = new cv::Mat(mat);
+        py::capsule capsule(owner, [](void* pointer) { delete static_cast<cv::Mat*>(pointer); });
+
+        std::vector<py::ssize_t> shape{ owner->rows, owner->cols };
+        std::vector<py::ssize_t> strides{ static_cast<py::ssize_t>(owner->step[0]), static_cast<py::ssize_t>(owner->elemSize()) };
+        if (owner->channels() > 1) {
+            shape.push_back(owner->channels());
+            strides.push_back(static_cast<py::ssize_t>(owner->elemSize1()));
+        }
+        return py::array(dtypeOf(owner->depth()), shape, strides, owner->data, capsule);
+    }
+
+    // ndarray -> заголовок cv::Mat над памятью массива. Строки могут идти
+    // с произвольным шагом, элементы внутри строки - подряд; иначе массив
+    // приводится к C-порядку (единственный случай копирования)
+    cv::Mat fromArray(py::array& array) {
+        if (array.ndim() != 2 && array.ndim() != 3) {
+            throw std::invalid_argument("Ожидается массив формы (строки, столбцы) или (строки, столбцы, каналы)");
+        }
+        const int channels = array.ndim() == 3 ? static_cast<int>(array.shape(2)) : 1;
+        const py::ssize_t itemSize = array.itemsize();
+        const bool rowContiguous = array.strides(1) == itemSize * channels && (channels == 1 || array.strides(2) == itemSize);
+        if (!rowContiguous || array.strides(0) < 0) {
+            array = py::array::ensure(array, py::array::c_style);
+        }
+        const int type = CV_MAKETYPE(depthOf(array.dtype()), channels);
+        return cv::Mat(static_cast<int>(array.shape(0)), static_cast<int>(array.shape(1)), type,
+            const_cast<void*>(array.data()), static_cast<size_t>(array.strides(0)));
+    }
+
+    py::dict toDict(const QMap<QString, QString>& tags) {
+        py::dict result;
+        for (auto it = tags.cbegin(); it != tags.cend(); ++it) {
+            result[py::str(it.key().toStdString())] = py::str(it.value().toStdString());
+        }
+        return result;
+    }
+
+    QMap<QString, QString> fromDict(const std::map<std::string, std::string>& tags) {
+        QMap<QString, QString> result;
+        for (const auto& tag : tags) {
+            result.insert(QString::fromStdString(tag.first), QString::fromStdString(tag.second));
+        }
+        return result;
+    }
+
+    Decoded decodeRaw(const QString& fileName) {
+        Decoded decoded{ fileName };
+        decoded.image = ImageProcessor::readImageFromRawFile(fileName.toStdString(), decoded.tags);
+        if (decoded.image.empty()) {
+            throw std::runtime_error("Не удалось открыть изображение .raw");
+        }
+        return decoded;
+    }
+
+    Decoded decodeDicom(const QString& fileName) {
+        Decoded decoded{ fileName };
+        QString infoMsg;
+        QImage qImage = DicomProcessor::processDicom(fileName, infoMsg);
+        if (qImage.isNull()) {
+            throw std::runtime_error("Не удалось открыть DICOM изображение");
+        }
+        decoded.tags = ImageLoader::parseInfoTags(infoMsg);
+        decoded.image = ImageProcessor::QImageToCvMat(qImage, false);
+        return decoded;
+    }
+
+    Decoded decodeAny(const QString& fileName) {
+        LoadedImage loaded = ImageLoader::load(fileName);
+        return Decoded{ fileName, loaded.image, loaded.tags };
+    }
+
+    // Декодирование без GIL с последующей упаковкой результата под GIL
+    py::tuple decodeToPython(Decoded (*decode)(const QString&), const std::string& fileName) {
+        Decoded decoded;
+        {
+            py::gil_scoped_release release;
+            decoded = decode(QString::fromStdString(fileName));
+        }
+        return py::make_tuple(toArray(decoded.image), toDict(decoded.tags));
+    }
+
+    // Теги DICOM без чтения пиксельных данных
+    QMap<QString, QString> readDicomTags(const QString& fileName) {
+        DcmFileFormat fileFormat;
+        OFCondition status = fileFormat.loadFileUntilTag(fileName.toStdString().c_str(), EXS_Unknown, EGL_noChange,
+            DCM_MaxReadLength, ERM_autoDetect, DCM_PixelData);
+        if (status.bad()) {
+            throw std::runtime_error("Не удалось открыть DICOM файл: " + fileName.toStdString() + " (" + status.text() + ")");
+        }
+        return DicomProcessor::extractAllTags(fileFormat.getDataset());
+    }
+
+    // Потоковый обход каталога: следующие prefetch файлов декодируются
+    // в фоновых потоках, пока Python обрабатывает текущий
+    class DirectoryIterator {
+    public:
+        DirectoryIterator(const std::string& directory, const std::vector<std::string>& patterns, int prefetchCount, bool calibrate)
+            : prefetch(std::max(prefetchCount, 1)), decode(calibrate ? decodeAny : decodeByExtension), next(0) {
+            QStringList filters;
+            for (const std::string& pattern : patterns) {
+                filters << QString::fromStdString(pattern);
+            }
+            QDir dir(QString::fromStdString(directory));
+            if (!dir.exists()) {
+                throw std::runtime_error("Каталог не найден: " + directory);
+            }
+            for (const QString& name : dir.entryList(filters, QDir::Files, QDir::Name)) {
+                files << dir.filePath(name);
+            }
+        }
+
+        ~DirectoryIterator() {
+            // Незавершенные задачи дожидаются без GIL: декодер его не берет,
+            // но деструктор future блокирует поток
+            py::gil_scoped_release release;
+            pending.clear();
+        }
+
+        py::tuple nextItem() {
+            fill();
+            if (pending.empty()) {
+                throw py::stop_iteration();
+            }
+            std::future<Decoded> front = std::move(pending.front());
+            pending.pop_front();
+            fill();
+
+            Decoded decoded;
+            {
+                py::gil_scoped_release release;
+                decoded = front.get();
+            }
+            return py::make_tuple(decoded.fileName.toStdString(), toArray(decoded.image), toDict(decoded.tags));
+        }
+
+        size_t size() const { return static_cast<size_t>(files.size()); }
+
+    private:
+        static Decoded decodeByExtension(const QString& fileName) {
+            if (fileName.endsWith(".raw", Qt::CaseInsensitive)) {
+                return decodeRaw(fileName);
+            }
+            if (fileName.endsWith(".dcm", Qt::CaseInsensitive)) {
+                return decodeDicom(fileName);
+            }
+            return decodeAny(fileName);
+        }
+
+        void fill() {
+            while (static_cast<int>(pending.size()) < prefetch && next < files.size()) {
+                pending.push_back(std::async(std::launch::async, decode, files[next++]));
+            }
+        }
+
+        QStringList files;
+        int prefetch;
+        Decoded (*decode)(const QString&);
+        qsizetype next;
+        std::deque<std::future<Decoded>> pending;
+    };
+
+} // namespace
+
+PYBIND11_MODULE(ndtanalyzer, m) {
+    m.doc() = "Чтение и запись технических растровых изображений NDTAnalyzer (.raw, DICOM/DICONDE)";
+
+    m.def("read_raw", [](const std::string& fileName) { return decodeToPython(decodeRaw, fileName); },
+        py::arg("path"),
+        "Чтение файла .raw. Возвращает (массив uint16, словарь тегов); массив разделяет память с декодированным буфером");
+
+    m.def("save_raw", [](const std::string& fileName, py::array image, const std::map<std::string, std::string>& tags) {
+        cv::Mat mat = fromArray(image);
+        const QMap<QString, QString> tagMap = fromDict(tags);
+        bool saved;
+        {
+            py::gil_scoped_release release;
+            saved = ImageProcessor::saveImageToRawFormat(mat, fileName, tagMap);
+        }
+        if (!saved) {
+            throw std::runtime_error("Не удалось сохранить изображение: " + fileName);
+        }
+    }, py::arg("path"), py::arg("image"), py::arg("tags") = std::map<std::string, std::string>(),
+        "Сохранение массива в формате .raw с тегами");
+
+    m.def("load_dicom", [](const std::string& fileName) { return decodeToPython(decodeDicom, fileName); },
+        py::arg("path"),
+        "Чтение DICOM/DICONDE файла. Возвращает (массив, словарь тегов) без копирования пикселей");
+
+    m.def("dicom_tags", [](const std::string& fileName) {
+        QMap<QString, QString> tags;
+        {
+            py::gil_scoped_release release;
+            tags = readDicomTags(QString::fromStdString(fileName));
+        }
+        return toDict(tags);
+    }, py::arg("path"),
+        "Теги DICOM файла; пиксельные данные не читаются");
+
+    m.def("save_dicom", [](const std::string& fileName, py::array image, const std::map<std::string, std::string>& tags) {
+        cv::Mat mat = fromArray(image);
+        const QMap<QString, QString> tagMap = fromDict(tags);
+        bool saved;
+        {
+            py::gil_scoped_release release;
+            saved = DicomProcessor::saveDicom(mat, QString::fromStdString(fileName), tagMap);
+        }
+        if (!saved) {
+            throw std::runtime_error("Не удалось сохранить DICOM файл: " + fileName);
+        }
+    }, py::arg("path"), py::arg("image"), py::arg("tags") = std::map<std::string, std::string>(),
+        "Сохранение массива в DICOM с тегами");
+
+    m.def("load", [](const std::string& fileName) { return decodeToPython(decodeAny, fileName); },
+        py::arg("path"),
+        "Загрузка любого поддерживаемого формата тем же путем, что и в приложении (с калибровкой детектора)");
+
+    m.def("set_calibration_root", [](const std::string& directory) {
+        DetectorCalibration::setRoot(QString::fromStdString(directory));
+    }, py::arg("directory"),
+        "Каталог калибровок детекторов для load() и iterate_directory(calibrate=True)");
+
+    py::class_<DirectoryIterator>(m, "DirectoryIterator")
+        .def("__iter__", [](DirectoryIterator& iterator) -> DirectoryIterator& { return iterator; })
+        .def("__next__", &DirectoryIterator::nextItem)
+        .def("__len__", &DirectoryIterator::size);
+
+    m.def("iterate_directory", [](const std::string& directory, const std::vector<std::string>& patterns, int prefetch, bool calibrate) {
+        return std::make_unique<DirectoryIterator>(directory, patterns, prefetch, calibrate);
+    }, py::arg("directory"), py::arg("patterns") = std::vector<std::string>{ "*.raw", "*.dcm" },
+        py::arg("prefetch") = 2, py::arg("calibrate") = false,
+        "Потоковый обход каталога: выдает (путь, массив, теги), декодируя следующие файлы в фоне");
+}